@@ -32,6 +32,8 @@
 
 #pragma once
 
+#include "tier0/threadtools.h"
+
 //===============================================================================
 
 extern bool g_bUsePseudoBufs;
@@ -61,10 +63,191 @@ struct GLMBuffLockParams
 	bool m_bDiscard;			
 };
 
+// which path a CGLMBuffer::Lock() took
+enum EGLMBufferLockPath
+{
+	kGLMBufferLockPseudo,
+	kGLMBufferLockPinnedMemory,
+	kGLMBufferLockStaticBuffer,		// copied through m_StaticBuffers and glBufferSubData at unlock
+	kGLMBufferLockMapRange,
+	kGLMBufferLockAsyncUpload,		// staged for the loader thread
+
+	kGLMNumBufferLockPaths
+};
+
+// always-on per frame buffer lock counters, GLMContext keeps a ring of these
+#define GL_BUFFER_FRAME_STATS_HISTORY	64
+
+struct GLMBufferFrameStats_t
+{
+	uint	m_nFrame;
+	uint	m_nLocks[ kGLMNumBufferLockPaths ];
+	uint	m_nLockBytes[ kGLMNumBufferLockPaths ];		// actual # of bytes reported at unlock
+	uint	m_nVBLockBytes;
+	uint	m_nIBLockBytes;
+	uint	m_nOrphans;
+	uint	m_nVertexConvertBytes;	// bytes written to converted vertex shadow buffers
+	double	m_flMapStallTime;		// seconds spent in glMapBufferRange / glUnmapBuffer
+	double	m_flUploadStallTime;	// seconds the render thread spent waiting on the loader thread
+
+	inline void Clear() { memset( this, 0, sizeof( *this ) ); }
+	inline uint GetTotalLocks() const { uint n = 0; for ( int i = 0; i < kGLMNumBufferLockPaths; i++ ) n += m_nLocks[i]; return n; }
+	inline uint GetTotalLockBytes() const { uint n = 0; for ( int i = 0; i < kGLMNumBufferLockPaths; i++ ) n += m_nLockBytes[i]; return n; }
+};
+
+// D3D vertex element types GL can't fetch as-is get repacked into a per-buffer shadow GL buffer
+// (see CGLMBuffer::GetVertexShadow). D3DVERTEXELEMENT9_GL::m_nConversion holds one of these.
+enum EGLMVertexConversion
+{
+	kGLMVertexConvertNone,
+	kGLMVertexConvertUDEC3,			// D3DDECLTYPE_UDEC3 -> 4 x GL_SHORT ( x, y, z, 1 )
+	kGLMVertexConvertDEC3N,			// D3DDECLTYPE_DEC3N -> 4 x normalized GL_SHORT ( x/511, y/511, z/511, 1 )
+	kGLMVertexConvertHalf2,			// D3DDECLTYPE_FLOAT16_2 -> 2 x GL_FLOAT, no GL_ARB_half_float_vertex
+	kGLMVertexConvertHalf4,			// D3DDECLTYPE_FLOAT16_4 -> 4 x GL_FLOAT, no GL_ARB_half_float_vertex
+
+	kGLMNumVertexConversions
+};
+
+// one per (stride, conversion, offset within the vertex), so every stream offset into the same buffer shares it
+struct GLMVertexShadow_t
+{
+	uint					m_nBaseOffset;		// offset of the element for vertex 0 in the source buffer, always < m_nStride
+	uint					m_nStride;			// source stride
+	EGLMVertexConversion	m_nConversion;
+	uint					m_nNumVerts;
+	GLuint					m_nHandle;
+	uint					m_nRevision;		// source buffer revision the shadow contents match
+	uint					m_nLastUse;			// CGLMBuffer::m_nVertexShadowUseCounter when last drawn from
+};
+
+// past this many shadows on one buffer the least recently drawn one is dropped
+#define GL_MAX_VERTEX_SHADOWS	8
+
 #define GL_STATIC_BUFFER_SIZE	( 2048 * 1024 )
 #define GL_MAX_STATIC_BUFFERS	2
 
-extern void glBufferSubDataMaxSize( GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data, uint nMaxSizePerCall = 128 * 1024 );
+// nMaxSizePerCall of 0 means use g_nBufferSubDataChunkSize (per-driver default, then tuned by CGLMBufferSubDataTuner)
+extern void glBufferSubDataMaxSize( GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data, uint nMaxSizePerCall = 0 );
+extern uint g_nBufferSubDataChunkSize;
+
+//===============================================================================
+// Times glBufferSubDataMaxSize() at a handful of chunk sizes during the first frames after context creation
+// (CPU submit time plus GPU timestamp delta), and settles on the fastest one for this driver.
+
+#define GL_SUBDATA_TUNER_UPLOAD_SIZE		( 4 * 1024 * 1024 )
+#define GL_SUBDATA_TUNER_NUM_CHUNK_SIZES	8
+#define GL_SUBDATA_TUNER_NUM_ROUNDS			3
+
+class CGLMBufferSubDataTuner
+{
+	CGLMBufferSubDataTuner( const CGLMBufferSubDataTuner& );
+	CGLMBufferSubDataTuner& operator= ( const CGLMBufferSubDataTuner& );
+
+public:
+	CGLMBufferSubDataTuner();
+	~CGLMBufferSubDataTuner();
+
+	void Init( GLMContext *pCtx );
+	void Deinit();
+
+	// call once per frame (Present) - issues at most one timed upload, and polls the outstanding queries
+	void Tick();
+
+	inline bool IsActive() const { return m_pCtx != NULL; }
+
+	static uint GetDefaultChunkSize( GLDriverProvider_t nDriverProvider );
+
+private:
+	struct Trial_t
+	{
+		GLuint m_nQueries[2];
+		double m_flCPUTime;
+		bool m_bPending;
+	};
+
+	void Finish();
+
+	GLMContext	*m_pCtx;
+	GLuint		m_nBuffer;
+	char		*m_pData;
+
+	uint		m_nFramesToSkip;
+	uint		m_nNextTrial;				// round * GL_SUBDATA_TUNER_NUM_CHUNK_SIZES + chunk size index
+	uint		m_nTrialsCompleted;
+
+	Trial_t		m_Trials[ GL_SUBDATA_TUNER_NUM_CHUNK_SIZES ];
+	double		m_flBestTime[ GL_SUBDATA_TUNER_NUM_CHUNK_SIZES ];
+};
+
+// cap on staged-but-not-yet-uploaded bytes; past this, static buffer locks fall back to the synchronous paths
+#define GL_BUFFER_UPLOADER_MAX_QUEUED_BYTES	( 32 * 1024 * 1024 )
+
+class CGLMBuffer;
+
+//===============================================================================
+// Loader thread with its own GL context (shared with the main context), used to upload static VB/IB contents
+// off the render thread. Jobs are processed in order, each one fenced in the loader context.
+// The render thread only blocks if it references a buffer before its upload has been completed.
+
+class CGLMBufferUploader : public CThread
+{
+	CGLMBufferUploader( const CGLMBufferUploader& );
+	CGLMBufferUploader& operator= ( const CGLMBufferUploader& );
+
+public:
+	CGLMBufferUploader();
+	~CGLMBufferUploader();
+
+	bool Init( GLMContext *pCtx );
+	void Deinit();
+
+	// render thread only
+	inline bool CanQueue( uint nSize ) const { return ( (uint)(int)m_nQueuedBytes + nSize ) <= GL_BUFFER_UPLOADER_MAX_QUEUED_BYTES; }
+	uint QueueUpload( CGLMBuffer *pBuf, uint nOffset, uint nSize, bool bOrphan, char *pData );		// takes ownership of pData (malloc'd)
+	void WaitForUpload( uint nSerial );
+	void RetireCompletedUploads();
+	
+protected:
+	virtual int Run();
+
+private:
+	struct UploadJob_t
+	{
+		uint m_nSerial;
+		GLuint m_nHandle;
+		GLenum m_nGLTarget;
+		uint m_nBufSize;
+		uint m_nOffset;
+		uint m_nSize;
+		bool m_bOrphan;
+		char *m_pData;
+		GLsync m_hReadyFence;		// inserted by the render context, the loader context waits on it before touching the buffer
+	};
+
+	struct CompletedUpload_t
+	{
+		uint m_nSerial;
+		GLsync m_hFence;			// inserted by the loader context after the upload
+	};
+
+	void ProcessJob( UploadJob_t &job );
+	
+	GLMContext						*m_pCtx;
+	PseudoGLContextPtr				m_hLoaderCtx;
+
+	CThreadFastMutex				m_Mutex;
+	CUtlVector<UploadJob_t>			m_PendingJobs;
+	CUtlVector<CompletedUpload_t>	m_CompletedUploads;
+	CThreadEvent					m_JobsAvailable;
+	CThreadEvent					m_UploadCompleted;
+	volatile bool					m_bExit;
+
+	CInterlockedInt					m_nQueuedBytes;
+	CInterlockedInt					m_nCompletedSerial;
+	
+	uint							m_nNextSerial;		// render thread
+	uint							m_nRetiredSerial;	// render thread
+};
 
 //===============================================================================
 
@@ -157,6 +340,14 @@ public:
 #if GL_ENABLE_INDEX_VERIFICATION
 	bool IsSpanValid( uint nOffset, uint nSize ) const;
 #endif
+
+	// returns the name of a GL buffer holding the converted element, tightly packed, and in *pShadowOffset where the vertex at nBaseOffset lands in it
+	GLuint GetVertexShadow( uint nBaseOffset, uint nStride, EGLMVertexConversion nConversion, uint *pShadowOffset );
+	void UpdateVertexShadows( uint nOffset, uint nSize, const void *pData, bool bDiscard );
+	void FreeVertexShadows();
+
+	static uint GetVertexConversionSrcSize( EGLMVertexConversion nConversion );
+	static uint GetVertexConversionDstSize( EGLMVertexConversion nConversion );
 	
 	GLMContext				*m_pCtx;					// link back to parent context
 	EGLMBufferType			m_type;
@@ -180,6 +371,9 @@ public:
 	
 	float					*m_pLastMappedAddress;
 
+	char					*m_pUploadStagingBuf;		// non-NULL while locked for a loader thread upload
+	uint					m_nPendingUploadSerial;		// non-zero if the loader thread may not have finished uploading this buffer yet
+
 	int						m_nPinnedMemoryOfs;
 	
 	bool					m_bPseudo;				// true if the m_name is 0, and the backing is plain RAM
@@ -194,6 +388,11 @@ public:
 	char					*m_pStaticBuffer;
 	
 	GLMBuffLockParams		m_LockParams;
+	EGLMBufferLockPath		m_nLockPath;
+
+	CUtlVector<GLMVertexShadow_t>	m_VertexShadows;	// converted copies of elements GL can't fetch directly
+	uint					m_nVertexShadowUseCounter;
+	char					*m_pVertexShadowSource;	// CPU copy of the whole buffer while it has shadows, conversions read from it instead of GL
 											
 	static char				ALIGN16 m_StaticBuffers[ GL_MAX_STATIC_BUFFERS ][ GL_STATIC_BUFFER_SIZE ] ALIGN16_POST;
 	static bool				m_bStaticBufferUsed[ GL_MAX_STATIC_BUFFERS ];
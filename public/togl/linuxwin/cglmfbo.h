@@ -98,6 +98,8 @@ protected:
 	GLuint					m_name;			// name of this FBO in the context
 	
 	GLMFBOTexAttachParams	m_attach[ kAttCount ];	// indexed by EGLMFBOAttachment
+
+	uint					m_nRBOAttachMask;		// bit per attachment drawing into an MSAA RBO, see GLMContext::DamageDrawingFBO
 };	
 
 
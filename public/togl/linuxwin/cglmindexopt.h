@@ -0,0 +1,173 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//                       TOGL CODE LICENSE
+//
+//  Copyright 2011-2014 Valve Corporation
+//  All Rights Reserved.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+// cglmindexopt.h
+//	GLMgr optional rework of static index buffer contents
+//
+//===============================================================================
+
+#ifndef CGLMINDEXOPT_H
+#define	CGLMINDEXOPT_H
+
+#pragma once
+
+#include "tier0/threadtools.h"
+#include "tier1/utlmap.h"
+#include "tier1/checksum_md5.h"
+
+//===============================================================================
+
+// forward declarations
+
+class	CGLMBuffer;
+
+//===============================================================================
+// Index order can matter to the app, so all of this is opt-in per device (see IDirect3DDevice9::SetStaticIndexOptimization).
+// Indices are only ever rewritten inside the exact [startIndex, startIndex + count) span a draw used, and a span is put back
+// to its original contents as soon as a different, overlapping span of the same buffer gets drawn.
+
+enum EGLMIndexOp
+{
+	kGLMIndexOpReorderTriList,		// post transform vertex cache friendly triangle order (Forsyth)
+	kGLMIndexOpStripRestart,		// degenerate stitched strips -> 0xFFFF primitive restart, result is shorter than the source
+
+	kGLMNumIndexOps
+};
+
+// SetStaticIndexOptimization flags, one per op
+#define GLM_STATIC_INDEX_OPT_REORDER_TRILISTS	( 1 << kGLMIndexOpReorderTriList )
+#define GLM_STATIC_INDEX_OPT_STRIP_RESTART		( 1 << kGLMIndexOpStripRestart )
+
+#define GL_INDEX_OPT_VCACHE_SIZE		32		// modelled post transform cache size
+#define GL_INDEX_OPT_MIN_INDICES		( 3 * 32 )
+#define GL_INDEX_OPT_MAX_CACHE_BYTES	( 16 * 1024 * 1024 )
+
+struct GLMIndexOptKey_t
+{
+	unsigned char	m_digest[ MD5_DIGEST_LENGTH ];		// of the source indices
+	uint			m_nCount;
+	EGLMIndexOp		m_nOp;
+
+	static bool LessFunc( const GLMIndexOptKey_t &lhs, const GLMIndexOptKey_t &rhs );
+};
+
+// Worker thread doing the actual index crunching, plus a content keyed cache of results so reloading the same
+// mesh (or instancing the same model in several buffers) doesn't redo the work. All public methods are render thread only.
+class CGLMIndexOptimizer : public CThread
+{
+	CGLMIndexOptimizer( const CGLMIndexOptimizer& );
+	CGLMIndexOptimizer& operator= ( const CGLMIndexOptimizer& );
+
+public:
+	CGLMIndexOptimizer();
+	~CGLMIndexOptimizer();
+
+	bool Init();
+	void Deinit();
+
+	// Returns the transformed indices once they're ready, NULL while the job is still queued. Queues a job on a cache miss.
+	const CUtlVector<uint16> *GetResult( const GLMIndexOptKey_t &key, const uint16 *pIndices );
+
+	static void ComputeKey( GLMIndexOptKey_t *pKey, EGLMIndexOp nOp, const uint16 *pIndices, uint nCount );
+	static void ReorderTriListForsyth( uint16 *pDst, const uint16 *pSrc, uint nNumIndices );
+	static void ConvertStripToRestart( CUtlVector<uint16> &dst, const uint16 *pSrc, uint nNumIndices );
+
+protected:
+	virtual int Run();
+
+private:
+	struct Entry_t
+	{
+		GLMIndexOptKey_t	m_key;
+		CUtlVector<uint16>	m_Src;			// freed by the worker once the job is done
+		CUtlVector<uint16>	m_Result;
+		CInterlockedInt		m_bDone;
+	};
+
+	void ProcessJob( Entry_t *pEntry );
+	void EvictEntries();
+
+	CThreadFastMutex						m_Mutex;
+	CUtlVector< Entry_t * >					m_PendingJobs;		// protected by m_Mutex
+	CThreadEvent							m_JobsAvailable;
+	volatile bool							m_bExit;
+	bool									m_bRunning;
+
+	CUtlMap< GLMIndexOptKey_t, Entry_t * >	m_Cache;
+	CUtlVector< Entry_t * >					m_CacheOrder;		// oldest first, for eviction
+	uint									m_nCacheBytes;
+};
+
+enum EGLMIndexSpanState
+{
+	kGLMIndexSpanPending,			// waiting on the optimizer
+	kGLMIndexSpanApplied,			// GL buffer holds the transformed indices
+	kGLMIndexSpanRejected,			// left alone (too small, overlaps another span, or the op didn't help)
+};
+
+struct GLMIndexSpan_t
+{
+	uint				m_nStart;
+	uint				m_nCount;
+	uint				m_nDrawCount;		// # of indices to actually draw, < m_nCount for restart converted strips
+	EGLMIndexSpanState	m_nState;
+	GLMIndexOptKey_t	m_key;
+};
+
+// Per static index buffer state, only exists for IB's created while the device had index optimization enabled.
+class CGLMStaticIndexData
+{
+	CGLMStaticIndexData( const CGLMStaticIndexData& );
+	CGLMStaticIndexData& operator= ( const CGLMStaticIndexData& );
+
+public:
+	CGLMStaticIndexData( CGLMBuffer *pBuffer, CGLMIndexOptimizer *pOptimizer );
+
+	// IB lock hands the app GetLockPtr() instead of the GL lock pointer (that can be a write-only mapping), and unlock copies
+	// it into GL from there. OnWrite takes data handed to UnlockActualSize instead, OnUnlocked forgets any spans the write
+	// touched (after the GL unlock, so GL can be written to again)
+	char *GetLockPtr( uint nOffset ) { return reinterpret_cast< char * >( m_Indices.Base() ) + nOffset; }
+	void OnWrite( uint nOffset, uint nSize, const void *pData );
+	void OnUnlocked( uint nOffset, uint nSize, bool bDiscard );
+
+	// called by DrawIndexedPrimitive before anything else touches GL, returns the index count to draw with
+	uint OnDraw( EGLMIndexOp nOp, uint nStartIndex, uint nCount, bool *pbPrimitiveRestart );
+
+	// every other indexed draw from this buffer (other primitive types, or the op is switched off) - it has to see the original indices
+	void OnUnoptimizedDraw( uint nStartIndex, uint nCount );
+
+private:
+	uint DrawCount( const GLMIndexSpan_t &span, bool *pbPrimitiveRestart );
+	void TryApply( GLMIndexSpan_t &span );
+	void Restore( GLMIndexSpan_t &span );
+	void Upload( uint nStartIndex, uint nCount, const uint16 *pIndices );
+
+	CGLMBuffer							*m_pBuffer;
+	CGLMIndexOptimizer					*m_pOptimizer;
+	CUtlVector<uint16>					m_Indices;			// original contents
+	CUtlMap< uint64, GLMIndexSpan_t >	m_Spans;			// keyed by ( start << 32 ) | count
+	uint								m_nNumApplied;		// spans in kGLMIndexSpanApplied, lets unoptimized draws skip the span walk
+};
+
+#endif // CGLMINDEXOPT_H
@@ -136,6 +136,9 @@ public:
 	bool	Compile					( EGLMProgramLang lang );	
 	bool	CheckValidity			( EGLMProgramLang lang );
 
+	GLhandleARB	GetArraySamplerVariant	( uint nArrayMask );	// GLSL object with ARRAY_SAMPLERn defined per mask bit, compiled on first use.  0 on failure
+	void	PurgeArraySamplerVariants	( void );
+
 	void	LogSlow					( EGLMProgramLang lang );	// detailed spew when called for first time; one liner or perhaps silence after that
 	
 	void	GetLabelIndexCombo		( char *labelOut, int labelOutMaxChars, int *indexOut, int *comboOut );	
@@ -165,7 +168,7 @@ public:
 	
 	GLMShaderDesc			m_descs[ kGLMNumProgramLangs ];	
 
-	uint					m_samplerMask;			// (1<<n) mask of sampler active locs, if this is a fragment shader (dxabstract sets this field)
+	uint					m_samplerMask;			// (1<<n) mask of sampler active locs (dxabstract sets this field)
 	uint					m_samplerTypes;			// SAMPLER_2D, etc.
 	uint					m_fragDataMask;			// (1<<n) mask of gl_FragData[n] outputs referenced, if this is a fragment shader (dxabstract sets this field)
 	uint					m_numDrawBuffers;		// number of draw buffers used
@@ -175,6 +178,14 @@ public:
 	uint					m_maxVertexAttrs;
 	uint					m_nCentroidMask;
 	uint					m_nShadowDepthSamplerMask;
+	uint					m_nArraySamplerMask;	// (1<<n) mask of 2D samplers that can read a texture atlas layer (dxabstract sets this field)
+
+	struct ArraySamplerVariant_t
+	{
+		uint				m_nMask;
+		GLhandleARB			m_glsl;
+	};
+	CUtlVector< ArraySamplerVariant_t >	m_ArraySamplerVariants;
 	
 	bool					m_bTranslatedProgram;
 
@@ -211,8 +222,9 @@ public:
 	CGLMShaderPair( GLMContext *ctx  );
 	~CGLMShaderPair( );	
 
-	bool	SetProgramPair			( CGLMProgram *vp, CGLMProgram *fp );
+	bool	SetProgramPair			( CGLMProgram *vp, CGLMProgram *fp, uint nArrayMask );
 		// true result means successful link and query
+		// nArrayMask selects the fp flavor reading texture atlas layers on those samplers, see CGLMProgram::GetArraySamplerVariant
 
 	bool	RefreshProgramPair		( void );
 		// re-link and re-query the uniforms
@@ -231,6 +243,17 @@ public:
 		if ( m_locVertexScreenParams >= 0 )
 			gGL->glUniform4fv( m_locVertexScreenParams, 1, v );
 	}
+
+	FORCEINLINE void UpdateSamplerLayer( uint nSampler, int nLayer )
+	{
+		if ( m_nSamplerLayers[ nSampler ] == nLayer )
+			return;
+
+		m_nSamplerLayers[ nSampler ] = nLayer;
+
+		if ( m_locSamplerLayers[ nSampler ] >= 0 )
+			gGL->glUniform1f( m_locSamplerLayers[ nSampler ], (float)nLayer );
+	}
 	
 	//===============================
 	
@@ -270,6 +293,11 @@ public:
 
 	GLint					m_locSamplers[ GLM_SAMPLER_COUNT ];			// "sampler0 ... sampler1..."
 
+	uint					m_nArraySamplerMask;		// samplers linked as sampler2DArray layers (the pair cache extra key bits)
+	GLhandleARB				m_fragmentObject;			// GLSL object actually attached for m_fragmentProg, may be an array sampler variant
+	GLint					m_locSamplerLayers[ GLM_SAMPLER_COUNT ];	// "sampler0Layer ..."
+	int						m_nSamplerLayers[ GLM_SAMPLER_COUNT ];		// shadow of the above, -1 after link
+
 	// other stuff
 	bool					m_valid;				// true on successful link
 	uint					m_revision;				// if this pair is relinked, bump this number.
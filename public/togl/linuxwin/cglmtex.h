@@ -47,8 +47,10 @@ class	GLMTester;
 class	CGLMTexLayoutTable;
 class	CGLMTex;
 class	CGLMFBO;
+class	CPixelUnpackBuffer;
 
 struct	IDirect3DSurface9;
+struct	GLMTexCompressJob_t;
 
 #if GLMDEBUG
 extern CGLMTex *g_pFirstCGMLTex;
@@ -140,12 +142,16 @@ struct GLMTexLayoutKey
 	int					m_xSize,m_ySize,m_zSize;	// size of base mip
 };
 
-bool LessFunc_GLMTexLayoutKey( const GLMTexLayoutKey &a, const GLMTexLayoutKey &b );
+bool EqualFunc_GLMTexLayoutKey( const GLMTexLayoutKey &a, const GLMTexLayoutKey &b );
+uint HashFunc_GLMTexLayoutKey( const GLMTexLayoutKey &key );
 
 #define	GLM_TEX_MAX_MIPS	14
 #define	GLM_TEX_MAX_FACES	6
 #define	GLM_TEX_MAX_SLICES	(GLM_TEX_MAX_MIPS * GLM_TEX_MAX_FACES)
 
+// runtime compressed textures that get written again this many times stay uncompressed (CGLMTex::DropCompression)
+#define GLM_TEX_MAX_COMPRESS_DROPS	3
+
 #pragma warning( push )
 #pragma warning( disable : 4200 )
 
@@ -182,7 +188,14 @@ public:
 	
 	void			DumpStats( void );
 protected:
-	CUtlMap< GLMTexLayoutKey, GLMTexLayout* >	m_layoutMap;
+	enum { kInitialHashSize = 256 };	// power of two
+
+	int				FindSlot( const GLMTexLayoutKey &key );		// slot holding the key, or the empty slot it would go in
+	void			GrowHash( void );
+
+	// open addressed with linear probing.  layouts never leave the table (refcounts just drop), so there's no deletion to handle.
+	CUtlVector< GLMTexLayout* >	m_layoutHash;
+	int							m_nLayoutCount;
 };
 
 //===============================================================================
@@ -204,6 +217,19 @@ struct GLMTexLockParams
 	// tells GLM to force re-read of the texels back from GL
 	// i.e. "I know I stepped on those texels with a draw or blit - the GLM copy is stale"
 	bool		m_readback;
+
+	// caller will only read the texels (so they can't be handed out in upload memory)
+	bool		m_readonly;
+
+	// caller doesn't care what was there before (D3DLOCK_DISCARD), a whole slice lock can skip bringing it back from GL
+	bool		m_discard;
+};
+
+// a partial upload waiting on CGLMTex::FlushDirtyRegions
+struct GLMTexDirtyRegion
+{
+	int			m_sliceIndex;
+	GLMRegion	m_region;
 };
 
 struct GLMTexLockDesc
@@ -215,6 +241,9 @@ struct GLMTexLockDesc
 	int					m_sliceIndex;			// which slice in the layout
 	int					m_sliceBaseOffset;		// where is that in the texture data
 	int					m_sliceRegionOffset;	// offset to the start (lowest address corner) of the region requested
+
+	CPixelUnpackBuffer	*m_pPixelUnpackBuffer;	// non-NULL if the region's texels were written to a PBO instead of m_backing
+	int					m_nPixelUnpackOfs;		// where the region starts in that PBO
 };
 
 //===============================================================================
@@ -231,6 +260,7 @@ enum EGLMTexSliceFlag
 	kSliceStorageValid	=	0x02,	// if backing store is available, this slice's data is a valid copy - set to 0 initially
 	kSliceLocked		=	0x04,	// are one or more locks outstanding on this slice
 	kSliceFullyDirty	=	0x08,	// does the slice need to be fully downloaded at unlock time (disregard dirty rects)
+	kSliceStreamPending	=	0x10,	// first upload deferred to GLMContext::UpdateTexStreaming, m_backing holds the texels
 };
 
 //===============================================================================
@@ -445,6 +475,18 @@ struct GLMTexSamplingParams
 
 //===============================================================================
 
+// a GL_TEXTURE_2D_ARRAY holding small static textures of one layout, a layer each (see GLMContext::AtlasTex)
+struct GLMTexAtlas
+{
+	GLMTexLayout			*m_layout;			// every layer has this layout, we hold a ref
+	GLuint					m_texName;
+	CUtlVector<CGLMTex*>	m_Layers;			// NULL for a free layer
+	int						m_nUsedLayers;
+	GLMTexSamplingParams	m_SamplingParams;	// what the array texture itself has set, like CGLMTex::m_SamplingParams
+};
+
+//===============================================================================
+
 class CGLMTex
 {
 
@@ -452,12 +494,19 @@ public:
 
 	void					Lock( GLMTexLockParams *params, char** addressOut, int* yStrideOut, int *zStrideOut );
 	void					Unlock( GLMTexLockParams *params );
-	GLuint                                  GetTexName() { return m_texName; }
+	GLuint                                  GetTexName() { EnsureGLTexture(); return m_texName; }
+
+	// IDirect3DResource9::SetPriority - lower priorities get evicted first, returns the old one
+	uint					SetResidencyPriority( uint nPriority ) { uint nOld = m_nResidencyPriority; m_nResidencyPriority = nPriority; return nOld; }
+	void					SetManaged( bool bManaged ) { m_bManaged = bManaged; }
+	void					SetRuntimeCompression( bool bEnable ) { m_bCompressCandidate = bEnable; }	// see GLMContext::SetTexCompression
+	void					SetAtlasCandidate( bool bEnable ) { m_bAtlasCandidate = bEnable; }			// see GLMContext::AtlasTex
 	
 protected:
 	friend class GLMContext;			// only GLMContext can make CGLMTex objects
 	friend class GLMTester;
 	friend class CGLMFBO;
+	friend class CGLMFBOMap;
 
 	friend struct IDirect3DDevice9;
 	friend struct IDirect3DBaseTexture9;
@@ -468,11 +517,72 @@ protected:
 	
 			CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel = NULL );
 			~CGLMTex( );
+
+	void					CreateGLTexture( void );	// makes the GL object (and RBO), deferred from the ctor for plain textures
+	FORCEINLINE void		EnsureGLTexture( void ) { if ( !m_texName ) CreateGLTexture(); }
 	
 	int						CalcSliceIndex( int face, int mip );
 	void					CalcTexelDataOffsetAndStrides( int sliceIndex, int x, int y, int z, int *offsetOut, int *yStrideOut, int *zStrideOut );
+	bool					CanLockToPixelUnpackBuffer( GLMTexLockParams *params, int sliceIndex, bool partial );
+
+	// GL reads the texels straight out of m_backing. m_texClientStorage alone means nothing, gl_texclientstorage defaults to 1 everywhere
+	FORCEINLINE bool		UsesAppleClientStorage( void ) const { return m_texClientStorage && gGL->m_bHave_GL_APPLE_client_storage; }
+	GLenum					GetGLIntFormat( void );
+	GLenum					GetGLDataFormat( void );
+	bool					NeedsTexelExpand( void );	// true if WriteTexels has to repack m_backing before GL can take it
+	void					*PackCompressedRegion( int sliceIndex, const GLMRegion &box, void *sliceAddress, int *sizeOut );
+	void					*DecodeDXTRegion( int sliceIndex, const GLMRegion &box, void *sliceAddress );
+	bool					CanHaveSRGBView( void );	// the context aliases sRGB through views and this format has a view compatible pair
+	bool					EnsureSRGBView( void );		// makes m_texViewName if this texture can have one
+	void					DeleteSRGBView( void );
 		
 	void					ReadTexels( GLMTexLockDesc *desc, bool readWholeSlice=true );
+
+	// async readback of one slice into a pixel pack buffer, fenced. Lock picks the texels up from there instead of stalling in ReadTexels.
+	// the readback is a snapshot of the slice as of IssueReadback, uploads, blits and draws into the texture after that discard it.
+	bool					CanReadbackAsync( void );
+	void					IssueReadback( int sliceIndex );
+	bool					IsReadbackPending( int sliceIndex ) { DiscardReadbackIfDrawn(); return m_nReadbackSlice == sliceIndex; }
+	bool					IsReadbackBusy( int sliceIndex );		// pending and the GPU hasn't got to it yet
+	bool					ConsumeReadback( int sliceIndex );		// copies a pending readback into m_backing (waiting if need be), false if there was none
+	void					DiscardReadback( void );
+	void					DiscardReadbackIfDrawn( void );		// if we're a draw attachment and batches went out since IssueReadback
+	void					MaterializeBacking( void );	// allocs m_backing if needed and copies every valid slice it doesn't hold out of GL
+
+	// idle m_backing LRU, owned by the context (see GLMContext::EnforceTexBackingBudget)
+	bool					CanReleaseBacking( void );
+	void					ReleaseBacking( void );
+	void					LinkBackingLRU( void );
+	void					UnlinkBackingLRU( void );
+
+	// residency (see GLMContext::EnforceResidencyBudget). an evicted texture has no GL object, CreateGLTexture re-sends it from m_backing.
+	bool					CanEvict( void );
+	void					Evict( void );
+
+	// mip streaming (see GLMContext::UpdateTexStreaming). fine mips of immutable textures get their first upload deferred,
+	// BASE_LEVEL keeps sampling on the coarser ones until they arrive.
+	bool					CanStreamSlice( int sliceIndex );
+	int						StreamNextMip( void );		// uploads the coarsest pending mip, returns the bytes sent
+
+	// small partial unlocks pile up here and go across in one go when GL next needs the texels (see GLMContext::FlushDirtyTextures)
+	void					AddDirtyRegion( int sliceIndex, const GLMRegion &box );
+	void					DropDirtyRegions( int sliceIndex );
+	void					FlushDirtyRegions( void );
+	bool					HasDirtyRegions( void ) const { return m_DirtyRegions.Count() != 0; }
+
+	// runtime compression (see GLMContext::UpdateTexCompression). once every slice is in m_backing the texels get compressed
+	// to DXT1/5 on a worker, then the texture moves to the compressed layout and keeps the original texels as a shadow.
+	// anything that needs the original format back (a Lock, a blit) puts the shadow back and the texture stays that way.
+	bool					CanQueueCompression( void );
+	void					ApplyCompression( void );
+	void					DropCompression( void );
+	void					SwapLayout( GLMTexLayout *newLayout, char *newBacking );
+
+	// texture atlasing (see GLMContext::AtlasTex). a fully written static texture also gets copied into a layer of a shared
+	// 2D array, samplers then only switch layers between draws. the texture keeps its own GL object for everything else.
+	bool					CanAtlas( void );
+	void					CopyToAtlasLayer( GLMTexAtlas *atlas, int layer );	// every mip from m_backing, makes the array on first use
+
 	void					WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice=true, bool noDataWrite=false );
 		// last param lets us send NULL data ptr (only legal with uncompressed formats, beware)
 		// this helps out ResetSRGB.
@@ -487,11 +597,16 @@ protected:
 	bool					IsRBODirty() const;
 	void					ForceRBONonDirty();
 	void					ForceRBODirty();
+	void					AddResolveDamage( const GLMRect &rect );	// rendered into the RBO, queues a lazy resolve (see GLMContext::ResolveTexBatch)
 			
 		// re-specify texture format to match desired sRGB form
 		// noWrite means send NULL for texel source addresses instead of actual data - ideal for RT's
 
 	GLuint					m_texName;			// name of this texture in the context
+	GLuint					m_texViewName;		// ARB_texture_view of m_texName in the opposite sRGB format, or 0
+	int						m_nViewBaseLevel;	// level range last pushed to the view, -1 before the first bind
+	int						m_nViewMaxLevel;
+	GLMTexSamplingParams	m_ViewSamplingParams;	// like m_SamplingParams, the view has its own texture parameters
 	GLenum					m_texGLTarget;
 	uint					m_nSamplerType;		// SAMPLER_2D, etc.
 	
@@ -499,7 +614,7 @@ protected:
 
 	GLMTexLayout			*m_layout;		// layout of texture (shared across all tex with same layout)
 	
-	uint					m_nLastResolvedBatchCounter;
+	GLMRect					m_resolveDamage;		// part of the RBO newer than m_texName (GL coords), valid while m_bResolvePending
 					
 	int						m_minActiveMip;//index of lowest mip that has been written.  used to drive setting of GL_TEXTURE_MAX_LEVEL.
 	int						m_maxActiveMip;//index of highest mip that has been written.  used to drive setting of GL_TEXTURE_MAX_LEVEL.
@@ -514,15 +629,51 @@ protected:
 	int						m_rtAttachCount; // how many RT's have this texture attached somewhere
 
 	char					*m_backing;		// backing storage if available
+
+	bool					m_bInBackingLRU;	// m_backing is idle and may be freed under memory pressure
+	CGLMTex					*m_pPrevBackingLRU;
+	CGLMTex					*m_pNextBackingLRU;
 	
 	int						m_lockCount;	// lock reqs are stored in the GLMContext for tracking
 
+	GLuint					m_nReadbackPBO;		// GL_PIXEL_PACK_BUFFER for IssueReadback, made on first use
+	int						m_nReadbackPBOSize;
+	GLsync					m_nReadbackSync;
+	int						m_nReadbackSlice;	// slice in flight, or -1
+	uint					m_nReadbackBatch;	// GLMContext::m_nBatchCounter at IssueReadback
+
+	int						m_nResidentIndex;		// slot in GLMContext::m_ResidentTextures, -1 while there is no GL object
+	uint					m_nLastUsedBatch;		// GLMContext::m_nBatchCounter when it was last bound to a sampler
+	uint					m_nResidencyPriority;
+	uint					m_nPooledFrame;			// GLMContext::m_nCurFrame when it went into GLMContext::m_TexPool
+
 	CUtlVector<unsigned char>	m_sliceFlags;
+	CUtlVector<GLMTexDirtyRegion>	m_DirtyRegions;	// non empty while queued on GLMContext::m_DirtyTextures
+
+	GLMTexCompressJob_t		*m_pCompressJob;	// in flight, the texture is on GLMContext::m_CompressingTextures
+	GLMTexLayout			*m_pShadowLayout;		// the original layout while compressed (we hold a ref), else NULL
+	CUtlVector<uint8>		m_ShadowTexels;			// and its texels
+
+	GLMTexAtlas				*m_pAtlas;			// holding a copy of us in layer m_nAtlasLayer, or NULL
+	int						m_nAtlasLayer;
+
+	int						m_nFBOMapHead;		// first CGLMFBOMap node for an FBO using us, -1 if none
 			
 	char					*m_debugLabel;	// strdup() of debugLabel passed in, or NULL
 	
 	bool					m_texClientStorage;	// was CS selected for texture
+	bool					m_bImmutableStorage;	// all levels allocated with glTexStorage, so only subimage uploads are legal
+	bool					m_bSwizzledFormat;		// L8/A8L8/A8 stored as R8/RG8 with a texture swizzle, see GetGLIntFormat
+	bool					m_bDecodeDXT;			// no S3TC, stored as RGBA8 and decoded from the blocks in m_backing (which is never released)
 	bool					m_texPreloaded;		// has it been kicked into VRAM with GLMContext::PreloadTex yet
+	bool					m_bMipGenPending;	// queued on GLMContext::m_PendingMipGen for a rebuild before the next draw
+	bool					m_bManaged;			// D3DPOOL_MANAGED, so the GL object may be dropped under memory pressure
+	bool					m_bEvicted;			// GL object dropped, m_backing holds every slice
+	bool					m_bStreamPending;	// queued on GLMContext::m_StreamingTextures, some slices are kSliceStreamPending
+	bool					m_bCompressCandidate;	// static 32 bit texture the device picked for runtime compression
+	uint8					m_nCompressDrops;		// times DropCompression threw a compressed copy away
+	bool					m_bAtlasCandidate;		// small static 2D texture the device picked for atlasing
+	bool					m_bResolvePending;		// queued on GLMContext::m_PendingResolves, RBO has damage in m_resolveDamage
 
 	int						m_srgbFlipCount;
 #if GLMDEBUG
@@ -0,0 +1,207 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//                       TOGL CODE LICENSE
+//
+//  Copyright 2011-2014 Valve Corporation
+//  All Rights Reserved.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+// cglmtexdecode.h
+//	GLMgr CPU DXT codecs - decode for GL's without S3TC, and the opt-in runtime compression of big 32 bit textures
+//
+//===============================================================================
+
+#ifndef CGLMTEXDECODE_H
+#define	CGLMTEXDECODE_H
+
+#pragma once
+
+#include "tier0/threadtools.h"
+#include "tier1/utlmap.h"
+#include "tier1/checksum_md5.h"
+
+//===============================================================================
+
+#define GL_DXT_DECODE_MAX_THREADS			8
+#define GL_DXT_DECODE_MIN_PARALLEL_BLOCKS	1024		// smaller regions aren't worth waking the workers for
+
+struct GLMDXTDecodeKey_t
+{
+	unsigned char	m_digest[ MD5_DIGEST_LENGTH ];		// of the source blocks
+	D3DFORMAT		m_nFormat;
+	int				m_nWidth;
+	int				m_nHeight;
+	int				m_nDepth;
+
+	static bool LessFunc( const GLMDXTDecodeKey_t &lhs, const GLMDXTDecodeKey_t &rhs );
+};
+
+// Expands DXT1/3/5 blocks to RGBA8 (in GL_RGBA / GL_UNSIGNED_BYTE order), one row of blocks at a time, spread over a few
+// worker threads plus the calling thread. Whole slices of static textures can go through a content keyed cache, so
+// re-uploading them (eviction, level reloads) doesn't decode them again. All public methods are render thread only.
+class CGLMDXTDecoder
+{
+	CGLMDXTDecoder( const CGLMDXTDecoder& );
+	CGLMDXTDecoder& operator= ( const CGLMDXTDecoder& );
+
+public:
+	CGLMDXTDecoder();
+	~CGLMDXTDecoder();
+
+	bool Init();
+	void Deinit();
+
+	// Decodes the blocks under box into pDst, which is laid out as the whole RGBA8 slice (so the region lands where
+	// GL_UNPACK_SKIP_* expects it). pSrc is the whole slice of blocks, box must be block aligned or run to the slice edge.
+	void DecodeRegion( D3DFORMAT nFormat, const uint8 *pSrc, uint8 *pDst, int nWidth, int nHeight, const GLMRegion &box );
+
+	// Whole slice decode through the cache. The result stays valid until the next call.
+	const uint8 *DecodeSliceCached( D3DFORMAT nFormat, const uint8 *pSrc, int nSrcSize, int nWidth, int nHeight, int nDepth );
+
+	static bool IsDecodableFormat( D3DFORMAT nFormat ) { return ( nFormat == D3DFMT_DXT1 ) || ( nFormat == D3DFMT_DXT3 ) || ( nFormat == D3DFMT_DXT5 ); }
+
+	// 16 RGBA8 texels out, row major
+	static void DecodeBlockDXT1( uint8 *pDst, const uint8 *pBlock );
+	static void DecodeBlockDXT3( uint8 *pDst, const uint8 *pBlock );
+	static void DecodeBlockDXT5( uint8 *pDst, const uint8 *pBlock );
+
+private:
+	class CWorker : public CThread
+	{
+	public:
+		CGLMDXTDecoder	*m_pOwner;
+		CThreadEvent	m_Wake;
+
+	protected:
+		virtual int Run();
+	};
+
+	struct Job_t
+	{
+		D3DFORMAT		m_nFormat;
+		const uint8		*m_pSrc;
+		uint8			*m_pDst;
+		int				m_nWidth;
+		int				m_nHeight;
+		int				m_nBlockBytes;
+		int				m_nSrcRowBytes;			// one row of blocks
+		int				m_nSrcLayerBytes;
+		int				m_nBlockXMin, m_nBlockXMax;
+		int				m_nBlockYMin;
+		int				m_nBlockRows;			// per layer
+		int				m_nZMin;
+		int				m_nBands;				// one per row of blocks per layer
+	};
+
+	struct CacheEntry_t
+	{
+		GLMDXTDecodeKey_t	m_key;
+		CUtlVector<uint8>	m_Result;
+	};
+
+	void ProcessBands();
+	static void DecodeBand( const Job_t &job, int nBand );
+	void EvictCacheEntries( CacheEntry_t *pKeep );
+
+	CUtlVector< CWorker * >						m_Workers;
+	volatile bool								m_bExit;
+
+	CThreadFastMutex							m_Mutex;
+	Job_t										m_Job;				// protected by m_Mutex until the job is done
+	int											m_nNextBand;		// protected by m_Mutex
+	CInterlockedInt								m_nBandsLeft;
+	CThreadEvent								m_JobDone;
+
+	CUtlMap< GLMDXTDecodeKey_t, CacheEntry_t * >	m_Cache;
+	CUtlVector< CacheEntry_t * >				m_CacheOrder;		// least recently used first
+	uint										m_nCacheBytes;
+};
+
+//===============================================================================
+
+struct GLMTexCompressSlice_t
+{
+	int		m_nWidth;
+	int		m_nHeight;
+	int		m_nDepth;
+	int		m_nSrcOffset;
+	int		m_nDstOffset;		// filled in by the worker, along with m_nDstSize
+	int		m_nDstSize;
+};
+
+struct GLMTexCompressJob_t
+{
+	CUtlVector<uint8>					m_Src;				// copy of the texture's backing, B,G,R,A byte order
+	CUtlVector<GLMTexCompressSlice_t>	m_Slices;
+	bool								m_bSrcHasAlpha;
+
+	// results, only valid once m_bDone is set
+	CUtlVector<uint8>					m_Result;			// slices back to back, see GLMTexCompressSlice_t::m_nDstOffset
+	D3DFORMAT							m_nResultFormat;
+	CInterlockedInt						m_bDone;
+
+	bool								m_bAbandoned;		// protected by CGLMTexCompressor::m_Mutex, the worker frees it when it's done
+};
+
+// Compresses the full set of slices of an A8R8G8B8 / X8R8G8B8 texture to DXT1 (or DXT5 if any alpha isn't 255) on
+// worker threads. The render thread polls m_bDone and hands every job back through ReleaseJob, finished or not.
+class CGLMTexCompressor
+{
+	CGLMTexCompressor( const CGLMTexCompressor& );
+	CGLMTexCompressor& operator= ( const CGLMTexCompressor& );
+
+public:
+	typedef GLMTexCompressJob_t Job_t;
+
+	CGLMTexCompressor();
+	~CGLMTexCompressor();
+
+	bool Init();
+	void Deinit();
+
+	void QueueJob( Job_t *pJob );
+	void ReleaseJob( Job_t *pJob );
+
+	// 16 RGBA8 texels in, row major
+	static void CompressBlockDXT1( uint8 *pDst, const uint8 *pTexels );
+	static void CompressBlockDXT5( uint8 *pDst, const uint8 *pTexels );
+
+private:
+	class CWorker : public CThread
+	{
+	public:
+		CGLMTexCompressor	*m_pOwner;
+		CThreadEvent		m_Wake;
+
+	protected:
+		virtual int Run();
+	};
+
+	void ProcessJobs();
+	static void ProcessJob( Job_t *pJob );
+
+	CUtlVector< CWorker * >			m_Workers;
+	volatile bool					m_bExit;
+
+	CThreadFastMutex				m_Mutex;
+	CUtlVector< Job_t * >			m_PendingJobs;		// protected by m_Mutex
+	CUtlVector< Job_t * >			m_ActiveJobs;		// protected by m_Mutex, being worked on
+};
+
+#endif // CGLMTEXDECODE_H
@@ -275,6 +275,10 @@ struct TOGL_CLASS IDirect3DIndexBuffer9 : public IDirect3DResource9	//was IUnkno
 	GLMContext				*m_ctx;
 	CGLMBuffer				*m_idxBuffer;
 	D3DINDEXBUFFER_DESC		m_idxDesc;		// to satisfy GetDesc
+
+	CGLMStaticIndexData		*m_pStaticIndexData;	// non-NULL if static index optimization was enabled when this was created
+	GLMBuffLockParams		m_LockParams;
+	void					*m_pLockData;
 		
 	virtual					~IDirect3DIndexBuffer9();
 
@@ -369,40 +373,78 @@ struct RenderTargetState_t
 		return false;
 	}
 
-	static inline bool LessFunc( const RenderTargetState_t &lhs, const RenderTargetState_t &rhs ) 
+	enum { kNumTextures = 5 };
+
+	// color targets 0-3, then depth
+	inline CGLMTex *GetTexture( int nIndex ) const
 	{
-		COMPILE_TIME_ASSERT( sizeof( lhs.m_pRenderTargets[0] ) == sizeof( uint32 ) );
-		uint64 lhs0 = reinterpret_cast<const uint64 *>(lhs.m_pRenderTargets)[0];
-		uint64 rhs0 = reinterpret_cast<const uint64 *>(rhs.m_pRenderTargets)[0];
-		if ( lhs0 < rhs0 )
-			return true;
-		else if ( lhs0 == rhs0 )
-		{
-			uint64 lhs1 = reinterpret_cast<const uint64 *>(lhs.m_pRenderTargets)[1];
-			uint64 rhs1 = reinterpret_cast<const uint64 *>(rhs.m_pRenderTargets)[1];
-			if ( lhs1 < rhs1 )
-				return true;
-			else if ( lhs1 == rhs1 )
-			{
-				return lhs.m_pDepthStencil < rhs.m_pDepthStencil;
-			}
-		}
-		return false;
+		return ( nIndex < 4 ) ? m_pRenderTargets[nIndex] : m_pDepthStencil;
+	}
+
+	inline bool operator == ( const RenderTargetState_t &rhs ) const
+	{
+		return ( m_pRenderTargets[0] == rhs.m_pRenderTargets[0] ) && ( m_pRenderTargets[1] == rhs.m_pRenderTargets[1] ) &&
+			   ( m_pRenderTargets[2] == rhs.m_pRenderTargets[2] ) && ( m_pRenderTargets[3] == rhs.m_pRenderTargets[3] ) &&
+			   ( m_pDepthStencil == rhs.m_pDepthStencil );
 	}
 
-	inline bool operator < ( const RenderTargetState_t &rhs ) const
+	inline uint Hash() const
 	{
-		return LessFunc( *this, rhs );
+		uint nHash = 2166136261U;
+		for ( int i = 0; i < kNumTextures; i++ )
+		{
+			nHash = ( nHash ^ (uint)( (uintp)GetTexture( i ) >> 4 ) ) * 16777619U;
+		}
+		return nHash ^ ( nHash >> 16 );
 	}
 };
 
-typedef CUtlMap< RenderTargetState_t, CGLMFBO *> CGLMFBOMap;
+// render target tuple -> FBO, hashed (chained buckets, grown as needed).
+// every texture in a key keeps the entries that use it on an intrusive list headed by CGLMTex::m_nFBOMapHead,
+// so scrubbing a texture only visits its own FBOs. entries are also kept in LRU order so the device can cap the count.
+class CGLMFBOMap
+{
+public:
+	CGLMFBOMap();
+
+	CGLMFBO		*Find( const RenderTargetState_t &key );		// NULL on a miss, a hit becomes the most recently used
+	void		Insert( const RenderTargetState_t &key, CGLMFBO *pFBO );
+	CGLMFBO		*RemoveLRU( CGLMFBO *pKeep = NULL );		// takes out the least recently used entry other than pKeep's, returns its FBO (NULL if none)
+	CGLMFBO		*RemoveFirstWithTex( CGLMTex *pTex );	// takes out one entry referring to pTex, returns its FBO (NULL if none left)
+	int			Count() const { return m_nCount; }
+
+protected:
+	struct Entry_t
+	{
+		RenderTargetState_t		m_key;
+		CGLMFBO					*m_pFBO;			// NULL while on the free list
+		uint					m_nHash;
+		int						m_nHashNext;		// bucket chain, or free list
+		int						m_nPrevLRU;
+		int						m_nNextLRU;
+		int						m_nTexPrev[RenderTargetState_t::kNumTextures];		// links in each key texture's list, as entry * kNumTextures + index
+		int						m_nTexNext[RenderTargetState_t::kNumTextures];
+	};
+
+	void		Remove( int nEntry );
+	void		GrowBuckets( void );
+	void		LinkLRUTail( int nEntry );
+	void		UnlinkLRU( int nEntry );
+
+	CUtlVector< Entry_t >	m_Entries;
+	CUtlVector< int >		m_Buckets;		// power of two, -1 for empty
+	int						m_nFreeHead;
+	int						m_nLRUHead;		// least recently used
+	int						m_nLRUTail;
+	int						m_nCount;
+};
 
 class simple_bitmap;
 
 struct TOGL_CLASS IDirect3DDevice9 : public IUnknown
 {
 	friend class GLMContext;
+	friend class CGLMTex;
 	friend struct IDirect3DBaseTexture9;
 	friend struct IDirect3DTexture9;
 	friend struct IDirect3DCubeTexture9;
@@ -556,6 +598,20 @@ struct TOGL_CLASS IDirect3DDevice9 : public IUnknown
 	void TOGLMETHODCALLTYPE ReleaseThreadOwnership( );
 	inline DWORD TOGLMETHODCALLTYPE GetCurrentOwnerThreadId() const { return m_ctx->m_nCurOwnerThreadId; }
 
+	// CGLMBuffer lock/upload counters for recently presented frames (nFramesAgo 0 = last Present), for frame profilers
+	inline bool TOGLMETHODCALLTYPE GetBufferFrameStats( uint nFramesAgo, GLMBufferFrameStats_t *pStats ) const { return m_ctx->GetBufferFrameStats( nFramesAgo, pStats ); }
+
+	// Opt-in rework of static 16-bit index buffers created while enabled, done on a worker thread (GLM_STATIC_INDEX_OPT_* flags):
+	//	REORDER_TRILISTS - triangle lists get reordered for the post transform vertex cache. Only use this if nothing depends on
+	//					   the triangle order within a draw.
+	//	STRIP_RESTART	 - degenerate stitched triangle strips get split with primitive restart instead (needs GL_ARB_ES3_compatibility).
+	void TOGLMETHODCALLTYPE SetStaticIndexOptimization( uint nFlags );
+
+	// Opt-in DXT1/DXT5 compression of static A8R8G8B8 / X8R8G8B8 2D textures of nMinKB or more (0 turns it off for new textures).
+	// Once filled in, they get compressed on a worker thread and swapped in at a later Present. Costs some quality, and a Lock
+	// or a blit afterwards puts the original texels back for good. Not available without S3TC.
+	void TOGLMETHODCALLTYPE SetRuntimeTextureCompression( uint nMinKB );
+
 	FORCEINLINE void TOGLMETHODCALLTYPE SetMaxUsedVertexShaderConstantsHint( uint nMaxReg );
 	void TOGLMETHODCALLTYPE SetMaxUsedVertexShaderConstantsHintNonInline( uint nMaxReg );
 
@@ -607,6 +663,9 @@ private:
 	CGLMBuffer					*m_pDummy_vtx_buffer;
 	D3DIndexDesc				m_indices;						// Set by SetIndices..
 
+	CGLMIndexOptimizer			*m_pIndexOptimizer;				// created on first non-zero SetStaticIndexOptimization, lives until the device goes away
+	uint						m_nStaticIndexOptimizations;	// GLM_STATIC_INDEX_OPT_* flags
+
 	IDirect3DVertexShader9		*m_vertexShader;				// Set by SetVertexShader...
 	IDirect3DPixelShader9		*m_pixelShader;					// Set by SetPixelShader...
 
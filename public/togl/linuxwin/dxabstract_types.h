@@ -238,6 +238,7 @@ typedef enum _D3DSHADER_COMPARISON
 #define D3DERR_INVALIDCALL                      MAKE_D3DHRESULT(2156)
 #define D3DERR_DRIVERINTERNALERROR              MAKE_D3DHRESULT(2087)
 #define D3DERR_OUTOFVIDEOMEMORY                 MAKE_D3DHRESULT(380)
+#define D3DERR_WASSTILLDRAWING                  MAKE_D3DHRESULT(540)
 #define D3D_OK									S_OK
 
 #define D3DPRESENT_RATE_DEFAULT         0x00000000
@@ -409,6 +410,7 @@ typedef enum _D3DSHADER_COMPARISON
 #define D3DLOCK_DISCARD            0x00002000L
 #define D3DLOCK_NOOVERWRITE        0x00001000L
 #define D3DLOCK_NOSYSLOCK          0x00000800L
+#define D3DLOCK_DONOTWAIT          0x00004000L
 
 #define D3DLOCK_NO_DIRTY_UPDATE     0x00008000L
 
@@ -1686,6 +1688,7 @@ struct D3DVERTEXELEMENT9_GL
 	//		BYTE    UsageIndex; // Semantic index
 
 	GLMVertexAttributeDesc	m_gldecl;
+	uint8					m_nConversion;	// EGLMVertexConversion - if set, m_gldecl describes the converted element in the stream buffer's shadow, not the D3D data
 	// CGLMBuffer				*m_buffer;		// late-dropped from selected stream desc (left NULL, will replace with stream source buffer at sync time)
 	// GLuint					m_datasize;		// component count (1,2,3,4) of the attrib
 	// GLenum					m_datatype;		// data type of the attribute (GL_FLOAT et al)
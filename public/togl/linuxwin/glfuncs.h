@@ -45,6 +45,8 @@ GL_FUNC_VOID(OpenGL,true,glColorMask,(GLboolean a,GLboolean b,GLboolean c,GLbool
 GL_FUNC_VOID(OpenGL,true,glCompileShaderARB,(GLhandleARB a),(a))
 GL_FUNC_VOID(OpenGL,true,glCompressedTexImage2D,(GLenum a,GLint b,GLenum c,GLsizei d,GLsizei e,GLint f,GLsizei g,const GLvoid *h),(a,b,c,d,e,f,g,h))
 GL_FUNC_VOID(OpenGL,true,glCompressedTexImage3D,(GLenum a,GLint b,GLenum c,GLsizei d,GLsizei e,GLsizei f,GLint g,GLsizei h,const GLvoid *i),(a,b,c,d,e,f,g,h,i))
+GL_FUNC_VOID(OpenGL,true,glCompressedTexSubImage2D,(GLenum a,GLint b,GLint c,GLint d,GLsizei e,GLsizei f,GLenum g,GLsizei h,const GLvoid *i),(a,b,c,d,e,f,g,h,i))
+GL_FUNC_VOID(OpenGL,true,glCompressedTexSubImage3D,(GLenum a,GLint b,GLint c,GLint d,GLint e,GLsizei f,GLsizei g,GLsizei h,GLenum i,GLsizei j,const GLvoid *k),(a,b,c,d,e,f,g,h,i,j,k))
 GL_FUNC(OpenGL,true,GLhandleARB,glCreateProgramObjectARB,(void),())
 GL_FUNC(OpenGL,true,GLhandleARB,glCreateShaderObjectARB,(GLenum a),(a))
 GL_FUNC_VOID(OpenGL,true,glDeleteBuffersARB,(GLsizei a,const GLuint *b),(a,b))
@@ -108,6 +110,7 @@ GL_FUNC_VOID(OpenGL,true,glTexImage3D,(GLenum a,GLint b,GLint c,GLsizei d,GLsize
 GL_FUNC_VOID(OpenGL,true,glTexParameterfv,(GLenum a,GLenum b,const GLfloat *c),(a,b,c))
 GL_FUNC_VOID(OpenGL,true,glTexParameteri,(GLenum a,GLenum b,GLint c),(a,b,c))
 GL_FUNC_VOID(OpenGL,true,glTexSubImage2D,(GLenum a,GLint b,GLint c,GLint d,GLsizei e,GLsizei f,GLenum g,GLenum h,const GLvoid *i),(a,b,c,d,e,f,g,h,i))
+GL_FUNC_VOID(OpenGL,true,glTexSubImage3D,(GLenum a,GLint b,GLint c,GLint d,GLint e,GLsizei f,GLsizei g,GLsizei h,GLenum i,GLenum j,const GLvoid *k),(a,b,c,d,e,f,g,h,i,j,k))
 GL_FUNC_VOID(OpenGL,true,glUniform1f,(GLint a,GLfloat b),(a,b))
 GL_FUNC_VOID(OpenGL,true,glUniform1i,(GLint a,GLint b),(a,b))
 GL_FUNC_VOID(OpenGL,true,glUniform1iARB,(GLint a,GLint b),(a,b))
@@ -139,6 +142,7 @@ GL_FUNC_VOID(GL_EXT_framebuffer_object,false,glFramebufferTexture3DEXT,(GLenum a
 GL_FUNC_VOID(GL_EXT_framebuffer_object,false,glGenFramebuffersEXT,(GLsizei a,GLuint *b),(a,b))
 GL_FUNC_VOID(GL_EXT_framebuffer_object,false,glGenRenderbuffersEXT,(GLsizei a,GLuint *b),(a,b))
 GL_FUNC_VOID(GL_EXT_framebuffer_object,false,glDeleteFramebuffersEXT,(GLsizei a,const GLuint *b),(a,b))
+GL_FUNC_VOID(GL_EXT_framebuffer_object,false,glGenerateMipmapEXT,(GLenum a),(a))
 GL_EXT(GL_EXT_framebuffer_blit,-1,-1)
 GL_FUNC_VOID(GL_EXT_framebuffer_blit,false,glBlitFramebufferEXT,(GLint a,GLint b,GLint c,GLint d,GLint e,GLint f,GLint g,GLint h,GLbitfield i,GLenum j),(a,b,c,d,e,f,g,h,i,j))
 GL_EXT(GL_EXT_framebuffer_multisample,-1,-1)
@@ -180,6 +184,7 @@ GL_FUNC(GL_ARB_map_buffer_range,false,void*,glMapBufferRange,(GLenum a,GLintptr
 GL_FUNC_VOID(GL_ARB_map_buffer_range,false,glFlushMappedBufferRange,(GLenum a,GLintptr b,GLsizeiptr c),(a,b,c))
 GL_EXT(GL_ARB_vertex_buffer_object,-1,-1)
 GL_FUNC_VOID(GL_ARB_vertex_buffer_object,true,glBufferSubData,(GLenum a,GLintptr b,GLsizeiptr c,const GLvoid *d),(a,b,c,d))
+GL_FUNC_VOID(GL_ARB_vertex_buffer_object,true,glGetBufferSubData,(GLenum a,GLintptr b,GLsizeiptr c,GLvoid *d),(a,b,c,d))
 GL_EXT(GL_ARB_occlusion_query,-1,-1)
 GL_FUNC_VOID(GL_ARB_occlusion_query,false,glBeginQueryARB,(GLenum a,GLuint b),(a,b))
 GL_FUNC_VOID(GL_ARB_occlusion_query,false,glEndQueryARB,(GLenum a),(a))
@@ -192,6 +197,17 @@ GL_EXT(GL_APPLE_client_storage,-1,-1)
 GL_EXT(GL_ARB_uniform_buffer,-1,-1)
 GL_EXT(GL_ARB_vertex_array_bgra,-1,-1)
 GL_EXT(GL_EXT_vertex_array_bgra,-1,-1)
+GL_EXT(GL_ARB_half_float_vertex,3,0)
+GL_EXT(GL_ARB_ES3_compatibility,4,3)
+GL_EXT(GL_ARB_buffer_storage,4,4)
+GL_FUNC_VOID(GL_ARB_buffer_storage,false,glBufferStorage,(GLenum a,GLsizeiptr b,const GLvoid *c,GLbitfield d),(a,b,c,d))
+GL_EXT(GL_ARB_texture_storage,4,2)
+GL_FUNC_VOID(GL_ARB_texture_storage,false,glTexStorage2D,(GLenum a,GLsizei b,GLenum c,GLsizei d,GLsizei e),(a,b,c,d,e))
+GL_FUNC_VOID(GL_ARB_texture_storage,false,glTexStorage3D,(GLenum a,GLsizei b,GLenum c,GLsizei d,GLsizei e,GLsizei f),(a,b,c,d,e,f))
+GL_EXT(GL_ARB_texture_rg,3,0)
+GL_EXT(GL_ARB_texture_swizzle,3,3)
+GL_EXT(GL_ARB_texture_view,4,3)
+GL_FUNC_VOID(GL_ARB_texture_view,false,glTextureView,(GLuint a,GLenum b,GLuint c,GLenum d,GLuint e,GLuint f,GLuint g,GLuint h),(a,b,c,d,e,f,g,h))
 GL_EXT(GL_ARB_framebuffer_object,3,0)
 GL_FUNC_VOID(GL_ARB_framebuffer_object,false,glBindFramebuffer,(GLenum a,GLuint b),(a,b))
 GL_FUNC_VOID(GL_ARB_framebuffer_object,false,glBindRenderbuffer,(GLenum a,GLuint b),(a,b))
@@ -216,6 +232,8 @@ GL_FUNC_VOID(GL_ARB_debug_output,false,glDebugMessageCallbackARB,(void (APIENTRY
 GL_FUNC_VOID(GL_ARB_debug_output,false,glDebugMessageControlARB,(GLenum a, GLenum b, GLenum c, GLsizei d, const GLuint* e, GLboolean f),(a,b,c,d,e,f))
 GL_EXT(GL_EXT_direct_state_access,-1,-1)
 GL_FUNC_VOID(GL_EXT_direct_state_access,false,glBindMultiTextureEXT,(GLenum a,GLuint b, GLuint c),(a,b,c))
+GL_FUNC_VOID(GL_EXT_direct_state_access,false,glTextureParameteriEXT,(GLuint a,GLenum b,GLenum c,GLint d),(a,b,c,d))
+GL_FUNC_VOID(GL_EXT_direct_state_access,false,glGenerateTextureMipmapEXT,(GLuint a,GLenum b),(a,b))
 GL_FUNC_VOID(OpenGL,true,glGenSamplers,(GLuint a,GLuint *b),(a,b))
 GL_FUNC_VOID(OpenGL,true,glDeleteSamplers,(GLsizei a,const GLuint *b),(a,b))
 GL_FUNC_VOID(OpenGL,true,glBindSampler,(GLuint a, GLuint b),(a,b))
@@ -254,6 +272,7 @@ GL_EXT(GL_EXT_texture_compression_s3tc,-1,-1)
 GL_EXT(GL_EXT_texture_compression_dxt1,-1,-1)
 GL_EXT(GL_ANGLE_texture_compression_dxt3,-1,-1)
 GL_EXT(GL_ANGLE_texture_compression_dxt5,-1,-1)
+GL_EXT(GL_EXT_texture_array,3,0)
 
 // This one is an OS extension. We'll add a little helper function to look for it.
 #ifdef _WIN32
@@ -180,6 +180,9 @@ struct GLMRendererInfoFields
 	//--------------------------- " bads " - known bad drivers
 	bool	m_badDriver1064NV;		// this is the bad NVIDIA driver on 10.6.4 - stutter, tex corruption, black screen issues
 	bool    m_badDriver108Intel;	// this is the bad Intel HD4000 driver on 10.8 - intermittent crash on GLSL compilation.
+
+	//--------------------------- tuned at runtime by the GLMContext (zero in the display DB)
+	uint	m_nBufferSubDataChunkSize;	// glBufferSubDataMaxSize() chunk size, per-driver default until the warm-up timing picks one
 };
 
 
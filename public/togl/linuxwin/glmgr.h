@@ -44,6 +44,8 @@
 #include "cglmprogram.h"
 #include "cglmbuffer.h"
 #include "cglmquery.h"
+#include "cglmindexopt.h"
+#include "cglmtexdecode.h"
 
 #include "tier0/vprof_telemetry.h"
 #include "materialsystem/ishader.h"
@@ -1043,6 +1045,8 @@ struct	GLMTexSampler
 {
 	CGLMTex *m_pBoundTex;				// tex which is actually bound now
 	GLMTexSamplingParams m_samp;		// current 2D sampler state
+	bool m_bBoundSRGBView;				// m_pBoundTex->m_texViewName is what's bound, see GLMContext::SelectSRGBView
+	GLMTexAtlas *m_pBoundAtlas;			// array bound on GL_TEXTURE_2D_ARRAY_EXT, see GLMContext::AtlasTex
 };
 
 // GLMContext will maintain one of these structures inside the context to represent the current state.
@@ -1311,6 +1315,128 @@ private:
 
 //===========================================================================//
 
+// Persistently mapped GL_PIXEL_UNPACK_BUFFER for texture uploads, used like the pinned memory buffers above:
+// a few of these are cycled at Present and bump allocated from in between. Needs GL_ARB_buffer_storage.
+#define GLMGR_PIXEL_UNPACK_BUFFER_SIZE ( 16 * 1024 * 1024 )
+#define GLMGR_PIXEL_UNPACK_ALIGNMENT 64
+
+class CPixelUnpackBuffer
+{
+	CPixelUnpackBuffer( const CPixelUnpackBuffer & );
+	CPixelUnpackBuffer & operator= ( const CPixelUnpackBuffer & );
+
+public:
+	CPixelUnpackBuffer() : m_pBuf( NULL ), m_nSize( 0 ), m_nOfs( 0 ), m_nBufferObj( 0 ), m_nSyncObj( 0 )
+	{
+	}
+
+	~CPixelUnpackBuffer()
+	{
+		Deinit();
+	}
+
+	bool Init( uint nSize )
+	{
+		Deinit();
+
+		gGL->glGenBuffersARB( 1, &m_nBufferObj );
+		gGL->glBindBufferARB( GL_PIXEL_UNPACK_BUFFER_ARB, m_nBufferObj );
+
+		const GLbitfield nFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		gGL->glBufferStorage( GL_PIXEL_UNPACK_BUFFER_ARB, nSize, NULL, nFlags );
+		m_pBuf = gGL->glMapBufferRange( GL_PIXEL_UNPACK_BUFFER_ARB, 0, nSize, nFlags );
+
+		gGL->glBindBufferARB( GL_PIXEL_UNPACK_BUFFER_ARB, 0 );
+
+		if ( !m_pBuf )
+		{
+			gGL->glDeleteBuffersARB( 1, &m_nBufferObj );
+			m_nBufferObj = 0;
+			return false;
+		}
+
+		m_nSize = nSize;
+		m_nOfs = 0;
+		return true;
+	}
+
+	void Deinit()
+	{
+		if ( !m_nBufferObj )
+			return;
+
+		BlockUntilNotBusy();
+
+		// deleting a persistently mapped buffer unmaps it
+		gGL->glDeleteBuffersARB( 1, &m_nBufferObj );
+		m_nBufferObj = 0;
+
+		m_pBuf = NULL;
+		m_nSize = 0;
+		m_nOfs = 0;
+	}
+
+	inline uint GetSize() const { return m_nSize; }
+	inline uint GetOfs() const { return m_nOfs; }
+	inline uint GetBytesRemaining() const { return m_nSize - m_nOfs; }
+	inline void *GetPtr() const { return m_pBuf; }
+	inline GLuint GetHandle() const { return m_nBufferObj; }
+
+	void InsertFence()
+	{
+		if ( m_nSyncObj )
+		{
+			gGL->glDeleteSync( m_nSyncObj );
+		}
+
+		m_nSyncObj = gGL->glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	}
+
+	bool IsBusy()
+	{
+		if ( !m_nSyncObj )
+			return false;
+
+		GLenum nResult = gGL->glClientWaitSync( m_nSyncObj, 0, 0 );
+		return ( nResult != GL_ALREADY_SIGNALED ) && ( nResult != GL_CONDITION_SATISFIED );
+	}
+
+	void BlockUntilNotBusy()
+	{
+		if ( m_nSyncObj )
+		{
+			gGL->glClientWaitSync( m_nSyncObj, GL_SYNC_FLUSH_COMMANDS_BIT, 3000000000000ULL );
+
+			gGL->glDeleteSync( m_nSyncObj );
+
+			m_nSyncObj = 0;
+		}
+		m_nOfs = 0;
+	}
+
+	// returns the offset of nSize bytes, or -1 if they don't fit
+	int Alloc( uint nSize )
+	{
+		uint nOfs = ALIGN_VALUE( m_nOfs, GLMGR_PIXEL_UNPACK_ALIGNMENT );
+		if ( ( nOfs > m_nSize ) || ( nSize > m_nSize - nOfs ) )
+			return -1;
+
+		m_nOfs = nOfs + nSize;
+		return (int)nOfs;
+	}
+
+private:
+	void *m_pBuf;
+	uint m_nSize;
+	uint m_nOfs;
+
+	GLuint m_nBufferObj;
+
+	GLsync m_nSyncObj;
+};
+
+//===========================================================================//
+
 class GLMContext
 {
 	public:
@@ -1338,6 +1464,22 @@ class GLMContext
 		CGLMTex	*NewTex( GLMTexLayoutKey *key, const char *debugLabel=NULL );
 		void	DelTex( CGLMTex	*tex );	
 
+			// released render targets park in m_TexPool (FBO map entries intact) for NewTex to hand back out on a layout match
+		bool	CanPoolTex( CGLMTex *tex );
+		void	UpdateTexPool( bool bPurgeAll );
+		void	ReleasePooledTex( int nPoolIndex );
+
+			// opt-in DXT compression of static 32 bit textures at or over nMinBytes (0 turns it off for new textures), see CGLMTex::ApplyCompression
+		bool	SetTexCompression( uint nMinBytes );
+		void	QueueTexCompress( CGLMTex *tex );
+		void	CancelTexCompress( CGLMTex *tex );
+		void	UpdateTexCompression( void );
+
+			// opt-in (-gl_texatlas) atlasing of small static 2D textures into shared 2D arrays, see CGLMTex::CanAtlas
+		void	AtlasTex( CGLMTex *tex );
+		void	ReleaseAtlasLayer( CGLMTex *tex );
+		void	FreeTexAtlas( GLMTexAtlas *atlas );
+
 			// options for Blit (replacement for ResolveTex and BlitTex)
 			// pass NULL for dstTex if you want to target GL_BACK with the blit.  You get y-flip with that, don't change the dstrect yourself.		
 		void	Blit2( CGLMTex *srcTex, GLMRect *srcRect, int srcFace, int srcMip, CGLMTex *dstTex, GLMRect *dstRect, int dstFace, int dstMip, uint filter );
@@ -1346,11 +1488,45 @@ class GLMContext
 		void	BlitTex( CGLMTex *srcTex, GLMRect *srcRect, int srcFace, int srcMip, CGLMTex *dstTex, GLMRect *dstRect, int dstFace, int dstMip, uint filter, bool useBlitFB = true );
 
 			//	MSAA resolve - we do this in GLMContext because it has to do a bunch of FBO/blit gymnastics
+			// only the damaged part of each RBO is resolved (all of it with forceDirty), a batch shares one FBO setup
 		void	ResolveTex( CGLMTex *tex, bool forceDirty=false );	
+		void	ResolveTexBatch( CGLMTex **ppTex, int nCount, bool forceDirty=false );
+
+			// draws and clears into MSAA RBOs record damage, which gets resolved when something samples or copies the texture
+		void	DamageDrawingFBO( const GLScissorBox_t *pClearBox, bool bClear );
+		void	FlushPendingResolves( void );
 		
 			// texture pre-load (residency forcing) - normally done one-time but you can force it
 		void	PreloadTex( CGLMTex *tex, bool force=false );
 
+			// frees the least recently used idle texture backings until they fit in gl_tex_backing_budget_mb
+		void	EnforceTexBackingBudget( void );
+
+			// autogen mip chains whose level 0 changed (uploads, blits, rendering) get rebuilt once, just before a draw samples them
+		void	QueueMipGen( CGLMTex *tex );
+		void	FlushPendingMipGen( void );
+		void	GenerateMipmaps( CGLMTex *tex );
+
+			// residency - estimated GL footprint of textures and buffers, managed textures get evicted past gl_residency_budget_mb
+		void	AddResidentTex( CGLMTex *tex );
+		void	RemoveResidentTex( CGLMTex *tex );
+		void	EnforceResidencyBudget( void );
+		void	EvictManagedTextures( void );
+		void	EvictTextures( uint64 nTargetBytes, bool bColdOnly );
+		static int __cdecl EvictOrderFunc( CGLMTex * const *ppA, CGLMTex * const *ppB );
+
+			// mip streaming - deferred first uploads go up a mip at a time within gl_texstream_budget_kb per frame
+		void	QueueTexStream( CGLMTex *tex );
+		void	UpdateTexStreaming( void );
+
+			// coalesced partial uploads - textures sampled by the next draw get theirs sent (or all of them, at Present)
+		void	FlushDirtyTextures( bool bSampledOnly );
+
+			// without GL_EXT_texture_sRGB_decode, samplers whose sRGB state disagrees with the texture get its other-format view bound.
+			// returns true if the view is bound (its sampling params are synced here too).
+		bool	SelectSRGBView( int nSamplerIndex );
+		uint64	GetResidentBytes( void ) const { return m_nResidentTexBytes + m_nResidentBufferBytes; }
+
 		// samplers
 		FORCEINLINE void SetSamplerTex( int sampler, CGLMTex *tex );
 				
@@ -1431,6 +1607,19 @@ class GLMContext
 		FORCEINLINE void DrawRangeElements(	GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type, const GLvoid *indices, uint baseVertex, CGLMBuffer *pIndexBuf );
 		void DrawRangeElementsNonInline(	GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type, const GLvoid *indices, uint baseVertex, CGLMBuffer *pIndexBuf );
 
+		// 0xFFFF restart index, only turned on for draws from strips rewritten by CGLMStaticIndexData (a plain D3D draw may use vertex 65535)
+		FORCEINLINE void SetPrimitiveRestart( bool bEnable )
+		{
+			if ( bEnable != m_bPrimitiveRestartEnabled )
+			{
+				m_bPrimitiveRestartEnabled = bEnable;
+				if ( bEnable )
+					gGL->glEnable( GL_PRIMITIVE_RESTART_FIXED_INDEX );
+				else
+					gGL->glDisable( GL_PRIMITIVE_RESTART_FIXED_INDEX );
+			}
+		}
+
 		void	CheckNative( void );
 		
 		// clearing
@@ -1508,6 +1697,10 @@ class GLMContext
 
 		FORCEINLINE void SetMaxUsedVertexShaderConstantsHint( uint nMaxConstants );
 		FORCEINLINE DWORD GetCurrentOwnerThreadId() const { return m_nCurOwnerThreadId; }
+
+		// buffer lock stats - nFramesAgo 0 is the most recently presented frame. returns false if not that much history yet.
+		bool GetBufferFrameStats( uint nFramesAgo, GLMBufferFrameStats_t *pStats ) const;
+		uint GetNumBufferFrameStats() const { return m_nNumBufferFrameStats; }
 								
 	protected:
 		friend class GLMgr;				// only GLMgr can make GLMContext objects
@@ -1519,6 +1712,9 @@ class GLMContext
 		friend class CGLMShaderPairCache;
 		friend class CGLMBuffer;
 		friend class CGLMBufferSpanManager;
+		friend class CGLMBufferUploader;
+		friend class CGLMBufferSubDataTuner;
+		friend class CGLMStaticIndexData;
 		friend class GLMTester;			// tester class needs access back into GLMContext
 		
 		friend struct IDirect3D9;
@@ -1614,12 +1810,24 @@ class GLMContext
 
 		FORCEINLINE void BindIndexBufferToCtx( CGLMBuffer *buff );
 		FORCEINLINE void BindVertexBufferToCtx( CGLMBuffer *buff );
+
+		// loader thread uploads - blocks until the buffer's last queued upload is visible to this context
+		void FinishBufferUpload( CGLMBuffer *pBuff );
 		
 		// debug font
 		void GenDebugFontTex( void );
 		void DrawDebugText( float x, float y, float z, float drawCharWidth, float drawCharHeight, char *string );
 		
 		CPinnedMemoryBuffer *GetCurPinnedMemoryBuffer( ) { return &m_PinnedMemoryBuffers[m_nCurPinnedMemoryBuffer]; }
+
+		// texture Lock staging memory in the current pixel unpack buffer, returns NULL if PBO uploads are off or it's full
+		CPixelUnpackBuffer *AllocPixelUnpackSpace( uint nSize, int *pOfs );
+		inline bool UsingPixelUnpackBuffers() const { return m_bUsePixelUnpackBuffers; }
+
+		// reusable destination for texel conversions done by WriteTexels, only valid until the next call
+		FORCEINLINE uint8 *GetTexelConvertScratch( int nBytes ) { m_TexelConvertScratch.EnsureCapacity( nBytes ); return m_TexelConvertScratch.Base(); }
+
+		FORCEINLINE GLMBufferFrameStats_t &GetCurBufferFrameStats() { return m_BufferFrameStats[m_nCurBufferFrameStats]; }
 						
 		// members------------------------------------------
 						
@@ -1628,6 +1836,9 @@ class GLMContext
 		uint							m_nThreadOwnershipReleaseCounter;
 
 		bool							m_bUseSamplerObjects;
+		bool							m_bUseSRGBTextureViews;		// no sRGB decode control, but ARB_texture_view can alias the storage
+		bool							m_bSoftwareDXTDecode;		// no S3TC (or -gl_force_dxt_decode), DXT textures go up as RGBA8 via m_pDXTDecoder
+		bool							m_bUseTexAtlas;				// -gl_texatlas and GL can do it, see AtlasTex
 
 		IDirect3DDevice9				*m_pDevice;
 		GLMRendererInfoFields			m_caps;
@@ -1645,6 +1856,43 @@ class GLMContext
 		// texture form table
 		CGLMTexLayoutTable				*m_texLayoutTable;
 
+		// idle texture backings, least recently used at the head
+		CGLMTex							*m_pTexBackingLRUHead;
+		CGLMTex							*m_pTexBackingLRUTail;
+		uint64							m_nTexBackingLRUBytes;
+
+		// textures waiting on FlushPendingMipGen (CGLMTex::m_bMipGenPending set)
+		CUtlVector< CGLMTex* >			m_PendingMipGen;
+
+		// MSAA textures with unresolved RBO damage (CGLMTex::m_bResolvePending set)
+		CUtlVector< CGLMTex* >			m_PendingResolves;
+
+		// textures that have a GL object (CGLMTex::m_nResidentIndex), and the estimated bytes behind them and the GL buffers
+		CUtlVector< CGLMTex* >			m_ResidentTextures;
+		uint64							m_nResidentTexBytes;
+		uint64							m_nResidentBufferBytes;
+		uint							m_nCurFrameFirstBatch;		// m_nBatchCounter at the last two Presents, textures
+		uint							m_nPrevFrameFirstBatch;		// used since m_nPrevFrameFirstBatch don't get evicted
+
+		// textures with deferred mip uploads (CGLMTex::m_bStreamPending set), oldest first
+		CUtlVector< CGLMTex* >			m_StreamingTextures;
+
+		// textures holding CGLMTex::m_DirtyRegions
+		CUtlVector< CGLMTex* >			m_DirtyTextures;
+
+		// released render targets waiting for reuse, oldest first
+		CUtlVector< CGLMTex* >			m_TexPool;
+		uint64							m_nTexPoolBytes;
+
+		// textures with a CGLMTex::m_pCompressJob in flight
+		CUtlVector< CGLMTex* >			m_CompressingTextures;
+		uint							m_nTexCompressMinBytes;		// 0 unless SetTexCompression enabled it
+
+		// 2D arrays holding atlased textures, and the samplers reading one (the bound tex's layer) instead of the tex
+		CUtlVector< GLMTexAtlas* >		m_TexAtlases;
+		uint							m_nAtlasSamplerMask;
+		int								m_nMaxTexAtlasLayers;
+
 		// context state mirrors
 		
 		GLState<GLAlphaTestEnable_t>	m_AlphaTestEnable;
@@ -1808,6 +2056,26 @@ class GLMContext
 		enum { cNumPinnedMemoryBuffers = 4 };
 		CPinnedMemoryBuffer m_PinnedMemoryBuffers[cNumPinnedMemoryBuffers];
 		uint m_nCurPinnedMemoryBuffer;
+
+		enum { cNumPixelUnpackBuffers = 3 };
+		CPixelUnpackBuffer m_PixelUnpackBuffers[cNumPixelUnpackBuffers];
+		uint m_nCurPixelUnpackBuffer;
+		bool m_bUsePixelUnpackBuffers;
+
+		CUtlMemory< uint8 > m_TexelConvertScratch;
+
+		CGLMBufferUploader *m_pBufferUploader;		// NULL unless -gl_async_buffer_uploads
+		CGLMDXTDecoder *m_pDXTDecoder;				// NULL unless m_bSoftwareDXTDecode
+		CGLMTexCompressor *m_pTexCompressor;		// NULL until SetTexCompression
+		uint m_nNumPendingBufferUploads;			// # of buffers with a non-zero m_nPendingUploadSerial
+
+		CGLMBufferSubDataTuner m_BufferSubDataTuner;
+
+		bool m_bPrimitiveRestartEnabled;
+
+		GLMBufferFrameStats_t m_BufferFrameStats[GL_BUFFER_FRAME_STATS_HISTORY];
+		uint m_nCurBufferFrameStats;
+		uint m_nNumBufferFrameStats;			// # of completed frames in m_BufferFrameStats
 		
 		void SaveColorMaskAndSetToDefault();
 		void RestoreSavedColorMask();
@@ -2120,9 +2388,34 @@ FORCEINLINE void GLMContext::SetSamplerDirty( int sampler )
 FORCEINLINE void GLMContext::SetSamplerTex( int sampler, CGLMTex *tex ) 
 { 
 	Assert( sampler < GLM_SAMPLER_COUNT );
+	if ( tex )
+	{
+		// first bind of a deferred texture makes its GL object (this uses TMU 0, so do it before we touch the binding)
+		tex->EnsureGLTexture();
+		tex->m_nLastUsedBatch = m_nBatchCounter;
+	}
 	m_samplers[sampler].m_pBoundTex = tex;
+	m_samplers[sampler].m_bBoundSRGBView = false;
+	m_nAtlasSamplerMask &= ~( 1 << sampler );
 	if ( tex )
 	{
+		GLenum target = tex->m_texGLTarget;
+		GLuint name = tex->m_texName;
+		bool bBind = true;
+
+		// an atlased tex is read out of its layer, nothing to bind if the array is already there
+		GLMTexAtlas *atlas = tex->m_pAtlas;
+		if ( atlas )
+		{
+			m_nAtlasSamplerMask |= 1 << sampler;
+			bBind = ( m_samplers[sampler].m_pBoundAtlas != atlas );
+			m_samplers[sampler].m_pBoundAtlas = atlas;
+			target = GL_TEXTURE_2D_ARRAY_EXT;
+			name = atlas->m_texName;
+		}
+
+		if ( bBind )
+		{
 			if ( !gGL->m_bHave_GL_EXT_direct_state_access )
 			{
 				if ( sampler != m_activeTexture )
@@ -2131,15 +2424,16 @@ FORCEINLINE void GLMContext::SetSamplerTex( int sampler, CGLMTex *tex )
 					m_activeTexture = sampler;
 				}
 
-				gGL->glBindTexture( tex->m_texGLTarget, tex->m_texName );
+				gGL->glBindTexture( target, name );
 			}
 			else
 			{
-				gGL->glBindMultiTextureEXT( GL_TEXTURE0 + sampler, tex->m_texGLTarget, tex->m_texName );
+				gGL->glBindMultiTextureEXT( GL_TEXTURE0 + sampler, target, name );
 			}
 		}
+	}
 	
-	if ( !m_bUseSamplerObjects )
+	if ( !m_bUseSamplerObjects || m_bUseSRGBTextureViews )
 	{
 		SetSamplerDirty( sampler );
 	}
@@ -2239,6 +2533,11 @@ FORCEINLINE void GLMContext::BindIndexBufferToCtx( CGLMBuffer *buff )
 		
 	Assert( !buff || ( buff->m_buffGLTarget == GL_ELEMENT_ARRAY_BUFFER_ARB ) );
 
+	if ( buff && buff->m_nPendingUploadSerial )
+	{
+		FinishBufferUpload( buff );
+	}
+
 	GLuint nGLName = buff ? buff->m_nHandle : 0;
 
 	if ( m_nBoundGLBuffer[ kGLMIndexBuffer] == nGLName )
@@ -2254,6 +2553,11 @@ FORCEINLINE void GLMContext::BindVertexBufferToCtx( CGLMBuffer *buff )
 
 	Assert( !buff || ( buff->m_buffGLTarget == GL_ARRAY_BUFFER_ARB ) );
 
+	if ( buff && buff->m_nPendingUploadSerial )
+	{
+		FinishBufferUpload( buff );
+	}
+
 	GLuint nGLName = buff ? buff->m_nHandle : 0;
 
 	if ( m_nBoundGLBuffer[ kGLMVertexBuffer] == nGLName )
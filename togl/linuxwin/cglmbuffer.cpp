@@ -27,6 +27,14 @@
 //===============================================================================
 
 #include "togl/rendermechanism.h"
+#include "appframework/ilaunchermgr.h"
+
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+#define GL_VERTEX_CONVERT_SSE2	1
+#include <emmintrin.h>
+#else
+#define GL_VERTEX_CONVERT_SSE2	0
+#endif
 
 // memdbgon -must- be the last include file in a .cpp file.
 #include "tier0/memdbgon.h"
@@ -280,6 +288,9 @@ bool CGLMBufferSpanManager::IsValid( uint nOffset, uint nSize ) const
 }
 #endif // GL_ENABLE_INDEX_VERIFICATION
 
+// chunk size used by glBufferSubDataMaxSize() when the caller doesn't pass one - see CGLMBufferSubDataTuner
+uint g_nBufferSubDataChunkSize = 128 * 1024;
+
 // glBufferSubData() with a max size limit, to work around NVidia's threaded driver limits (anything > than roughly 256KB triggers a sync with the server thread).
 void glBufferSubDataMaxSize( GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data, uint nMaxSizePerCall )
 {
@@ -287,6 +298,11 @@ void glBufferSubDataMaxSize( GLenum target, GLintptr offset, GLsizeiptr size, co
 	if ( g_bNullD3DDevice ) return;
 #endif
 
+	if ( !nMaxSizePerCall )
+	{
+		nMaxSizePerCall = g_nBufferSubDataChunkSize;
+	}
+
 	uint nBytesLeft = size;
 	uint nOfs = 0;
 	while ( nBytesLeft )
@@ -300,6 +316,445 @@ void glBufferSubDataMaxSize( GLenum target, GLintptr offset, GLsizeiptr size, co
 	}
 }
 
+//===============================================================================
+
+ConVar gl_subdata_chunk_size( "gl_subdata_chunk_size", "0", 0, "glBufferSubData() chunk size in bytes, 0 = per-driver tuned value (takes effect on context creation)" );
+ConVar gl_subdata_chunk_tuned( "gl_subdata_chunk_tuned", "", FCVAR_ARCHIVE, "Persisted glBufferSubData() chunk size tuning result (driverprovider:deviceid:bytes)" );
+
+static const uint s_nSubDataChunkSizes[ GL_SUBDATA_TUNER_NUM_CHUNK_SIZES ] = 
+{
+	32 * 1024, 64 * 1024, 128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024, 2048 * 1024, GL_SUBDATA_TUNER_UPLOAD_SIZE
+};
+
+CGLMBufferSubDataTuner::CGLMBufferSubDataTuner() :
+	m_pCtx( NULL ),
+	m_nBuffer( 0 ),
+	m_pData( NULL ),
+	m_nFramesToSkip( 0 ),
+	m_nNextTrial( 0 ),
+	m_nTrialsCompleted( 0 )
+{
+	memset( m_Trials, 0, sizeof( m_Trials ) );
+}
+
+CGLMBufferSubDataTuner::~CGLMBufferSubDataTuner()
+{
+	Deinit();
+}
+
+uint CGLMBufferSubDataTuner::GetDefaultChunkSize( GLDriverProvider_t nDriverProvider )
+{
+	// NVidia's threaded driver syncs with its server thread on anything larger than roughly 256KB, the others don't need splitting this fine.
+	return ( nDriverProvider == cGLDriverProviderNVIDIA ) ? ( 128 * 1024 ) : ( 1024 * 1024 );
+}
+
+void CGLMBufferSubDataTuner::Init( GLMContext *pCtx )
+{
+	Deinit();
+
+	g_nBufferSubDataChunkSize = GetDefaultChunkSize( gGL->m_nDriverProvider );
+	if ( gl_subdata_chunk_size.GetInt() > 0 )
+	{
+		g_nBufferSubDataChunkSize = gl_subdata_chunk_size.GetInt();
+	}
+	pCtx->m_caps.m_nBufferSubDataChunkSize = g_nBufferSubDataChunkSize;
+
+	if ( ( gl_subdata_chunk_size.GetInt() > 0 ) || CommandLine()->CheckParm( "-gl_disable_subdata_tuning" ) )
+		return;
+
+#if TOGL_SUPPORT_NULL_DEVICE
+	if ( g_bNullD3DDevice )
+		return;
+#endif
+
+	m_pCtx = pCtx;
+
+	gGL->glGenBuffersARB( 1, &m_nBuffer );
+	gGL->glBindBufferARB( GL_COPY_WRITE_BUFFER, m_nBuffer );
+	gGL->glBufferDataARB( GL_COPY_WRITE_BUFFER, GL_SUBDATA_TUNER_UPLOAD_SIZE, (const GLvoid*)NULL, GL_STATIC_DRAW_ARB );
+	gGL->glBindBufferARB( GL_COPY_WRITE_BUFFER, 0 );
+
+	m_pData = (char*)malloc( GL_SUBDATA_TUNER_UPLOAD_SIZE );
+	for ( uint i = 0; i < GL_SUBDATA_TUNER_UPLOAD_SIZE / sizeof( uint32 ); i++ )
+	{
+		reinterpret_cast< uint32 * >( m_pData )[i] = i * 2654435761U;
+	}
+
+	for ( uint i = 0; i < GL_SUBDATA_TUNER_NUM_CHUNK_SIZES; i++ )
+	{
+		gGL->glGenQueries( 2, m_Trials[i].m_nQueries );
+		m_Trials[i].m_flCPUTime = 0.0;
+		m_Trials[i].m_bPending = false;
+		m_flBestTime[i] = 1e+30;
+	}
+
+	// let loading settle, and give the config a chance to restore gl_subdata_chunk_tuned
+	m_nFramesToSkip = 30;
+	m_nNextTrial = 0;
+	m_nTrialsCompleted = 0;
+}
+
+void CGLMBufferSubDataTuner::Deinit()
+{
+	if ( !m_pCtx )
+		return;
+
+	for ( uint i = 0; i < GL_SUBDATA_TUNER_NUM_CHUNK_SIZES; i++ )
+	{
+		gGL->glDeleteQueries( 2, m_Trials[i].m_nQueries );
+		m_Trials[i].m_bPending = false;
+	}
+
+	gGL->glDeleteBuffersARB( 1, &m_nBuffer );
+	m_nBuffer = 0;
+
+	free( m_pData );
+	m_pData = NULL;
+
+	m_pCtx = NULL;
+}
+
+void CGLMBufferSubDataTuner::Tick()
+{
+	if ( !m_pCtx )
+		return;
+
+	if ( m_nFramesToSkip )
+	{
+		if ( --m_nFramesToSkip )
+			return;
+
+		// already tuned on this driver/device in a previous run?
+		int nDriverProvider = -1;
+		uint nDeviceID = 0, nChunkSize = 0;
+		if ( ( sscanf( gl_subdata_chunk_tuned.GetString(), "%d:%x:%u", &nDriverProvider, &nDeviceID, &nChunkSize ) == 3 ) &&
+			 ( nDriverProvider == gGL->m_nDriverProvider ) && ( nDeviceID == m_pCtx->m_caps.m_pciDeviceID ) && ( nChunkSize ) )
+		{
+			g_nBufferSubDataChunkSize = m_pCtx->m_caps.m_nBufferSubDataChunkSize = nChunkSize;
+			Deinit();
+			return;
+		}
+	}
+
+	const uint nTotalTrials = GL_SUBDATA_TUNER_NUM_CHUNK_SIZES * GL_SUBDATA_TUNER_NUM_ROUNDS;
+
+	for ( uint i = 0; i < GL_SUBDATA_TUNER_NUM_CHUNK_SIZES; i++ )
+	{
+		Trial_t &trial = m_Trials[i];
+		if ( !trial.m_bPending )
+			continue;
+
+		GLint nAvailable = 0;
+		gGL->glGetQueryObjectiv( trial.m_nQueries[1], GL_QUERY_RESULT_AVAILABLE, &nAvailable );
+		if ( !nAvailable )
+			continue;
+
+		GLuint64 nBegin = 0, nEnd = 0;
+		gGL->glGetQueryObjectui64v( trial.m_nQueries[0], GL_QUERY_RESULT, &nBegin );
+		gGL->glGetQueryObjectui64v( trial.m_nQueries[1], GL_QUERY_RESULT, &nEnd );
+
+		// the CPU side catches driver syncs, the GPU side the actual transfer cost
+		double flTime = trial.m_flCPUTime + ( nEnd - nBegin ) * ( 1.0 / 1000000000.0 );
+		m_flBestTime[i] = MIN( m_flBestTime[i], flTime );
+
+		trial.m_bPending = false;
+		m_nTrialsCompleted++;
+	}
+
+	if ( m_nTrialsCompleted == nTotalTrials )
+	{
+		Finish();
+		return;
+	}
+
+	if ( m_nNextTrial < nTotalTrials )
+	{
+		const uint nIndex = m_nNextTrial % GL_SUBDATA_TUNER_NUM_CHUNK_SIZES;
+		Trial_t &trial = m_Trials[nIndex];
+		if ( !trial.m_bPending )
+		{
+			gGL->glBindBufferARB( GL_COPY_WRITE_BUFFER, m_nBuffer );
+			
+			// orphan outside of the timed region so we're not measuring a wait on the previous trial
+			gGL->glBufferDataARB( GL_COPY_WRITE_BUFFER, GL_SUBDATA_TUNER_UPLOAD_SIZE, (const GLvoid*)NULL, GL_STATIC_DRAW_ARB );
+
+			double flStart = Plat_FloatTime();
+			gGL->glQueryCounter( trial.m_nQueries[0], GL_TIMESTAMP );
+			glBufferSubDataMaxSize( GL_COPY_WRITE_BUFFER, 0, GL_SUBDATA_TUNER_UPLOAD_SIZE, m_pData, s_nSubDataChunkSizes[nIndex] );
+			gGL->glQueryCounter( trial.m_nQueries[1], GL_TIMESTAMP );
+			trial.m_flCPUTime = Plat_FloatTime() - flStart;
+
+			gGL->glBindBufferARB( GL_COPY_WRITE_BUFFER, 0 );
+
+			trial.m_bPending = true;
+			m_nNextTrial++;
+		}
+	}
+}
+
+void CGLMBufferSubDataTuner::Finish()
+{
+	uint nBest = 0;
+	for ( uint i = 1; i < GL_SUBDATA_TUNER_NUM_CHUNK_SIZES; i++ )
+	{
+		if ( m_flBestTime[i] < m_flBestTime[nBest] )
+		{
+			nBest = i;
+		}
+	}
+
+	g_nBufferSubDataChunkSize = m_pCtx->m_caps.m_nBufferSubDataChunkSize = s_nSubDataChunkSizes[nBest];
+
+	char buf[256];
+	V_snprintf( buf, sizeof( buf ), "%d:%x:%u", gGL->m_nDriverProvider, m_pCtx->m_caps.m_pciDeviceID, g_nBufferSubDataChunkSize );
+	gl_subdata_chunk_tuned.SetValue( buf );
+
+	V_snprintf( buf, sizeof( buf ), "GL glBufferSubData chunk size: %uKB (%.3fms per %uMB)\n", g_nBufferSubDataChunkSize / 1024, m_flBestTime[nBest] * 1000.0, GL_SUBDATA_TUNER_UPLOAD_SIZE / ( 1024 * 1024 ) );
+	Plat_DebugString( buf );
+
+	Deinit();
+}
+
+//===============================================================================
+
+CGLMBufferUploader::CGLMBufferUploader() :
+	m_pCtx( NULL ),
+	m_hLoaderCtx( NULL ),
+	m_bExit( false ),
+	m_nQueuedBytes( 0 ),
+	m_nCompletedSerial( 0 ),
+	m_nNextSerial( 1 ),
+	m_nRetiredSerial( 0 )
+{
+}
+
+CGLMBufferUploader::~CGLMBufferUploader()
+{
+	Deinit();
+}
+
+bool CGLMBufferUploader::Init( GLMContext *pCtx )
+{
+	Deinit();
+
+	if ( !gGL->m_bHave_GL_ARB_sync )
+		return false;
+
+	m_pCtx = pCtx;
+
+	// creating the extra context makes it current on this thread, so put the render context back afterwards.
+	m_hLoaderCtx = g_pLauncherMgr->CreateExtraContext();
+	g_pLauncherMgr->MakeContextCurrent( m_pCtx->m_ctx );
+	
+	if ( !m_hLoaderCtx )
+	{
+		m_pCtx = NULL;
+		return false;
+	}
+
+	m_bExit = false;
+	m_nQueuedBytes = 0;
+	m_nCompletedSerial = 0;
+	m_nNextSerial = 1;
+	m_nRetiredSerial = 0;
+
+	SetName( "GLMBufferUploader" );
+	if ( !Start() )
+	{
+		g_pLauncherMgr->DeleteContext( m_hLoaderCtx );
+		m_hLoaderCtx = NULL;
+		m_pCtx = NULL;
+		return false;
+	}
+	
+	return true;
+}
+
+void CGLMBufferUploader::Deinit()
+{
+	if ( !m_pCtx )
+		return;
+
+	// the loader drains any remaining jobs before exiting
+	m_bExit = true;
+	m_JobsAvailable.Set();
+	Join();
+
+	FOR_EACH_VEC( m_CompletedUploads, i )
+	{
+		gGL->glDeleteSync( m_CompletedUploads[i].m_hFence );
+	}
+	m_CompletedUploads.Purge();
+	m_PendingJobs.Purge();
+	
+	g_pLauncherMgr->DeleteContext( m_hLoaderCtx );
+	m_hLoaderCtx = NULL;
+	
+	m_pCtx = NULL;
+}
+
+uint CGLMBufferUploader::QueueUpload( CGLMBuffer *pBuf, uint nOffset, uint nSize, bool bOrphan, char *pData )
+{
+	UploadJob_t job;
+	job.m_nSerial = m_nNextSerial++;
+	if ( !m_nNextSerial )
+		m_nNextSerial = 1;		// 0 means "no upload pending"
+	job.m_nHandle = pBuf->m_nHandle;
+	job.m_nGLTarget = pBuf->m_buffGLTarget;
+	job.m_nBufSize = pBuf->m_nSize;
+	job.m_nOffset = nOffset;
+	job.m_nSize = nSize;
+	job.m_bOrphan = bOrphan;
+	job.m_pData = pData;
+	
+	// Orders the upload after anything the render context has already issued against this buffer (creation, earlier draws).
+	// The flush is needed so the loader context can actually see the fence.
+	job.m_hReadyFence = gGL->glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	gGL->glFlush();
+	
+	m_nQueuedBytes += nSize;
+
+	{
+		AUTO_LOCK( m_Mutex );
+		m_PendingJobs.AddToTail( job );
+	}
+	m_JobsAvailable.Set();
+
+	return job.m_nSerial;
+}
+
+void CGLMBufferUploader::WaitForUpload( uint nSerial )
+{
+	if ( (int)( nSerial - m_nRetiredSerial ) <= 0 )
+		return;
+
+	if ( (int)( nSerial - (uint)(int)m_nCompletedSerial ) > 0 )
+	{
+		tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "GLMBufferUploaderStall" );
+
+		while ( (int)( nSerial - (uint)(int)m_nCompletedSerial ) > 0 )
+		{
+			m_UploadCompleted.Wait();
+		}
+	}
+
+	// the loader context processes jobs in order, so a server side wait on the last fence covers all earlier uploads
+	GLsync hFence = 0;
+	{
+		AUTO_LOCK( m_Mutex );
+		while ( m_CompletedUploads.Count() && ( (int)( m_CompletedUploads[0].m_nSerial - nSerial ) <= 0 ) )
+		{
+			if ( hFence )
+			{
+				gGL->glDeleteSync( hFence );
+			}
+			hFence = m_CompletedUploads[0].m_hFence;
+			m_nRetiredSerial = m_CompletedUploads[0].m_nSerial;
+			m_CompletedUploads.Remove( 0 );
+		}
+	}
+
+	if ( hFence )
+	{
+		gGL->glWaitSync( hFence, 0, GL_TIMEOUT_IGNORED );
+		gGL->glDeleteSync( hFence );
+	}
+}
+
+void CGLMBufferUploader::RetireCompletedUploads()
+{
+	// non-blocking, called once per frame to keep the list of outstanding fences short
+	AUTO_LOCK( m_Mutex );
+	while ( m_CompletedUploads.Count() )
+	{
+		GLenum nResult = gGL->glClientWaitSync( m_CompletedUploads[0].m_hFence, 0, 0 );
+		if ( ( nResult != GL_ALREADY_SIGNALED ) && ( nResult != GL_CONDITION_SATISFIED ) )
+			break;
+			
+		gGL->glDeleteSync( m_CompletedUploads[0].m_hFence );
+		m_nRetiredSerial = m_CompletedUploads[0].m_nSerial;
+		m_CompletedUploads.Remove( 0 );
+	}
+}
+
+int CGLMBufferUploader::Run()
+{
+	if ( !g_pLauncherMgr->MakeContextCurrent( m_hLoaderCtx ) )
+	{
+		Assert( 0 );
+		return -1;
+	}
+
+	for ( ;; )
+	{
+		m_JobsAvailable.Wait();
+
+		for ( ;; )
+		{
+			UploadJob_t job;
+			{
+				AUTO_LOCK( m_Mutex );
+				if ( !m_PendingJobs.Count() )
+					break;
+				job = m_PendingJobs[0];
+				m_PendingJobs.Remove( 0 );
+			}
+
+			ProcessJob( job );
+		}
+
+		if ( m_bExit )
+			break;
+	}
+
+	g_pLauncherMgr->MakeContextCurrent( NULL );
+	return 0;
+}
+
+void CGLMBufferUploader::ProcessJob( UploadJob_t &job )
+{
+	tmZone( TELEMETRY_LEVEL2, TMZF_NONE, "GLMBufferUploader::ProcessJob" );
+
+	gGL->glWaitSync( job.m_hReadyFence, 0, GL_TIMEOUT_IGNORED );
+	gGL->glDeleteSync( job.m_hReadyFence );
+
+	gGL->glBindBufferARB( job.m_nGLTarget, job.m_nHandle );
+
+	if ( job.m_bOrphan && !job.m_nOffset && ( job.m_nSize == job.m_nBufSize ) )
+	{
+		gGL->glBufferDataARB( job.m_nGLTarget, job.m_nBufSize, job.m_pData, GL_STATIC_DRAW_ARB );
+	}
+	else
+	{
+		if ( job.m_bOrphan )
+		{
+			gGL->glBufferDataARB( job.m_nGLTarget, job.m_nBufSize, (const GLvoid*)NULL, GL_STATIC_DRAW_ARB );
+		}
+
+		glBufferSubDataMaxSize( job.m_nGLTarget, job.m_nOffset, job.m_nSize, job.m_pData );
+	}
+
+	gGL->glBindBufferARB( job.m_nGLTarget, 0 );
+	
+	CompletedUpload_t completed;
+	completed.m_nSerial = job.m_nSerial;
+	completed.m_hFence = gGL->glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	gGL->glFlush();
+
+	free( job.m_pData );
+	m_nQueuedBytes -= job.m_nSize;
+
+	{
+		AUTO_LOCK( m_Mutex );
+		m_CompletedUploads.AddToTail( completed );
+	}
+
+	m_nCompletedSerial = (int)job.m_nSerial;
+	m_UploadCompleted.Set();
+}
+
+//===============================================================================
+
 CGLMBuffer::CGLMBuffer( GLMContext *pCtx, EGLMBufferType type, uint size, uint options )
 {
 	m_pCtx = pCtx;
@@ -324,6 +779,12 @@ CGLMBuffer::CGLMBuffer( GLMContext *pCtx, EGLMBufferType type, uint size, uint o
 
 	m_pStaticBuffer = NULL;
 	m_nPinnedMemoryOfs = -1;
+	m_nVertexShadowUseCounter = 0;
+	m_pVertexShadowSource = NULL;
+	m_nLockPath = kGLMBufferLockMapRange;
+
+	m_pUploadStagingBuf = NULL;
+	m_nPendingUploadSerial = 0;
 
 	m_bEnableAsyncMap = false;
 	m_bEnableExplicitFlush = false;
@@ -408,6 +869,7 @@ CGLMBuffer::CGLMBuffer( GLMContext *pCtx, EGLMBufferType type, uint size, uint o
 		}
 
 		gGL->glBufferDataARB( m_buffGLTarget, m_nSize, (const GLvoid*)NULL, hint );	// may ultimately need more hints to set the usage correctly (esp for streaming)
+		m_pCtx->m_nResidentBufferBytes += m_nSize;
 
 		SetModes( false, true, true );
 
@@ -418,6 +880,8 @@ CGLMBuffer::CGLMBuffer( GLMContext *pCtx, EGLMBufferType type, uint size, uint o
 CGLMBuffer::~CGLMBuffer( )
 {
 	m_pCtx->CheckCurrent();
+
+	FreeVertexShadows();
 	
 	if ( m_bPseudo )
 	{
@@ -436,6 +900,9 @@ CGLMBuffer::~CGLMBuffer( )
 	else
 	{
 		gGL->glDeleteBuffersARB( 1, &m_nHandle );
+
+		Assert( m_pCtx->m_nResidentBufferBytes >= m_nSize );
+		m_pCtx->m_nResidentBufferBytes -= m_nSize;
 	}
 	
 	m_pCtx = NULL;
@@ -530,6 +997,415 @@ void CGLMBuffer::FlushRange( uint offset, uint size )
 	}
 }
 
+//===============================================================================
+// Vertex element conversion - for D3D decl types GL can't fetch directly.
+// The decl points the attrib at a shadow GL buffer holding just the converted element, one per vertex.
+
+uint CGLMBuffer::GetVertexConversionSrcSize( EGLMVertexConversion nConversion )
+{
+	switch ( nConversion )
+	{
+		case kGLMVertexConvertUDEC3:
+		case kGLMVertexConvertDEC3N:
+		case kGLMVertexConvertHalf2:	return 4;
+		case kGLMVertexConvertHalf4:	return 8;
+		default:						Assert( 0 ); break;
+	}
+	return 0;
+}
+
+uint CGLMBuffer::GetVertexConversionDstSize( EGLMVertexConversion nConversion )
+{
+	switch ( nConversion )
+	{
+		case kGLMVertexConvertUDEC3:
+		case kGLMVertexConvertDEC3N:
+		case kGLMVertexConvertHalf2:	return 8;
+		case kGLMVertexConvertHalf4:	return 16;
+		default:						Assert( 0 ); break;
+	}
+	return 0;
+}
+
+// D3D DEC3N is v/511, GL normalized shorts are (roughly) v/32767
+#define DEC3N_TO_SHORTN_SCALE	( 32767.0f / 511.0f )
+
+static inline float HalfToFloat( uint16 h )
+{
+	union { uint32 n; float f; } result;
+
+	uint32 nSign = ( h & 0x8000 ) << 16;
+	uint32 nExp = ( h >> 10 ) & 0x1F;
+	uint32 nMant = h & 0x3FF;
+
+	if ( nExp == 0x1F )
+	{
+		result.n = nSign | 0x7F800000 | ( nMant << 13 );
+	}
+	else if ( nExp )
+	{
+		result.n = nSign | ( ( nExp + 112 ) << 23 ) | ( nMant << 13 );
+	}
+	else
+	{
+		// zero/denormal
+		result.f = nMant * ( 1.0f / 16777216.0f );
+		result.n |= nSign;
+	}
+
+	return result.f;
+}
+
+static inline int16 Dec3NToShortN( int32 v )
+{
+	int n = (int)floorf( v * DEC3N_TO_SHORTN_SCALE + .5f );
+	return (int16)MAX( -32768, MIN( 32767, n ) );
+}
+
+static void ConvertVertexElementsScalar( EGLMVertexConversion nConversion, uint8 *pDst, const uint8 *pSrc, uint nSrcStride, uint nNumVerts )
+{
+	for ( uint i = 0; i < nNumVerts; i++, pSrc += nSrcStride )
+	{
+		switch ( nConversion )
+		{
+			case kGLMVertexConvertUDEC3:
+			{
+				uint32 v = *reinterpret_cast< const uint32 * >( pSrc );
+				int16 *pOut = reinterpret_cast< int16 * >( pDst );
+				pOut[0] = v & 0x3FF; pOut[1] = ( v >> 10 ) & 0x3FF; pOut[2] = ( v >> 20 ) & 0x3FF; pOut[3] = 1;
+				pDst += 8;
+				break;
+			}
+			case kGLMVertexConvertDEC3N:
+			{
+				int32 v = *reinterpret_cast< const int32 * >( pSrc );
+				int16 *pOut = reinterpret_cast< int16 * >( pDst );
+				pOut[0] = Dec3NToShortN( ( v << 22 ) >> 22 );
+				pOut[1] = Dec3NToShortN( ( v << 12 ) >> 22 );
+				pOut[2] = Dec3NToShortN( ( v << 2 ) >> 22 );
+				pOut[3] = 32767;
+				pDst += 8;
+				break;
+			}
+			case kGLMVertexConvertHalf2:
+			case kGLMVertexConvertHalf4:
+			{
+				const uint nComps = ( nConversion == kGLMVertexConvertHalf2 ) ? 2 : 4;
+				const uint16 *pIn = reinterpret_cast< const uint16 * >( pSrc );
+				float *pOut = reinterpret_cast< float * >( pDst );
+				for ( uint j = 0; j < nComps; j++ )
+				{
+					pOut[j] = HalfToFloat( pIn[j] );
+				}
+				pDst += nComps * sizeof( float );
+				break;
+			}
+			default:
+				Assert( 0 );
+				return;
+		}
+	}
+}
+
+#if GL_VERTEX_CONVERT_SSE2
+
+// interleaves 4 verts worth of x/y/z (32-bit lanes) plus a constant w into 4 x int16 per vert
+static FORCEINLINE void StoreShort4x4( uint8 *pDst, __m128i x, __m128i y, __m128i z, __m128i w )
+{
+	__m128i xz = _mm_packs_epi32( x, z );		// x0 x1 x2 x3 z0 z1 z2 z3
+	__m128i yw = _mm_packs_epi32( y, w );		// y0 y1 y2 y3 w  w  w  w
+	__m128i xy = _mm_unpacklo_epi16( xz, yw );	// x0 y0 x1 y1 x2 y2 x3 y3
+	__m128i zw = _mm_unpackhi_epi16( xz, yw );	// z0 w  z1 w  z2 w  z3 w
+	_mm_storeu_si128( reinterpret_cast< __m128i * >( pDst ), _mm_unpacklo_epi32( xy, zw ) );
+	_mm_storeu_si128( reinterpret_cast< __m128i * >( pDst + 16 ), _mm_unpackhi_epi32( xy, zw ) );
+}
+
+// classic branchless half->float - denormals come out right via the float multiply
+static FORCEINLINE __m128 HalfToFloat4( __m128i h )
+{
+	const __m128i nMaskNoSign = _mm_set1_epi32( 0x7FFF );
+	const __m128 flMagic = _mm_castsi128_ps( _mm_set1_epi32( ( 254 - 15 ) << 23 ) );
+	const __m128i nWasInfNan = _mm_set1_epi32( 0x7BFF );
+	const __m128i nExpInfNan = _mm_set1_epi32( 255 << 23 );
+
+	__m128i nExpMant = _mm_and_si128( nMaskNoSign, h );
+	__m128i nJustSign = _mm_xor_si128( h, nExpMant );
+	__m128 flScaled = _mm_mul_ps( _mm_castsi128_ps( _mm_slli_epi32( nExpMant, 13 ) ), flMagic );
+	__m128i nInfNan = _mm_and_si128( _mm_cmpgt_epi32( nExpMant, nWasInfNan ), nExpInfNan );
+	__m128i nSignInfNan = _mm_or_si128( _mm_slli_epi32( nJustSign, 16 ), nInfNan );
+	return _mm_or_ps( flScaled, _mm_castsi128_ps( nSignInfNan ) );
+}
+
+static void ConvertVertexElements( EGLMVertexConversion nConversion, uint8 *pDst, const uint8 *pSrc, uint nSrcStride, uint nNumVerts )
+{
+	uint nNumVerts4 = nNumVerts & ~3;
+	uint i = 0;
+
+	switch ( nConversion )
+	{
+		case kGLMVertexConvertUDEC3:
+		case kGLMVertexConvertDEC3N:
+		{
+			const bool bSigned = ( nConversion == kGLMVertexConvertDEC3N );
+			const __m128i nMask = _mm_set1_epi32( 0x3FF );
+			const __m128 flScale = _mm_set1_ps( DEC3N_TO_SHORTN_SCALE );
+			const __m128i w = _mm_set1_epi32( bSigned ? 32767 : 1 );
+
+			for ( ; i < nNumVerts4; i += 4, pSrc += nSrcStride * 4, pDst += 32 )
+			{
+				__m128i v = _mm_setr_epi32(
+					*reinterpret_cast< const int32 * >( pSrc ),
+					*reinterpret_cast< const int32 * >( pSrc + nSrcStride ),
+					*reinterpret_cast< const int32 * >( pSrc + nSrcStride * 2 ),
+					*reinterpret_cast< const int32 * >( pSrc + nSrcStride * 3 ) );
+
+				__m128i x, y, z;
+				if ( bSigned )
+				{
+					// sign extend each 10 bit field, then rescale to the short range
+					x = _mm_cvtps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_slli_epi32( v, 22 ), 22 ) ), flScale ) );
+					y = _mm_cvtps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_slli_epi32( v, 12 ), 22 ) ), flScale ) );
+					z = _mm_cvtps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_slli_epi32( v, 2 ), 22 ) ), flScale ) );
+				}
+				else
+				{
+					x = _mm_and_si128( v, nMask );
+					y = _mm_and_si128( _mm_srli_epi32( v, 10 ), nMask );
+					z = _mm_and_si128( _mm_srli_epi32( v, 20 ), nMask );
+				}
+
+				StoreShort4x4( pDst, x, y, z, w );
+			}
+			break;
+		}
+
+		case kGLMVertexConvertHalf2:
+		{
+			const __m128i nZero = _mm_setzero_si128();
+			for ( ; i < nNumVerts4; i += 2, pSrc += nSrcStride * 2, pDst += 16 )
+			{
+				__m128i h = _mm_setr_epi32( *reinterpret_cast< const int32 * >( pSrc ), *reinterpret_cast< const int32 * >( pSrc + nSrcStride ), 0, 0 );
+				_mm_storeu_ps( reinterpret_cast< float * >( pDst ), HalfToFloat4( _mm_unpacklo_epi16( h, nZero ) ) );
+			}
+			break;
+		}
+
+		case kGLMVertexConvertHalf4:
+		{
+			const __m128i nZero = _mm_setzero_si128();
+			for ( ; i < nNumVerts; i++, pSrc += nSrcStride, pDst += 16 )
+			{
+				__m128i h = _mm_loadl_epi64( reinterpret_cast< const __m128i * >( pSrc ) );
+				_mm_storeu_ps( reinterpret_cast< float * >( pDst ), HalfToFloat4( _mm_unpacklo_epi16( h, nZero ) ) );
+			}
+			break;
+		}
+
+		default:
+			Assert( 0 );
+			return;
+	}
+
+	// leftovers
+	ConvertVertexElementsScalar( nConversion, pDst, pSrc, nSrcStride, nNumVerts - i );
+}
+
+#else
+
+static void ConvertVertexElements( EGLMVertexConversion nConversion, uint8 *pDst, const uint8 *pSrc, uint nSrcStride, uint nNumVerts )
+{
+	ConvertVertexElementsScalar( nConversion, pDst, pSrc, nSrcStride, nNumVerts );
+}
+
+#endif // GL_VERTEX_CONVERT_SSE2
+
+static inline int64 FloorDiv( int64 a, int64 b )
+{
+	return ( a >= 0 ) ? ( a / b ) : -( ( -a + b - 1 ) / b );
+}
+
+GLuint CGLMBuffer::GetVertexShadow( uint nBaseOffset, uint nStride, EGLMVertexConversion nConversion, uint *pShadowOffset )
+{
+	Assert( ( m_type == kGLMVertexBuffer ) && !m_bMapped );
+
+	const uint nSrcSize = GetVertexConversionSrcSize( nConversion );
+	const uint nDstSize = GetVertexConversionDstSize( nConversion );
+
+	// stream offsets move in whole vertices, so only the position inside the vertex picks the shadow
+	*pShadowOffset = nStride ? ( nBaseOffset / nStride ) * nDstSize : 0;
+	if ( nStride )
+	{
+		nBaseOffset %= nStride;
+	}
+
+	GLMVertexShadow_t *pShadow = NULL;
+	for ( int i = 0; i < m_VertexShadows.Count(); i++ )
+	{
+		GLMVertexShadow_t &shadow = m_VertexShadows[i];
+		if ( ( shadow.m_nBaseOffset == nBaseOffset ) && ( shadow.m_nStride == nStride ) && ( shadow.m_nConversion == nConversion ) )
+		{
+			shadow.m_nLastUse = ++m_nVertexShadowUseCounter;
+			if ( shadow.m_nRevision == m_nRevision )
+				return shadow.m_nHandle;
+
+			pShadow = &shadow;
+			break;
+		}
+	}
+
+	if ( !pShadow )
+	{
+		if ( m_VertexShadows.Count() >= GL_MAX_VERTEX_SHADOWS )
+		{
+			int nOldest = 0;
+			for ( int i = 1; i < m_VertexShadows.Count(); i++ )
+			{
+				if ( m_VertexShadows[i].m_nLastUse < m_VertexShadows[nOldest].m_nLastUse )
+					nOldest = i;
+			}
+			GLuint nHandle = m_VertexShadows[nOldest].m_nHandle;
+			if ( m_pCtx->m_nBoundGLBuffer[kGLMVertexBuffer] == nHandle )
+			{
+				// GL unbinds it, and the name can come straight back from glGenBuffers
+				m_pCtx->m_nBoundGLBuffer[kGLMVertexBuffer] = 0xFFFFFFFF;
+			}
+			gGL->glDeleteBuffersARB( 1, &nHandle );
+			m_VertexShadows.FastRemove( nOldest );
+		}
+
+		pShadow = &m_VertexShadows[ m_VertexShadows.AddToTail() ];
+		pShadow->m_nLastUse = ++m_nVertexShadowUseCounter;
+		pShadow->m_nBaseOffset = nBaseOffset;
+		pShadow->m_nStride = nStride;
+		pShadow->m_nConversion = nConversion;
+		if ( nBaseOffset + nSrcSize > m_nSize )
+			pShadow->m_nNumVerts = 0;
+		else
+			pShadow->m_nNumVerts = nStride ? ( ( m_nSize - nBaseOffset - nSrcSize ) / nStride + 1 ) : 1;
+
+		gGL->glGenBuffersARB( 1, &pShadow->m_nHandle );
+	}
+
+	// first use or the write in Unlock only covered part of an element, so convert from the CPU copy.
+	// the first shadow on a buffer pulls the whole thing back from GL once, after that every Unlock keeps the copy current.
+	const uint nNumVerts = pShadow->m_nNumVerts;
+	uint8 *pDst = (uint8 *)malloc( MAX( 1, nNumVerts ) * nDstSize );
+	if ( nNumVerts )
+	{
+		if ( !m_bPseudo && !m_pVertexShadowSource )
+		{
+			m_pVertexShadowSource = (char *)malloc( m_nSize );
+
+			gGL->glBindBufferARB( GL_COPY_READ_BUFFER, m_nHandle );
+			gGL->glGetBufferSubData( GL_COPY_READ_BUFFER, 0, m_nSize, m_pVertexShadowSource );
+			gGL->glBindBufferARB( GL_COPY_READ_BUFFER, 0 );
+		}
+
+		const char *pSource = m_bPseudo ? m_pPseudoBuf : m_pVertexShadowSource;
+		ConvertVertexElements( nConversion, pDst, reinterpret_cast< const uint8 * >( pSource ) + nBaseOffset, nStride, nNumVerts );
+
+		m_pCtx->GetCurBufferFrameStats().m_nVertexConvertBytes += nNumVerts * nDstSize;
+	}
+	else
+	{
+		memset( pDst, 0, nDstSize );
+	}
+
+	gGL->glBindBufferARB( GL_COPY_WRITE_BUFFER, pShadow->m_nHandle );
+	gGL->glBufferDataARB( GL_COPY_WRITE_BUFFER, MAX( 1, nNumVerts ) * nDstSize, pDst, m_bDynamic ? GL_DYNAMIC_DRAW_ARB : GL_STATIC_DRAW_ARB );
+	gGL->glBindBufferARB( GL_COPY_WRITE_BUFFER, 0 );
+
+	free( pDst );
+
+	pShadow->m_nRevision = m_nRevision;
+
+	return pShadow->m_nHandle;
+}
+
+// Called from Unlock (after the revision bump) on the paths where the written data is still in RAM.
+// Shadows are converted in place for the written vertex range, anything we can't do cleanly is left stale for GetVertexShadow().
+void CGLMBuffer::UpdateVertexShadows( uint nOffset, uint nSize, const void *pData, bool bDiscard )
+{
+	if ( m_pVertexShadowSource && ( pData != m_pVertexShadowSource + nOffset ) )
+	{
+		memcpy( m_pVertexShadowSource + nOffset, pData, nSize );
+	}
+
+	for ( int i = 0; i < m_VertexShadows.Count(); i++ )
+	{
+		GLMVertexShadow_t &shadow = m_VertexShadows[i];
+
+		// after a discard nothing outside the written range is defined anyway
+		if ( ( shadow.m_nRevision != m_nRevision - 1 ) && !bDiscard )
+			continue;
+
+		const int64 nSrcSize = GetVertexConversionSrcSize( shadow.m_nConversion );
+		const int64 nStride = shadow.m_nStride;
+		const int64 nLastVert = (int64)shadow.m_nNumVerts - 1;
+
+		// write range relative to vertex 0's element
+		const int64 nRel = (int64)nOffset - shadow.m_nBaseOffset;
+		const int64 nRelEnd = nRel + nSize;
+
+		int64 nFirstTouched, nLastTouched, nFirstContained, nLastContained;
+		if ( nStride )
+		{
+			nFirstTouched = MAX( 0, FloorDiv( nRel - nSrcSize, nStride ) + 1 );
+			nLastTouched = MIN( nLastVert, FloorDiv( nRelEnd - 1, nStride ) );
+			nFirstContained = MAX( 0, -FloorDiv( -nRel, nStride ) );
+			nLastContained = MIN( nLastVert, FloorDiv( nRelEnd - nSrcSize, nStride ) );
+		}
+		else
+		{
+			nFirstTouched = nFirstContained = 0;
+			nLastTouched = ( ( nRel < nSrcSize ) && ( nRelEnd > 0 ) ) ? nLastVert : -1;
+			nLastContained = ( ( nRel <= 0 ) && ( nRelEnd >= nSrcSize ) ) ? nLastVert : -1;
+		}
+
+		if ( nFirstTouched > nLastTouched )
+		{
+			// write didn't hit this element
+			shadow.m_nRevision = m_nRevision;
+			continue;
+		}
+
+		if ( ( nFirstTouched != nFirstContained ) || ( nLastTouched != nLastContained ) )
+		{
+			// partial element write - convert from the CPU copy at draw time
+			continue;
+		}
+
+		const uint nDstSize = GetVertexConversionDstSize( shadow.m_nConversion );
+		const uint nNumVerts = (uint)( nLastTouched - nFirstTouched + 1 );
+		const uint8 *pSrc = static_cast< const uint8 * >( pData ) + ( shadow.m_nBaseOffset + nFirstTouched * nStride - nOffset );
+
+		uint8 *pDst = (uint8 *)malloc( nNumVerts * nDstSize );
+		ConvertVertexElements( shadow.m_nConversion, pDst, pSrc, shadow.m_nStride, nNumVerts );
+
+		gGL->glBindBufferARB( GL_COPY_WRITE_BUFFER, shadow.m_nHandle );
+		glBufferSubDataMaxSize( GL_COPY_WRITE_BUFFER, nFirstTouched * nDstSize, nNumVerts * nDstSize, pDst );
+		gGL->glBindBufferARB( GL_COPY_WRITE_BUFFER, 0 );
+
+		free( pDst );
+
+		m_pCtx->GetCurBufferFrameStats().m_nVertexConvertBytes += nNumVerts * nDstSize;
+
+		shadow.m_nRevision = m_nRevision;
+	}
+}
+
+void CGLMBuffer::FreeVertexShadows()
+{
+	for ( int i = 0; i < m_VertexShadows.Count(); i++ )
+	{
+		gGL->glDeleteBuffersARB( 1, &m_VertexShadows[i].m_nHandle );
+	}
+	m_VertexShadows.Purge();
+
+	free( m_pVertexShadowSource );
+	m_pVertexShadowSource = NULL;
+}
+
 void CGLMBuffer::Lock( GLMBuffLockParams *pParams, char **pAddressOut )
 {
 #if GL_TELEMETRY_GPU_ZONES
@@ -574,6 +1450,8 @@ void CGLMBuffer::Lock( GLMBuffLockParams *pParams, char **pAddressOut )
 	
 	if ( m_bPseudo )
 	{
+		m_nLockPath = kGLMBufferLockPseudo;
+
 		if ( pParams->m_bDiscard )
 		{
 			m_nRevision++;
@@ -621,6 +1499,8 @@ void CGLMBuffer::Lock( GLMBuffLockParams *pParams, char **pAddressOut )
 	}
 	else if ( m_bDynamic && gGL->m_bHave_GL_AMD_pinned_memory && ( m_pCtx->GetCurPinnedMemoryBuffer()->GetBytesRemaining() >= pParams->m_nSize ) )
 	{
+		m_nLockPath = kGLMBufferLockPinnedMemory;
+
 		if ( pParams->m_bDiscard )
 		{
 			m_nRevision++;
@@ -637,8 +1517,25 @@ void CGLMBuffer::Lock( GLMBuffLockParams *pParams, char **pAddressOut )
 		
 		pTempBuffer->Append( pParams->m_nSize );
 	}
+	else if ( m_pCtx->m_pBufferUploader && !m_bDynamic && ( ( m_type == kGLMVertexBuffer ) || ( m_type == kGLMIndexBuffer ) ) && m_pCtx->m_pBufferUploader->CanQueue( pParams->m_nSize ) &&
+		( pParams->m_bDiscard || ( ( pParams->m_nOffset == 0 ) && ( pParams->m_nSize == m_nSize ) ) ) )
+	{
+		// static buffer: stage the data in RAM and let the loader thread upload it at Unlock time.
+		// the staging buffer starts out uninitialized, so only for locks that replace the whole thing - partial locks
+		// keep going through the paths below, which see the current contents (binding waits for any queued upload)
+		m_nLockPath = kGLMBufferLockAsyncUpload;
+
+		m_pUploadStagingBuf = (char*)malloc( pParams->m_nSize );
+
+		m_dirtyMinOffset = pParams->m_nOffset;
+		m_dirtyMaxOffset = pParams->m_nOffset + pParams->m_nSize;
+
+		resultPtr = m_pUploadStagingBuf;
+	}
 	else if ( !g_bDisableStaticBuffer && ( pParams->m_bDiscard || pParams->m_bNoOverwrite ) && ( pParams->m_nSize <= GL_STATIC_BUFFER_SIZE ) )
 	{
+		m_nLockPath = kGLMBufferLockStaticBuffer;
+
 #if TOGL_SUPPORT_NULL_DEVICE
 		if ( !g_bNullD3DDevice )
 #endif
@@ -682,6 +1579,8 @@ void CGLMBuffer::Lock( GLMBuffLockParams *pParams, char **pAddressOut )
 	}
 	else
 	{
+		m_nLockPath = kGLMBufferLockMapRange;
+
 		// bind (yes, even for pseudo - this binds name 0)
 		m_pCtx->BindBufferToCtx( m_type, this );
 
@@ -708,14 +1607,14 @@ void CGLMBuffer::Lock( GLMBuffLockParams *pParams, char **pAddressOut )
 			// m_bEnableAsyncMap is actually pParams->m_bNoOverwrite
 			GLbitfield parms = GL_MAP_WRITE_BIT | ( m_bEnableAsyncMap ? GL_MAP_UNSYNCHRONIZED_BIT : 0 ) | ( pParams->m_bDiscard ? GL_MAP_INVALIDATE_BUFFER_BIT : 0 ) | ( m_bEnableExplicitFlush ? GL_MAP_FLUSH_EXPLICIT_BIT : 0 );
 
-#ifdef REPORT_LOCK_TIME
 			double flStart = Plat_FloatTime();
-#endif
 
 			mapPtr = (char*)gGL->glMapBufferRange( m_buffGLTarget, pParams->m_nOffset, pParams->m_nSize, parms);
 
-#ifdef REPORT_LOCK_TIME
 			double flEnd = Plat_FloatTime();
+			m_pCtx->GetCurBufferFrameStats().m_flMapStallTime += flEnd - flStart;
+
+#ifdef REPORT_LOCK_TIME
 			if ( flEnd - flStart > 5.0 / 1000.0 )
 			{
 				int nDelta = ( int )( ( flEnd - flStart ) * 1000 );
@@ -750,7 +1649,9 @@ void CGLMBuffer::Lock( GLMBuffLockParams *pParams, char **pAddressOut )
 		}
 		else
 		{
+			double flStart = Plat_FloatTime();
 			mapPtr = (char*)gGL->glMapBufferARB( m_buffGLTarget, GL_WRITE_ONLY_ARB );
+			m_pCtx->GetCurBufferFrameStats().m_flMapStallTime += Plat_FloatTime() - flStart;
 		}
 
 		Assert( mapPtr );
@@ -770,6 +1671,12 @@ void CGLMBuffer::Lock( GLMBuffLockParams *pParams, char **pAddressOut )
 	m_bMapped = true;
 
 	m_pLastMappedAddress = (float*)resultPtr;
+
+	// a shadowed buffer on the map path is written through its CPU copy (readable, and current), Unlock moves it into the mapping
+	if ( ( m_nLockPath == kGLMBufferLockMapRange ) && m_pVertexShadowSource )
+	{
+		resultPtr = m_pVertexShadowSource + pParams->m_nOffset;
+	}
 	
 	*pAddressOut = resultPtr;
 }
@@ -888,6 +1795,25 @@ void CGLMBuffer::Unlock( int nActualSize, const void *pActualData )
 		g_nTotalVBLockBytes += nActualSize;
 #endif
 
+	{
+		GLMBufferFrameStats_t &frameStats = m_pCtx->GetCurBufferFrameStats();
+		frameStats.m_nLocks[ m_nLockPath ]++;
+		frameStats.m_nLockBytes[ m_nLockPath ] += nActualSize;
+		if ( m_type == kGLMIndexBuffer )
+			frameStats.m_nIBLockBytes += nActualSize;
+		else if ( m_type == kGLMVertexBuffer )
+			frameStats.m_nVBLockBytes += nActualSize;
+		if ( m_LockParams.m_bDiscard )
+			frameStats.m_nOrphans++;
+	}
+
+	// any write makes converted vertex shadows stale, the RAM backed paths below bring them back up to date in place
+	const bool bUpdateVertexShadows = ( m_VertexShadows.Count() > 0 ) && ( nActualSize > 0 );
+	if ( bUpdateVertexShadows )
+	{
+		m_nRevision++;
+	}
+
 	if ( m_nPinnedMemoryOfs >= 0 )
 	{
 #if TOGL_SUPPORT_NULL_DEVICE
@@ -906,12 +1832,47 @@ void CGLMBuffer::Unlock( int nActualSize, const void *pActualData )
 				nActualSize );
 		}
 
+		// pinned memory is plain cached RAM, convert straight out of it
+		if ( bUpdateVertexShadows )
+		{
+			UpdateVertexShadows( m_dirtyMinOffset, nActualSize, m_pLastMappedAddress, m_LockParams.m_bDiscard );
+		}
+
 #if TOGL_SUPPORT_NULL_DEVICE
 		}
 #endif
 		
 		m_nPinnedMemoryOfs = -1;
 	}
+	else if ( m_pUploadStagingBuf )
+	{
+		if ( nActualSize )
+		{
+			if ( pActualData )
+			{
+				memcpy( m_pUploadStagingBuf, pActualData, nActualSize );
+			}
+
+			if ( bUpdateVertexShadows )
+			{
+				UpdateVertexShadows( m_dirtyMinOffset, nActualSize, m_pUploadStagingBuf, m_LockParams.m_bDiscard );
+			}
+
+			if ( !m_nPendingUploadSerial )
+			{
+				m_pCtx->m_nNumPendingBufferUploads++;
+			}
+
+			// the loader thread frees the staging buffer
+			m_nPendingUploadSerial = m_pCtx->m_pBufferUploader->QueueUpload( this, m_dirtyMinOffset, nActualSize, m_LockParams.m_bDiscard, m_pUploadStagingBuf );
+		}
+		else
+		{
+			free( m_pUploadStagingBuf );
+		}
+
+		m_pUploadStagingBuf = NULL;
+	}
 	else if ( m_pStaticBuffer )
 	{
 #if TOGL_SUPPORT_NULL_DEVICE
@@ -930,6 +1891,11 @@ void CGLMBuffer::Unlock( int nActualSize, const void *pActualData )
 				Assert( nActualSize <= (int)( m_dirtyMaxOffset - m_dirtyMinOffset ) );
 
 				glBufferSubDataMaxSize( m_buffGLTarget, m_dirtyMinOffset, nActualSize, pActualData ? pActualData : m_pStaticBuffer );
+
+				if ( bUpdateVertexShadows )
+				{
+					UpdateVertexShadows( m_dirtyMinOffset, nActualSize, pActualData ? pActualData : m_pStaticBuffer, m_LockParams.m_bDiscard );
+				}
 						
 		#ifdef REPORT_LOCK_TIME
 				double flEnd = Plat_FloatTime();
@@ -955,6 +1921,11 @@ void CGLMBuffer::Unlock( int nActualSize, const void *pActualData )
 			memcpy( m_pLastMappedAddress, pActualData, nActualSize );
 		}
 
+		if ( bUpdateVertexShadows )
+		{
+			UpdateVertexShadows( m_LockParams.m_nOffset, nActualSize, m_pLastMappedAddress, m_LockParams.m_bDiscard );
+		}
+
 #if GL_ENABLE_UNLOCK_BUFFER_OVERWRITE_DETECTION
 		uint nProtectOfs = m_LockParams.m_nOffset & 4095;
 		uint nProtectEnd = ( m_LockParams.m_nOffset + m_LockParams.m_nSize + 4095 ) & ~4095;
@@ -972,9 +1943,16 @@ void CGLMBuffer::Unlock( int nActualSize, const void *pActualData )
 	{
 		tmZone( TELEMETRY_LEVEL2, TMZF_NONE, "UnlockUnmap" );
 
-		if ( pActualData )
+		const char *pWritten = pActualData ? (const char *)pActualData : ( m_pVertexShadowSource ? m_pVertexShadowSource + m_dirtyMinOffset : NULL );
+		if ( pWritten )
 		{
-			memcpy( m_pLastMappedAddress, pActualData, nActualSize );
+			memcpy( m_pLastMappedAddress, pWritten, nActualSize );
+		}
+
+		// never from the mapping, it's write-only (and write combined)
+		if ( bUpdateVertexShadows && pWritten )
+		{
+			UpdateVertexShadows( m_dirtyMinOffset, nActualSize, pWritten, m_LockParams.m_bDiscard );
 		}
 
 		m_pCtx->BindBufferToCtx( m_type, this );
@@ -990,14 +1968,14 @@ void CGLMBuffer::Unlock( int nActualSize, const void *pActualData )
 		// clear dirty range no matter what
 		m_dirtyMinOffset = m_dirtyMaxOffset = 0;								// adjust/grow on lock, clear on unlock
 
-#ifdef REPORT_LOCK_TIME
 		double flStart = Plat_FloatTime();
-#endif
 
 		gGL->glUnmapBuffer( m_buffGLTarget );
 
-#ifdef REPORT_LOCK_TIME
 		double flEnd = Plat_FloatTime();
+		m_pCtx->GetCurBufferFrameStats().m_flMapStallTime += flEnd - flStart;
+
+#ifdef REPORT_LOCK_TIME
 		if ( flEnd - flStart > 5.0 / 1000.0 )
 		{
 			int nDelta = ( int )( ( flEnd - flStart ) * 1000 );
@@ -39,6 +39,7 @@ CGLMFBO::CGLMFBO( GLMContext *ctx )
 	gGL->glGenFramebuffersEXT( 1, &m_name );
 	
 	memset( m_attach, 0, sizeof( m_attach ) );
+	m_nRBOAttachMask = 0;
 }
 
 
@@ -116,6 +117,8 @@ void	CGLMFBO::TexAttach( GLMFBOTexAttachParams *params, EGLMFBOAttachment attach
 		// andif they pass NULL to us, then we are done.
 		return;
 	}
+
+	tex->EnsureGLTexture();
 	
 	GLMTexLayout	*layout = tex->m_layout;
 
@@ -151,7 +154,7 @@ void	CGLMFBO::TexAttach( GLMFBOTexAttachParams *params, EGLMFBOAttachment attach
 				
 			if (useRBO)
 			{
-				// MSAA path - attach the RBO, not the texture, and mark the RBO dirty
+				// MSAA path - attach the RBO, not the texture. it gets damaged as draws and clears land (GLMContext::DamageDrawingFBO)
 				if (attachIndexGL==GL_DEPTH_STENCIL_ATTACHMENT_EXT)
 				{
 					// you have to attach it both places...
@@ -177,7 +180,7 @@ void	CGLMFBO::TexAttach( GLMFBOTexAttachParams *params, EGLMFBOAttachment attach
 					
 					gGL->glBindRenderbufferEXT( GL_RENDERBUFFER_EXT, 0 );
 				}
-				tex->ForceRBODirty();
+				m_nRBOAttachMask |= 1 << attachIndex;
 			}
 			else
 			{
@@ -297,6 +300,7 @@ void	CGLMFBO::TexDetach( EGLMFBOAttachment attachIndex, GLenum fboBindPoint )
 		
 		// un-log the attached tex
 		memset( &m_attach[ attachIndex ], 0, sizeof( m_attach[0] ) );
+		m_nRBOAttachMask &= ~( 1 << attachIndex );
 		
 		// drop the RT attach count
 		tex->m_rtAttachCount--;
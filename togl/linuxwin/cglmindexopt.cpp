@@ -0,0 +1,650 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//                       TOGL CODE LICENSE
+//
+//  Copyright 2011-2014 Valve Corporation
+//  All Rights Reserved.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+// cglmindexopt.cpp
+//
+//===============================================================================
+
+#include "togl/rendermechanism.h"
+
+// memdbgon -must- be the last include file in a .cpp file.
+#include "tier0/memdbgon.h"
+
+//===============================================================================
+
+bool GLMIndexOptKey_t::LessFunc( const GLMIndexOptKey_t &lhs, const GLMIndexOptKey_t &rhs )
+{
+	if ( lhs.m_nCount != rhs.m_nCount )
+		return lhs.m_nCount < rhs.m_nCount;
+	if ( lhs.m_nOp != rhs.m_nOp )
+		return lhs.m_nOp < rhs.m_nOp;
+	return memcmp( lhs.m_digest, rhs.m_digest, sizeof( lhs.m_digest ) ) < 0;
+}
+
+//===============================================================================
+
+CGLMIndexOptimizer::CGLMIndexOptimizer() :
+	m_bExit( false ),
+	m_bRunning( false ),
+	m_Cache( GLMIndexOptKey_t::LessFunc ),
+	m_nCacheBytes( 0 )
+{
+}
+
+CGLMIndexOptimizer::~CGLMIndexOptimizer()
+{
+	Deinit();
+}
+
+bool CGLMIndexOptimizer::Init()
+{
+	Deinit();
+
+	m_bExit = false;
+
+	SetName( "GLMIndexOptimizer" );
+	if ( !Start() )
+		return false;
+
+	m_bRunning = true;
+	return true;
+}
+
+void CGLMIndexOptimizer::Deinit()
+{
+	if ( m_bRunning )
+	{
+		// don't bother finishing queued work
+		{
+			AUTO_LOCK( m_Mutex );
+			m_PendingJobs.RemoveAll();
+		}
+
+		m_bExit = true;
+		m_JobsAvailable.Set();
+		Join();
+
+		m_bRunning = false;
+	}
+
+	m_CacheOrder.PurgeAndDeleteElements();
+	m_Cache.RemoveAll();
+	m_nCacheBytes = 0;
+}
+
+void CGLMIndexOptimizer::ComputeKey( GLMIndexOptKey_t *pKey, EGLMIndexOp nOp, const uint16 *pIndices, uint nCount )
+{
+	MD5Context_t md5ctx;
+	MD5Init( &md5ctx );
+	MD5Update( &md5ctx, (const unsigned char *)pIndices, nCount * sizeof( uint16 ) );
+	MD5Final( pKey->m_digest, &md5ctx );
+
+	pKey->m_nCount = nCount;
+	pKey->m_nOp = nOp;
+}
+
+const CUtlVector<uint16> *CGLMIndexOptimizer::GetResult( const GLMIndexOptKey_t &key, const uint16 *pIndices )
+{
+	if ( !m_bRunning )
+		return NULL;
+
+	int i = m_Cache.Find( key );
+	if ( i != m_Cache.InvalidIndex() )
+	{
+		Entry_t *pEntry = m_Cache[i];
+		return pEntry->m_bDone ? &pEntry->m_Result : NULL;
+	}
+
+	Entry_t *pEntry = new Entry_t;
+	pEntry->m_key = key;
+	pEntry->m_Src.CopyArray( pIndices, key.m_nCount );
+	pEntry->m_bDone = 0;
+
+	m_Cache.Insert( key, pEntry );
+	m_CacheOrder.AddToTail( pEntry );
+	m_nCacheBytes += key.m_nCount * sizeof( uint16 );
+
+	{
+		AUTO_LOCK( m_Mutex );
+		m_PendingJobs.AddToTail( pEntry );
+	}
+	m_JobsAvailable.Set();
+
+	EvictEntries();
+
+	return NULL;
+}
+
+void CGLMIndexOptimizer::EvictEntries()
+{
+	// oldest first, but never anything the worker may still be looking at
+	while ( ( m_nCacheBytes > GL_INDEX_OPT_MAX_CACHE_BYTES ) && m_CacheOrder.Count() && m_CacheOrder[0]->m_bDone )
+	{
+		Entry_t *pEntry = m_CacheOrder[0];
+		m_CacheOrder.Remove( 0 );
+		m_Cache.Remove( pEntry->m_key );
+		m_nCacheBytes -= pEntry->m_key.m_nCount * sizeof( uint16 );
+		delete pEntry;
+	}
+}
+
+int CGLMIndexOptimizer::Run()
+{
+	for ( ;; )
+	{
+		m_JobsAvailable.Wait();
+
+		for ( ;; )
+		{
+			Entry_t *pEntry;
+			{
+				AUTO_LOCK( m_Mutex );
+				if ( !m_PendingJobs.Count() )
+					break;
+				pEntry = m_PendingJobs[0];
+				m_PendingJobs.Remove( 0 );
+			}
+
+			ProcessJob( pEntry );
+		}
+
+		if ( m_bExit )
+			break;
+	}
+
+	return 0;
+}
+
+void CGLMIndexOptimizer::ProcessJob( Entry_t *pEntry )
+{
+	const uint nCount = pEntry->m_key.m_nCount;
+
+	switch ( pEntry->m_key.m_nOp )
+	{
+		case kGLMIndexOpReorderTriList:
+			pEntry->m_Result.SetCount( nCount );
+			ReorderTriListForsyth( pEntry->m_Result.Base(), pEntry->m_Src.Base(), nCount );
+			break;
+
+		case kGLMIndexOpStripRestart:
+			// may come back empty, meaning leave it alone
+			ConvertStripToRestart( pEntry->m_Result, pEntry->m_Src.Base(), nCount );
+			break;
+
+		default:
+			Assert( 0 );
+			pEntry->m_Result.SetCount( 0 );
+			break;
+	}
+
+	pEntry->m_Src.Purge();
+
+	// the render thread reads m_Result as soon as it sees this
+	ThreadMemoryBarrier();
+	pEntry->m_bDone = 1;
+}
+
+//===============================================================================
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation" - greedily emits the best scoring triangle touching the modelled
+// LRU cache, vertices score higher the more recently they were used and the fewer unemitted triangles they have left.
+
+static inline float ForsythVertexScore( int nCachePos, int nNumActiveTris )
+{
+	if ( !nNumActiveTris )
+		return -1.0f;
+
+	float flScore = 0.0f;
+	if ( nCachePos >= 0 )
+	{
+		// the last triangle's verts get a fixed score, so it doesn't matter which order they went in
+		if ( nCachePos < 3 )
+			flScore = 0.75f;
+		else
+			flScore = powf( 1.0f - ( nCachePos - 3 ) * ( 1.0f / ( GL_INDEX_OPT_VCACHE_SIZE - 3 ) ), 1.5f );
+	}
+
+	// bonus for verts with few triangles left, so we don't leave lone triangles behind
+	return flScore + 2.0f / sqrtf( (float)nNumActiveTris );
+}
+
+void CGLMIndexOptimizer::ReorderTriListForsyth( uint16 *pDst, const uint16 *pSrc, uint nNumIndices )
+{
+	const int nNumTris = nNumIndices / 3;
+
+	// anything past the last whole triangle goes through untouched
+	memcpy( pDst + nNumTris * 3, pSrc + nNumTris * 3, ( nNumIndices - nNumTris * 3 ) * sizeof( uint16 ) );
+	if ( !nNumTris )
+		return;
+
+	uint nMinIndex = 0xFFFF, nMaxIndex = 0;
+	for ( int i = 0; i < nNumTris * 3; i++ )
+	{
+		nMinIndex = MIN( nMinIndex, pSrc[i] );
+		nMaxIndex = MAX( nMaxIndex, pSrc[i] );
+	}
+	const int nNumVerts = nMaxIndex - nMinIndex + 1;
+
+	// per vertex lists of triangles not emitted yet
+	CUtlVector<int> vertNumActiveTris, vertFirstTri, vertTris, vertCachePos;
+	CUtlVector<float> vertScore;
+	vertNumActiveTris.SetCount( nNumVerts );
+	vertFirstTri.SetCount( nNumVerts );
+	vertTris.SetCount( nNumTris * 3 );
+	vertCachePos.SetCount( nNumVerts );
+	vertScore.SetCount( nNumVerts );
+
+	memset( vertNumActiveTris.Base(), 0, nNumVerts * sizeof( int ) );
+	for ( int i = 0; i < nNumTris * 3; i++ )
+	{
+		vertNumActiveTris[ pSrc[i] - nMinIndex ]++;
+	}
+
+	int nOfs = 0;
+	for ( int v = 0; v < nNumVerts; v++ )
+	{
+		vertFirstTri[v] = nOfs;
+		nOfs += vertNumActiveTris[v];
+		vertNumActiveTris[v] = 0;
+	}
+
+	for ( int i = 0; i < nNumTris * 3; i++ )
+	{
+		int v = pSrc[i] - nMinIndex;
+		vertTris[ vertFirstTri[v] + vertNumActiveTris[v]++ ] = i / 3;
+	}
+
+	for ( int v = 0; v < nNumVerts; v++ )
+	{
+		vertCachePos[v] = -1;
+		vertScore[v] = ForsythVertexScore( -1, vertNumActiveTris[v] );
+	}
+
+	CUtlVector<uint8> triAdded;
+	triAdded.SetCount( nNumTris );
+	memset( triAdded.Base(), 0, nNumTris );
+
+	int cache[ GL_INDEX_OPT_VCACHE_SIZE + 3 ];
+	int nCacheCount = 0;
+
+	int nBestTri = -1;
+	int nNextUnadded = 0;
+
+	for ( int nOut = 0; nOut < nNumTris; nOut++ )
+	{
+		if ( nBestTri < 0 )
+		{
+			// nothing left touching the cache (new island), just take the next triangle in the original order
+			while ( triAdded[ nNextUnadded ] )
+				nNextUnadded++;
+			nBestTri = nNextUnadded;
+		}
+
+		const int t = nBestTri;
+		triAdded[t] = 1;
+
+		int newCache[ GL_INDEX_OPT_VCACHE_SIZE + 3 ];
+		int nNewCount = 0;
+
+		for ( int k = 0; k < 3; k++ )
+		{
+			pDst[ nOut * 3 + k ] = pSrc[ t * 3 + k ];
+
+			const int v = pSrc[ t * 3 + k ] - nMinIndex;
+
+			int *pTris = &vertTris[ vertFirstTri[v] ];
+			int nNumActive = vertNumActiveTris[v];
+			for ( int j = 0; j < nNumActive; j++ )
+			{
+				if ( pTris[j] == t )
+				{
+					pTris[j] = pTris[ nNumActive - 1 ];
+					break;
+				}
+			}
+			vertNumActiveTris[v] = nNumActive - 1;
+
+			bool bInCache = false;
+			for ( int j = 0; j < nNewCount; j++ )
+				bInCache |= ( newCache[j] == v );
+			if ( !bInCache )
+				newCache[ nNewCount++ ] = v;
+		}
+
+		// the rest of the old cache goes behind this triangle's verts
+		const int nTriVerts = nNewCount;
+		for ( int i = 0; i < nCacheCount; i++ )
+		{
+			const int v = cache[i];
+
+			bool bInTri = false;
+			for ( int j = 0; j < nTriVerts; j++ )
+				bInTri |= ( newCache[j] == v );
+			if ( !bInTri )
+				newCache[ nNewCount++ ] = v;
+		}
+
+		// whatever got pushed out drops back to a no-cache score
+		for ( int i = GL_INDEX_OPT_VCACHE_SIZE; i < nNewCount; i++ )
+		{
+			const int v = newCache[i];
+			vertCachePos[v] = -1;
+			vertScore[v] = ForsythVertexScore( -1, vertNumActiveTris[v] );
+		}
+
+		nCacheCount = MIN( nNewCount, GL_INDEX_OPT_VCACHE_SIZE );
+		for ( int i = 0; i < nCacheCount; i++ )
+		{
+			const int v = newCache[i];
+			cache[i] = v;
+			vertCachePos[v] = i;
+			vertScore[v] = ForsythVertexScore( i, vertNumActiveTris[v] );
+		}
+
+		// next triangle is the best one touching the cache
+		nBestTri = -1;
+		float flBestScore = -1.0f;
+		for ( int i = 0; i < nCacheCount; i++ )
+		{
+			const int v = cache[i];
+			const int *pTris = &vertTris[ vertFirstTri[v] ];
+			for ( int j = 0; j < vertNumActiveTris[v]; j++ )
+			{
+				const int tt = pTris[j];
+				float flScore = vertScore[ pSrc[ tt * 3 + 0 ] - nMinIndex ] + vertScore[ pSrc[ tt * 3 + 1 ] - nMinIndex ] + vertScore[ pSrc[ tt * 3 + 2 ] - nMinIndex ];
+				if ( flScore > flBestScore )
+				{
+					flBestScore = flScore;
+					nBestTri = tt;
+				}
+			}
+		}
+	}
+}
+
+//===============================================================================
+// Stitched strips join pieces with repeated indices (...a b b c c d...), which costs 2-3 indices and a few degenerate
+// triangles per join. Each run of real triangles becomes its own strip, separated by the 0xFFFF restart index instead.
+// GL starts every restarted strip with even winding, so a run starting on an odd triangle gets its first index doubled.
+
+static inline bool IsDegenerateTri( uint16 a, uint16 b, uint16 c )
+{
+	return ( a == b ) || ( b == c ) || ( a == c );
+}
+
+void CGLMIndexOptimizer::ConvertStripToRestart( CUtlVector<uint16> &dst, const uint16 *pSrc, uint nNumIndices )
+{
+	dst.RemoveAll();
+	if ( nNumIndices < 3 )
+		return;
+
+	for ( uint i = 0; i < nNumIndices; i++ )
+	{
+		// can't tell the app's vertex 65535 from a restart
+		if ( pSrc[i] == 0xFFFF )
+			return;
+	}
+
+	dst.EnsureCapacity( nNumIndices );
+
+	const uint nNumTris = nNumIndices - 2;
+	uint t = 0;
+	while ( t < nNumTris )
+	{
+		if ( IsDegenerateTri( pSrc[t], pSrc[t + 1], pSrc[t + 2] ) )
+		{
+			t++;
+			continue;
+		}
+
+		uint nEnd = t + 1;
+		while ( ( nEnd < nNumTris ) && !IsDegenerateTri( pSrc[nEnd], pSrc[nEnd + 1], pSrc[nEnd + 2] ) )
+		{
+			nEnd++;
+		}
+
+		if ( dst.Count() )
+		{
+			dst.AddToTail( 0xFFFF );
+		}
+
+		if ( t & 1 )
+		{
+			dst.AddToTail( pSrc[t] );
+		}
+
+		dst.AddMultipleToTail( nEnd - t + 2, &pSrc[t] );
+
+		t = nEnd;
+	}
+
+	// nothing to stitch (or nothing to draw), not worth switching restart on for
+	if ( (uint)dst.Count() >= nNumIndices )
+	{
+		dst.RemoveAll();
+	}
+}
+
+//===============================================================================
+
+CGLMStaticIndexData::CGLMStaticIndexData( CGLMBuffer *pBuffer, CGLMIndexOptimizer *pOptimizer ) :
+	m_pBuffer( pBuffer ),
+	m_pOptimizer( pOptimizer ),
+	m_Spans( DefLessFunc( uint64 ) ),
+	m_nNumApplied( 0 )
+{
+	// rounded up, a lock of the last byte still lands inside GetLockPtr()'s copy
+	m_Indices.SetCount( ( pBuffer->m_nSize + sizeof( uint16 ) - 1 ) / sizeof( uint16 ) );
+	memset( m_Indices.Base(), 0, m_Indices.Count() * sizeof( uint16 ) );
+}
+
+void CGLMStaticIndexData::OnWrite( uint nOffset, uint nSize, const void *pData )
+{
+	const uint nBufSize = m_Indices.Count() * sizeof( uint16 );
+	if ( ( nOffset >= nBufSize ) || !pData )
+		return;
+
+	memcpy( reinterpret_cast< char * >( m_Indices.Base() ) + nOffset, pData, MIN( nSize, nBufSize - nOffset ) );
+}
+
+void CGLMStaticIndexData::OnUnlocked( uint nOffset, uint nSize, bool bDiscard )
+{
+	if ( bDiscard )
+	{
+		m_Spans.RemoveAll();
+		m_nNumApplied = 0;
+		return;
+	}
+
+	if ( !nSize )
+		return;
+
+	const uint nFirst = nOffset / sizeof( uint16 );
+	const uint nEnd = ( nOffset + nSize + sizeof( uint16 ) - 1 ) / sizeof( uint16 );
+
+	for ( int i = m_Spans.FirstInorder(); i != m_Spans.InvalidIndex(); )
+	{
+		int nNext = m_Spans.NextInorder( i );
+
+		GLMIndexSpan_t &span = m_Spans[i];
+		if ( ( span.m_nStart < nEnd ) && ( nFirst < span.m_nStart + span.m_nCount ) )
+		{
+			// the app only rewrote part of it, put the rest back the way it left it
+			if ( span.m_nState == kGLMIndexSpanApplied )
+			{
+				Restore( span );
+			}
+			m_Spans.RemoveAt( i );
+		}
+
+		i = nNext;
+	}
+}
+
+uint CGLMStaticIndexData::OnDraw( EGLMIndexOp nOp, uint nStartIndex, uint nCount, bool *pbPrimitiveRestart )
+{
+	const uint64 nKey = ( (uint64)nStartIndex << 32 ) | nCount;
+
+	int i = m_Spans.Find( nKey );
+	if ( i != m_Spans.InvalidIndex() )
+	{
+		GLMIndexSpan_t &span = m_Spans[i];
+		if ( span.m_nState == kGLMIndexSpanRejected )
+			return DrawCount( span, pbPrimitiveRestart );
+
+		if ( span.m_key.m_nOp != nOp )
+		{
+			// same span drawn as a different primitive type, leave it alone
+			if ( span.m_nState == kGLMIndexSpanApplied )
+			{
+				Restore( span );
+			}
+			span.m_nState = kGLMIndexSpanRejected;
+		}
+		else if ( span.m_nState == kGLMIndexSpanPending )
+		{
+			TryApply( span );
+		}
+		return DrawCount( span, pbPrimitiveRestart );
+	}
+
+	GLMIndexSpan_t span;
+	span.m_nStart = nStartIndex;
+	span.m_nCount = nCount;
+	span.m_nDrawCount = nCount;
+	span.m_nState = kGLMIndexSpanPending;
+
+	if ( ( nCount < GL_INDEX_OPT_MIN_INDICES ) || ( nStartIndex + nCount > (uint)m_Indices.Count() ) )
+	{
+		span.m_nState = kGLMIndexSpanRejected;
+	}
+
+	// a reorder of either of two overlapping (but different) spans would scramble the other one
+	for ( int j = m_Spans.FirstInorder(); j != m_Spans.InvalidIndex(); j = m_Spans.NextInorder( j ) )
+	{
+		GLMIndexSpan_t &other = m_Spans[j];
+		if ( ( other.m_nStart < nStartIndex + nCount ) && ( nStartIndex < other.m_nStart + other.m_nCount ) )
+		{
+			if ( other.m_nState == kGLMIndexSpanApplied )
+			{
+				Restore( other );
+			}
+			other.m_nState = kGLMIndexSpanRejected;
+			span.m_nState = kGLMIndexSpanRejected;
+		}
+	}
+
+	if ( span.m_nState == kGLMIndexSpanPending )
+	{
+		CGLMIndexOptimizer::ComputeKey( &span.m_key, nOp, &m_Indices[ nStartIndex ], nCount );
+	}
+	else
+	{
+		memset( &span.m_key, 0, sizeof( span.m_key ) );
+		span.m_key.m_nOp = nOp;
+	}
+
+	i = m_Spans.Insert( nKey, span );
+
+	if ( span.m_nState == kGLMIndexSpanPending )
+	{
+		TryApply( m_Spans[i] );
+	}
+
+	return DrawCount( m_Spans[i], pbPrimitiveRestart );
+}
+
+void CGLMStaticIndexData::OnUnoptimizedDraw( uint nStartIndex, uint nCount )
+{
+	if ( !m_nNumApplied )
+		return;
+
+	// spans are ordered by start, so stop at the first one past the draw
+	const uint nEnd = nStartIndex + nCount;
+	for ( int i = m_Spans.FirstInorder(); i != m_Spans.InvalidIndex(); i = m_Spans.NextInorder( i ) )
+	{
+		GLMIndexSpan_t &span = m_Spans[i];
+		if ( span.m_nStart >= nEnd )
+			break;
+
+		if ( ( nStartIndex < span.m_nStart + span.m_nCount ) && ( span.m_nState == kGLMIndexSpanApplied ) )
+		{
+			Restore( span );
+			span.m_nState = kGLMIndexSpanRejected;
+		}
+	}
+}
+
+uint CGLMStaticIndexData::DrawCount( const GLMIndexSpan_t &span, bool *pbPrimitiveRestart )
+{
+	if ( span.m_nState != kGLMIndexSpanApplied )
+	{
+		*pbPrimitiveRestart = false;
+		return span.m_nCount;
+	}
+
+	*pbPrimitiveRestart = ( span.m_key.m_nOp == kGLMIndexOpStripRestart );
+	return span.m_nDrawCount;
+}
+
+void CGLMStaticIndexData::TryApply( GLMIndexSpan_t &span )
+{
+	const CUtlVector<uint16> *pResult = m_pOptimizer->GetResult( span.m_key, &m_Indices[ span.m_nStart ] );
+	if ( !pResult )
+		return;
+
+	if ( !pResult->Count() )
+	{
+		span.m_nState = kGLMIndexSpanRejected;
+		return;
+	}
+
+	Assert( pResult->Count() <= (int)span.m_nCount );
+	Upload( span.m_nStart, pResult->Count(), pResult->Base() );
+	span.m_nDrawCount = pResult->Count();
+	span.m_nState = kGLMIndexSpanApplied;
+	m_nNumApplied++;
+}
+
+void CGLMStaticIndexData::Restore( GLMIndexSpan_t &span )
+{
+	// shorter results only overwrote the front of the span, but the whole thing is cheap enough
+	Upload( span.m_nStart, span.m_nCount, &m_Indices[ span.m_nStart ] );
+	span.m_nDrawCount = span.m_nCount;
+
+	Assert( ( span.m_nState == kGLMIndexSpanApplied ) && m_nNumApplied );
+	m_nNumApplied--;
+}
+
+void CGLMStaticIndexData::Upload( uint nStartIndex, uint nCount, const uint16 *pIndices )
+{
+	if ( m_pBuffer->m_bPseudo )
+	{
+		memcpy( m_pBuffer->m_pPseudoBuf + nStartIndex * sizeof( uint16 ), pIndices, nCount * sizeof( uint16 ) );
+		return;
+	}
+
+	// also waits on any loader thread upload of this buffer
+	m_pBuffer->m_pCtx->BindBufferToCtx( kGLMIndexBuffer, m_pBuffer );
+	glBufferSubDataMaxSize( m_pBuffer->m_buffGLTarget, nStartIndex * sizeof( uint16 ), nCount * sizeof( uint16 ), pIndices );
+}
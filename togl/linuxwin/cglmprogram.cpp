@@ -115,6 +115,7 @@ CGLMProgram::CGLMProgram( GLMContext *ctx, EGLMProgramType type )
 
 	m_nCentroidMask = 0;
 	m_nShadowDepthSamplerMask = 0;
+	m_nArraySamplerMask = 0;
 		
 	// no text has arrived yet.  That's done in SetProgramText.
 }
@@ -139,6 +140,8 @@ CGLMProgram::~CGLMProgram( )
 		glslDesc->m_object.glsl = 0;
 	}
 
+	PurgeArraySamplerVariants();
+
 #if GLMDEBUG
 	if (m_editable)
 	{
@@ -190,6 +193,9 @@ void	CGLMProgram::SetProgramText( char *text )
 		free( m_text );
 		m_text = NULL;
 	}
+
+	// any array sampler flavors were built from the old text
+	PurgeArraySamplerVariants();
 	
 	// scrub desc text references
 	for( int i=0; i<kGLMNumProgramTypes; i++)
@@ -450,6 +456,83 @@ bool	CGLMProgram::Compile( EGLMProgramLang lang )
 	return result;
 }
 
+GLhandleARB CGLMProgram::GetArraySamplerVariant( uint nArrayMask )
+{
+	GLMShaderDesc *glslDesc = &m_descs[ kGLMGLSL ];
+
+	if ( !nArrayMask )
+		return glslDesc->m_object.glsl;
+
+	for ( int i = 0; i < m_ArraySamplerVariants.Count(); i++ )
+	{
+		if ( m_ArraySamplerVariants[i].m_nMask == nArrayMask )
+			return m_ArraySamplerVariants[i].m_glsl;
+	}
+
+	Assert( ( m_type == kGLMFragmentProgram ) && glslDesc->m_textPresent && !( nArrayMask & ~m_nArraySamplerMask ) );
+
+	// the extension and the defines have to land right after the #version line
+	char *section = m_text + glslDesc->m_textOffset;
+	char *pSplit = strstr( section, "#version" );
+	if ( pSplit )
+	{
+		pSplit = strchr( pSplit, '\n' );
+	}
+
+	if ( !pSplit || ( pSplit >= ( section + glslDesc->m_textLength ) ) )
+	{
+		m_nArraySamplerMask = 0;
+		return 0;
+	}
+	pSplit++;
+
+	char defines[512];
+	V_strncpy( defines, "#extension GL_EXT_texture_array : require\n", sizeof( defines ) );
+	for ( int i = 0; i < GLM_SAMPLER_COUNT; i++ )
+	{
+		if ( nArrayMask & ( 1 << i ) )
+		{
+			char tmp[32];
+			V_snprintf( tmp, sizeof( tmp ), "#define ARRAY_SAMPLER%d 1\n", i );
+			V_strncat( defines, tmp, sizeof( defines ) );
+		}
+	}
+
+	const GLcharARB *strings[3] = { section, defines, pSplit };
+	GLint lengths[3] = { (GLint)( pSplit - section ), (GLint)strlen( defines ), glslDesc->m_textLength - (GLint)( pSplit - section ) };
+
+	GLhandleARB glsl = gGL->glCreateShaderObjectARB( GLMProgTypeToGLSLEnum( m_type ) );
+	gGL->glShaderSourceARB( glsl, 3, strings, lengths );
+	gGL->glCompileShaderARB( glsl );
+
+	GLint compiled = 0;
+	gGL->glGetObjectParameterivARB( glsl, GL_OBJECT_COMPILE_STATUS_ARB, &compiled );
+	if ( !compiled )
+	{
+		// don't try again, this program just samples its own textures from now on
+		GLMPRINTF(( "-D- CGLMProgram::GetArraySamplerVariant: array sampler flavor (mask %x) of %s failed to compile", nArrayMask, m_shaderName ));
+		gGL->glDeleteShader( (uint)glsl );
+		m_nArraySamplerMask = 0;
+		return 0;
+	}
+
+	ArraySamplerVariant_t variant;
+	variant.m_nMask = nArrayMask;
+	variant.m_glsl = glsl;
+	m_ArraySamplerVariants.AddToTail( variant );
+
+	return glsl;
+}
+
+void CGLMProgram::PurgeArraySamplerVariants( void )
+{
+	for ( int i = 0; i < m_ArraySamplerVariants.Count(); i++ )
+	{
+		gGL->glDeleteShader( (uint)m_ArraySamplerVariants[i].m_glsl );
+	}
+	m_ArraySamplerVariants.Purge();
+}
+
 #if GLMDEBUG
 
 	bool CGLMProgram::PollForChanges( void )
@@ -860,6 +943,11 @@ CGLMShaderPair::CGLMShaderPair( GLMContext *ctx  )
 	m_fakeSRGBEnableValue = -1.0f;
 	
 	memset( m_locSamplers, 0xFF, sizeof( m_locSamplers ) );
+
+	m_nArraySamplerMask = 0;
+	m_fragmentObject = 0;
+	memset( m_locSamplerLayers, 0xFF, sizeof( m_locSamplerLayers ) );
+	memset( m_nSamplerLayers, 0xFF, sizeof( m_nSamplerLayers ) );
 	
 	m_valid = false;
 	m_revision = 0;				// bumps to 1 once linked
@@ -875,7 +963,7 @@ CGLMShaderPair::~CGLMShaderPair( )
 }
 
 // glUseProgram() will be called as a side effect!
-bool CGLMShaderPair::SetProgramPair( CGLMProgram *vp, CGLMProgram *fp )
+bool CGLMShaderPair::SetProgramPair( CGLMProgram *vp, CGLMProgram *fp, uint nArrayMask )
 {
 	m_valid	= false;			// assume failure
 	
@@ -906,8 +994,18 @@ bool CGLMShaderPair::SetProgramPair( CGLMProgram *vp, CGLMProgram *fp )
 		
 		if (m_fragmentProg)
 		{
-			gGL->glDetachObjectARB(m_program, m_fragmentProg->m_descs[kGLMGLSL].m_object.glsl);
+			gGL->glDetachObjectARB(m_program, m_fragmentObject);
 			m_fragmentProg = NULL;			
+			m_fragmentObject = 0;
+		}
+
+		// array sampler flavor of the fp if asked for, falls back to the plain one if it won't compile
+		nArrayMask &= fp->m_nArraySamplerMask;
+		GLhandleARB fragmentObject = fp->GetArraySamplerVariant( nArrayMask );
+		if ( !fragmentObject )
+		{
+			nArrayMask = 0;
+			fragmentObject = fp->m_descs[kGLMGLSL].m_object.glsl;
 		}
 		
 		// now attach
@@ -915,8 +1013,10 @@ bool CGLMShaderPair::SetProgramPair( CGLMProgram *vp, CGLMProgram *fp )
 		gGL->glAttachObjectARB( m_program, vp->m_descs[kGLMGLSL].m_object.glsl );
 		m_vertexProg = vp;
 
-		gGL->glAttachObjectARB( m_program, fp->m_descs[kGLMGLSL].m_object.glsl );
+		gGL->glAttachObjectARB( m_program, fragmentObject );
 		m_fragmentProg = fp;
+		m_fragmentObject = fragmentObject;
+		m_nArraySamplerMask = nArrayMask;
 	
 		// force the locations for input attributes v0-vN to be at locations 0-N
 		// use the vertex attrib map to know which slots are live or not... oy!  we don't have that map yet... but it's OK.
@@ -1076,7 +1176,15 @@ bool CGLMShaderPair::SetProgramPair( CGLMProgram *vp, CGLMProgram *fp )
 			{
 				gGL->glUniform1iARB( nLoc, sampler );
 			}
+
+			m_locSamplerLayers[sampler] = -1;
+			if ( m_nArraySamplerMask & ( 1 << sampler ) )
+			{
+				sprintf(tmp, "sampler%dLayer", sampler);
+				m_locSamplerLayers[sampler] = gGL->glGetUniformLocationARB( m_program, tmp );
+			}
 		}
+		memset( m_nSamplerLayers, 0xFF, sizeof( m_nSamplerLayers ) );
 	}
 	else
 	{
@@ -1095,6 +1203,8 @@ bool CGLMShaderPair::SetProgramPair( CGLMProgram *vp, CGLMProgram *fp )
 		m_fakeSRGBEnableValue = -999;
 		
 		memset( m_locSamplers, 0xFF, sizeof( m_locSamplers ) );
+		memset( m_locSamplerLayers, 0xFF, sizeof( m_locSamplerLayers ) );
+		m_nArraySamplerMask = 0;
 		
 		m_revision = 0;		
 	}
@@ -1116,7 +1226,7 @@ bool	CGLMShaderPair::RefreshProgramPair		( void )
 
 	if (vpgood && fpgood)
 	{
-		SetProgramPair( vp, fp );
+		SetProgramPair( vp, fp, m_nArraySamplerMask );
 	}
 	else
 	{
@@ -1324,7 +1434,7 @@ CGLMShaderPair	*CGLMShaderPairCache::SelectShaderPairInternal( CGLMProgram *vp,
 	newentry->m_extraKeyBits = extraKeyBits;
 	newentry->m_pair = new CGLMShaderPair( m_ctx );
 	Assert( newentry->m_pair );
-	newentry->m_pair->SetProgramPair( vp, fp );
+	newentry->m_pair->SetProgramPair( vp, fp, extraKeyBits );
 
 	if (loglevel >= 2)  // say a little bit more
 	{
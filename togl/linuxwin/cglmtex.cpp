@@ -28,6 +28,13 @@
 
 #include "togl/rendermechanism.h"
 
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+#define GL_TEXEL_CONVERT_SSE2	1
+#include <emmintrin.h>
+#else
+#define GL_TEXEL_CONVERT_SSE2	0
+#endif
+
 #include "tier0/icommandline.h"
 #include "glmtexinlines.h"
 
@@ -132,8 +139,8 @@ const GLMTexFormatDesc g_formatDescTable[] =
 	// _Q8W8V8U8 we just pass through as RGBA bytes.  Shader does scale/bias fix
 	{ "_Q8W8V8U8",		D3DFMT_Q8W8V8U8,		GL_RGBA8,							0,									GL_BGRA,				GL_UNSIGNED_INT_8_8_8_8_REV,	1, 4 },		// straight ripoff of D3DFMT_A8R8G8B8
 
-	// U8V8 is exposed to the client as 2-bytes per texel, but we download it as 3-byte RGB.
-	// WriteTexels needs to do that conversion from rg8 to rgb8 in order to be able to download it correctly
+	// U8V8 is exposed to the client as 2-bytes per texel, but lives in an RGB8 texture.
+	// GL_RG uploads fill that directly - without ARB_texture_rg WriteTexels widens it to 4-byte texels first (see NeedsTexelExpand)
 	{ "_V8U8",			D3DFMT_V8U8,			GL_RGB8,							0,									GL_RG,					GL_BYTE,						1, 2 },
 	
 	{ "_R32F",			D3DFMT_R32F,			GL_R32F,							GL_R32F,							GL_RED,					GL_FLOAT,						1, 4 },
@@ -160,13 +167,45 @@ const GLMTexFormatDesc g_formatDescTable[] =
 
 int	g_formatDescTableCount = sizeof(g_formatDescTable) / sizeof( g_formatDescTable[0] );
 
+// D3DFORMAT -> desc.  the plain D3D formats are small numbers and index straight in,
+// the FOURCC ones (DXTn etc) are few enough to scan.
+#define	GLM_FORMAT_DESC_DIRECT_COUNT	256
+
+static const GLMTexFormatDesc *g_formatDescDirect[ GLM_FORMAT_DESC_DIRECT_COUNT ];
+static const GLMTexFormatDesc *g_formatDescFourCC[ sizeof(g_formatDescTable) / sizeof( g_formatDescTable[0] ) ];
+static int g_formatDescFourCCCount;
+
+static struct CFormatDescIndexInit
+{
+	CFormatDescIndexInit()
+	{
+		for( int i=0; i<g_formatDescTableCount; i++)
+		{
+			uint format = (uint)g_formatDescTable[i].m_d3dFormat;
+			if ( format < GLM_FORMAT_DESC_DIRECT_COUNT )
+			{
+				g_formatDescDirect[ format ] = &g_formatDescTable[i];
+			}
+			else
+			{
+				g_formatDescFourCC[ g_formatDescFourCCCount++ ] = &g_formatDescTable[i];
+			}
+		}
+	}
+} g_formatDescIndexInit;
+
 const GLMTexFormatDesc *GetFormatDesc( D3DFORMAT format )
 {
-	for( int i=0; i<g_formatDescTableCount; i++)
+	if ( (uint)format < GLM_FORMAT_DESC_DIRECT_COUNT )
+	{
+		return g_formatDescDirect[ (uint)format ];	// NULL if not found
+	}
+
+	for( int i=0; i<g_formatDescFourCCCount; i++)
 	{
-		if (g_formatDescTable[i].m_d3dFormat == format)
+		if (g_formatDescFourCC[i]->m_d3dFormat == format)
 		{
-			return &g_formatDescTable[i];
+			return g_formatDescFourCC[i];
 		}
 	}
 	return (const GLMTexFormatDesc *)NULL;	// not found
@@ -441,26 +480,73 @@ bool	GLMGenTexels( GLMGenTexelParams *params )
 
 
 //===============================================================================
-bool LessFunc_GLMTexLayoutKey( const GLMTexLayoutKey &a, const GLMTexLayoutKey &b )
+bool EqualFunc_GLMTexLayoutKey( const GLMTexLayoutKey &a, const GLMTexLayoutKey &b )
 {
-	#define	DO_LESS(fff) if (a.fff != b.fff) { return (a.fff< b.fff); }
+	// field by field, the struct has padding so no memcmp
+	return	( a.m_texGLTarget == b.m_texGLTarget ) && ( a.m_texFormat == b.m_texFormat ) &&
+			( a.m_texFlags == b.m_texFlags ) && ( a.m_texSamples == b.m_texSamples ) &&
+			( a.m_xSize == b.m_xSize ) && ( a.m_ySize == b.m_ySize ) && ( a.m_zSize == b.m_zSize );
+}
 
-	DO_LESS(m_texGLTarget);
-	DO_LESS(m_texFormat);
-	DO_LESS(m_texFlags);
-	DO_LESS(m_texSamples);
-	DO_LESS(m_xSize);
-	DO_LESS(m_ySize)
-	DO_LESS(m_zSize);
-		
-	#undef DO_LESS
+uint HashFunc_GLMTexLayoutKey( const GLMTexLayoutKey &key )
+{
+	// FNV-1a over the fields
+	uint32 h = 2166136261u;
+	#define	DO_HASH(fff) h = ( h ^ (uint32)key.fff ) * 16777619u
+
+	DO_HASH(m_texGLTarget);
+	DO_HASH(m_texFormat);
+	DO_HASH(m_texFlags);
+	DO_HASH(m_texSamples);
+	DO_HASH(m_xSize);
+	DO_HASH(m_ySize);
+	DO_HASH(m_zSize);
 	
-	return false;	// they are equal
+	#undef DO_HASH
+
+	return h ^ ( h >> 15 );
 }
 
 CGLMTexLayoutTable::CGLMTexLayoutTable()
 {
-	m_layoutMap.SetLessFunc( LessFunc_GLMTexLayoutKey );
+	m_layoutHash.SetCount( kInitialHashSize );
+	for( int i=0; i<m_layoutHash.Count(); i++)
+	{
+		m_layoutHash[i] = NULL;
+	}
+	m_nLayoutCount = 0;
+}
+
+int CGLMTexLayoutTable::FindSlot( const GLMTexLayoutKey &key )
+{
+	// linear probe, the hash is a power of two in size and never more than half full so this always finds a NULL
+	int nMask = m_layoutHash.Count() - 1;
+	int h = HashFunc_GLMTexLayoutKey( key ) & nMask;
+	while ( m_layoutHash[h] && !EqualFunc_GLMTexLayoutKey( m_layoutHash[h]->m_key, key ) )
+	{
+		h = ( h + 1 ) & nMask;
+	}
+	return h;
+}
+
+void CGLMTexLayoutTable::GrowHash( void )
+{
+	CUtlVector< GLMTexLayout* > oldHash;
+	oldHash.Swap( m_layoutHash );
+
+	m_layoutHash.SetCount( oldHash.Count() * 2 );
+	for( int i=0; i<m_layoutHash.Count(); i++)
+	{
+		m_layoutHash[i] = NULL;
+	}
+
+	for( int i=0; i<oldHash.Count(); i++)
+	{
+		if ( oldHash[i] )
+		{
+			m_layoutHash[ FindSlot( oldHash[i]->m_key ) ] = oldHash[i];
+		}
+	}
 }
 
 GLMTexLayout *CGLMTexLayoutTable::NewLayoutRef( GLMTexLayoutKey *pDesiredKey )
@@ -491,12 +577,12 @@ GLMTexLayout *CGLMTexLayoutTable::NewLayoutRef( GLMTexLayoutKey *pDesiredKey )
 		}
 	}
 
-	unsigned short index = m_layoutMap.Find( *key );
-	if (index != m_layoutMap.InvalidIndex())
+	int slot = FindSlot( *key );
+	if ( m_layoutHash[ slot ] )
 	{
 		// found it
 		//printf(" -hit- ");
-		GLMTexLayout *layout = m_layoutMap[ index ];
+		GLMTexLayout *layout = m_layoutHash[ slot ];
 		
 		// bump ref count
 		layout->m_refCount ++;
@@ -656,8 +742,14 @@ GLMTexLayout *CGLMTexLayoutTable::NewLayoutRef( GLMTexLayoutKey *pDesiredKey )
 		layout->m_layoutSummary = strdup( scratch );
 		//GLMPRINTF(("-D- new tex layout [ %s ]", scratch ));
 		
-		// then insert into map. disregard returned index.
-		m_layoutMap.Insert( layout->m_key, layout );
+		// then insert into the hash, growing it first if that would take it past half full.
+		if ( ( m_nLayoutCount + 1 ) * 2 > m_layoutHash.Count() )
+		{
+			GrowHash();
+			slot = FindSlot( layout->m_key );
+		}
+		m_layoutHash[ slot ] = layout;
+		m_nLayoutCount++;
 		
 		return layout;
 	}
@@ -668,11 +760,11 @@ void CGLMTexLayoutTable::DelLayoutRef( GLMTexLayout *layout )
 	// locate layout in hash, drop refcount
 	// (some GC step later on will harvest expired layouts - not like it's any big challenge to re-generate them)
 	
-	unsigned short index = m_layoutMap.Find( layout->m_key );
-	if (index != m_layoutMap.InvalidIndex())
+	int slot = FindSlot( layout->m_key );
+	if ( m_layoutHash[ slot ] )
 	{
 		// found it
-		GLMTexLayout *layout = m_layoutMap[ index ];
+		GLMTexLayout *layout = m_layoutHash[ slot ];
 		
 		// drop ref count
 		layout->m_refCount --;
@@ -688,9 +780,11 @@ void CGLMTexLayoutTable::DelLayoutRef( GLMTexLayout *layout )
 
 void CGLMTexLayoutTable::DumpStats( )
 {
-	for (uint i=0; i<m_layoutMap.Count(); i++ )
+	for (int i=0; i<m_layoutHash.Count(); i++ )
 	{
-		GLMTexLayout *layout = m_layoutMap[ i ];
+		GLMTexLayout *layout = m_layoutHash[ i ];
+		if ( !layout )
+			continue;
 		
 		// print it out
 		printf("\n%05d instances %08d bytes  %08d totbytes  %s", layout->m_refCount, layout->m_storageTotalSize, (layout->m_refCount*layout->m_storageTotalSize), layout->m_layoutSummary );
@@ -707,6 +801,64 @@ ConVar gl_rt_forcergba ( "gl_rt_forcergba", "1" );	// on teximage of a renderabl
 ConVar gl_minimize_rt_tex ( "gl_minimize_rt_tex", "0" );	// if 1, set the GL_TEXTURE_MINIMIZE_STORAGE_APPLE texture parameter to cut off mipmaps for RT's
 ConVar gl_minimize_all_tex ( "gl_minimize_all_tex", "1" );	// if 1, set the GL_TEXTURE_MINIMIZE_STORAGE_APPLE texture parameter to cut off mipmaps for textures which are unmipped
 ConVar gl_minimize_tex_log ( "gl_minimize_tex_log", "0" );	// if 1, printf the names of the tex that got minimized
+ConVar gl_texstorage ( "gl_texstorage", "1" );	// if 1, allocate new textures with glTexStorage when available instead of pushing blank texels into every slice
+ConVar gl_texswizzle ( "gl_texswizzle", "1" );	// if 1, store L8/A8L8/A8 as R8/RG8 and let a texture swizzle spread the channels
+ConVar gl_async_readback ( "gl_async_readback", "1" );	// if 1, GetRenderTargetData and D3DLOCK_DONOTWAIT read back through a fenced pixel pack buffer
+ConVar gl_texdefercreate ( "gl_texdefercreate", "1" );	// if 1, non-RT textures get their GL object on first lock/bind/attach instead of at creation
+ConVar gl_texstream ( "gl_texstream", "0" );	// if 1, the first upload of big mips is spread over later frames (see GLMContext::UpdateTexStreaming)
+ConVar gl_texstream_min_kb ( "gl_texstream_min_kb", "64" );	// mips smaller than this are always sent right away
+ConVar gl_texcoalesce ( "gl_texcoalesce", "1" );	// if 1, partial unlocks are merged per slice and uploaded when the texture is next drawn with or blitted
+
+// V8U8 -> 4 byte texels, for drivers that can't take GL_RG uploads. GL_BYTE pad bytes clamp to 0 going into the RGB8 texture.
+static void ExpandV8U8( uint8 *pDst, const uint8 *pSrc, uint nTexels )
+{
+	uint i = 0;
+#if GL_TEXEL_CONVERT_SSE2
+	const __m128i nPad = _mm_set1_epi16( (short)0xBBBB );
+	for ( ; i + 8 <= nTexels; i += 8 )
+	{
+		__m128i uv = _mm_loadu_si128( reinterpret_cast< const __m128i * >( pSrc + i * 2 ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( pDst + i * 4 ), _mm_unpacklo_epi16( uv, nPad ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( pDst + i * 4 + 16 ), _mm_unpackhi_epi16( uv, nPad ) );
+	}
+#endif
+	for ( ; i < nTexels; i++ )
+	{
+		pDst[ i * 4 + 0 ] = pSrc[ i * 2 + 0 ];
+		pDst[ i * 4 + 1 ] = pSrc[ i * 2 + 1 ];
+		pDst[ i * 4 + 2 ] = 0xBB;
+		pDst[ i * 4 + 3 ] = 0xBB;
+	}
+}
+
+// glTexStorage only takes sized formats, and the legacy luminance/alpha ones are compatibility profile only
+static bool IsImmutableStorageFormat( GLenum intformat )
+{
+	switch( intformat )
+	{
+		case 0:
+		case GL_RGB:
+		case GL_SRGB_EXT:
+		case GL_ALPHA8:
+		case GL_LUMINANCE8:
+		case GL_LUMINANCE8_ALPHA8:
+		case GL_SLUMINANCE8_EXT:
+		case GL_SLUMINANCE8_ALPHA8_EXT:
+			return false;
+	}
+	return true;
+}
+
+// texture views want sized formats on both sides, the unsized R5G6B5 pair gets stored as the 8 bit ones
+static GLenum GetSizedViewFormat( GLenum intformat )
+{
+	switch( intformat )
+	{
+		case GL_RGB:		return GL_RGB8;
+		case GL_SRGB_EXT:	return GL_SRGB8_EXT;
+	}
+	return intformat;
+}
 
 CGLMTex::CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel )
 {
@@ -724,7 +876,8 @@ CGLMTex::CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel
 	// caller has responsibility to make 'ctx' current, but we check to be sure.
 	ctx->CheckCurrent();
 						
-	m_nLastResolvedBatchCounter = ctx->m_nBatchCounter;
+	m_bResolvePending = false;
+	memset( &m_resolveDamage, 0, sizeof( m_resolveDamage ) );
 		
 	// note layout requested
 	m_layout = layout;
@@ -752,23 +905,142 @@ CGLMTex::CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel
 	
 	// clear the RT attach count
 	m_rtAttachCount = 0;
-	
-	// come up with a GL name for this texture.
-	// for MTGL friendliness, we should generate our own names at some point..
-	gGL->glGenTextures( 1, &m_texName );
+
+	m_bInBackingLRU = false;
+	m_pPrevBackingLRU = NULL;
+	m_pNextBackingLRU = NULL;
+	
+	// the GL object itself is made on first real use (see CreateGLTexture), so zero the names for now
+	m_texName = 0;
+	m_rboName = 0;
+	m_texViewName = 0;
+	m_nViewBaseLevel = m_nViewMaxLevel = -1;
+	m_bImmutableStorage = false;
+
+	// the one and two channel formats live on in core GL as R8/RG8 plus a swizzle, which costs the CPU nothing at upload time.
+	// (not for sRGB, there's no core sRGB R8 - and not on OSX where ResetSRGB flips formats)
+	m_bSwizzledFormat = false;
+#if !defined( OSX )
+	if ( gGL->m_bHave_GL_ARB_texture_rg && gGL->m_bHave_GL_ARB_texture_swizzle && gl_texswizzle.GetInt() &&
+		!( layout->m_key.m_texFlags & ( kGLMTexRenderable | kGLMTexSRGB ) ) )
+	{
+		switch( layout->m_format->m_d3dFormat )
+		{
+			case D3DFMT_L8:
+			case D3DFMT_A8L8:
+			case D3DFMT_A8:
+				m_bSwizzledFormat = true;
+			break;
+		}
+	}
+#endif
+
+	// GL's without S3TC get DXT as RGBA8, the blocks stay in m_backing for the D3D side
+	m_bDecodeDXT = ctx->m_bSoftwareDXTDecode && CGLMDXTDecoder::IsDecodableFormat( layout->m_format->m_d3dFormat );
+
+	m_SamplingParams.SetToDefaults();
 
 	m_pBlitSrcFBO = NULL;
 	m_pBlitDstFBO = NULL;
 
 	//sense whether to try and apply client storage upon teximage/subimage
 	m_texClientStorage = gl_texclientstorage.GetInt() != 0;
+	if ( m_bDecodeDXT )
+	{
+		// GL would be pointing at the decode scratch
+		m_texClientStorage = false;
+	}
 	
 	// flag that we have not yet been explicitly kicked into VRAM..
 	m_texPreloaded = false;
+	m_bMipGenPending = false;
 	
 	// clone the debug label if there is one.
 	m_debugLabel = debugLabel ? strdup(debugLabel) : NULL;
 
+	// backing storage is made by CreateGLTexture or Lock, whichever needs it first
+	m_backing = NULL;
+
+	if ( !(layout->m_key.m_texFlags & kGLMTexRenderable) )
+	{
+		// track bytes allocated for non-RT's
+		int formindex = sEncodeLayoutAsIndex( &layout->m_key );
+		
+		g_texGlobalBytes[ formindex ] += m_layout->m_storageTotalSize;
+		
+		#if TEXSPACE_LOGGING
+			printf( "\n Tex %s added %d bytes in form %d which is now %d bytes", m_debugLabel ? m_debugLabel : "-", m_layout->m_storageTotalSize, formindex, g_texGlobalBytes[ formindex ] );
+			printf( "\n\t\t[ %d %d %d %d  %d %d %d %d ]",
+				   g_texGlobalBytes[ 0 ],g_texGlobalBytes[ 1 ],g_texGlobalBytes[ 2 ],g_texGlobalBytes[ 3 ],
+				   g_texGlobalBytes[ 4 ],g_texGlobalBytes[ 5 ],g_texGlobalBytes[ 6 ],g_texGlobalBytes[ 7 ]
+				   );
+		#endif
+	}
+	else
+	{
+		m_texClientStorage = false;
+	}		
+
+	// init lock count
+	// lock reqs are tracked by the owning context
+	m_lockCount = 0;
+
+	m_nReadbackPBO = 0;
+	m_nReadbackPBOSize = 0;
+	m_nReadbackSync = 0;
+	m_nReadbackSlice = -1;
+	m_nReadbackBatch = 0;
+
+	m_nResidentIndex = -1;
+	m_nLastUsedBatch = ctx->m_nBatchCounter;
+	m_nResidencyPriority = 0;
+	m_nPooledFrame = 0;
+	m_bManaged = false;
+	m_bEvicted = false;
+	m_bStreamPending = false;
+
+	m_pCompressJob = NULL;
+	m_pShadowLayout = NULL;
+	m_bCompressCandidate = false;
+	m_nCompressDrops = 0;
+
+	m_pAtlas = NULL;
+	m_nAtlasLayer = -1;
+	m_bAtlasCandidate = false;
+	m_nFBOMapHead = -1;
+
+	m_sliceFlags.SetCount( m_layout->m_sliceCount );
+	for( int i=0; i< m_layout->m_sliceCount; i++)
+	{
+		m_sliceFlags[i] = 0;
+			// kSliceValid			=	false	(we have not teximaged each slice yet)
+			// kSliceStorageValid	=	false	(the storage allocated does not reflect what is in the tex)
+			// kSliceLocked			=	false	(the slices are not locked)
+			// kSliceFullyDirty		=	false	(this does not come true til first lock)
+	}
+
+	// plain textures stay a proxy until they are locked, bound or attached - lots of them are placeholders that never get used.
+	// RT's get drawn to right away, and dxabstract looks at m_rboName to pick blit paths, so they are made now.
+	if ( ( layout->m_key.m_texFlags & kGLMTexRenderable ) || !gl_texdefercreate.GetInt() )
+	{
+		CreateGLTexture();
+	}
+}
+
+void CGLMTex::CreateGLTexture( void )
+{
+	Assert( !m_texName );
+
+	GLMContext *ctx = m_ctx;
+	GLMTexLayout *layout = m_layout;
+
+	// caller has responsibility to make 'ctx' current, but we check to be sure.
+	ctx->CheckCurrent();
+	
+	// come up with a GL name for this texture.
+	// for MTGL friendliness, we should generate our own names at some point..
+	gGL->glGenTextures( 1, &m_texName );
+
 	// if tex is MSAA renderable, make an RBO, else zero the RBO name and dirty bit
 	if (layout->m_key.m_texFlags & kGLMTexMultisampled)
 	{
@@ -814,47 +1086,57 @@ CGLMTex::CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel
 
 	m_SamplingParams.SetToDefaults();
 	m_SamplingParams.SetToTarget( m_texGLTarget );
+
+	if ( m_bSwizzledFormat )
+	{
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };	// L8: R8 -> LLL1
+		switch( m_layout->m_format->m_d3dFormat )
+		{
+			case D3DFMT_A8L8:	swizzle[3] = GL_GREEN;	break;	// RG8 -> LLLA
+			case D3DFMT_A8:		swizzle[0] = swizzle[1] = swizzle[2] = GL_ZERO; swizzle[3] = GL_RED;	break;	// R8 -> 000A
+			default:			break;
+		}
+
+		for( int i=0; i<4; i++ )
+		{
+			gGL->glTexParameteri( m_texGLTarget, GL_TEXTURE_SWIZZLE_R + i, swizzle[i] );
+		}
+	}
 	
 	// OK, our texture now exists and is bound on the active TMU.  Not drawable yet though.
-		
-	// if not an RT, create backing storage and fill it
-	if ( !(layout->m_key.m_texFlags & kGLMTexRenderable) )
+
+	// allocate every level up front if we can - that makes it complete without pushing any texels.
+	// (not on OSX, ResetSRGB has to re-specify the internal format there)
+	// without sRGB decode control it isn't optional for anything with an sRGB flavor, views only alias immutable storage.
+	m_bImmutableStorage = false;
+#if !defined( OSX )
+	const bool bForSRGBView = CanHaveSRGBView();
+	if ( gGL->m_bHave_GL_ARB_texture_storage && ( gl_texstorage.GetInt() || bForSRGBView ) )
 	{
-		m_backing = (char *)malloc( m_layout->m_storageTotalSize );
-		memset( m_backing, 0, m_layout->m_storageTotalSize );
-		
-		// track bytes allocated for non-RT's
-		int formindex = sEncodeLayoutAsIndex( &layout->m_key );
-		
-		g_texGlobalBytes[ formindex ] += m_layout->m_storageTotalSize;
-		
-		#if TEXSPACE_LOGGING
-			printf( "\n Tex %s added %d bytes in form %d which is now %d bytes", m_debugLabel ? m_debugLabel : "-", m_layout->m_storageTotalSize, formindex, g_texGlobalBytes[ formindex ] );
-			printf( "\n\t\t[ %d %d %d %d  %d %d %d %d ]",
-				   g_texGlobalBytes[ 0 ],g_texGlobalBytes[ 1 ],g_texGlobalBytes[ 2 ],g_texGlobalBytes[ 3 ],
-				   g_texGlobalBytes[ 4 ],g_texGlobalBytes[ 5 ],g_texGlobalBytes[ 6 ],g_texGlobalBytes[ 7 ]
-				   );
-		#endif
+		GLenum intformat = bForSRGBView ? GetSizedViewFormat( GetGLIntFormat() ) : GetGLIntFormat();
+		if ( IsImmutableStorageFormat( intformat ) )
+		{
+			GLMTexLayoutSlice *slice = &m_layout->m_slices[0];
+			if ( m_texGLTarget == GL_TEXTURE_3D )
+			{
+				gGL->glTexStorage3D( m_texGLTarget, m_layout->m_mipCount, intformat, slice->m_xSize, slice->m_ySize, slice->m_zSize );
+			}
+			else
+			{
+				gGL->glTexStorage2D( m_texGLTarget, m_layout->m_mipCount, intformat, slice->m_xSize, slice->m_ySize );
+			}
+			m_bImmutableStorage = true;
+		}
 	}
-	else
-	{
-		m_backing = NULL;
+#endif
 		
-		m_texClientStorage = false;
-	}		
-
-	// init lock count
-	// lock reqs are tracked by the owning context
-	m_lockCount = 0;
-
-	m_sliceFlags.SetCount( m_layout->m_sliceCount );
-	for( int i=0; i< m_layout->m_sliceCount; i++)
+	// if not an RT, create backing storage to push the blank texels from.
+	// immutable textures don't push any, Lock will make the backing when it's needed.
+	// (it may already exist if ResetSRGB got here first)
+	if ( !(layout->m_key.m_texFlags & kGLMTexRenderable) && !m_bImmutableStorage && !m_backing )
 	{
-		m_sliceFlags[i] = 0;
-			// kSliceValid			=	false	(we have not teximaged each slice yet)
-			// kSliceStorageValid	=	false	(the storage allocated does not reflect what is in the tex)
-			// kSliceLocked			=	false	(the slices are not locked)
-			// kSliceFullyDirty		=	false	(this does not come true til first lock)
+		m_backing = (char *)malloc( m_layout->m_storageTotalSize );
+		memset( m_backing, 0, m_layout->m_storageTotalSize );
 	}
 	
 	// texture minimize parameter keeps driver from allocing mips when it should not, by being explicit about the ones that have no mips.
@@ -893,6 +1175,7 @@ CGLMTex::CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel
 
 	// after a lot of pain with texture completeness...
 	// always push black into all slices of all newly created textures.
+	// (unless glTexStorage already took care of completeness - RT's still go through for their slice flags, but send no texels)
 	
 	#if 0
 		bool pushRenderableSlices = (m_layout->m_key.m_texFlags & kGLMTexRenderable) != 0;
@@ -921,7 +1204,8 @@ CGLMTex::CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel
 	#endif
 	
 	//if (pushRenderableSlices || pushTexSlices)
-	if (1)
+	// (an evicted texture always comes through, m_backing has its texels)
+	if ( !m_bImmutableStorage || ( layout->m_key.m_texFlags & kGLMTexRenderable ) || m_bEvicted )
 	{
 		for( int face=0; face <m_layout->m_faceCount; face++)
 		{
@@ -945,6 +1229,8 @@ CGLMTex::CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel
 
 				desc.m_sliceBaseOffset = slice->m_storageOffset;	// doesn't really matter... we're just pushing zeroes..
 				desc.m_sliceRegionOffset = 0;
+				desc.m_pPixelUnpackBuffer = NULL;
+				desc.m_nPixelUnpackOfs = 0;
 
 				WriteTexels( &desc, true, (layout->m_key.m_texFlags & kGLMTexRenderable)!=0 );					// write whole slice - but disable data source if it's an RT, as there's no backing
 			}
@@ -952,6 +1238,17 @@ CGLMTex::CGLMTex( GLMContext *ctx, GLMTexLayout *layout, const char *debugLabel
 	}
 	GLMPRINTF(("-A- -**TEXNEW '%-60s' name=%06d  size=%09d  storage=%08x label=%s ", m_layout->m_layoutSummary, m_texName, m_layout->m_storageTotalSize, m_backing, m_debugLabel ? m_debugLabel : "-" ));
 
+	if ( m_bEvicted )
+	{
+		m_bEvicted = false;
+		if ( CanReleaseBacking() )
+		{
+			LinkBackingLRU();
+		}
+	}
+
+	ctx->AddResidentTex( this );
+
 	ctx->BindTexToTMU( pPrevTex, 0 );
 }
 
@@ -976,6 +1273,40 @@ CGLMTex::~CGLMTex( )
 	m_pNextTex = m_pPrevTex = NULL;
 #endif
 
+	// the device normally scrubs us on release, but don't leave dangling nodes if something went around it
+	if ( ( m_nFBOMapHead >= 0 ) && m_ctx->m_pDevice )
+	{
+		m_ctx->m_pDevice->ScrubFBOMap( this );
+	}
+
+	if ( m_bMipGenPending )
+	{
+		m_ctx->m_PendingMipGen.FindAndFastRemove( this );
+		m_bMipGenPending = false;
+	}
+
+	if ( m_bResolvePending )
+	{
+		m_ctx->m_PendingResolves.FindAndFastRemove( this );
+		m_bResolvePending = false;
+	}
+
+	if ( m_pCompressJob )
+	{
+		m_ctx->CancelTexCompress( this );
+	}
+
+	if ( m_pShadowLayout )
+	{
+		m_ctx->m_texLayoutTable->DelLayoutRef( m_pShadowLayout );
+		m_pShadowLayout = NULL;
+	}
+
+	if ( m_pAtlas )
+	{
+		m_ctx->ReleaseAtlasLayer( this );
+	}
+
 	if ( !(m_layout->m_key.m_texFlags & kGLMTexRenderable) )
 	{
 		int formindex = sEncodeLayoutAsIndex( &m_layout->m_key );
@@ -992,6 +1323,29 @@ CGLMTex::~CGLMTex( )
 	}
 	
 	GLMPRINTF(("-A- -**TEXDEL '%-60s' name=%06d  size=%09d  storage=%08x label=%s ", m_layout->m_layoutSummary, m_texName, m_layout->m_storageTotalSize, m_backing, m_debugLabel ? m_debugLabel : "-" ));
+
+	UnlinkBackingLRU();
+	m_ctx->RemoveResidentTex( this );
+
+	if ( m_bStreamPending )
+	{
+		m_ctx->m_StreamingTextures.FindAndRemove( this );
+		m_bStreamPending = false;
+	}
+
+	if ( HasDirtyRegions() )
+	{
+		m_ctx->m_DirtyTextures.FindAndFastRemove( this );
+		m_DirtyRegions.RemoveAll();
+	}
+
+	DiscardReadback();
+	if ( m_nReadbackPBO )
+	{
+		gGL->glDeleteBuffersARB( 1, &m_nReadbackPBO );
+		m_nReadbackPBO = 0;
+	}
+
 	// check first to see if we were still bound anywhere or locked... these should be failures.
 	
 	if ( m_pBlitSrcFBO )
@@ -1013,6 +1367,7 @@ CGLMTex::~CGLMTex( )
 	}
 
 	// if all that is OK, then delete the underlying tex
+	DeleteSRGBView();
 	if ( m_texName )
 	{
 		gGL->glDeleteTextures( 1, &m_texName );
@@ -1115,6 +1470,12 @@ void CGLMTex::ReadTexels( GLMTexLockDesc *desc, bool readWholeSlice )
 	{
 		readBox = desc->m_req.m_region;
 	}
+
+	if ( m_bDecodeDXT )
+	{
+		// GL only has the decoded texels, m_backing is all there is
+		return;
+	}
 	
 	CGLMTex *pPrevTex = m_ctx->m_samplers[0].m_pBoundTex;
 	m_ctx->BindTexToTMU( this, 0 );		// SelectTMU(n) is a side effect
@@ -1160,7 +1521,7 @@ void CGLMTex::ReadTexels( GLMTexLockDesc *desc, bool readWholeSlice )
 					
 					gGL->glGetTexImage(			target,						// target
 											desc->m_req.m_mip,			// level
-											format->m_glDataFormat,		// dataformat
+											GetGLDataFormat(),			// dataformat
 											format->m_glDataType,		// datatype
 											sliceAddress );				// destination
 				}
@@ -1176,81 +1537,864 @@ void CGLMTex::ReadTexels( GLMTexLockDesc *desc, bool readWholeSlice )
 	m_ctx->BindTexToTMU( pPrevTex, 0 );
 }
 
-// TexSubImage should work properly on every driver stack and GPU--enabling by default.
-ConVar	gl_enabletexsubimage( "gl_enabletexsubimage", "1" );
+bool CGLMTex::CanReadbackAsync( void )
+{
+	return gGL->m_bHave_GL_ARB_sync && ( gl_async_readback.GetInt() != 0 ) && !m_bDecodeDXT;
+}
 
-void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDataWrite )
+void CGLMTex::IssueReadback( int sliceIndex )
 {
-	//if ( m_nBindlessHashNumEntries )
-	//	return;
-	
-	GLMRegion	writeBox;
+	Assert( CanReadbackAsync() );
 
-	bool needsExpand = false;
-	char *expandTemp = NULL;
-	
-	switch( m_layout->m_format->m_d3dFormat)
+	// only one slice in flight per texture, a newer request replaces the old one
+	DiscardReadback();
+
+	EnsureGLTexture();
+
+	GLMTexFormatDesc *format = m_layout->m_format;
+	GLMTexLayoutSlice *slice = &m_layout->m_slices[ sliceIndex ];
+	int face = sliceIndex % m_layout->m_faceCount;
+	int mip = sliceIndex / m_layout->m_faceCount;
+
+	if ( !m_nReadbackPBO )
 	{
-		case D3DFMT_V8U8:
-		{
-			needsExpand = true;
-			writeWholeSlice = true;
-			
-			// shoot down client storage if we have to generate a new flavor of the data
-			m_texClientStorage = false;
-		}
-		break;
+		gGL->glGenBuffersARB( 1, &m_nReadbackPBO );
 	}
-	
-	if (writeWholeSlice)
+	gGL->glBindBufferARB( GL_PIXEL_PACK_BUFFER_ARB, m_nReadbackPBO );
+	if ( m_nReadbackPBOSize < slice->m_storageSize )
 	{
-		writeBox.xmin = writeBox.ymin = writeBox.zmin = 0;
+		gGL->glBufferDataARB( GL_PIXEL_PACK_BUFFER_ARB, slice->m_storageSize, NULL, GL_STREAM_READ_ARB );
+		m_nReadbackPBOSize = slice->m_storageSize;
+	}
 
-		writeBox.xmax = m_layout->m_slices[ desc->m_sliceIndex ].m_xSize;
-		writeBox.ymax = m_layout->m_slices[ desc->m_sliceIndex ].m_ySize;
-		writeBox.zmax = m_layout->m_slices[ desc->m_sliceIndex ].m_zSize;
+	CGLMTex *pPrevTex = m_ctx->m_samplers[0].m_pBoundTex;
+	m_ctx->BindTexToTMU( this, 0 );		// SelectTMU(n) is a side effect
+
+	GLenum target = m_layout->m_key.m_texGLTarget;
+	if ( target == GL_TEXTURE_CUBE_MAP )
+	{
+		target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+	}
+
+	// with a pack buffer bound the destination is an offset, and the driver can queue the copy instead of draining the pipe
+	if (format->m_chunkSize != 1)
+	{
+		gGL->glGetCompressedTexImage( target, mip, NULL );
 	}
 	else
 	{
-		writeBox = desc->m_req.m_region;
+		gGL->glGetTexImage( target, mip, GetGLDataFormat(), format->m_glDataType, NULL );
 	}
 
-	// first thing is to get the GL texture bound to a TMU, or just select one if already bound
-	// to get this running we will just always slam TMU 0 and let the draw time code fix it back
-	// a later optimization would be to hoist the bind call to the caller, do it exactly once
-	
-	CGLMTex *pPrevTex = m_ctx->m_samplers[0].m_pBoundTex;
-	m_ctx->BindTexToTMU( this, 0 );		// SelectTMU(n) is a side effect
+	gGL->glBindBufferARB( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+	m_ctx->BindTexToTMU( pPrevTex, 0 );
+
+	m_nReadbackSync = gGL->glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	m_nReadbackSlice = sliceIndex;
+	m_nReadbackBatch = m_ctx->m_nBatchCounter;
+}
+
+bool CGLMTex::IsReadbackBusy( int sliceIndex )
+{
+	if ( m_nReadbackSlice != sliceIndex )
+		return false;
+
+	// flush on the poll, or a caller spinning on D3DERR_WASSTILLDRAWING could wait on a fence the driver never submitted
+	GLenum nResult = gGL->glClientWaitSync( m_nReadbackSync, GL_SYNC_FLUSH_COMMANDS_BIT, 0 );
+	return ( nResult != GL_ALREADY_SIGNALED ) && ( nResult != GL_CONDITION_SATISFIED );
+}
+
+bool CGLMTex::ConsumeReadback( int sliceIndex )
+{
+	if ( !IsReadbackPending( sliceIndex ) )
+		return false;
+
+	Assert( m_backing );
+	
+	const GLuint64 timeout = 10 * ((GLuint64)1000 * 1000 * 1000);  // 10 seconds in nanoseconds.
+	GLenum nResult = gGL->glClientWaitSync( m_nReadbackSync, GL_SYNC_FLUSH_COMMANDS_BIT, timeout );
+	if ( ( nResult != GL_ALREADY_SIGNALED ) && ( nResult != GL_CONDITION_SATISFIED ) )
+	{
+		// let the caller read it the slow way
+		DiscardReadback();
+		return false;
+	}
+
+	GLMTexLayoutSlice *slice = &m_layout->m_slices[ sliceIndex ];
+
+	gGL->glBindBufferARB( GL_PIXEL_PACK_BUFFER_ARB, m_nReadbackPBO );
+	void *pTexels = gGL->glMapBufferARB( GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB );
+	if ( pTexels )
+	{
+		memcpy( m_backing + slice->m_storageOffset, pTexels, slice->m_storageSize );
+		gGL->glUnmapBuffer( GL_PIXEL_PACK_BUFFER_ARB );
+	}
+	gGL->glBindBufferARB( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+
+	DiscardReadback();
+
+	return pTexels != NULL;
+}
+
+void CGLMTex::DiscardReadbackIfDrawn( void )
+{
+	if ( !m_nReadbackSync || ( m_nReadbackBatch == m_ctx->m_nBatchCounter ) || !m_ctx->m_drawingFBO )
+		return;
+
+	// the device also calls this on the outgoing targets when the drawing FBO changes, so draws made while we were attached get caught later too
+	for ( int i = 0; i < kAttCount; i++ )
+	{
+		if ( m_ctx->m_drawingFBO->m_attach[i].m_tex == this )
+		{
+			DiscardReadback();
+			return;
+		}
+	}
+}
+
+void CGLMTex::DiscardReadback( void )
+{
+	if ( m_nReadbackSync )
+	{
+		gGL->glDeleteSync( m_nReadbackSync );
+		m_nReadbackSync = 0;
+	}
+	m_nReadbackSlice = -1;
+}
+
+void CGLMTex::MaterializeBacking( void )
+{
+	if ( !m_backing )
+	{
+		m_backing = (char *)malloc( m_layout->m_storageTotalSize );
+		memset( m_backing, 0, m_layout->m_storageTotalSize );
+
+		for( int i=0; i<m_layout->m_sliceCount; i++)
+		{
+			m_sliceFlags[i] &= ~kSliceStorageValid;
+		}
+	}
+
+	for( int face=0; face <m_layout->m_faceCount; face++)
+	{
+		for( int mip=0; mip <m_layout->m_mipCount; mip++)
+		{
+			int sliceIndex = CalcSliceIndex( face, mip );
+			if ( ( m_sliceFlags[ sliceIndex ] & ( kSliceValid | kSliceStorageValid ) ) != kSliceValid )
+				continue;
+
+			GLMTexLockDesc desc;
+			memset( &desc, 0, sizeof( desc ) );
+
+			desc.m_req.m_tex = this;
+			desc.m_req.m_face = face;
+			desc.m_req.m_mip = mip;
+			desc.m_sliceIndex = sliceIndex;
+			desc.m_sliceBaseOffset = m_layout->m_slices[ sliceIndex ].m_storageOffset;
+			desc.m_sliceRegionOffset = desc.m_sliceBaseOffset;
+
+			ReadTexels( &desc, true );
+
+			m_sliceFlags[ sliceIndex ] |= kSliceStorageValid;
+		}
+	}
+}
+
+bool CGLMTex::CanReleaseBacking( void )
+{
+	// with client storage GL keeps pointing at m_backing
+	// and decoded DXT can't be read back out of GL as blocks
+	if ( !m_backing || m_lockCount || HasDirtyRegions() || m_bDecodeDXT || ( m_layout->m_key.m_texFlags & kGLMTexRenderable ) || UsesAppleClientStorage() )
+		return false;
+
+	// only once GL holds every slice, so it can always be copied back out
+	for( int i=0; i<m_layout->m_sliceCount; i++)
+	{
+		if ( !( m_sliceFlags[i] & kSliceValid ) )
+			return false;
+	}
+
+	return true;
+}
+
+void CGLMTex::ReleaseBacking( void )
+{
+	Assert( !m_bInBackingLRU && !m_lockCount );
+
+	if ( m_backing )
+	{
+		free( m_backing );
+		m_backing = NULL;
+	}
+
+	for( int i=0; i<m_layout->m_sliceCount; i++)
+	{
+		m_sliceFlags[i] &= ~kSliceStorageValid;
+	}
+}
+
+void CGLMTex::LinkBackingLRU( void )
+{
+	UnlinkBackingLRU();
+
+	// most recently used goes at the tail
+	m_pPrevBackingLRU = m_ctx->m_pTexBackingLRUTail;
+	m_pNextBackingLRU = NULL;
+	if ( m_pPrevBackingLRU )
+	{
+		m_pPrevBackingLRU->m_pNextBackingLRU = this;
+	}
+	else
+	{
+		m_ctx->m_pTexBackingLRUHead = this;
+	}
+	m_ctx->m_pTexBackingLRUTail = this;
+
+	m_ctx->m_nTexBackingLRUBytes += m_layout->m_storageTotalSize;
+	m_bInBackingLRU = true;
+}
+
+void CGLMTex::UnlinkBackingLRU( void )
+{
+	if ( !m_bInBackingLRU )
+		return;
+
+	if ( m_pPrevBackingLRU )
+	{
+		m_pPrevBackingLRU->m_pNextBackingLRU = m_pNextBackingLRU;
+	}
+	else
+	{
+		Assert( m_ctx->m_pTexBackingLRUHead == this );
+		m_ctx->m_pTexBackingLRUHead = m_pNextBackingLRU;
+	}
+
+	if ( m_pNextBackingLRU )
+	{
+		m_pNextBackingLRU->m_pPrevBackingLRU = m_pPrevBackingLRU;
+	}
+	else
+	{
+		Assert( m_ctx->m_pTexBackingLRUTail == this );
+		m_ctx->m_pTexBackingLRUTail = m_pPrevBackingLRU;
+	}
+
+	m_pPrevBackingLRU = m_pNextBackingLRU = NULL;
+
+	Assert( m_ctx->m_nTexBackingLRUBytes >= (uint64)m_layout->m_storageTotalSize );
+	m_ctx->m_nTexBackingLRUBytes -= m_layout->m_storageTotalSize;
+	m_bInBackingLRU = false;
+}
+
+bool CGLMTex::CanEvict( void )
+{
+	// RT contents only live in GL, and client storage textures don't cost VRAM of their own anyway
+	if ( !m_bManaged || !m_texName || m_lockCount || m_bStreamPending || HasDirtyRegions() || ( m_layout->m_key.m_texFlags & kGLMTexRenderable ) || UsesAppleClientStorage() )
+		return false;
+
+	for( int i=0; i<GLM_SAMPLER_COUNT; i++)
+	{
+		if ( m_ctx->m_samplers[i].m_pBoundTex == this )
+			return false;
+	}
+
+	return true;
+}
+
+void CGLMTex::Evict( void )
+{
+	Assert( CanEvict() );
+
+	GLMPRINTF(("-A- -**TEXEVICT '%-60s' name=%06d  size=%09d  label=%s ", m_layout->m_layoutSummary, m_texName, m_layout->m_storageTotalSize, m_debugLabel ? m_debugLabel : "-" ));
+
+	// m_backing becomes the only copy, so it has to hold everything and stay put
+	UnlinkBackingLRU();
+	MaterializeBacking();
+	DiscardReadback();
+
+	m_ctx->RemoveResidentTex( this );
+
+	DeleteSRGBView();
+	gGL->glDeleteTextures( 1, &m_texName );
+	m_texName = 0;
+
+	for( int i=0; i<m_layout->m_sliceCount; i++)
+	{
+		m_sliceFlags[i] &= ~kSliceValid;
+	}
+
+	// the new GL object starts from scratch
+	m_maxActiveMip = -1;
+	m_minActiveMip = 999;
+	m_texPreloaded = false;
+	m_bEvicted = true;
+}
+
+bool CGLMTex::CanStreamSlice( int sliceIndex )
+{
+	// BASE_LEVEL only moves on immutable textures, and autogen / RT chains get their mips from the GPU
+	if ( !gl_texstream.GetInt() || !m_bImmutableStorage || ( m_layout->m_key.m_texFlags & ( kGLMTexRenderable | kGLMTexMippedAuto ) ) )
+		return false;
+
+	// only first uploads - a slice that has been sampled already must not go stale
+	if ( m_sliceFlags[ sliceIndex ] & kSliceValid )
+		return false;
+
+	// the coarsest mip always goes right away so there's something to sample, as do the small ones.
+	// mip sizes only shrink, so the deferred ones stay contiguous from level 0 down.
+	int mip = sliceIndex / m_layout->m_faceCount;
+	if ( mip >= ( m_layout->m_mipCount - 1 ) )
+		return false;
+
+	return m_layout->m_slices[ sliceIndex ].m_storageSize >= ( gl_texstream_min_kb.GetInt() * 1024 );
+}
+
+int CGLMTex::StreamNextMip( void )
+{
+	// a locked texture is still being written, try next frame
+	if ( m_lockCount )
+		return 0;
+
+	// coarsest first, so BASE_LEVEL can come down one level at a time
+	int mip = -1;
+	for( int slice = m_layout->m_sliceCount - 1; slice >= 0; slice-- )
+	{
+		if ( m_sliceFlags[ slice ] & kSliceStreamPending )
+		{
+			mip = slice / m_layout->m_faceCount;
+			break;
+		}
+	}
+
+	if ( mip < 0 )
+		return 0;
+
+	int nBytes = 0;
+	for( int face=0; face <m_layout->m_faceCount; face++)
+	{
+		int sliceIndex = CalcSliceIndex( face, mip );
+		if ( !( m_sliceFlags[ sliceIndex ] & kSliceStreamPending ) )
+			continue;
+
+		GLMTexLayoutSlice *slice = &m_layout->m_slices[ sliceIndex ];
+
+		GLMTexLockDesc desc;
+		memset( &desc, 0, sizeof( desc ) );
+
+		desc.m_req.m_tex = this;
+		desc.m_req.m_face = face;
+		desc.m_req.m_mip = mip;
+		desc.m_req.m_region.xmax = slice->m_xSize;
+		desc.m_req.m_region.ymax = slice->m_ySize;
+		desc.m_req.m_region.zmax = slice->m_zSize;
+		desc.m_sliceIndex = sliceIndex;
+		desc.m_sliceBaseOffset = slice->m_storageOffset;
+		desc.m_sliceRegionOffset = desc.m_sliceBaseOffset;
+
+		m_sliceFlags[ sliceIndex ] &= ~kSliceStreamPending;
+		WriteTexels( &desc, true );
+
+		nBytes += slice->m_storageSize;
+	}
+
+	return nBytes;
+}
+
+static inline int RegionVolume( const GLMRegion &box )
+{
+	return ( box.xmax - box.xmin ) * ( box.ymax - box.ymin ) * ( box.zmax - box.zmin );
+}
+
+static inline void UnionRegion( GLMRegion *pDst, const GLMRegion &box )
+{
+	pDst->xmin = MIN( pDst->xmin, box.xmin );	pDst->xmax = MAX( pDst->xmax, box.xmax );
+	pDst->ymin = MIN( pDst->ymin, box.ymin );	pDst->ymax = MAX( pDst->ymax, box.ymax );
+	pDst->zmin = MIN( pDst->zmin, box.zmin );	pDst->zmax = MAX( pDst->zmax, box.zmax );
+}
+
+#define GLM_MAX_DIRTY_REGIONS_PER_SLICE	8
+
+void CGLMTex::AddDirtyRegion( int sliceIndex, const GLMRegion &box )
+{
+	if ( !HasDirtyRegions() )
+	{
+		m_ctx->m_DirtyTextures.AddToTail( this );
+	}
+
+	// fold it into an existing rect if the union doesn't drag in much that's clean
+	// (glyphs and lightmap pages tend to land right next to each other, so this catches most of them)
+	int nSliceRegions = 0;
+	int nFirst = -1;
+	for( int i=0; i<m_DirtyRegions.Count(); i++ )
+	{
+		GLMTexDirtyRegion &dirty = m_DirtyRegions[i];
+		if ( dirty.m_sliceIndex != sliceIndex )
+			continue;
+
+		GLMRegion merged = dirty.m_region;
+		UnionRegion( &merged, box );
+		if ( RegionVolume( merged ) * 4 <= ( RegionVolume( dirty.m_region ) + RegionVolume( box ) ) * 5 )
+		{
+			dirty.m_region = merged;
+			return;
+		}
+
+		nSliceRegions++;
+		if ( nFirst < 0 )
+		{
+			nFirst = i;
+		}
+	}
+
+	if ( nSliceRegions < GLM_MAX_DIRTY_REGIONS_PER_SLICE )
+	{
+		GLMTexDirtyRegion dirty;
+		dirty.m_sliceIndex = sliceIndex;
+		dirty.m_region = box;
+		m_DirtyRegions.AddToTail( dirty );
+		return;
+	}
+
+	// too scattered to be worth tracking, one bounding box for the whole slice
+	GLMRegion *pBounds = &m_DirtyRegions[ nFirst ].m_region;
+	UnionRegion( pBounds, box );
+	for( int i=m_DirtyRegions.Count()-1; i>nFirst; i-- )
+	{
+		if ( m_DirtyRegions[i].m_sliceIndex == sliceIndex )
+		{
+			UnionRegion( pBounds, m_DirtyRegions[i].m_region );
+			m_DirtyRegions.Remove( i );
+		}
+	}
+}
+
+void CGLMTex::DropDirtyRegions( int sliceIndex )
+{
+	for( int i=m_DirtyRegions.Count()-1; i>=0; i-- )
+	{
+		if ( m_DirtyRegions[i].m_sliceIndex == sliceIndex )
+		{
+			m_DirtyRegions.Remove( i );
+		}
+	}
+
+	if ( !HasDirtyRegions() )
+	{
+		m_ctx->m_DirtyTextures.FindAndFastRemove( this );
+	}
+}
+
+void CGLMTex::FlushDirtyRegions( void )
+{
+	if ( !HasDirtyRegions() )
+		return;
+
+	m_ctx->m_DirtyTextures.FindAndFastRemove( this );
+
+	// WriteTexels drops a slice's regions when it sends the whole thing, so work on a copy
+	CUtlVector<GLMTexDirtyRegion> regions;
+	regions.Swap( m_DirtyRegions );
+
+	for( int i=0; i<regions.Count(); i++ )
+	{
+		GLMTexLockDesc desc;
+		memset( &desc, 0, sizeof( desc ) );
+
+		int sliceIndex = regions[i].m_sliceIndex;
+		
+		desc.m_req.m_tex = this;
+		desc.m_req.m_face = sliceIndex % m_layout->m_faceCount;
+		desc.m_req.m_mip = sliceIndex / m_layout->m_faceCount;
+		desc.m_req.m_region = regions[i].m_region;
+		desc.m_sliceIndex = sliceIndex;
+		desc.m_sliceBaseOffset = m_layout->m_slices[ sliceIndex ].m_storageOffset;
+		desc.m_sliceRegionOffset = desc.m_sliceBaseOffset;
+
+		WriteTexels( &desc, false );
+	}
+
+	if ( CanReleaseBacking() )
+	{
+		LinkBackingLRU();
+	}
+}
+
+bool CGLMTex::CanQueueCompression( void )
+{
+	if ( !m_bCompressCandidate || m_pCompressJob || m_pShadowLayout || !m_ctx->m_pTexCompressor || !m_backing )
+		return false;
+
+	if ( m_lockCount || m_bStreamPending || HasDirtyRegions() || UsesAppleClientStorage() )
+		return false;
+
+	// the job copies m_backing, so every slice has to be in there (a mip chain still being filled in doesn't qualify yet,
+	// slices only become kSliceStorageValid as they're locked)
+	for( int i=0; i<m_layout->m_sliceCount; i++)
+	{
+		if ( !( m_sliceFlags[i] & kSliceStorageValid ) )
+			return false;
+	}
+
+	return true;
+}
+
+void CGLMTex::SwapLayout( GLMTexLayout *newLayout, char *newBacking )
+{
+	UnlinkBackingLRU();
+	DiscardReadback();
+
+	// any blit FBO's have the old GL name attached
+	if ( m_pBlitSrcFBO )
+	{
+		m_ctx->DelFBO( m_pBlitSrcFBO );
+		m_pBlitSrcFBO = NULL;
+	}
+
+	if ( m_pBlitDstFBO )
+	{
+		m_ctx->DelFBO( m_pBlitDstFBO );
+		m_pBlitDstFBO = NULL;
+	}
+
+	if ( m_texName )
+	{
+		m_ctx->RemoveResidentTex( this );
+
+		DeleteSRGBView();
+		gGL->glDeleteTextures( 1, &m_texName );
+		m_texName = 0;
+	}
+
+	if ( m_backing )
+	{
+		free( m_backing );
+	}
+
+	g_texGlobalBytes[ sEncodeLayoutAsIndex( &m_layout->m_key ) ] -= m_layout->m_storageTotalSize;
+	g_texGlobalBytes[ sEncodeLayoutAsIndex( &newLayout->m_key ) ] += newLayout->m_storageTotalSize;
+
+	m_layout = newLayout;
+	m_backing = newBacking;
+
+	Assert( m_sliceFlags.Count() == m_layout->m_sliceCount );
+	for( int i=0; i<m_layout->m_sliceCount; i++)
+	{
+		m_sliceFlags[i] = kSliceStorageValid;
+	}
+
+	// same as coming back from an eviction, CreateGLTexture sends every slice from m_backing
+	m_maxActiveMip = -1;
+	m_minActiveMip = 999;
+	m_texPreloaded = false;
+	m_bEvicted = true;
+
+	// samplers still pointing at us need the new GL object
+	for( int i=0; i<GLM_SAMPLER_COUNT; i++)
+	{
+		if ( m_ctx->m_samplers[i].m_pBoundTex == this )
+		{
+			m_ctx->BindTexToTMU( this, i );
+			m_ctx->SetSamplerDirty( i );
+		}
+	}
+}
+
+void CGLMTex::ApplyCompression( void )
+{
+	GLMTexCompressJob_t *pJob = m_pCompressJob;
+	Assert( pJob && pJob->m_bDone );
+
+	GLMTexLayoutKey newKey = m_layout->m_key;
+	newKey.m_texFormat = pJob->m_nResultFormat;
+
+	GLMTexLayout *newLayout = m_ctx->m_texLayoutTable->NewLayoutRef( &newKey );
+
+	bool bMatch = ( newLayout->m_sliceCount == pJob->m_Slices.Count() );
+	for( int i=0; bMatch && i<newLayout->m_sliceCount; i++)
+	{
+		bMatch = ( newLayout->m_slices[i].m_storageSize == pJob->m_Slices[i].m_nDstSize );
+	}
+
+	if ( !bMatch )
+	{
+		Assert( !"Runtime compression result doesn't match the layout" );
+		m_ctx->m_texLayoutTable->DelLayoutRef( newLayout );
+		m_ctx->m_pTexCompressor->ReleaseJob( pJob );
+		m_pCompressJob = NULL;
+		m_bCompressCandidate = false;
+		return;
+	}
+
+	char *newBacking = (char *)malloc( newLayout->m_storageTotalSize );
+	for( int i=0; i<newLayout->m_sliceCount; i++)
+	{
+		memcpy( newBacking + newLayout->m_slices[i].m_storageOffset, pJob->m_Result.Base() + pJob->m_Slices[i].m_nDstOffset, pJob->m_Slices[i].m_nDstSize );
+	}
+
+	GLMPRINTF(("-A- -**TEXCOMPRESS '%-60s' name=%06d  size=%09d -> %09d  label=%s ", m_layout->m_layoutSummary, m_texName, m_layout->m_storageTotalSize, newLayout->m_storageTotalSize, m_debugLabel ? m_debugLabel : "-" ));
+
+	// hang on to the original texels, a Lock wants them back in the original format
+	m_pShadowLayout = m_layout;
+	m_ShadowTexels.Swap( pJob->m_Src );
+
+	m_ctx->m_pTexCompressor->ReleaseJob( pJob );
+	m_pCompressJob = NULL;
+
+	SwapLayout( newLayout, newBacking );
+}
+
+void CGLMTex::DropCompression( void )
+{
+	if ( m_pCompressJob )
+	{
+		m_ctx->CancelTexCompress( this );
+	}
+
+	if ( m_pShadowLayout )
+	{
+		GLMTexLayout *shadowLayout = m_pShadowLayout;
+		GLMTexLayout *compressedLayout = m_layout;
+		m_pShadowLayout = NULL;
+
+		// keep whatever SRGB state got set while we were compressed
+		if ( ( shadowLayout->m_key.m_texFlags ^ compressedLayout->m_key.m_texFlags ) & kGLMTexSRGB )
+		{
+			GLMTexLayoutKey newKey = shadowLayout->m_key;
+			newKey.m_texFlags = ( newKey.m_texFlags & ~kGLMTexSRGB ) | ( compressedLayout->m_key.m_texFlags & kGLMTexSRGB );
+
+			GLMTexLayout *newLayout = m_ctx->m_texLayoutTable->NewLayoutRef( &newKey );
+			m_ctx->m_texLayoutTable->DelLayoutRef( shadowLayout );
+			shadowLayout = newLayout;
+		}
+
+		Assert( m_ShadowTexels.Count() == shadowLayout->m_storageTotalSize );
+		char *newBacking = (char *)malloc( shadowLayout->m_storageTotalSize );
+		memcpy( newBacking, m_ShadowTexels.Base(), shadowLayout->m_storageTotalSize );
+		m_ShadowTexels.Purge();
+
+		GLMPRINTF(("-A- -**TEXUNCOMPRESS '%-60s' name=%06d  label=%s ", shadowLayout->m_layoutSummary, m_texName, m_debugLabel ? m_debugLabel : "-" ));
+
+		SwapLayout( shadowLayout, newBacking );
+		m_ctx->m_texLayoutTable->DelLayoutRef( compressedLayout );
+	}
+
+	// textures that keep getting touched after compressing (streamed in a mip at a time, refreshed now and then) stop being candidates,
+	// the first few times the next full unlock just compresses it again
+	if ( ++m_nCompressDrops >= GLM_TEX_MAX_COMPRESS_DROPS )
+	{
+		m_bCompressCandidate = false;
+	}
+}
+
+bool CGLMTex::CanAtlas( void )
+{
+	if ( !m_bAtlasCandidate || m_pAtlas || !m_ctx->m_bUseTexAtlas || !m_backing )
+		return false;
+
+	if ( m_lockCount || m_bStreamPending || HasDirtyRegions() || UsesAppleClientStorage() || m_pCompressJob || m_pShadowLayout )
+		return false;
+
+	// the layer goes up straight from m_backing, so it has to be in the form GL stores
+	if ( m_bSwizzledFormat || m_bDecodeDXT || NeedsTexelExpand() )
+		return false;
+
+	for( int i=0; i<m_layout->m_sliceCount; i++)
+	{
+		if ( !( m_sliceFlags[i] & kSliceStorageValid ) )
+			return false;
+	}
+
+	return true;
+}
+
+void CGLMTex::CopyToAtlasLayer( GLMTexAtlas *atlas, int layer )
+{
+	Assert( ( atlas->m_layout == m_layout ) && m_backing );
+
+	GLMTexFormatDesc *format = m_layout->m_format;
+	GLenum intformat = GetGLIntFormat();
+	GLenum glDataFormat = GetGLDataFormat();
+	bool compressed = ( format->m_chunkSize != 1 );
+
+	// TMU 0 gets used for this like every other upload, its array binding is put back at the end
+	m_ctx->SelectTMU( 0 );
+
+	if ( !atlas->m_texName )
+	{
+		gGL->glGenTextures( 1, &atlas->m_texName );
+		gGL->glBindTexture( GL_TEXTURE_2D_ARRAY_EXT, atlas->m_texName );
+
+		int nLayers = atlas->m_Layers.Count();
+		GLMTexLayoutSlice *slice = &m_layout->m_slices[0];
+		if ( gGL->m_bHave_GL_ARB_texture_storage && gl_texstorage.GetInt() && IsImmutableStorageFormat( intformat ) )
+		{
+			gGL->glTexStorage3D( GL_TEXTURE_2D_ARRAY_EXT, m_layout->m_mipCount, intformat, slice->m_xSize, slice->m_ySize, nLayers );
+		}
+		else
+		{
+			for( int mip=0; mip<m_layout->m_mipCount; mip++)
+			{
+				slice = &m_layout->m_slices[ CalcSliceIndex( 0, mip ) ];
+				if ( compressed )
+				{
+					gGL->glCompressedTexImage3D( GL_TEXTURE_2D_ARRAY_EXT, mip, intformat, slice->m_xSize, slice->m_ySize, nLayers, 0, slice->m_storageSize * nLayers, NULL );
+				}
+				else
+				{
+					gGL->glTexImage3D( GL_TEXTURE_2D_ARRAY_EXT, mip, intformat, slice->m_xSize, slice->m_ySize, nLayers, 0, glDataFormat, format->m_glDataType, NULL );
+				}
+			}
+		}
+
+		// every layer is complete when it goes in, so all the levels are live
+		gGL->glTexParameteri( GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_BASE_LEVEL, 0 );
+		gGL->glTexParameteri( GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAX_LEVEL, m_layout->m_mipCount - 1 );
+
+		atlas->m_SamplingParams.SetToDefaults();
+		atlas->m_SamplingParams.SetToTarget( GL_TEXTURE_2D_ARRAY_EXT );
+	}
+	else
+	{
+		gGL->glBindTexture( GL_TEXTURE_2D_ARRAY_EXT, atlas->m_texName );
+	}
+
+	for( int mip=0; mip<m_layout->m_mipCount; mip++)
+	{
+		GLMTexLayoutSlice *slice = &m_layout->m_slices[ CalcSliceIndex( 0, mip ) ];
+		char *sliceAddress = m_backing + slice->m_storageOffset;
+
+		if ( compressed )
+		{
+			gGL->glCompressedTexSubImage3D( GL_TEXTURE_2D_ARRAY_EXT, mip, 0, 0, layer, slice->m_xSize, slice->m_ySize, 1, intformat, slice->m_storageSize, sliceAddress );
+		}
+		else
+		{
+			gGL->glTexSubImage3D( GL_TEXTURE_2D_ARRAY_EXT, mip, 0, 0, layer, slice->m_xSize, slice->m_ySize, 1, glDataFormat, format->m_glDataType, sliceAddress );
+		}
+	}
+
+	GLMTexAtlas *pBoundAtlas = m_ctx->m_samplers[0].m_pBoundAtlas;
+	gGL->glBindTexture( GL_TEXTURE_2D_ARRAY_EXT, pBoundAtlas ? pBoundAtlas->m_texName : 0 );
+}
+
+// TexSubImage should work properly on every driver stack and GPU--enabling by default.
+ConVar	gl_enabletexsubimage( "gl_enabletexsubimage", "1" );
+
+void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDataWrite )
+{
+	// a readback issued before these texels went in would hand back stale data
+	if ( IsReadbackPending( desc->m_sliceIndex ) )
+	{
+		DiscardReadback();
+	}
+
+	//if ( m_nBindlessHashNumEntries )
+	//	return;
+	
+	GLMRegion	writeBox;
+
+	bool needsExpand = false;
+	char *expandTemp = NULL;
+
+	if ( NeedsTexelExpand() )
+	{
+		needsExpand = true;
+		writeWholeSlice = true;
+		
+		// shoot down client storage if we have to generate a new flavor of the data
+		m_texClientStorage = false;
+	}
+	
+	if (writeWholeSlice)
+	{
+		writeBox.xmin = writeBox.ymin = writeBox.zmin = 0;
+
+		writeBox.xmax = m_layout->m_slices[ desc->m_sliceIndex ].m_xSize;
+		writeBox.ymax = m_layout->m_slices[ desc->m_sliceIndex ].m_ySize;
+		writeBox.zmax = m_layout->m_slices[ desc->m_sliceIndex ].m_zSize;
+	}
+	else
+	{
+		writeBox = desc->m_req.m_region;
+
+		// DXT regions have to start on a block and cover whole blocks, or run to the edge of the slice
+		int chunk = m_layout->m_format->m_chunkSize;
+		if ( chunk != 1 )
+		{
+			GLMTexLayoutSlice *pSlice = &m_layout->m_slices[ desc->m_sliceIndex ];
+
+			writeBox.xmin &= ~( chunk - 1 );
+			writeBox.ymin &= ~( chunk - 1 );
+			writeBox.xmax = MIN( ALIGN_VALUE( writeBox.xmax, chunk ), pSlice->m_xSize );
+			writeBox.ymax = MIN( ALIGN_VALUE( writeBox.ymax, chunk ), pSlice->m_ySize );
+		}
+	}
+
+	// first thing is to get the GL texture bound to a TMU, or just select one if already bound
+	// to get this running we will just always slam TMU 0 and let the draw time code fix it back
+	// a later optimization would be to hoist the bind call to the caller, do it exactly once
+	
+	CGLMTex *pPrevTex = m_ctx->m_samplers[0].m_pBoundTex;
+	m_ctx->BindTexToTMU( this, 0 );		// SelectTMU(n) is a side effect
 
 	GLMTexFormatDesc *format = m_layout->m_format;
 	
 	GLenum target		= m_layout->m_key.m_texGLTarget;
-	GLenum glDataFormat	= format->m_glDataFormat;				// this could change if expansion kicks in 
+	GLenum glDataFormat	= GetGLDataFormat();					// this could change if expansion kicks in 
 	GLenum glDataType	= format->m_glDataType;
 	
 	GLMTexLayoutSlice *slice = &m_layout->m_slices[ desc->m_sliceIndex ];		
-	void *sliceAddress = m_backing ? (m_backing + slice->m_storageOffset) : NULL;	// this would change for PBO
+	void *sliceAddress = m_backing ? (m_backing + slice->m_storageOffset) : NULL;
+
+	// texels locked into a PBO start right at the region corner, not at the start of the slice
+	int skipPixels = writeBox.xmin;
+	int skipRows = writeBox.ymin;
+	int skipImages = writeBox.zmin;
+	if ( desc->m_pPixelUnpackBuffer )
+	{
+		Assert( !needsExpand );
+		Assert( !writeWholeSlice || ( desc->m_sliceRegionOffset == desc->m_sliceBaseOffset ) );
+
+		gGL->glBindBufferARB( GL_PIXEL_UNPACK_BUFFER_ARB, desc->m_pPixelUnpackBuffer->GetHandle() );
+		sliceAddress = reinterpret_cast< void * >( (intp)desc->m_nPixelUnpackOfs );
+		skipPixels = skipRows = skipImages = 0;
+	}
 
-	// allow use of subimage if the target is texture2D and it has already been teximage'd
+	// allow use of subimage if the slice has already been teximage'd - 2D, cube face or volume, compressed or not
 	bool mayUseSubImage = false;
-	if ( (target==GL_TEXTURE_2D) && (m_sliceFlags[ desc->m_sliceIndex ] & kSliceValid) )
+	if ( m_bImmutableStorage )
+	{
+		// teximage isn't even legal on these
+		mayUseSubImage = true;
+	}
+	else if ( m_sliceFlags[ desc->m_sliceIndex ] & kSliceValid )
 	{
 		mayUseSubImage = gl_enabletexsubimage.GetInt() != 0;
 	}
+
+	// teximage always re-specifies the whole slice
+	if ( !mayUseSubImage && !writeWholeSlice )
+	{
+		writeWholeSlice = true;
+
+		writeBox.xmin = writeBox.ymin = writeBox.zmin = 0;
+		writeBox.xmax = m_layout->m_slices[ desc->m_sliceIndex ].m_xSize;
+		writeBox.ymax = m_layout->m_slices[ desc->m_sliceIndex ].m_ySize;
+		writeBox.zmax = m_layout->m_slices[ desc->m_sliceIndex ].m_zSize;
+		skipPixels = skipRows = skipImages = 0;
+	}
+
+	// anything still queued for this slice is covered now (or stale, if this came from a PBO)
+	if ( writeWholeSlice && HasDirtyRegions() )
+	{
+		DropDirtyRegions( desc->m_sliceIndex );
+	}
 			
 	// check flavor, 2D, 3D, or cube map
 	// we also have the choice to use subimage if this is a tex already created. (open question as to benefit)
 	
 	
-	// SRGB select. At this level (writetexels) we firmly obey the m_texFlags.
-	// (mechanism not policy)
-	
-	GLenum intformat = (m_layout->m_key.m_texFlags & kGLMTexSRGB) ? format->m_glIntFormatSRGB : format->m_glIntFormat;
-	if (CommandLine()->FindParm("-disable_srgbtex"))
-	{
-		// force non srgb flavor - experiment to make ATI r600 happy on 10.5.8 (maybe x1600 too!)
-		intformat = format->m_glIntFormat;
-	}
+	GLenum intformat = GetGLIntFormat();
 	
 	Assert( intformat != 0 );
 	
@@ -1266,6 +2410,11 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 	{
 		m_maxActiveMip = desc->m_req.m_mip;
 
+		// immutable textures are complete from the start, so keep sampling off the levels that hold no texels yet
+		if ( m_bImmutableStorage )
+		{
+			gGL->glTexParameteri( target, GL_TEXTURE_MAX_LEVEL, m_maxActiveMip );
+		}
 		//gGL->glTexParameteri( target, GL_TEXTURE_MAX_LEVEL, desc->m_req.m_mip);
 	}
 	
@@ -1273,9 +2422,23 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 	{
 		m_minActiveMip = desc->m_req.m_mip;
 		
+		if ( m_bImmutableStorage )
+		{
+			gGL->glTexParameteri( target, GL_TEXTURE_BASE_LEVEL, m_minActiveMip );
+		}
 		//gGL->glTexParameteri( target, GL_TEXTURE_BASE_LEVEL, desc->m_req.m_mip);
 	}
 
+	if ( m_bImmutableStorage && noDataWrite )
+	{
+		// the storage already exists and there are no texels to send
+		Assert( !desc->m_pPixelUnpackBuffer );
+		m_sliceFlags[ desc->m_sliceIndex ] |= kSliceValid;
+
+		m_ctx->BindTexToTMU( pPrevTex, 0 );
+		return;
+	}
+
 	if (needsExpand)
 	{
 		int expandSize = 0;
@@ -1284,29 +2447,20 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 		{
 			case D3DFMT_V8U8:
 			{
-				// figure out new size based on 3byte RGB format
-				// easy, just take the two byte size and grow it by 50%
-				expandSize = (slice->m_storageSize * 3) / 2;
-				expandTemp = (char*)malloc( expandSize );
-				
-				char *src = (char*)sliceAddress;
-				char *dst = expandTemp;
+				// two byte texels grow to four, which keeps the rows aligned and the repack a pair of unpacks
+				expandSize = slice->m_storageSize * 2;
+				expandTemp = (char*)m_ctx->GetTexelConvertScratch( expandSize );
 
-				// transfer RG's to RGB's
-				while(expandSize>0)
+				if ( sliceAddress )
 				{
-					*dst = *src++;	// move first byte
-					*dst = *src++;	// move second byte
-					*reinterpret_cast<uint8*>(dst) = 0xBB;	// pad third byte
-					
-					expandSize -= 3;
+					ExpandV8U8( (uint8*)expandTemp, (const uint8*)sliceAddress, slice->m_storageSize / 2 );
+
+					// move the slice pointer
+					sliceAddress = expandTemp;
 				}
 				
-				// move the slice pointer
-				sliceAddress = expandTemp;
-				
 				// change the data format we tell GL about
-				glDataFormat = GL_RGB;
+				glDataFormat = GL_RGBA;
 			}
 			break;
 			
@@ -1315,6 +2469,14 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 		
 	}
 
+	// no S3TC - GL gets RGBA8, and from here on this is an uncompressed upload
+	bool compressedUpload = ( format->m_chunkSize != 1 ) && !m_bDecodeDXT;
+	if ( m_bDecodeDXT && sliceAddress && !noDataWrite )
+	{
+		Assert( !desc->m_pPixelUnpackBuffer );
+		sliceAddress = DecodeDXTRegion( desc->m_sliceIndex, writeBox, sliceAddress );
+	}
+
 	// set up the client storage now, one way or another
 	// If this extension isn't supported, we just end up with two copies of the texture, one in the GL and one in app memory.
 	//  So it's safe to just go on as if this extension existed and hold the possibly-unnecessary extra RAM.
@@ -1333,9 +2495,24 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 		case GL_TEXTURE_2D:
 		{			
 			// check compressed or not
-			if (format->m_chunkSize != 1)
+			if ( compressedUpload )
 			{
-				Assert( writeWholeSlice );	//subimage not implemented in this path yet
+				if ( mayUseSubImage )
+				{
+					int regionSize = 0;
+					void *regionAddress = PackCompressedRegion( desc->m_sliceIndex, writeBox, sliceAddress, &regionSize );
+
+					gGL->glCompressedTexSubImage2D( target,				// target
+											desc->m_req.m_mip,			// level
+											writeBox.xmin,				// xoffset
+											writeBox.ymin,				// yoffset
+											writeBox.xmax - writeBox.xmin,	// width
+											writeBox.ymax - writeBox.ymin,	// height
+											intformat,					// format
+											regionSize,					// imageSize
+											regionAddress );			// data
+				}
+				else
 												
 				// compressed path
 				// http://www.opengl.org/sdk/docs/man/xhtml/glCompressedTexImage2D.xml
@@ -1348,7 +2525,10 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 										slice->m_storageSize,		// imageSize
 										sliceAddress );				// data
 				
-				
+				if ( writeWholeSlice )
+				{
+					m_sliceFlags[ desc->m_sliceIndex ] |= kSliceValid;
+				}
 			}
 			else
 			{
@@ -1358,8 +2538,8 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 
 
 					gGL->glPixelStorei( GL_UNPACK_ROW_LENGTH, slice->m_xSize );			// in pixels
-					gGL->glPixelStorei( GL_UNPACK_SKIP_PIXELS, writeBox.xmin );		// in pixels
-					gGL->glPixelStorei( GL_UNPACK_SKIP_ROWS, writeBox.ymin );		// in pixels
+					gGL->glPixelStorei( GL_UNPACK_SKIP_PIXELS, skipPixels );		// in pixels
+					gGL->glPixelStorei( GL_UNPACK_SKIP_ROWS, skipRows );			// in pixels
 
 					gGL->glTexSubImage2D(	target,
 										desc->m_req.m_mip,				// level
@@ -1376,6 +2556,11 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 					gGL->glPixelStorei( GL_UNPACK_SKIP_PIXELS, 0 );
 					gGL->glPixelStorei( GL_UNPACK_SKIP_ROWS, 0 );
 
+					if ( m_bImmutableStorage && writeWholeSlice )
+					{
+						m_sliceFlags[ desc->m_sliceIndex ] |= kSliceValid;
+					}
+
 						/*
 							//http://www.opengl.org/sdk/docs/man/xhtml/glTexSubImage2D.xml
 							glTexSubImage2D(	target,
@@ -1434,11 +2619,27 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 		case GL_TEXTURE_3D:
 		{
 			// check compressed or not
-			if (format->m_chunkSize != 1)
+			if ( compressedUpload )
 			{
 				// compressed path
 				// http://www.opengl.org/sdk/docs/man/xhtml/glCompressedTexImage3D.xml
 				
+				if ( mayUseSubImage )
+				{
+					int regionSize = 0;
+					void *regionAddress = PackCompressedRegion( desc->m_sliceIndex, writeBox, sliceAddress, &regionSize );
+
+					gGL->glCompressedTexSubImage3D( target,				// target
+											desc->m_req.m_mip,			// level
+											writeBox.xmin, writeBox.ymin, writeBox.zmin,	// x/y/z offset
+											writeBox.xmax - writeBox.xmin,	// width
+											writeBox.ymax - writeBox.ymin,	// height
+											writeBox.zmax - writeBox.zmin,	// depth
+											intformat,					// format
+											regionSize,					// imageSize
+											regionAddress );			// data
+				}
+				else
 				gGL->glCompressedTexImage3D(	target,						// target
 										desc->m_req.m_mip,			// level
 										intformat,					// internalformat
@@ -1448,11 +2649,41 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 										0,							// border
 										slice->m_storageSize,		// imageSize
 										sliceAddress );				// data
+
+				if ( writeWholeSlice )
+				{
+					m_sliceFlags[ desc->m_sliceIndex ] |= kSliceValid;
+				}
 			}
 			else
 			{
 				// uncompressed path
 				// http://www.opengl.org/sdk/docs/man/xhtml/glTexImage3D.xml
+				if ( mayUseSubImage )
+				{
+					gGL->glPixelStorei( GL_UNPACK_ROW_LENGTH, slice->m_xSize );		// in pixels
+					gGL->glPixelStorei( GL_UNPACK_IMAGE_HEIGHT, slice->m_ySize );	// in rows
+					gGL->glPixelStorei( GL_UNPACK_SKIP_PIXELS, skipPixels );
+					gGL->glPixelStorei( GL_UNPACK_SKIP_ROWS, skipRows );
+					gGL->glPixelStorei( GL_UNPACK_SKIP_IMAGES, skipImages );
+
+					gGL->glTexSubImage3D(	target,						// target
+										desc->m_req.m_mip,			// level
+										writeBox.xmin, writeBox.ymin, writeBox.zmin,	// x/y/z offset
+										writeBox.xmax - writeBox.xmin,	// width
+										writeBox.ymax - writeBox.ymin,	// height
+										writeBox.zmax - writeBox.zmin,	// depth
+										glDataFormat,				// dataformat
+										glDataType,					// datatype
+										sliceAddress );				// data (offsetted by the SKIP_* values)
+
+					gGL->glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+					gGL->glPixelStorei( GL_UNPACK_IMAGE_HEIGHT, 0 );
+					gGL->glPixelStorei( GL_UNPACK_SKIP_PIXELS, 0 );
+					gGL->glPixelStorei( GL_UNPACK_SKIP_ROWS, 0 );
+					gGL->glPixelStorei( GL_UNPACK_SKIP_IMAGES, 0 );
+				}
+				else
 				gGL->glTexImage3D(			target,						// target
 										desc->m_req.m_mip,			// level
 										intformat,					// internalformat
@@ -1463,6 +2694,11 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 										glDataFormat,				// dataformat
 										glDataType,					// datatype
 										noDataWrite ? NULL : sliceAddress );	// data (optionally suppressed in case ResetSRGB desires)
+
+				if ( writeWholeSlice )
+				{
+					m_sliceFlags[ desc->m_sliceIndex ] |= kSliceValid;
+				}
 			}
 		}
 		break;
@@ -1473,15 +2709,207 @@ void CGLMTex::WriteTexels( GLMTexLockDesc *desc, bool writeWholeSlice, bool noDa
 		gGL->glPixelStorei( GL_UNPACK_CLIENT_STORAGE_APPLE, GL_FALSE );
 	}
 
-	if ( expandTemp )
+	if ( desc->m_pPixelUnpackBuffer )
+	{
+		gGL->glBindBufferARB( GL_PIXEL_UNPACK_BUFFER_ARB, 0 );
+		m_ctx->m_nBoundGLBuffer[kGLMPixelBuffer] = 0;
+	}
+
+	if ( ( m_layout->m_key.m_texFlags & kGLMTexMippedAuto ) && ( desc->m_req.m_mip == 0 ) && !noDataWrite )
 	{
-		free( expandTemp );
+		// lower mips get rebuilt on the GPU right before this texture is next drawn with
+		m_ctx->QueueMipGen( this );
 	}
 
 	m_ctx->BindTexToTMU( pPrevTex, 0 );
 }
 	
 
+GLenum CGLMTex::GetGLIntFormat( void )
+{
+	// SRGB select. At this level (writetexels) we firmly obey the m_texFlags.
+	// (mechanism not policy)
+	
+	GLMTexFormatDesc *format = m_layout->m_format;
+	if ( m_bSwizzledFormat )
+	{
+		return ( format->m_d3dFormat == D3DFMT_A8L8 ) ? GL_RG8 : GL_R8;
+	}
+
+	if ( m_bDecodeDXT )
+	{
+		return ( ( m_layout->m_key.m_texFlags & kGLMTexSRGB ) && !CommandLine()->FindParm("-disable_srgbtex") ) ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	}
+
+	GLenum intformat = (m_layout->m_key.m_texFlags & kGLMTexSRGB) ? format->m_glIntFormatSRGB : format->m_glIntFormat;
+	if (CommandLine()->FindParm("-disable_srgbtex"))
+	{
+		// force non srgb flavor - experiment to make ATI r600 happy on 10.5.8 (maybe x1600 too!)
+		intformat = format->m_glIntFormat;
+	}
+
+	return intformat;
+}
+
+GLenum CGLMTex::GetGLDataFormat( void )
+{
+	if ( m_bSwizzledFormat )
+	{
+		return ( m_layout->m_format->m_d3dFormat == D3DFMT_A8L8 ) ? GL_RG : GL_RED;
+	}
+
+	if ( m_bDecodeDXT )
+	{
+		return GL_RGBA;
+	}
+
+	return m_layout->m_format->m_glDataFormat;
+}
+
+bool CGLMTex::NeedsTexelExpand( void )
+{
+	// with GL_RG uploads V8U8 goes straight into the RGB8 texture, the missing blue comes out as 0 either way
+	return ( m_layout->m_format->m_d3dFormat == D3DFMT_V8U8 ) && !gGL->m_bHave_GL_ARB_texture_rg;
+}
+
+bool CGLMTex::CanHaveSRGBView( void )
+{
+	// a format with both flavors (the swizzled R8/RG8 ones have no sRGB twin), and not the legacy luminance ones, no view takes those
+	GLMTexFormatDesc *format = m_layout->m_format;
+	if ( !m_ctx->m_bUseSRGBTextureViews || m_bSwizzledFormat || !format->m_glIntFormatSRGB )
+		return false;
+
+	return IsImmutableStorageFormat( GetSizedViewFormat( GetGLIntFormat() ) );
+}
+
+bool CGLMTex::EnsureSRGBView( void )
+{
+	if ( m_texViewName )
+		return true;
+
+	// CreateGLTexture gave these immutable storage whatever gl_texstorage says
+	GLMTexFormatDesc *format = m_layout->m_format;
+	if ( !m_texName || !m_bImmutableStorage || !CanHaveSRGBView() )
+		return false;
+
+	GLenum viewFormat = GetSizedViewFormat( ( m_layout->m_key.m_texFlags & kGLMTexSRGB ) ? format->m_glIntFormat : format->m_glIntFormatSRGB );
+	if ( m_bDecodeDXT )
+	{
+		viewFormat = ( m_layout->m_key.m_texFlags & kGLMTexSRGB ) ? GL_RGBA8 : GL_SRGB8_ALPHA8;
+	}
+
+	gGL->glGenTextures( 1, &m_texViewName );
+	gGL->glTextureView( m_texViewName, m_texGLTarget, m_texName, viewFormat, 0, m_layout->m_mipCount, 0, ( m_texGLTarget == GL_TEXTURE_CUBE_MAP ) ? 6 : 1 );
+
+	m_nViewBaseLevel = m_nViewMaxLevel = -1;
+	return true;
+}
+
+void CGLMTex::DeleteSRGBView( void )
+{
+	if ( !m_texViewName )
+		return;
+
+	// nobody can be left sampling it
+	for( int i=0; i<GLM_SAMPLER_COUNT; i++)
+	{
+		if ( m_ctx->m_samplers[i].m_pBoundTex == this )
+		{
+			m_ctx->m_samplers[i].m_bBoundSRGBView = false;
+		}
+	}
+
+	gGL->glDeleteTextures( 1, &m_texViewName );
+	m_texViewName = 0;
+	m_nViewBaseLevel = m_nViewMaxLevel = -1;
+}
+
+void *CGLMTex::PackCompressedRegion( int sliceIndex, const GLMRegion &box, void *sliceAddress, int *sizeOut )
+{
+	// compressed subimage wants the region's blocks tightly packed, and m_backing rows are the whole slice wide
+	GLMTexFormatDesc *format = m_layout->m_format;
+	GLMTexLayoutSlice *slice = &m_layout->m_slices[ sliceIndex ];
+
+	int chunk = format->m_chunkSize;
+	int rowBytes = ( MAX( slice->m_xSize, chunk ) / chunk ) * format->m_bytesPerSquareChunk;		// one row of blocks
+	int layerBytes = ( MAX( slice->m_ySize, chunk ) / chunk ) * rowBytes;
+
+	int regionRowBytes = ( ( box.xmax - box.xmin + chunk - 1 ) / chunk ) * format->m_bytesPerSquareChunk;
+	int regionRows = ( box.ymax - box.ymin + chunk - 1 ) / chunk;
+	int regionDepth = box.zmax - box.zmin;
+
+	*sizeOut = regionRowBytes * regionRows * regionDepth;
+
+	char *src = (char*)sliceAddress + ( box.zmin * layerBytes ) + ( ( box.ymin / chunk ) * rowBytes ) + ( ( box.xmin / chunk ) * format->m_bytesPerSquareChunk );
+
+	// full width rows (and full layers if there's more than one) are already contiguous
+	if ( ( regionRowBytes == rowBytes ) && ( ( regionDepth == 1 ) || ( regionRows * rowBytes == layerBytes ) ) )
+		return src;
+
+	// a PBO lock always covers the whole slice, so this is reading m_backing
+	Assert( m_backing && ( (char*)sliceAddress >= m_backing ) );
+
+	char *dst = (char*)m_ctx->GetTexelConvertScratch( *sizeOut );
+	char *out = dst;
+	for( int z=0; z < regionDepth; z++ )
+	{
+		for( int row=0; row < regionRows; row++ )
+		{
+			memcpy( out, src + ( z * layerBytes ) + ( row * rowBytes ), regionRowBytes );
+			out += regionRowBytes;
+		}
+	}
+
+	return dst;
+}
+
+void *CGLMTex::DecodeDXTRegion( int sliceIndex, const GLMRegion &box, void *sliceAddress )
+{
+	GLMTexLayoutSlice *slice = &m_layout->m_slices[ sliceIndex ];
+	D3DFORMAT d3dFormat = m_layout->m_format->m_d3dFormat;
+	CGLMDXTDecoder *pDecoder = m_ctx->m_pDXTDecoder;
+
+	// whole slices of managed textures are static content, worth remembering in case they get uploaded again
+	bool wholeSlice = ( box.xmin == 0 ) && ( box.ymin == 0 ) && ( box.zmin == 0 ) &&
+		( box.xmax == slice->m_xSize ) && ( box.ymax == slice->m_ySize ) && ( box.zmax == slice->m_zSize );
+	if ( wholeSlice && m_bManaged )
+	{
+		return (void*)pDecoder->DecodeSliceCached( d3dFormat, (const uint8*)sliceAddress, slice->m_storageSize, slice->m_xSize, slice->m_ySize, slice->m_zSize );
+	}
+
+	// laid out as the whole RGBA8 slice, so the region sits where WriteTexels' unpack skips point
+	uint8 *dst = m_ctx->GetTexelConvertScratch( slice->m_xSize * slice->m_ySize * slice->m_zSize * 4 );
+	pDecoder->DecodeRegion( d3dFormat, (const uint8*)sliceAddress, dst, slice->m_xSize, slice->m_ySize, box );
+
+	return dst;
+}
+
+bool CGLMTex::CanLockToPixelUnpackBuffer( GLMTexLockParams *params, int sliceIndex, bool partial )
+{
+	if ( !m_ctx->UsingPixelUnpackBuffers() || params->m_readback || params->m_readonly || UsesAppleClientStorage() )
+		return false;
+
+	// streamed slices wait in m_backing
+	if ( CanStreamSlice( sliceIndex ) )
+		return false;
+
+	// RT's have no texels to push, and expanded or decoded formats get repacked from m_backing by WriteTexels.
+	// runtime compression candidates need their texels in m_backing for the compress job too
+	// as do atlas candidates, the layer is copied from m_backing
+	if ( ( m_layout->m_key.m_texFlags & kGLMTexRenderable ) || NeedsTexelExpand() || m_bDecodeDXT || m_bCompressCandidate || m_bAtlasCandidate )
+		return false;
+
+	if ( !partial )
+		return true;
+
+	// a partial region can only go across with glTexSubImage2D, into a slice that has already been teximage'd
+	// (a 2D texture or a cube face - PBO regions are packed rows, which volume and DXT uploads can't skip through)
+	unsigned char nSliceFlags = m_sliceFlags[ sliceIndex ];
+	GLenum target = m_layout->m_key.m_texGLTarget;
+	return	( ( target == GL_TEXTURE_2D ) || ( target == GL_TEXTURE_CUBE_MAP ) ) && ( m_layout->m_format->m_chunkSize == 1 ) &&
+			( nSliceFlags & kSliceValid ) && !( nSliceFlags & kSliceFullyDirty ) && ( gl_enabletexsubimage.GetInt() != 0 );
+}
+
 void CGLMTex::Lock( GLMTexLockParams *params, char** addressOut, int* yStrideOut, int *zStrideOut )
 {
 #if GL_TELEMETRY_GPU_ZONES
@@ -1489,6 +2917,24 @@ void CGLMTex::Lock( GLMTexLockParams *params, char** addressOut, int* yStrideOut
 	g_TelemetryGPUStats.m_nTotalTexLocksAndUnlocks++;
 #endif
 
+	// the caller wants the original format. a compress still in flight is just restarted by the unlock
+	if ( m_pShadowLayout )
+	{
+		DropCompression();
+	}
+	else if ( m_pCompressJob )
+	{
+		m_ctx->CancelTexCompress( this );
+	}
+
+	// the layer would go stale, the unlock puts us back in an atlas
+	if ( m_pAtlas && !params->m_readonly )
+	{
+		m_ctx->ReleaseAtlasLayer( this );
+	}
+
+	EnsureGLTexture();
+
 	// locate appropriate slice in layout record
 	int sliceIndex = CalcSliceIndex( params->m_face, params->m_mip );
 	
@@ -1521,8 +2967,34 @@ void CGLMTex::Lock( GLMTexLockParams *params, char** addressOut, int* yStrideOut
 	// c - the slice is marked as locked
 	// d - the params of the lock request have been saved in the lock table (in the context)
 	
+	// the backing is in use until the last unlock, don't let the budget free it
+	UnlinkBackingLRU();
+
+	// write-only locks can go straight into a PBO, skipping m_backing entirely
+	CPixelUnpackBuffer *pPixelUnpackBuffer = NULL;
+	int nPixelUnpackOfs = 0;
+	if ( CanLockToPixelUnpackBuffer( params, sliceIndex, partial ) )
+	{
+		int nRegionSize = slice->m_storageSize;
+		if ( partial )
+		{
+			int nFirst, nEnd, nYStride, nZStride;
+			CalcTexelDataOffsetAndStrides( sliceIndex, params->m_region.xmin, params->m_region.ymin, 0, &nFirst, &nYStride, &nZStride );
+			CalcTexelDataOffsetAndStrides( sliceIndex, params->m_region.xmax, params->m_region.ymax - 1, 0, &nEnd, &nYStride, &nZStride );
+			nRegionSize = nEnd - nFirst;
+		}
+
+		pPixelUnpackBuffer = m_ctx->AllocPixelUnpackSpace( nRegionSize, &nPixelUnpackOfs );
+	}
+
+	// coalesced uploads are older than whatever this lock is about to read back or push through a PBO
+	if ( HasDirtyRegions() && ( params->m_readback || pPixelUnpackBuffer ) )
+	{
+		FlushDirtyRegions();
+	}
+
 	// so step 1 is unambiguous.  If there's no backing storage, make some.
-	if (!m_backing)
+	if ( !m_backing && !pPixelUnpackBuffer )
 	{
 		m_backing = (char *)malloc( m_layout->m_storageTotalSize );
 		memset( m_backing, 0, m_layout->m_storageTotalSize );
@@ -1548,7 +3020,11 @@ void CGLMTex::Lock( GLMTexLockParams *params, char** addressOut, int* yStrideOut
 		
 	unsigned char *sliceFlags = &m_sliceFlags[ sliceIndex ];
 	
-	if (params->m_readback)
+	if ( params->m_readback && ( *sliceFlags & kSliceStreamPending ) )
+	{
+		// GL doesn't have this one yet, m_backing is the real thing
+	}
+	else if (params->m_readback)
 	{
 		// caller is letting us know that it wants to readback the real texels.
 		*sliceFlags |= kSliceStorageValid;
@@ -1556,13 +3032,23 @@ void CGLMTex::Lock( GLMTexLockParams *params, char** addressOut, int* yStrideOut
 		*sliceFlags &= ~(kSliceFullyDirty);
 		copyout = true;
 	}
+	else if ( pPixelUnpackBuffer )
+	{
+		// caller is pushing texels into the PBO, so whatever m_backing holds for this slice goes stale.
+		*sliceFlags &= ~kSliceStorageValid;
+	}
 	else
 	{
 		// caller is pushing texels.
 		if (! (*sliceFlags & kSliceStorageValid) )
 		{
 			// storage is invalid.  check texture state
-			if ( *sliceFlags & kSliceValid )
+			if ( ( *sliceFlags & kSliceValid ) && !partial && params->m_discard && !params->m_readonly )
+			{
+				// the caller said it's rewriting the whole slice, so there's no point copying it out first.
+				// any other lock has to see the current texels, even after GLMContext::EnforceTexBackingBudget freed them.
+			}
+			else if ( *sliceFlags & kSliceValid )
 			{
 				// kSliceValid set: the texture itself has a valid slice, but we don't have it in our backing copy, so copy it out.
 				copyout = true;
@@ -1601,6 +3087,8 @@ void CGLMTex::Lock( GLMTexLockParams *params, char** addressOut, int* yStrideOut
 	desc->m_active = true;
 	desc->m_sliceIndex = sliceIndex;
 	desc->m_sliceBaseOffset = m_layout->m_slices[sliceIndex].m_storageOffset;
+	desc->m_pPixelUnpackBuffer = pPixelUnpackBuffer;
+	desc->m_nPixelUnpackOfs = nPixelUnpackOfs;
 
 	// to calculate the additional offset we need to look at the rect's min corner
 	// combined with the per-texel size and Y/Z stride
@@ -1623,10 +3111,21 @@ void CGLMTex::Lock( GLMTexLockParams *params, char** addressOut, int* yStrideOut
 	{
 		// read the whole slice
 		// (odds are we'll never request anything but a whole slice to be read..)
-		ReadTexels( desc, true );
+		// if an async readback of it is already in flight, take the texels from that instead.
+		if ( !ConsumeReadback( sliceIndex ) )
+		{
+			ReadTexels( desc, true );
+		}
 	}	// this would be a good place to fill with scrub value if in debug...
 	
-	*addressOut = m_backing + desc->m_sliceRegionOffset;
+	if ( pPixelUnpackBuffer )
+	{
+		*addressOut = static_cast< char * >( pPixelUnpackBuffer->GetPtr() ) + nPixelUnpackOfs;
+	}
+	else
+	{
+		*addressOut = m_backing + desc->m_sliceRegionOffset;
+	}
 	*yStrideOut = yStride;
 	*zStrideOut = zStride;
 
@@ -1712,7 +3211,28 @@ void CGLMTex::Unlock( GLMTexLockParams *params )
 				
 				// fullyDirty |= (m_sliceFlags[ desc->m_sliceIndex ] & kSliceStorageValid);
 				
-				WriteTexels( desc, fullyDirty  );
+				if ( ( m_sliceFlags[ desc->m_sliceIndex ] & kSliceStreamPending ) || ( fullyDirty && !desc->m_pPixelUnpackBuffer && CanStreamSlice( desc->m_sliceIndex ) ) )
+				{
+					// m_backing has the whole slice, it goes up in a later frame
+					m_sliceFlags[ desc->m_sliceIndex ] |= kSliceStreamPending;
+					m_ctx->QueueTexStream( this );
+				}
+				else if ( !fullyDirty && !desc->m_pPixelUnpackBuffer && gl_texcoalesce.GetInt() && ( m_sliceFlags[ desc->m_sliceIndex ] & kSliceValid ) )
+				{
+					// m_backing has it, GL can wait until it needs it
+					AddDirtyRegion( desc->m_sliceIndex, desc->m_req.m_region );
+				}
+				else
+				{
+					WriteTexels( desc, fullyDirty  );
+				}
+
+				// the PBO was fenced when the context moved off it, cover this upload too before it can be recycled
+				CPixelUnpackBuffer *pPixelUnpackBuffer = desc->m_pPixelUnpackBuffer;
+				if ( pPixelUnpackBuffer && ( pPixelUnpackBuffer != &m_ctx->m_PixelUnpackBuffers[ m_ctx->m_nCurPixelUnpackBuffer ] ) )
+				{
+					pPixelUnpackBuffer->InsertFence();
+				}
 
 				// logical place to trigger preloading
 				// only do it for an RT tex, if it is not yet attached to any FBO.
@@ -1739,6 +3259,25 @@ void CGLMTex::Unlock( GLMTexLockParams *params )
 		{
 			m_sliceFlags[slice] &= ~( kSliceLocked | kSliceFullyDirty );
 		}
+
+		// a fully written static texture goes off to be compressed (the job takes its own copy of the backing)
+		if ( CanQueueCompression() )
+		{
+			m_ctx->QueueTexCompress( this );
+		}
+
+		// and a small one gets a layer in a shared array (before the backing can go)
+		if ( CanAtlas() )
+		{
+			m_ctx->AtlasTex( this );
+		}
+
+		// everything is in GL now, so the backing can go if memory gets tight
+		if ( CanReleaseBacking() )
+		{
+			LinkBackingLRU();
+			m_ctx->EnforceTexBackingBudget();
+		}
 	}
 }
 
@@ -1860,6 +3399,13 @@ void CGLMTex::ResetSRGB( bool srgb, bool noDataWrite )
 
 	if (srgb != wasSRGB)
 	{
+		// the texels get re-sent from m_backing below, so it has to hold all of them
+		if ( !noDataWrite )
+		{
+			UnlinkBackingLRU();
+			MaterializeBacking();
+		}
+
 		// we're going to need a new layout (though the storage size should be the same - check it)
 		GLMTexLayoutKey newKey = m_layout->m_key;
 		
@@ -1899,6 +3445,10 @@ void CGLMTex::ResetSRGB( bool srgb, bool noDataWrite )
 		m_ctx->m_texLayoutTable->DelLayoutRef( oldLayout );
 		oldLayout = NULL;
 
+		// no GL object yet - CreateGLTexture will pick up the new layout
+		if ( !m_texName )
+			return;
+
 		// force texel re-DL
 
 		// note this messes with TMU 0 as side effect of WriteTexels
@@ -1930,6 +3480,8 @@ void CGLMTex::ResetSRGB( bool srgb, bool noDataWrite )
 
 				desc.m_sliceBaseOffset = slice->m_storageOffset;	// doesn't really matter... we're just pushing zeroes..
 				desc.m_sliceRegionOffset = 0;
+				desc.m_pPixelUnpackBuffer = NULL;
+				desc.m_nPixelUnpackOfs = 0;
 
 				WriteTexels( &desc, true, noDataWrite );	// write whole slice. and avoid pushing real bits if the caller requests (RT's)
 			}
@@ -1943,15 +3495,52 @@ void CGLMTex::ResetSRGB( bool srgb, bool noDataWrite )
 
 bool CGLMTex::IsRBODirty() const 
 { 
-	return m_nLastResolvedBatchCounter != m_ctx->m_nBatchCounter; 
+	return m_bResolvePending; 
 }
 
 void CGLMTex::ForceRBONonDirty() 
 { 
-	m_nLastResolvedBatchCounter = m_ctx->m_nBatchCounter; 
+	if ( m_bResolvePending )
+	{
+		m_ctx->m_PendingResolves.FindAndFastRemove( this );
+		m_bResolvePending = false;
+	}
 }
 
 void CGLMTex::ForceRBODirty() 
 { 
-	m_nLastResolvedBatchCounter = m_ctx->m_nBatchCounter - 1; 
+	GLMRect rect = { 0, 0, (int)m_layout->m_key.m_xSize, (int)m_layout->m_key.m_ySize };
+	AddResolveDamage( rect );
+}
+
+void CGLMTex::AddResolveDamage( const GLMRect &rect )
+{
+	if ( !m_rboName )
+		return;
+
+	int xmin = MAX( rect.xmin, 0 );
+	int ymin = MAX( rect.ymin, 0 );
+	int xmax = MIN( rect.xmax, (int)m_layout->m_key.m_xSize );
+	int ymax = MIN( rect.ymax, (int)m_layout->m_key.m_ySize );
+	if ( ( xmin >= xmax ) || ( ymin >= ymax ) )
+		return;
+
+	if ( m_bResolvePending )
+	{
+		// union, the resolve is one blit so a bounding rect is all we keep
+		m_resolveDamage.xmin = MIN( m_resolveDamage.xmin, xmin );
+		m_resolveDamage.ymin = MIN( m_resolveDamage.ymin, ymin );
+		m_resolveDamage.xmax = MAX( m_resolveDamage.xmax, xmax );
+		m_resolveDamage.ymax = MAX( m_resolveDamage.ymax, ymax );
+	}
+	else
+	{
+		m_resolveDamage.xmin = xmin;
+		m_resolveDamage.ymin = ymin;
+		m_resolveDamage.xmax = xmax;
+		m_resolveDamage.ymax = ymax;
+
+		m_bResolvePending = true;
+		m_ctx->m_PendingResolves.AddToTail( this );
+	}
 }
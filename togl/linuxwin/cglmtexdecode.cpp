@@ -0,0 +1,831 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//                       TOGL CODE LICENSE
+//
+//  Copyright 2011-2014 Valve Corporation
+//  All Rights Reserved.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+// cglmtexdecode.cpp
+//
+//===============================================================================
+
+#include "togl/rendermechanism.h"
+
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+#define GL_TEXEL_CONVERT_SSE2	1
+#include <emmintrin.h>
+#else
+#define GL_TEXEL_CONVERT_SSE2	0
+#endif
+
+// memdbgon -must- be the last include file in a .cpp file.
+#include "tier0/memdbgon.h"
+
+ConVar gl_dxtdecode_threads( "gl_dxtdecode_threads", "3" );		// read at init
+ConVar gl_dxtdecode_cache_mb( "gl_dxtdecode_cache_mb", "32" );
+
+//===============================================================================
+
+bool GLMDXTDecodeKey_t::LessFunc( const GLMDXTDecodeKey_t &lhs, const GLMDXTDecodeKey_t &rhs )
+{
+	if ( lhs.m_nFormat != rhs.m_nFormat )
+		return lhs.m_nFormat < rhs.m_nFormat;
+	if ( lhs.m_nWidth != rhs.m_nWidth )
+		return lhs.m_nWidth < rhs.m_nWidth;
+	if ( lhs.m_nHeight != rhs.m_nHeight )
+		return lhs.m_nHeight < rhs.m_nHeight;
+	if ( lhs.m_nDepth != rhs.m_nDepth )
+		return lhs.m_nDepth < rhs.m_nDepth;
+	return memcmp( lhs.m_digest, rhs.m_digest, sizeof( lhs.m_digest ) ) < 0;
+}
+
+//===============================================================================
+
+CGLMDXTDecoder::CGLMDXTDecoder() :
+	m_bExit( false ),
+	m_nNextBand( 0 ),
+	m_Cache( GLMDXTDecodeKey_t::LessFunc ),
+	m_nCacheBytes( 0 )
+{
+	memset( &m_Job, 0, sizeof( m_Job ) );
+	m_nBandsLeft = 0;
+}
+
+CGLMDXTDecoder::~CGLMDXTDecoder()
+{
+	Deinit();
+}
+
+bool CGLMDXTDecoder::Init()
+{
+	Deinit();
+
+	m_bExit = false;
+
+	// zero workers is fine, everything just runs on the calling thread
+	int nThreads = clamp( gl_dxtdecode_threads.GetInt(), 0, GL_DXT_DECODE_MAX_THREADS );
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		CWorker *pWorker = new CWorker;
+		pWorker->m_pOwner = this;
+		pWorker->SetName( "GLMDXTDecoder" );
+		if ( !pWorker->Start() )
+		{
+			delete pWorker;
+			break;
+		}
+		m_Workers.AddToTail( pWorker );
+	}
+
+	return true;
+}
+
+void CGLMDXTDecoder::Deinit()
+{
+	// never called mid job, so the workers are all parked on m_Wake
+	m_bExit = true;
+	for ( int i = 0; i < m_Workers.Count(); i++ )
+	{
+		m_Workers[i]->m_Wake.Set();
+		m_Workers[i]->Join();
+	}
+	m_Workers.PurgeAndDeleteElements();
+
+	m_CacheOrder.PurgeAndDeleteElements();
+	m_Cache.RemoveAll();
+	m_nCacheBytes = 0;
+}
+
+int CGLMDXTDecoder::CWorker::Run()
+{
+	for ( ;; )
+	{
+		m_Wake.Wait();
+
+		if ( m_pOwner->m_bExit )
+			break;
+
+		m_pOwner->ProcessBands();
+	}
+
+	return 0;
+}
+
+void CGLMDXTDecoder::ProcessBands()
+{
+	for ( ;; )
+	{
+		int nBand;
+		{
+			AUTO_LOCK( m_Mutex );
+			if ( m_nNextBand >= m_Job.m_nBands )
+				return;
+			nBand = m_nNextBand++;
+		}
+
+		// m_Job can't change under us, the render thread waits for every band before posting another job
+		DecodeBand( m_Job, nBand );
+
+		if ( --m_nBandsLeft == 0 )
+		{
+			m_JobDone.Set();
+		}
+	}
+}
+
+void CGLMDXTDecoder::DecodeRegion( D3DFORMAT nFormat, const uint8 *pSrc, uint8 *pDst, int nWidth, int nHeight, const GLMRegion &box )
+{
+	Assert( IsDecodableFormat( nFormat ) );
+
+	// mips smaller than a block still take a whole one
+	Job_t job;
+	job.m_nFormat = nFormat;
+	job.m_pSrc = pSrc;
+	job.m_pDst = pDst;
+	job.m_nWidth = nWidth;
+	job.m_nHeight = nHeight;
+	job.m_nBlockBytes = ( nFormat == D3DFMT_DXT1 ) ? 8 : 16;
+	job.m_nSrcRowBytes = ( ( MAX( nWidth, 4 ) + 3 ) / 4 ) * job.m_nBlockBytes;
+	job.m_nSrcLayerBytes = ( ( MAX( nHeight, 4 ) + 3 ) / 4 ) * job.m_nSrcRowBytes;
+	job.m_nBlockXMin = box.xmin / 4;
+	job.m_nBlockXMax = ( box.xmax + 3 ) / 4;
+	job.m_nBlockYMin = box.ymin / 4;
+	job.m_nBlockRows = ( ( box.ymax + 3 ) / 4 ) - job.m_nBlockYMin;
+	job.m_nZMin = box.zmin;
+	job.m_nBands = job.m_nBlockRows * ( box.zmax - box.zmin );
+
+	int nBlocks = job.m_nBands * ( job.m_nBlockXMax - job.m_nBlockXMin );
+	if ( !m_Workers.Count() || ( nBlocks < GL_DXT_DECODE_MIN_PARALLEL_BLOCKS ) || ( job.m_nBands < 2 ) )
+	{
+		for ( int i = 0; i < job.m_nBands; i++ )
+		{
+			DecodeBand( job, i );
+		}
+		return;
+	}
+
+	{
+		AUTO_LOCK( m_Mutex );
+		m_Job = job;
+		m_nNextBand = 0;
+		m_nBandsLeft = job.m_nBands;
+	}
+
+	for ( int i = 0; i < m_Workers.Count(); i++ )
+	{
+		m_Workers[i]->m_Wake.Set();
+	}
+
+	// pitch in, then wait for the stragglers
+	ProcessBands();
+	m_JobDone.Wait();
+}
+
+const uint8 *CGLMDXTDecoder::DecodeSliceCached( D3DFORMAT nFormat, const uint8 *pSrc, int nSrcSize, int nWidth, int nHeight, int nDepth )
+{
+	GLMDXTDecodeKey_t key;
+	MD5Context_t md5ctx;
+	MD5Init( &md5ctx );
+	MD5Update( &md5ctx, pSrc, nSrcSize );
+	MD5Final( key.m_digest, &md5ctx );
+	key.m_nFormat = nFormat;
+	key.m_nWidth = nWidth;
+	key.m_nHeight = nHeight;
+	key.m_nDepth = nDepth;
+
+	int i = m_Cache.Find( key );
+	if ( i != m_Cache.InvalidIndex() )
+	{
+		CacheEntry_t *pEntry = m_Cache[i];
+
+		// most recently used goes to the back
+		m_CacheOrder.FindAndRemove( pEntry );
+		m_CacheOrder.AddToTail( pEntry );
+
+		return pEntry->m_Result.Base();
+	}
+
+	CacheEntry_t *pEntry = new CacheEntry_t;
+	pEntry->m_key = key;
+	pEntry->m_Result.SetCount( nWidth * nHeight * nDepth * 4 );
+
+	GLMRegion box;
+	box.xmin = box.ymin = box.zmin = 0;
+	box.xmax = nWidth;
+	box.ymax = nHeight;
+	box.zmax = nDepth;
+	DecodeRegion( nFormat, pSrc, pEntry->m_Result.Base(), nWidth, nHeight, box );
+
+	m_Cache.Insert( key, pEntry );
+	m_CacheOrder.AddToTail( pEntry );
+	m_nCacheBytes += pEntry->m_Result.Count();
+
+	EvictCacheEntries( pEntry );
+
+	return pEntry->m_Result.Base();
+}
+
+void CGLMDXTDecoder::EvictCacheEntries( CacheEntry_t *pKeep )
+{
+	const uint nBudget = (uint)MAX( gl_dxtdecode_cache_mb.GetInt(), 0 ) * 1024 * 1024;
+
+	// the one just handed out has to survive until the caller has uploaded it, even if it's bigger than the budget
+	while ( ( m_nCacheBytes > nBudget ) && ( m_CacheOrder[0] != pKeep ) )
+	{
+		CacheEntry_t *pEntry = m_CacheOrder[0];
+		m_CacheOrder.Remove( 0 );
+		m_Cache.Remove( pEntry->m_key );
+		m_nCacheBytes -= pEntry->m_Result.Count();
+		delete pEntry;
+	}
+}
+
+void CGLMDXTDecoder::DecodeBand( const Job_t &job, int nBand )
+{
+	const int z = job.m_nZMin + ( nBand / job.m_nBlockRows );
+	const int by = job.m_nBlockYMin + ( nBand % job.m_nBlockRows );
+
+	const uint8 *pSrcRow = job.m_pSrc + ( z * job.m_nSrcLayerBytes ) + ( by * job.m_nSrcRowBytes );
+	uint8 *pDstLayer = job.m_pDst + ( z * job.m_nWidth * job.m_nHeight * 4 );
+
+	// edge blocks of odd sized mips only have some of their texels in the slice
+	const int nRows = MIN( 4, job.m_nHeight - ( by * 4 ) );
+
+	uint8 texels[ 16 * 4 ];
+	for ( int bx = job.m_nBlockXMin; bx < job.m_nBlockXMax; bx++ )
+	{
+		const uint8 *pBlock = pSrcRow + ( bx * job.m_nBlockBytes );
+		switch ( job.m_nFormat )
+		{
+			case D3DFMT_DXT1:	DecodeBlockDXT1( texels, pBlock );	break;
+			case D3DFMT_DXT3:	DecodeBlockDXT3( texels, pBlock );	break;
+			case D3DFMT_DXT5:	DecodeBlockDXT5( texels, pBlock );	break;
+			default:			Assert( 0 ); return;
+		}
+
+		const int nCols = MIN( 4, job.m_nWidth - ( bx * 4 ) );
+		for ( int row = 0; row < nRows; row++ )
+		{
+			memcpy( pDstLayer + ( ( ( ( by * 4 ) + row ) * job.m_nWidth ) + ( bx * 4 ) ) * 4, &texels[ row * 16 ], nCols * 4 );
+		}
+	}
+}
+
+//===============================================================================
+// block decoders - these follow the GL S3TC spec, so DXT1 comes out like GL_COMPRESSED_RGB_S3TC_DXT1_EXT (the "transparent"
+// code is opaque black, the format table never asks GL for the RGBA flavor).
+
+static inline void Unpack565( uint8 *pOut, uint16 c )
+{
+	uint r = ( c >> 11 ) & 31;
+	uint g = ( c >> 5 ) & 63;
+	uint b = c & 31;
+
+	pOut[0] = ( r << 3 ) | ( r >> 2 );
+	pOut[1] = ( g << 2 ) | ( g >> 4 );
+	pOut[2] = ( b << 3 ) | ( b >> 2 );
+	pOut[3] = 255;
+}
+
+#if GL_TEXEL_CONVERT_SSE2
+// the whole palette in one register, 4 bytes per entry. Every entry is opaque, the three color mode's black included.
+static inline __m128i BuildColorPalette( const uint8 *pBlock, bool bAllowThreeColor )
+{
+	uint16 c0 = pBlock[0] | ( pBlock[1] << 8 );
+	uint16 c1 = pBlock[2] | ( pBlock[3] << 8 );
+
+	uint8 ends[8];
+	Unpack565( &ends[0], c0 );
+	Unpack565( &ends[4], c1 );
+
+	// p0 p1 as words, and the same with the halves swapped
+	__m128i p01 = _mm_unpacklo_epi8( _mm_loadl_epi64( reinterpret_cast< const __m128i * >( ends ) ), _mm_setzero_si128() );
+	__m128i p10 = _mm_shuffle_epi32( p01, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+
+	__m128i p23;
+	if ( ( c0 > c1 ) || !bAllowThreeColor )
+	{
+		// (2a + b) / 3 for both mixes, the multiply is exact well past 765
+		p23 = _mm_add_epi16( _mm_add_epi16( p01, p01 ), p10 );
+		p23 = _mm_srli_epi16( _mm_mulhi_epu16( p23, _mm_set1_epi16( (short)0xAAAB ) ), 1 );
+	}
+	else
+	{
+		// midpoint, then black
+		p23 = _mm_srli_epi16( _mm_add_epi16( p01, p10 ), 1 );
+		p23 = _mm_unpacklo_epi64( p23, _mm_setzero_si128() );
+	}
+
+	return _mm_or_si128( _mm_packus_epi16( p01, p23 ), _mm_set1_epi32( 0xFF000000 ) );
+}
+
+// alpha always comes out 255, DXT3/5 overwrite it afterwards
+static inline void DecodeColorBlock( uint8 *pDst, const uint8 *pBlock, bool bAllowThreeColor, bool bWriteAlpha )
+{
+	NOTE_UNUSED( bWriteAlpha );
+
+	__m128i palette = BuildColorPalette( pBlock, bAllowThreeColor );
+	__m128i color1 = _mm_shuffle_epi32( palette, _MM_SHUFFLE( 1, 1, 1, 1 ) );
+	__m128i color2 = _mm_shuffle_epi32( palette, _MM_SHUFFLE( 2, 2, 2, 2 ) );
+	__m128i color3 = _mm_shuffle_epi32( palette, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+	palette = _mm_shuffle_epi32( palette, _MM_SHUFFLE( 0, 0, 0, 0 ) );
+
+	// each row's index byte goes to all four lanes, lane n keeps bits 2n..2n+1 and compares them in place
+	const __m128i codeMask = _mm_set_epi32( 3 << 6, 3 << 4, 3 << 2, 3 );
+	const __m128i code1 = _mm_set_epi32( 1 << 6, 1 << 4, 1 << 2, 1 );
+	const __m128i code2 = _mm_add_epi32( code1, code1 );
+
+	for ( int row = 0; row < 4; row++ )
+	{
+		__m128i codes = _mm_and_si128( _mm_set1_epi32( pBlock[ 4 + row ] ), codeMask );
+
+		__m128i texels = palette;
+		__m128i sel = _mm_cmpeq_epi32( codes, code1 );
+		texels = _mm_or_si128( _mm_andnot_si128( sel, texels ), _mm_and_si128( sel, color1 ) );
+		sel = _mm_cmpeq_epi32( codes, code2 );
+		texels = _mm_or_si128( _mm_andnot_si128( sel, texels ), _mm_and_si128( sel, color2 ) );
+		sel = _mm_cmpeq_epi32( codes, codeMask );
+		texels = _mm_or_si128( _mm_andnot_si128( sel, texels ), _mm_and_si128( sel, color3 ) );
+
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( pDst + row * 16 ), texels );
+	}
+}
+#else
+// alpha is left alone for DXT3/5, they fill it in afterwards
+static inline void DecodeColorBlock( uint8 *pDst, const uint8 *pBlock, bool bAllowThreeColor, bool bWriteAlpha )
+{
+	uint16 c0 = pBlock[0] | ( pBlock[1] << 8 );
+	uint16 c1 = pBlock[2] | ( pBlock[3] << 8 );
+
+	uint8 palette[4][4];
+	Unpack565( palette[0], c0 );
+	Unpack565( palette[1], c1 );
+
+	if ( ( c0 > c1 ) || !bAllowThreeColor )
+	{
+		for ( int i = 0; i < 3; i++ )
+		{
+			palette[2][i] = ( ( 2 * palette[0][i] ) + palette[1][i] ) / 3;
+			palette[3][i] = ( palette[0][i] + ( 2 * palette[1][i] ) ) / 3;
+		}
+	}
+	else
+	{
+		for ( int i = 0; i < 3; i++ )
+		{
+			palette[2][i] = ( palette[0][i] + palette[1][i] ) / 2;
+			palette[3][i] = 0;
+		}
+	}
+	palette[2][3] = palette[3][3] = 255;
+
+	uint32 indices = pBlock[4] | ( pBlock[5] << 8 ) | ( pBlock[6] << 16 ) | ( (uint32)pBlock[7] << 24 );
+	for ( int i = 0; i < 16; i++, indices >>= 2 )
+	{
+		const uint8 *pColor = palette[ indices & 3 ];
+		pDst[ i * 4 + 0 ] = pColor[0];
+		pDst[ i * 4 + 1 ] = pColor[1];
+		pDst[ i * 4 + 2 ] = pColor[2];
+		if ( bWriteAlpha )
+		{
+			pDst[ i * 4 + 3 ] = pColor[3];
+		}
+	}
+}
+
+#endif
+
+void CGLMDXTDecoder::DecodeBlockDXT1( uint8 *pDst, const uint8 *pBlock )
+{
+	DecodeColorBlock( pDst, pBlock, true, true );
+}
+
+void CGLMDXTDecoder::DecodeBlockDXT3( uint8 *pDst, const uint8 *pBlock )
+{
+	DecodeColorBlock( pDst, pBlock + 8, false, false );
+
+	// explicit 4 bit alpha, low nibble first
+#if GL_TEXEL_CONVERT_SSE2
+	__m128i packed = _mm_loadl_epi64( reinterpret_cast< const __m128i * >( pBlock ) );
+	__m128i nibbles = _mm_unpacklo_epi8( _mm_and_si128( packed, _mm_set1_epi8( 15 ) ), _mm_and_si128( _mm_srli_epi16( packed, 4 ), _mm_set1_epi8( 15 ) ) );
+	__m128i alphas = _mm_or_si128( nibbles, _mm_slli_epi16( nibbles, 4 ) );	// a * 17
+
+	// widen to one byte per texel, parked in the top byte of each lane
+	__m128i lo = _mm_unpacklo_epi8( _mm_setzero_si128(), alphas );
+	__m128i hi = _mm_unpackhi_epi8( _mm_setzero_si128(), alphas );
+	__m128i rowAlpha[4] =
+	{
+		_mm_unpacklo_epi16( _mm_setzero_si128(), lo ),
+		_mm_unpackhi_epi16( _mm_setzero_si128(), lo ),
+		_mm_unpacklo_epi16( _mm_setzero_si128(), hi ),
+		_mm_unpackhi_epi16( _mm_setzero_si128(), hi ),
+	};
+
+	const __m128i colorMask = _mm_set1_epi32( 0x00FFFFFF );
+	for ( int row = 0; row < 4; row++ )
+	{
+		__m128i *pRow = reinterpret_cast< __m128i * >( pDst + row * 16 );
+		_mm_storeu_si128( pRow, _mm_or_si128( _mm_and_si128( _mm_loadu_si128( pRow ), colorMask ), rowAlpha[row] ) );
+	}
+#else
+	for ( int i = 0; i < 16; i++ )
+	{
+		uint a = ( pBlock[ i / 2 ] >> ( ( i & 1 ) * 4 ) ) & 15;
+		pDst[ i * 4 + 3 ] = a * 17;
+	}
+#endif
+}
+
+void CGLMDXTDecoder::DecodeBlockDXT5( uint8 *pDst, const uint8 *pBlock )
+{
+	DecodeColorBlock( pDst, pBlock + 8, false, false );
+
+	uint a0 = pBlock[0];
+	uint a1 = pBlock[1];
+
+	uint8 alphas[8];
+	alphas[0] = a0;
+	alphas[1] = a1;
+	if ( a0 > a1 )
+	{
+		for ( int i = 2; i < 8; i++ )
+		{
+			alphas[i] = ( ( ( 8 - i ) * a0 ) + ( ( i - 1 ) * a1 ) ) / 7;
+		}
+	}
+	else
+	{
+		for ( int i = 2; i < 6; i++ )
+		{
+			alphas[i] = ( ( ( 6 - i ) * a0 ) + ( ( i - 1 ) * a1 ) ) / 5;
+		}
+		alphas[6] = 0;
+		alphas[7] = 255;
+	}
+
+	// 16 3-bit codes packed little endian into the next 6 bytes
+	uint64 codes = 0;
+	for ( int i = 0; i < 6; i++ )
+	{
+		codes |= (uint64)pBlock[ 2 + i ] << ( i * 8 );
+	}
+
+	for ( int i = 0; i < 16; i++, codes >>= 3 )
+	{
+		pDst[ i * 4 + 3 ] = alphas[ codes & 7 ];
+	}
+}
+
+//===============================================================================
+
+ConVar gl_texcompress_threads( "gl_texcompress_threads", "2" );		// read at init
+
+CGLMTexCompressor::CGLMTexCompressor() :
+	m_bExit( false )
+{
+}
+
+CGLMTexCompressor::~CGLMTexCompressor()
+{
+	Deinit();
+}
+
+bool CGLMTexCompressor::Init()
+{
+	Deinit();
+
+	m_bExit = false;
+
+	int nThreads = clamp( gl_texcompress_threads.GetInt(), 1, GL_DXT_DECODE_MAX_THREADS );
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		CWorker *pWorker = new CWorker;
+		pWorker->m_pOwner = this;
+		pWorker->SetName( "GLMTexCompressor" );
+		if ( !pWorker->Start() )
+		{
+			delete pWorker;
+			break;
+		}
+		m_Workers.AddToTail( pWorker );
+	}
+
+	return m_Workers.Count() != 0;
+}
+
+void CGLMTexCompressor::Deinit()
+{
+	// don't bother finishing queued work - those jobs still belong to their textures, ReleaseJob frees them
+	m_bExit = true;
+	for ( int i = 0; i < m_Workers.Count(); i++ )
+	{
+		m_Workers[i]->m_Wake.Set();
+		m_Workers[i]->Join();
+	}
+	m_Workers.PurgeAndDeleteElements();
+}
+
+void CGLMTexCompressor::QueueJob( Job_t *pJob )
+{
+	pJob->m_bDone = 0;
+	pJob->m_bAbandoned = false;
+
+	{
+		AUTO_LOCK( m_Mutex );
+		m_PendingJobs.AddToTail( pJob );
+	}
+
+	for ( int i = 0; i < m_Workers.Count(); i++ )
+	{
+		m_Workers[i]->m_Wake.Set();
+	}
+}
+
+void CGLMTexCompressor::ReleaseJob( Job_t *pJob )
+{
+	AUTO_LOCK( m_Mutex );
+
+	if ( m_PendingJobs.FindAndRemove( pJob ) )
+	{
+		delete pJob;
+	}
+	else if ( m_ActiveJobs.Find( pJob ) != m_ActiveJobs.InvalidIndex() )
+	{
+		pJob->m_bAbandoned = true;
+	}
+	else
+	{
+		delete pJob;
+	}
+}
+
+int CGLMTexCompressor::CWorker::Run()
+{
+	for ( ;; )
+	{
+		m_Wake.Wait();
+
+		if ( m_pOwner->m_bExit )
+			break;
+
+		m_pOwner->ProcessJobs();
+	}
+
+	return 0;
+}
+
+void CGLMTexCompressor::ProcessJobs()
+{
+	for ( ;; )
+	{
+		Job_t *pJob;
+		{
+			AUTO_LOCK( m_Mutex );
+			if ( !m_PendingJobs.Count() || m_bExit )
+				return;
+			pJob = m_PendingJobs[0];
+			m_PendingJobs.Remove( 0 );
+			m_ActiveJobs.AddToTail( pJob );
+		}
+
+		ProcessJob( pJob );
+
+		AUTO_LOCK( m_Mutex );
+		m_ActiveJobs.FindAndFastRemove( pJob );
+		if ( pJob->m_bAbandoned )
+		{
+			delete pJob;
+		}
+		else
+		{
+			// the render thread reads the results as soon as it sees this
+			ThreadMemoryBarrier();
+			pJob->m_bDone = 1;
+		}
+	}
+}
+
+void CGLMTexCompressor::ProcessJob( Job_t *pJob )
+{
+	const uint8 *pSrc = pJob->m_Src.Base();
+
+	// DXT1 unless some texel actually uses its alpha
+	bool bAlpha = false;
+	if ( pJob->m_bSrcHasAlpha )
+	{
+		for ( int i = 3; i < pJob->m_Src.Count(); i += 4 )
+		{
+			if ( pSrc[i] != 255 )
+			{
+				bAlpha = true;
+				break;
+			}
+		}
+	}
+	pJob->m_nResultFormat = bAlpha ? D3DFMT_DXT5 : D3DFMT_DXT1;
+	const int nBlockBytes = bAlpha ? 16 : 8;
+
+	int nTotal = 0;
+	for ( int i = 0; i < pJob->m_Slices.Count(); i++ )
+	{
+		GLMTexCompressSlice_t &slice = pJob->m_Slices[i];
+		slice.m_nDstOffset = nTotal;
+		slice.m_nDstSize = ( ( slice.m_nWidth + 3 ) / 4 ) * ( ( slice.m_nHeight + 3 ) / 4 ) * slice.m_nDepth * nBlockBytes;
+		nTotal += slice.m_nDstSize;
+	}
+	pJob->m_Result.SetCount( nTotal );
+
+	uint8 texels[ 16 * 4 ];
+	for ( int i = 0; i < pJob->m_Slices.Count(); i++ )
+	{
+		const GLMTexCompressSlice_t &slice = pJob->m_Slices[i];
+		uint8 *pDst = pJob->m_Result.Base() + slice.m_nDstOffset;
+
+		for ( int z = 0; z < slice.m_nDepth; z++ )
+		{
+			const uint8 *pLayer = pSrc + slice.m_nSrcOffset + ( z * slice.m_nWidth * slice.m_nHeight * 4 );
+
+			for ( int by = 0; by < slice.m_nHeight; by += 4 )
+			{
+				for ( int bx = 0; bx < slice.m_nWidth; bx += 4 )
+				{
+					// edge blocks of small mips repeat the last row / column
+					for ( int t = 0; t < 16; t++ )
+					{
+						int x = MIN( bx + ( t & 3 ), slice.m_nWidth - 1 );
+						int y = MIN( by + ( t >> 2 ), slice.m_nHeight - 1 );
+						const uint8 *pTexel = pLayer + ( ( y * slice.m_nWidth ) + x ) * 4;
+
+						texels[ t * 4 + 0 ] = pTexel[2];
+						texels[ t * 4 + 1 ] = pTexel[1];
+						texels[ t * 4 + 2 ] = pTexel[0];
+						texels[ t * 4 + 3 ] = bAlpha ? pTexel[3] : 255;
+					}
+
+					if ( bAlpha )
+					{
+						CompressBlockDXT5( pDst, texels );
+					}
+					else
+					{
+						CompressBlockDXT1( pDst, texels );
+					}
+					pDst += nBlockBytes;
+				}
+			}
+		}
+	}
+}
+
+//===============================================================================
+// block encoders - bounding box endpoints, pulled in a little, and the nearest palette entry per texel.
+// Not the best quality BC around, but cheap, and it's opt-in.
+
+static inline uint16 Pack565( const int *pColor )
+{
+	return	( ( ( pColor[0] * 31 + 127 ) / 255 ) << 11 ) |
+			( ( ( pColor[1] * 63 + 127 ) / 255 ) << 5 ) |
+			( ( pColor[2] * 31 + 127 ) / 255 );
+}
+
+static void EncodeColorBlock( uint8 *pDst, const uint8 *pTexels )
+{
+	int mins[3] = { 255, 255, 255 };
+	int maxs[3] = { 0, 0, 0 };
+	for ( int i = 0; i < 16; i++ )
+	{
+		for ( int c = 0; c < 3; c++ )
+		{
+			mins[c] = MIN( mins[c], (int)pTexels[ i * 4 + c ] );
+			maxs[c] = MAX( maxs[c], (int)pTexels[ i * 4 + c ] );
+		}
+	}
+
+	for ( int c = 0; c < 3; c++ )
+	{
+		int inset = ( maxs[c] - mins[c] ) >> 4;
+		mins[c] += inset;
+		maxs[c] -= inset;
+	}
+
+	// c0 > c1 selects the four color mode
+	uint16 c0 = Pack565( maxs );
+	uint16 c1 = Pack565( mins );
+	if ( c0 < c1 )
+	{
+		uint16 t = c0; c0 = c1; c1 = t;
+	}
+
+	uint8 palette[4][4];
+	Unpack565( palette[0], c0 );
+	Unpack565( palette[1], c1 );
+	for ( int c = 0; c < 3; c++ )
+	{
+		palette[2][c] = ( ( 2 * palette[0][c] ) + palette[1][c] ) / 3;
+		palette[3][c] = ( palette[0][c] + ( 2 * palette[1][c] ) ) / 3;
+	}
+
+	uint32 indices = 0;
+	if ( c0 != c1 )
+	{
+		for ( int i = 0; i < 16; i++ )
+		{
+			int best = 0;
+			int bestDist = INT_MAX;
+			for ( int p = 0; p < 4; p++ )
+			{
+				int dr = (int)pTexels[ i * 4 + 0 ] - palette[p][0];
+				int dg = (int)pTexels[ i * 4 + 1 ] - palette[p][1];
+				int db = (int)pTexels[ i * 4 + 2 ] - palette[p][2];
+				int dist = ( dr * dr ) + ( dg * dg ) + ( db * db );
+				if ( dist < bestDist )
+				{
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices |= best << ( i * 2 );
+		}
+	}
+
+	pDst[0] = c0 & 0xFF;
+	pDst[1] = c0 >> 8;
+	pDst[2] = c1 & 0xFF;
+	pDst[3] = c1 >> 8;
+	pDst[4] = indices & 0xFF;
+	pDst[5] = ( indices >> 8 ) & 0xFF;
+	pDst[6] = ( indices >> 16 ) & 0xFF;
+	pDst[7] = indices >> 24;
+}
+
+void CGLMTexCompressor::CompressBlockDXT1( uint8 *pDst, const uint8 *pTexels )
+{
+	EncodeColorBlock( pDst, pTexels );
+}
+
+void CGLMTexCompressor::CompressBlockDXT5( uint8 *pDst, const uint8 *pTexels )
+{
+	uint a0 = 0;
+	uint a1 = 255;
+	for ( int i = 0; i < 16; i++ )
+	{
+		a0 = MAX( a0, (uint)pTexels[ i * 4 + 3 ] );
+		a1 = MIN( a1, (uint)pTexels[ i * 4 + 3 ] );
+	}
+
+	// a0 > a1 is the eight value ramp, and a flat block just uses code 0
+	uint8 alphas[8];
+	alphas[0] = a0;
+	alphas[1] = a1;
+	for ( int i = 2; i < 8; i++ )
+	{
+		alphas[i] = ( ( ( 8 - i ) * a0 ) + ( ( i - 1 ) * a1 ) ) / 7;
+	}
+
+	uint64 codes = 0;
+	if ( a0 != a1 )
+	{
+		for ( int i = 0; i < 16; i++ )
+		{
+			int alpha = pTexels[ i * 4 + 3 ];
+			int best = 0;
+			int bestDist = 256;
+			for ( int p = 0; p < 8; p++ )
+			{
+				int dist = abs( alpha - (int)alphas[p] );
+				if ( dist < bestDist )
+				{
+					bestDist = dist;
+					best = p;
+				}
+			}
+			codes |= (uint64)best << ( i * 3 );
+		}
+	}
+
+	pDst[0] = a0;
+	pDst[1] = a1;
+	for ( int i = 0; i < 6; i++ )
+	{
+		pDst[ 2 + i ] = ( codes >> ( i * 8 ) ) & 0xFF;
+	}
+
+	EncodeColorBlock( pDst + 8, pTexels );
+}
@@ -2484,6 +2484,8 @@ void D3DToGL::Handle_TEX( uint32 dwToken, bool bIsTexLDL )
 			V_strncat( szLOD, szExtra, sizeof( szLOD ) );
 
 			PrintToBufWithIndents( *m_pBufALUCode, "%s = %s( %s, %s, %s );\n", pDestReg, bIsShadowSampler ? "shadow2DLod" : "texture2DLod", pSrc1Reg, sCoordVar.String(), szLOD );
+
+			m_dwNoArraySamplerMask |= 1 << ( dwSrc1Token & D3DSP_REGNUM_MASK );
 		}
 		else if ( bIsShadowSampler )
 		{
@@ -2501,12 +2503,26 @@ void D3DToGL::Handle_TEX( uint32 dwToken, bool bIsTexLDL )
 			// We use the vec4 variant of texture2DProj() intentionally here, since it lines up well with Direct3D.
 
 			CUtlString s4DProjCoords = EnsureNumSwizzleComponents( pSrc0Reg, 4 ); // Ensure vec4 variant
-			PrintToBufWithIndents( *m_pBufALUCode, "%s = texture2DProj( %s, %s );\n", pDestReg, pSrc1Reg, s4DProjCoords.String() );
+			if ( m_bSamplerArrayMacros )
+			{
+				PrintToBufWithIndents( *m_pBufALUCode, "%s = TEX2DPROJ%d( %s );\n", pDestReg, dwSrc1Token & D3DSP_REGNUM_MASK, s4DProjCoords.String() );
+			}
+			else
+			{
+				PrintToBufWithIndents( *m_pBufALUCode, "%s = texture2DProj( %s, %s );\n", pDestReg, pSrc1Reg, s4DProjCoords.String() );
+			}
 		}
 		else				
 		{
 			CUtlString sCoordVar = EnsureNumSwizzleComponents( pSrc0Reg, bIsShadowSampler ? 3 : 2 );
-			PrintToBufWithIndents( *m_pBufALUCode, "%s = texture2D( %s, %s );\n", pDestReg, pSrc1Reg, sCoordVar.String() );
+			if ( m_bSamplerArrayMacros )
+			{
+				PrintToBufWithIndents( *m_pBufALUCode, "%s = TEX2D%d( %s );\n", pDestReg, dwSrc1Token & D3DSP_REGNUM_MASK, sCoordVar.String() );
+			}
+			else
+			{
+				PrintToBufWithIndents( *m_pBufALUCode, "%s = texture2D( %s, %s );\n", pDestReg, pSrc1Reg, sCoordVar.String() );
+			}
 		}
 	}
 	else if ( nSamplerType == SAMPLER_TYPE_3D )
@@ -2879,6 +2895,25 @@ void D3DToGL::WriteGLSLSamplerDefinitions()
 			{
 				PrintToBuf( *m_pBufHeaderCode, "uniform sampler2DShadow sampler%d;\n", i );
 			}
+			else if ( m_bSamplerArrayMacros )
+			{
+				// the array flavor reads layer samplerNLayer of a sampler2DArray, GLM defines ARRAY_SAMPLERn when it compiles one
+				if ( !( ( 1 << i ) & m_dwNoArraySamplerMask ) )
+				{
+					PrintToBuf( *m_pBufHeaderCode, "#ifdef ARRAY_SAMPLER%d\n", i );
+					PrintToBuf( *m_pBufHeaderCode, "uniform sampler2DArray sampler%d;\nuniform float sampler%dLayer;\n", i, i );
+					PrintToBuf( *m_pBufHeaderCode, "#define TEX2D%d( c ) texture2DArray( sampler%d, vec3( ( c ).xy, sampler%dLayer ) )\n", i, i, i );
+					PrintToBuf( *m_pBufHeaderCode, "#define TEX2DPROJ%d( c ) texture2DArray( sampler%d, vec3( ( c ).xy / ( c ).w, sampler%dLayer ) )\n", i, i, i );
+					PrintToBuf( *m_pBufHeaderCode, "#else\n" );
+				}
+				PrintToBuf( *m_pBufHeaderCode, "uniform sampler2D sampler%d;\n", i );
+				PrintToBuf( *m_pBufHeaderCode, "#define TEX2D%d( c ) texture2D( sampler%d, c )\n", i, i );
+				PrintToBuf( *m_pBufHeaderCode, "#define TEX2DPROJ%d( c ) texture2DProj( sampler%d, c )\n", i, i );
+				if ( !( ( 1 << i ) & m_dwNoArraySamplerMask ) )
+				{
+					PrintToBuf( *m_pBufHeaderCode, "#endif\n" );
+				}
+			}
 			else
 			{
 				PrintToBuf( *m_pBufHeaderCode, "uniform sampler2D sampler%d;\n", i );
@@ -3158,6 +3193,8 @@ int D3DToGL::TranslateShader( uint32* code, CUtlBuffer *pBufDisassembledCode, bo
 	m_nHighestBoneRegister = -1;
 	m_bGenerateBoneUniformBuffer = false;
 	m_bUseBindlessTexturing = ((options & D3DToGL_OptionUseBindlessTexturing) != 0);
+	m_bSamplerArrayMacros = ((options & D3DToGL_OptionSamplerArrayMacros) != 0);
+	m_dwNoArraySamplerMask = 0;
 		
 	m_bUsedAtomicTempVar = false;
 	for ( int i=0; i < ARRAYSIZE( m_dwSamplerTypes ); i++ )
@@ -3537,6 +3574,21 @@ int D3DToGL::TranslateShader( uint32* code, CUtlBuffer *pBufDisassembledCode, bo
 	
 	PrintToBuf( *m_pBufHeaderCode, "%sSAMPLERTYPES-%x\n", "//", nSamplerTypes );
 
+	// plain 2D samplers the array flavor can redirect
+	if ( m_bSamplerArrayMacros )
+	{
+		uint nArraySamplerMask = 0;
+		for ( int i = 0; i < 16; i++ )
+		{
+			if ( ( m_dwSamplerTypes[i] == SAMPLER_TYPE_2D ) && !( ( ( 1 << i ) & m_nShadowDepthSamplerMask ) || ( ( 1 << i ) & m_dwNoArraySamplerMask ) ) )
+			{
+				nArraySamplerMask |= 1 << i;
+			}
+		}
+
+		PrintToBuf( *m_pBufHeaderCode, "%sARRAYSAMPLERMASK-%x\n", "//", nArraySamplerMask );
+	}
+
 	// fragData outputs referenced
 	uint nFragDataMask = 0;
 	for ( int i = 0; i < 4; i++ )
@@ -52,6 +52,7 @@
 #define D3DToGL_OptionSRGBWriteSuffix			0x0400		// Tack sRGB conversion suffix on to pixel shaders
 #define D3DToGL_OptionGenerateBoneUniformBuffer	0x0800		// if enabled, the vertex shader "bone" registers (all regs DXABSTRACT_VS_FIRST_BONE_SLOT and higher) will be separated out into another uniform buffer (vcbone)
 #define D3DToGL_OptionUseBindlessTexturing		0x1000
+#define D3DToGL_OptionSamplerArrayMacros		0x2000		// plain 2D samples go through TEX2Dn() macros, so GLM can compile a sampler2DArray flavor (see CGLMProgram::GetArraySamplerVariant)
 #define D3DToGL_OptionSpew						0x80000000
 
 // Code for which component of the "dummy" address register is needed by an instruction
@@ -82,6 +83,7 @@ private:
 	bool	m_bGenerateSRGBWriteSuffix;	// set D3DToGL_OptionSRGBWriteSuffix
 	bool	m_bGenerateBoneUniformBuffer;
 	bool	m_bUseBindlessTexturing;
+	bool	m_bSamplerArrayMacros;		// set D3DToGL_OptionSamplerArrayMacros
 		
 	// Counter for dealing with nested loops
 	int m_nLoopDepth;
@@ -143,6 +145,9 @@ private:
 
 	// Track shadow sampler usage
 	int m_nShadowDepthSamplerMask;
+
+	// 2D samplers read with an explicit LOD, which the array flavor can't do
+	uint32 m_dwNoArraySamplerMask;
 	bool m_bDeclareShadowOption;
 
 	// Track attribute references
@@ -89,6 +89,7 @@ static IDirect3DDevice9 *g_pD3D_Device;
 #endif // GL_BATCH_PERF_ANALYSIS
 
 ConVar gl_batch_vis( "gl_batch_vis", "0" );
+ConVar gl_texatlas_max_size( "gl_texatlas_max_size", "128" );	// with -gl_texatlas, static 2D textures up to this size on both sides get atlased
 
 // ------------------------------------------------------------------------------------------------------------------------------ //
 // functions that are dependant on g_pLauncherMgr
@@ -257,9 +258,25 @@ D3DXVECTOR4::D3DXVECTOR4( float a, float b, float c, float d )
 
 DWORD IDirect3DResource9::SetPriority(DWORD PriorityNew)
 {
-//	DXABSTRACT_BREAK_ON_ERROR();
-//	GLMPRINTF(( "-X- SetPriority" ));
-	// no-op city
+	// only textures take part in eviction (see GLMContext::EvictTextures)
+	switch( m_restype )
+	{
+		case D3DRTYPE_TEXTURE:
+		case D3DRTYPE_CUBETEXTURE:
+		case D3DRTYPE_VOLUMETEXTURE:
+		{
+			IDirect3DBaseTexture9 *pTex = static_cast< IDirect3DBaseTexture9* >( this );
+			if ( pTex->m_tex )
+			{
+				return pTex->m_tex->SetResidencyPriority( PriorityNew );
+			}
+		}
+		break;
+
+		default:
+		break;
+	}
+
 	return 0;
 }
 
@@ -452,6 +469,21 @@ HRESULT IDirect3DDevice9::CreateTexture(UINT Width,UINT Height,UINT Levels,DWORD
 	dxtex->m_tex = tex;
 
 	dxtex->m_tex->m_srgbFlipCount = 0;
+	dxtex->m_tex->SetManaged( Pool == D3DPOOL_MANAGED );
+
+	// big static 32 bit textures may get swapped for DXT once they're filled in (see SetRuntimeTextureCompression)
+	if ( m_ctx->m_nTexCompressMinBytes && !( Usage & ( D3DUSAGE_RENDERTARGET | D3DUSAGE_DYNAMIC | D3DUSAGE_DEPTHSTENCIL | D3DUSAGE_AUTOGENMIPMAP ) ) &&
+		 ( ( Format == D3DFMT_A8R8G8B8 ) || ( Format == D3DFMT_X8R8G8B8 ) ) && !( Width & 3 ) && !( Height & 3 ) &&
+		 ( (uint)tex->m_layout->m_storageTotalSize >= m_ctx->m_nTexCompressMinBytes ) )
+	{
+		tex->SetRuntimeCompression( true );
+	}
+	// small static ones may share a 2D array with others of their layout (see GLMContext::AtlasTex)
+	else if ( m_ctx->m_bUseTexAtlas && !( Usage & ( D3DUSAGE_RENDERTARGET | D3DUSAGE_DYNAMIC | D3DUSAGE_DEPTHSTENCIL | D3DUSAGE_AUTOGENMIPMAP ) ) &&
+		 ( (int)Width <= gl_texatlas_max_size.GetInt() ) && ( (int)Height <= gl_texatlas_max_size.GetInt() ) )
+	{
+		tex->SetAtlasCandidate( true );
+	}
 
 	m_ObjectStats.m_nTotalSurfaces++;
 
@@ -635,6 +667,7 @@ HRESULT IDirect3DDevice9::CreateCubeTexture(UINT EdgeLength,UINT Levels,DWORD Us
 	dxtex->m_tex = tex;
 	
 	dxtex->m_tex->m_srgbFlipCount = 0;
+	dxtex->m_tex->SetManaged( Pool == D3DPOOL_MANAGED );
 
 	for( int face = 0; face < 6; face ++)
 	{
@@ -841,6 +874,7 @@ HRESULT IDirect3DDevice9::CreateVolumeTexture(UINT Width,UINT Height,UINT Depth,
 	dxtex->m_tex = tex;
 	
 	dxtex->m_tex->m_srgbFlipCount = 0;
+	dxtex->m_tex->SetManaged( Pool == D3DPOOL_MANAGED );
 
 	m_ObjectStats.m_nTotalSurfaces++;
 
@@ -906,6 +940,9 @@ HRESULT IDirect3DVolumeTexture9::LockBox(UINT Level,D3DLOCKED_BOX* pLockedVolume
 	lockreq.m_region.xmax = pBox->Right;
 	lockreq.m_region.ymax = pBox->Bottom;
 	lockreq.m_region.zmax = pBox->Back;
+
+	lockreq.m_readonly = ( Flags & D3DLOCK_READONLY ) != 0;
+	lockreq.m_discard = ( Flags & D3DLOCK_DISCARD ) != 0;
 	
 	char	*lockAddress;
 	int		yStride;
@@ -1038,6 +1075,25 @@ HRESULT IDirect3DSurface9::LockRect(D3DLOCKED_RECT* pLockedRect,CONST RECT* pRec
 		// smells like readback, force texel readout
 		lockreq.m_readback = true;
 	}
+
+	lockreq.m_readonly = ( Flags & D3DLOCK_READONLY ) != 0;
+	lockreq.m_discard = ( Flags & D3DLOCK_DISCARD ) != 0;
+
+	if ( lockreq.m_readback && ( Flags & D3DLOCK_DONOTWAIT ) && m_tex->CanReadbackAsync() )
+	{
+		// first try kicks off the copy, and we report busy until the GPU has caught up with it.
+		// (GetRenderTargetData may have already started one)
+		int sliceIndex = m_tex->CalcSliceIndex( m_face, m_mip );
+		if ( !m_tex->IsReadbackPending( sliceIndex ) )
+		{
+			m_tex->IssueReadback( sliceIndex );
+		}
+
+		if ( m_tex->IsReadbackBusy( sliceIndex ) )
+		{
+			return D3DERR_WASSTILLDRAWING;
+		}
+	}
 	
 	char	*lockAddress;
 	int		yStride;
@@ -2151,6 +2207,13 @@ HRESULT IDirect3DDevice9::CreateIndexBuffer(UINT Length,DWORD Usage,D3DFORMAT Fo
 	newbuff->m_idxDesc.Usage	= Usage;
 	newbuff->m_idxDesc.Pool		= Pool;
 	newbuff->m_idxDesc.Size		= Length;
+
+	newbuff->m_pStaticIndexData = NULL;
+	newbuff->m_pLockData = NULL;
+	if ( m_nStaticIndexOptimizations && !( Usage & D3DUSAGE_DYNAMIC ) && ( Format == D3DFMT_INDEX16 ) )
+	{
+		newbuff->m_pStaticIndexData = new CGLMStaticIndexData( newbuff->m_idxBuffer, m_pIndexOptimizer );
+	}
 		
 	*ppIndexBuffer = newbuff;
 
@@ -2175,6 +2238,9 @@ IDirect3DIndexBuffer9::~IDirect3DIndexBuffer9()
 			m_ctx->DelBuffer( m_idxBuffer );
 			GLMPRINTF(( "<-A- ~IDirect3DIndexBuffer9 deleting m_idxBuffer - done" ));
 		}
+
+		delete m_pStaticIndexData;
+		m_pStaticIndexData = NULL;
 		m_device = NULL;
 	}
 	else
@@ -2201,6 +2267,15 @@ HRESULT IDirect3DIndexBuffer9::Lock(UINT OffsetToLock,UINT SizeToLock,void** ppb
 	
 	m_idxBuffer->Lock( &lockreq, (char**)ppbData );
 
+	m_LockParams = lockreq;
+	m_pLockData = *ppbData;
+
+	// the app writes (and can read) the RAM copy, unlock moves it into GL
+	if ( m_pStaticIndexData )
+	{
+		*ppbData = m_pStaticIndexData->GetLockPtr( OffsetToLock );
+	}
+
 	return S_OK;
 }
 
@@ -2211,7 +2286,19 @@ HRESULT IDirect3DIndexBuffer9::Unlock()
 
 	tmZoneFiltered( TELEMETRY_LEVEL2, 25, TMZF_NONE, "IB Unlock" );
 
-	m_idxBuffer->Unlock();
+	if ( m_pStaticIndexData )
+	{
+		m_idxBuffer->Unlock( m_LockParams.m_nSize, m_pStaticIndexData->GetLockPtr( m_LockParams.m_nOffset ) );
+	}
+	else
+	{
+		m_idxBuffer->Unlock();
+	}
+
+	if ( m_pStaticIndexData )
+	{
+		m_pStaticIndexData->OnUnlocked( m_LockParams.m_nOffset, m_LockParams.m_nSize, m_LockParams.m_bDiscard );
+	}
 
 	return S_OK;
 }
@@ -2222,7 +2309,24 @@ void IDirect3DIndexBuffer9::UnlockActualSize( uint nActualSize, const void *pAct
 	GL_PUBLIC_ENTRYPOINT_CHECKS( m_device );
 	tmZoneFiltered( TELEMETRY_LEVEL2, 25, TMZF_NONE, "IB UnlockActualSize" );
 
+	if ( m_pStaticIndexData )
+	{
+		if ( pActualData )
+		{
+			m_pStaticIndexData->OnWrite( m_LockParams.m_nOffset, nActualSize, pActualData );
+		}
+		else
+		{
+			pActualData = m_pStaticIndexData->GetLockPtr( m_LockParams.m_nOffset );
+		}
+	}
+
 	m_idxBuffer->Unlock( nActualSize, pActualData );
+
+	if ( m_pStaticIndexData )
+	{
+		m_pStaticIndexData->OnUnlocked( m_LockParams.m_nOffset, nActualSize, m_LockParams.m_bDiscard );
+	}
 }
 
 HRESULT IDirect3DIndexBuffer9::GetDesc(D3DINDEXBUFFER_DESC *pDesc)
@@ -2380,7 +2484,6 @@ HRESULT	IDirect3DDevice9::Create( IDirect3DDevice9Params *params )
 	m_bFBODirty = false;
 
 	m_pFBOs = new CGLMFBOMap();
-	m_pFBOs->SetLessFunc( RenderTargetState_t::LessFunc );
 
 	// we create two IDirect3DSurface9's.  These will be known as the internal render target 0 and the depthstencil.
 	
@@ -2505,10 +2608,75 @@ HRESULT	IDirect3DDevice9::Create( IDirect3DDevice9Params *params )
 	m_vtx_buffers[1] = m_pDummy_vtx_buffer;
 	m_vtx_buffers[2] = m_pDummy_vtx_buffer;
 	m_vtx_buffers[3] = m_pDummy_vtx_buffer;
+
+	m_pIndexOptimizer = NULL;
+	m_nStaticIndexOptimizations = 0;
+	
+	uint nStaticIndexOptimizations = 0;
+	if ( CommandLine()->CheckParm( "-gl_optimize_static_indices" ) )
+	{
+		nStaticIndexOptimizations |= GLM_STATIC_INDEX_OPT_REORDER_TRILISTS;
+	}
+	if ( CommandLine()->CheckParm( "-gl_static_index_restart" ) )
+	{
+		nStaticIndexOptimizations |= GLM_STATIC_INDEX_OPT_STRIP_RESTART;
+	}
+	if ( nStaticIndexOptimizations )
+	{
+		SetStaticIndexOptimization( nStaticIndexOptimizations );
+	}
+
+	if ( CommandLine()->CheckParm( "-gl_compress_textures" ) )
+	{
+		SetRuntimeTextureCompression( 256 );
+	}
 	
 	return result;
 }
 
+void IDirect3DDevice9::SetRuntimeTextureCompression( uint nMinKB )
+{
+	GL_PUBLIC_ENTRYPOINT_CHECKS( this );
+
+	bool bEnabled = m_ctx->SetTexCompression( nMinKB * 1024 );
+
+	if ( bEnabled )
+	{
+		ConMsg( "GL runtime texture compression: ENABLED for 32 bit textures of %u KB or more\n", nMinKB );
+	}
+	else
+	{
+		ConMsg( "GL runtime texture compression: DISABLED%s\n", ( nMinKB && m_ctx->m_bSoftwareDXTDecode ) ? " (no S3TC)" : "" );
+	}
+}
+
+void IDirect3DDevice9::SetStaticIndexOptimization( uint nFlags )
+{
+	GL_PUBLIC_ENTRYPOINT_CHECKS( this );
+
+	if ( ( nFlags & GLM_STATIC_INDEX_OPT_STRIP_RESTART ) && !gGL->m_bHave_GL_ARB_ES3_compatibility )
+	{
+		ConMsg( "GL static index buffer optimization: no GL_PRIMITIVE_RESTART_FIXED_INDEX, strip restart unavailable\n" );
+		nFlags &= ~GLM_STATIC_INDEX_OPT_STRIP_RESTART;
+	}
+
+	if ( nFlags && !m_pIndexOptimizer )
+	{
+		m_pIndexOptimizer = new CGLMIndexOptimizer;
+		if ( !m_pIndexOptimizer->Init() )
+		{
+			delete m_pIndexOptimizer;
+			m_pIndexOptimizer = NULL;
+		}
+	}
+
+	m_nStaticIndexOptimizations = m_pIndexOptimizer ? nFlags : 0;
+
+	ConMsg( "GL static index buffer optimization: trilist reorder %s, strip restart %s\n",
+		( m_nStaticIndexOptimizations & GLM_STATIC_INDEX_OPT_REORDER_TRILISTS ) ? "ENABLED" : "DISABLED",
+		( m_nStaticIndexOptimizations & GLM_STATIC_INDEX_OPT_STRIP_RESTART ) ? "ENABLED" : "DISABLED" );
+}
+
 IDirect3DDevice9::IDirect3DDevice9() :
 	m_nValidMarker( D3D_DEVICE_VALID_MARKER )
 {
@@ -2553,6 +2721,10 @@ IDirect3DDevice9::~IDirect3DDevice9()
 	if ( m_ObjectStats.m_nTotalSurfaces ) ConMsg( "Leaking %i surfaces\n", m_ObjectStats.m_nTotalSurfaces );
 	if ( m_ObjectStats.m_nTotalQueries ) ConMsg( "Leaking %i queries\n", m_ObjectStats.m_nTotalQueries );
 	if ( m_ObjectStats.m_nTotalRenderTargets ) ConMsg( "Leaking %i render targets\n", m_ObjectStats.m_nTotalRenderTargets );
+
+	delete m_pIndexOptimizer;
+	m_pIndexOptimizer = NULL;
+
 	GLMgr::aGLMgr()->DelContext( m_ctx );
 	m_ctx = NULL;
 	m_nValidMarker = 0xDEADBEEF;
@@ -2852,6 +3024,44 @@ void IDirect3DDevice9::DumpStatsToConsole( const CCommand *pArgs )
 		m_nOverallPresents = 0;
 	}
 #endif
+	uint nNumFrames = m_ctx->GetNumBufferFrameStats();
+	if ( nNumFrames )
+	{
+		static const char *s_pLockPathNames[kGLMNumBufferLockPaths] = { "pseudo", "pinned", "static", "maprange", "async" };
+
+		GLMBufferFrameStats_t lastFrame, totals;
+		m_ctx->GetBufferFrameStats( 0, &lastFrame );
+		totals.Clear();
+		for ( uint i = 0; i < nNumFrames; i++ )
+		{
+			GLMBufferFrameStats_t frame;
+			m_ctx->GetBufferFrameStats( i, &frame );
+			for ( int j = 0; j < kGLMNumBufferLockPaths; j++ )
+			{
+				totals.m_nLocks[j] += frame.m_nLocks[j];
+				totals.m_nLockBytes[j] += frame.m_nLockBytes[j];
+			}
+			totals.m_nVBLockBytes += frame.m_nVBLockBytes;
+			totals.m_nIBLockBytes += frame.m_nIBLockBytes;
+			totals.m_nOrphans += frame.m_nOrphans;
+			totals.m_nVertexConvertBytes += frame.m_nVertexConvertBytes;
+			totals.m_flMapStallTime += frame.m_flMapStallTime;
+			totals.m_flUploadStallTime += frame.m_flUploadStallTime;
+		}
+		
+		ConMsg( "Buffer locks, frame %u: %u locks, VB: %u bytes, IB: %u bytes, orphans: %u, map stall: %4.3fms, upload stall: %4.3fms\n",
+			lastFrame.m_nFrame, lastFrame.GetTotalLocks(), lastFrame.m_nVBLockBytes, lastFrame.m_nIBLockBytes, lastFrame.m_nOrphans, lastFrame.m_flMapStallTime * 1000.0, lastFrame.m_flUploadStallTime * 1000.0 );
+		ConMsg( "Buffer locks, avg over last %u frames: %.1f locks, VB: %.0f bytes, IB: %.0f bytes, orphans: %.1f, map stall: %4.3fms, upload stall: %4.3fms\n",
+			nNumFrames, (float)totals.GetTotalLocks() / nNumFrames, (float)totals.m_nVBLockBytes / nNumFrames, (float)totals.m_nIBLockBytes / nNumFrames, (float)totals.m_nOrphans / nNumFrames,
+			totals.m_flMapStallTime * 1000.0 / nNumFrames, totals.m_flUploadStallTime * 1000.0 / nNumFrames );
+		for ( int j = 0; j < kGLMNumBufferLockPaths; j++ )
+		{
+			ConMsg( "  %-10s: last frame %u locks %u bytes, avg %.1f locks %.0f bytes\n", s_pLockPathNames[j],
+				lastFrame.m_nLocks[j], lastFrame.m_nLockBytes[j], (float)totals.m_nLocks[j] / nNumFrames, (float)totals.m_nLockBytes[j] / nNumFrames );
+		}
+		ConMsg( "  Vertex conversion: last frame %u bytes, avg %.0f bytes\n", lastFrame.m_nVertexConvertBytes, (float)totals.m_nVertexConvertBytes / nNumFrames );
+	}
+
 	ConMsg( "Totals:\n" );
 	m_ObjectStats.m_nTotalFBOs = m_pFBOs->Count();
 	PrintObjectStats( m_ObjectStats );
@@ -3161,21 +3371,254 @@ HRESULT IDirect3DDevice9::CreateRenderTarget(UINT Width,UINT Height,D3DFORMAT Fo
 	return result;
 }
 
+CGLMFBOMap::CGLMFBOMap()
+{
+	m_Buckets.SetCount( 64 );
+	FOR_EACH_VEC( m_Buckets, i )
+	{
+		m_Buckets[i] = -1;
+	}
+
+	m_nFreeHead = -1;
+	m_nLRUHead = -1;
+	m_nLRUTail = -1;
+	m_nCount = 0;
+}
+
+CGLMFBO *CGLMFBOMap::Find( const RenderTargetState_t &key )
+{
+	uint nHash = key.Hash();
+
+	for ( int nEntry = m_Buckets[ nHash & ( m_Buckets.Count() - 1 ) ]; nEntry >= 0; nEntry = m_Entries[nEntry].m_nHashNext )
+	{
+		Entry_t &entry = m_Entries[nEntry];
+		if ( ( entry.m_nHash == nHash ) && ( entry.m_key == key ) )
+		{
+			if ( nEntry != m_nLRUTail )
+			{
+				UnlinkLRU( nEntry );
+				LinkLRUTail( nEntry );
+			}
+			return entry.m_pFBO;
+		}
+	}
+
+	return NULL;
+}
+
+void CGLMFBOMap::Insert( const RenderTargetState_t &key, CGLMFBO *pFBO )
+{
+	Assert( pFBO && !Find( key ) );
+
+	if ( m_nCount >= m_Buckets.Count() )
+	{
+		GrowBuckets();
+	}
+
+	int nEntry = m_nFreeHead;
+	if ( nEntry >= 0 )
+	{
+		m_nFreeHead = m_Entries[nEntry].m_nHashNext;
+	}
+	else
+	{
+		nEntry = m_Entries.AddToTail();
+	}
+
+	Entry_t &entry = m_Entries[nEntry];
+	entry.m_key = key;
+	entry.m_pFBO = pFBO;
+	entry.m_nHash = key.Hash();
+
+	int &nBucket = m_Buckets[ entry.m_nHash & ( m_Buckets.Count() - 1 ) ];
+	entry.m_nHashNext = nBucket;
+	nBucket = nEntry;
+
+	LinkLRUTail( nEntry );
+
+	// onto the front of each texture's list
+	for ( int i = 0; i < RenderTargetState_t::kNumTextures; i++ )
+	{
+		CGLMTex *pTex = key.GetTexture( i );
+		entry.m_nTexPrev[i] = -1;
+		entry.m_nTexNext[i] = -1;
+		if ( !pTex )
+			continue;
+
+		int nNode = nEntry * RenderTargetState_t::kNumTextures + i;
+		int nNext = pTex->m_nFBOMapHead;
+		if ( nNext >= 0 )
+		{
+			m_Entries[ nNext / RenderTargetState_t::kNumTextures ].m_nTexPrev[ nNext % RenderTargetState_t::kNumTextures ] = nNode;
+		}
+		entry.m_nTexNext[i] = nNext;
+		pTex->m_nFBOMapHead = nNode;
+	}
+
+	m_nCount++;
+}
+
+CGLMFBO *CGLMFBOMap::RemoveLRU( CGLMFBO *pKeep )
+{
+	int nEntry = m_nLRUHead;
+	if ( ( nEntry >= 0 ) && ( m_Entries[nEntry].m_pFBO == pKeep ) )
+	{
+		nEntry = m_Entries[nEntry].m_nNextLRU;
+	}
+
+	if ( nEntry < 0 )
+		return NULL;
+
+	CGLMFBO *pFBO = m_Entries[nEntry].m_pFBO;
+	Remove( nEntry );
+	return pFBO;
+}
+
+CGLMFBO *CGLMFBOMap::RemoveFirstWithTex( CGLMTex *pTex )
+{
+	int nNode = pTex->m_nFBOMapHead;
+	if ( nNode < 0 )
+		return NULL;
+
+	int nEntry = nNode / RenderTargetState_t::kNumTextures;
+	CGLMFBO *pFBO = m_Entries[nEntry].m_pFBO;
+	Remove( nEntry );
+	return pFBO;
+}
+
+void CGLMFBOMap::Remove( int nEntry )
+{
+	Entry_t &entry = m_Entries[nEntry];
+	Assert( entry.m_pFBO );
+
+	// bucket chains stay short, just walk it
+	int *pLink = &m_Buckets[ entry.m_nHash & ( m_Buckets.Count() - 1 ) ];
+	while ( *pLink != nEntry )
+	{
+		Assert( *pLink >= 0 );
+		pLink = &m_Entries[ *pLink ].m_nHashNext;
+	}
+	*pLink = entry.m_nHashNext;
+
+	UnlinkLRU( nEntry );
+
+	for ( int i = 0; i < RenderTargetState_t::kNumTextures; i++ )
+	{
+		CGLMTex *pTex = entry.m_key.GetTexture( i );
+		if ( !pTex )
+			continue;
+
+		int nPrev = entry.m_nTexPrev[i];
+		int nNext = entry.m_nTexNext[i];
+		if ( nPrev >= 0 )
+		{
+			m_Entries[ nPrev / RenderTargetState_t::kNumTextures ].m_nTexNext[ nPrev % RenderTargetState_t::kNumTextures ] = nNext;
+		}
+		else
+		{
+			Assert( pTex->m_nFBOMapHead == nEntry * RenderTargetState_t::kNumTextures + i );
+			pTex->m_nFBOMapHead = nNext;
+		}
+		if ( nNext >= 0 )
+		{
+			m_Entries[ nNext / RenderTargetState_t::kNumTextures ].m_nTexPrev[ nNext % RenderTargetState_t::kNumTextures ] = nPrev;
+		}
+	}
+
+	entry.m_key.clear();
+	entry.m_pFBO = NULL;
+	entry.m_nHashNext = m_nFreeHead;
+	m_nFreeHead = nEntry;
+
+	m_nCount--;
+}
+
+void CGLMFBOMap::GrowBuckets( void )
+{
+	int nNewCount = m_Buckets.Count() * 2;
+	m_Buckets.SetCount( nNewCount );
+	FOR_EACH_VEC( m_Buckets, i )
+	{
+		m_Buckets[i] = -1;
+	}
+
+	FOR_EACH_VEC( m_Entries, i )
+	{
+		Entry_t &entry = m_Entries[i];
+		if ( !entry.m_pFBO )
+			continue;
+
+		int &nBucket = m_Buckets[ entry.m_nHash & ( nNewCount - 1 ) ];
+		entry.m_nHashNext = nBucket;
+		nBucket = i;
+	}
+}
+
+void CGLMFBOMap::LinkLRUTail( int nEntry )
+{
+	Entry_t &entry = m_Entries[nEntry];
+	entry.m_nPrevLRU = m_nLRUTail;
+	entry.m_nNextLRU = -1;
+	if ( m_nLRUTail >= 0 )
+	{
+		m_Entries[m_nLRUTail].m_nNextLRU = nEntry;
+	}
+	else
+	{
+		m_nLRUHead = nEntry;
+	}
+	m_nLRUTail = nEntry;
+}
+
+void CGLMFBOMap::UnlinkLRU( int nEntry )
+{
+	Entry_t &entry = m_Entries[nEntry];
+	if ( entry.m_nPrevLRU >= 0 )
+	{
+		m_Entries[entry.m_nPrevLRU].m_nNextLRU = entry.m_nNextLRU;
+	}
+	else
+	{
+		m_nLRUHead = entry.m_nNextLRU;
+	}
+	if ( entry.m_nNextLRU >= 0 )
+	{
+		m_Entries[entry.m_nNextLRU].m_nPrevLRU = entry.m_nPrevLRU;
+	}
+	else
+	{
+		m_nLRUTail = entry.m_nPrevLRU;
+	}
+	entry.m_nPrevLRU = entry.m_nNextLRU = -1;
+}
+
+ConVar gl_fbo_cache_size( "gl_fbo_cache_size", "256" );		// FBOs kept around for render target combos, least recently used go first
+
 void IDirect3DDevice9::UpdateBoundFBO()
 {
+	// async readbacks of the targets we're leaving are stale if anything was drawn into them
+	if ( m_ctx->m_drawingFBO )
+	{
+		for ( int i = 0; i < kAttCount; i++ )
+		{
+			if ( m_ctx->m_drawingFBO->m_attach[i].m_tex )
+			{
+				m_ctx->m_drawingFBO->m_attach[i].m_tex->DiscardReadbackIfDrawn();
+			}
+		}
+	}
+
 	RenderTargetState_t renderTargetState;
 	for ( uint i = 0; i < 4; i++ )
 	{
 		renderTargetState.m_pRenderTargets[i] = m_pRenderTargets[i] ? m_pRenderTargets[i]->m_tex : NULL;
 	}
 	renderTargetState.m_pDepthStencil = m_pDepthStencil ? m_pDepthStencil->m_tex : NULL;
-	CUtlMap < RenderTargetState_t, CGLMFBO * >::IndexType_t index = m_pFBOs->Find( renderTargetState );
+	CGLMFBO *pFBO = m_pFBOs->Find( renderTargetState );
 
-	if ( m_pFBOs->IsValidIndex( index ) )
+	if ( pFBO )
 	{
-		Assert( (*m_pFBOs)[index] );
-		
-		m_ctx->m_drawingFBO = (*m_pFBOs)[index];
+		m_ctx->m_drawingFBO = pFBO;
 	} 
 	else 
 	{
@@ -3224,10 +3667,30 @@ void IDirect3DDevice9::UpdateBoundFBO()
 #endif
 
 		m_ctx->m_drawingFBO = newFBO;
+
+		// keep the cache bounded (DelFBO unbinds anything it takes away, the new one goes on just below)
+		int nMaxFBOs = MAX( gl_fbo_cache_size.GetInt(), 1 );
+		while ( m_pFBOs->Count() > nMaxFBOs )
+		{
+			CGLMFBO *pOldFBO = m_pFBOs->RemoveLRU( newFBO );
+			if ( !pOldFBO )
+				break;
+
+			m_ctx->DelFBO( pOldFBO );
+		}
 	}
 
 	m_ctx->BindFBOToCtx( m_ctx->m_drawingFBO, GL_FRAMEBUFFER_EXT );
 
+	// anything rendered into mip 0 of an autogen RT needs its chain rebuilt once it's sampled
+	for ( uint i = 0; i < 4; i++ )
+	{
+		if ( m_pRenderTargets[i] && ( m_pRenderTargets[i]->m_mip == 0 ) && ( m_pRenderTargets[i]->m_tex->m_layout->m_key.m_texFlags & kGLMTexMippedAuto ) )
+		{
+			m_ctx->QueueMipGen( m_pRenderTargets[i]->m_tex );
+		}
+	}
+
 	m_bFBODirty = false;
 }
 
@@ -3236,16 +3699,11 @@ void IDirect3DDevice9::ResetFBOMap()
 	if ( !m_pFBOs )
 		return;
 
-	FOR_EACH_MAP_FAST( (*m_pFBOs), i )
+	while ( CGLMFBO *pFBO = m_pFBOs->RemoveLRU() )
 	{
-		const RenderTargetState_t &rtState = m_pFBOs->Key( i ); (void)rtState;
-		CGLMFBO *pFBO = (*m_pFBOs)[i];
-				
 		m_ctx->DelFBO( pFBO );
 	}
 
-	m_pFBOs->Purge();
-
 	m_bFBODirty = true;
 }
 
@@ -3256,41 +3714,13 @@ void IDirect3DDevice9::ScrubFBOMap( CGLMTex *pTex )
 	if ( !m_pFBOs )
 		return;
 				
-	CUtlVectorFixed< RenderTargetState_t, 128 > fbosToRemove;
-	
-	FOR_EACH_MAP_FAST( (*m_pFBOs), i )
+	// just the FBOs on pTex's own list
+	while ( CGLMFBO *pFBO = m_pFBOs->RemoveFirstWithTex( pTex ) )
 	{
-		const RenderTargetState_t &rtState = m_pFBOs->Key( i );
-		CGLMFBO *pFBO = (*m_pFBOs)[i]; (void)pFBO;
-
-		if ( rtState.RefersTo( pTex ) )
-		{
-			fbosToRemove.AddToTail( rtState );
-		}
-	}
-
-	for ( int i = 0; i < fbosToRemove.Count(); ++i )
-	{
-		const RenderTargetState_t &rtState = fbosToRemove[i];
-
-		CUtlMap < RenderTargetState_t, CGLMFBO * >::IndexType_t index = m_pFBOs->Find( rtState );
-
-		if ( !m_pFBOs->IsValidIndex( index ) )
-		{
-			Assert( 0 );
-			continue;
-		}
-		
-		CGLMFBO *pFBO = (*m_pFBOs)[index];
-						
 		m_ctx->DelFBO( pFBO );
 
-		m_pFBOs->RemoveAt( index );
-
 		m_bFBODirty = true;
 	}
-
-	//GLMDebugPrintf( "IDirect3DDevice9::ScrubFBOMap: Removed %u entries\n", fbosToRemove.Count() );
 }
 HRESULT IDirect3DDevice9::SetRenderTarget(DWORD RenderTargetIndex,IDirect3DSurface9* pRenderTarget)
 {
@@ -3575,6 +4005,13 @@ HRESULT IDirect3DDevice9::GetRenderTargetData(IDirect3DSurface9* pRenderTarget,I
 
 	this->StretchRect( pRenderTarget, NULL, pDestSurface, NULL, D3DTEXF_NONE ); // is this good enough ???
 
+	// start pulling the copy back now, so the LockRect that follows waits on a fence instead of flushing the pipe
+	CGLMTex *pDestTex = pDestSurface->m_tex;
+	if ( pDestTex->CanReadbackAsync() )
+	{
+		pDestTex->IssueReadback( pDestTex->CalcSliceIndex( pDestSurface->m_face, pDestSurface->m_mip ) );
+	}
+
 	return S_OK;
 }
 
@@ -3615,7 +4052,7 @@ HRESULT IDirect3DDevice9::StretchRect(IDirect3DSurface9* pSourceSurface,CONST RE
 	
 	if ( !useFastBlit && (srcTex->m_rboName !=0))		// old way, we do a resolve to scratch tex first (necessitating two step blit)
 	{
-		m_ctx->ResolveTex( srcTex, true );
+		m_ctx->ResolveTex( srcTex );
 	}
 
 	// set up source/dest rect in GLM form
@@ -3875,6 +4312,12 @@ HRESULT IDirect3DDevice9::CreatePixelShader(CONST DWORD* pFunction,IDirect3DPixe
 		tempbuf.EnsureCapacity( maxTranslationSize );
 			
 		uint glslPixelShaderOptions = D3DToGL_OptionUseEnvParams;// | D3DToGL_OptionAllowStaticControlFlow;
+
+		// plain 2D samples go through macros so GLM can build a flavor that reads texture atlas layers
+		if ( m_ctx->m_bUseTexAtlas )
+		{
+			glslPixelShaderOptions |= D3DToGL_OptionSamplerArrayMacros;
+		}
 			
 
 		// Fake SRGB mode - needed on R500, probably indefinitely.
@@ -4000,6 +4443,22 @@ HRESULT IDirect3DDevice9::CreatePixelShader(CONST DWORD* pFunction,IDirect3DPixe
 				}
 			}
 
+			{
+				// 2D samplers that can read a texture atlas layer (only there when the translator was asked for the macros)
+				char *arraySamplerMaskPrefix = "//ARRAYSAMPLERMASK-";
+
+				char *arraySamplerMaskStr = strstr( (char *)transbuf.Base(), arraySamplerMaskPrefix );
+				if ( arraySamplerMaskStr )
+				{
+					char *arraySamplerMaskActualData = arraySamplerMaskStr + strlen( arraySamplerMaskPrefix );
+
+					int value = 0;
+					sscanf( arraySamplerMaskActualData, "%04x", &value );
+
+					newprog->m_pixProgram->m_nArraySamplerMask = value;
+				}
+			}
+
 			{
 				// find the fb outputs used by this shader/combo
 				const GLenum buffers[] = { GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_COLOR_ATTACHMENT2_EXT, GL_COLOR_ATTACHMENT3_EXT };
@@ -4240,6 +4699,17 @@ HRESULT IDirect3DDevice9::CreateVertexShader(CONST DWORD* pFunction, IDirect3DVe
 				newprog->m_vtxHighWaterBone = 0;
 				newprog->m_vtxProgram->m_descs[kGLMGLSL].m_VSHighWaterBone = 0;
 			}
+
+			// samplers are rare in vertex shaders, but GLM needs to know about them to resolve what they read
+			char *samplerMaskPrefix = "//SAMPLERMASK-";
+			char *samplerMaskStr = strstr( (char *)transbuf.Base(), samplerMaskPrefix );
+			if (samplerMaskStr)
+			{
+				int value = 0;
+				sscanf( samplerMaskStr + strlen( samplerMaskPrefix ), "%04x", &value );
+
+				newprog->m_vtxProgram->m_samplerMask = value;
+			}
 									
 			// find the attrib map..
 			char *attribMapPrefix = "//ATTRIBMAP-";		// try to arrange this so it can work with pure GLSL if needed
@@ -4432,6 +4902,7 @@ HRESULT IDirect3DDevice9::CreateVertexDeclaration(CONST D3DVERTEXELEMENT9* pVert
 
 		// copy the D3D decl wholesale.
 		elem->m_dxdecl = *src;
+		elem->m_nConversion = kGLMVertexConvertNone;
 		
 		// latch current offset in this stream.
 		elem->m_gldecl.m_offset = streamOffsets[ elem->m_dxdecl.Stream ];
@@ -4485,6 +4956,38 @@ HRESULT IDirect3DDevice9::CreateVertexDeclaration(CONST D3DVERTEXELEMENT9* pVert
 				
 				bytes = 4;
 			break;
+
+			case D3DDECLTYPE_SHORT4:	elem->m_gldecl.m_nCompCount = 4; elem->m_gldecl.m_datatype = GL_SHORT; elem->m_gldecl.m_normalized=0; bytes = 8; break;
+			case D3DDECLTYPE_SHORT2N:	elem->m_gldecl.m_nCompCount = 2; elem->m_gldecl.m_datatype = GL_SHORT; elem->m_gldecl.m_normalized=1; bytes = 4; break;
+			case D3DDECLTYPE_SHORT4N:	elem->m_gldecl.m_nCompCount = 4; elem->m_gldecl.m_datatype = GL_SHORT; elem->m_gldecl.m_normalized=1; bytes = 8; break;
+			case D3DDECLTYPE_USHORT2N:	elem->m_gldecl.m_nCompCount = 2; elem->m_gldecl.m_datatype = GL_UNSIGNED_SHORT; elem->m_gldecl.m_normalized=1; bytes = 4; break;
+			case D3DDECLTYPE_USHORT4N:	elem->m_gldecl.m_nCompCount = 4; elem->m_gldecl.m_datatype = GL_UNSIGNED_SHORT; elem->m_gldecl.m_normalized=1; bytes = 8; break;
+
+			// GL's packed 2_10_10_10 types always fetch w from the top 2 bits (and pre-4.2 signed normalization differs from D3D's v/511),
+			// so these always go through a converted shadow buffer as 4 shorts.
+			case D3DDECLTYPE_UDEC3:
+			case D3DDECLTYPE_DEC3N:
+				elem->m_nConversion = ( elem->m_dxdecl.Type == D3DDECLTYPE_UDEC3 ) ? kGLMVertexConvertUDEC3 : kGLMVertexConvertDEC3N;
+				elem->m_gldecl.m_nCompCount = 4; elem->m_gldecl.m_datatype = GL_SHORT;
+				elem->m_gldecl.m_normalized = ( elem->m_dxdecl.Type == D3DDECLTYPE_DEC3N );
+				bytes = 4;
+			break;
+
+			case D3DDECLTYPE_FLOAT16_2:
+			case D3DDECLTYPE_FLOAT16_4:
+				elem->m_gldecl.m_nCompCount = ( elem->m_dxdecl.Type == D3DDECLTYPE_FLOAT16_2 ) ? 2 : 4;
+				elem->m_gldecl.m_normalized = 0;
+				if ( gGL->m_bHave_GL_ARB_half_float_vertex )
+				{
+					elem->m_gldecl.m_datatype = GL_HALF_FLOAT;
+				}
+				else
+				{
+					elem->m_nConversion = ( elem->m_dxdecl.Type == D3DDECLTYPE_FLOAT16_2 ) ? kGLMVertexConvertHalf2 : kGLMVertexConvertHalf4;
+					elem->m_gldecl.m_datatype = GL_FLOAT;
+				}
+				bytes = elem->m_gldecl.m_nCompCount * 2;
+			break;
 			
 			default:	DXABSTRACT_BREAK_ON_ERROR(); return D3DERR_INVALIDCALL; break;
 
@@ -4690,7 +5193,11 @@ void IDirect3DDevice9::ReleasedCGLMTex( CGLMTex *pTex)
 	GL_BATCH_PERF_CALL_TIMER;
 	TOGL_NULL_DEVICE_CHECK_RET_VOID;
 
-	ScrubFBOMap( pTex );
+	// render targets headed for the context's tex pool keep their FBOs, GLMContext::ReleasePooledTex scrubs them if they're never reused
+	if ( !m_ctx->CanPoolTex( pTex ) )
+	{
+		ScrubFBOMap( pTex );
+	}
 	if ( pTex->m_layout )
 	{
 		if ( pTex->m_layout->m_key.m_texFlags & kGLMTexRenderable )
@@ -5348,6 +5855,53 @@ HRESULT IDirect3DDevice9::DrawIndexedPrimitive( D3DPRIMITIVETYPE Type, INT BaseV
 	
 	{
 		GL_BATCH_PERF_CALL_TIMER;
+
+		Assert( ( D3DPT_LINELIST == 2 ) && ( D3DPT_TRIANGLELIST == 4 ) && ( D3DPT_TRIANGLESTRIP == 5 ) );
+
+		static const struct prim_t
+		{
+			GLenum m_nType;
+			uint m_nPrimMul;
+			uint m_nPrimAdd;
+		} s_primTypes[6] = 
+		{ 
+			{ 0, 0, 0 },				// 0
+			{ 0, 0, 0 },				// 1
+			{ GL_LINES, 2, 0 },			// 2 D3DPT_LINELIST
+			{ 0, 0, 0 },				// 3 
+			{ GL_TRIANGLES, 3, 0 },		// 4 D3DPT_TRIANGLELIST
+			{ GL_TRIANGLE_STRIP, 1, 2 }	// 5 D3DPT_TRIANGLESTRIP
+		};
+
+		if ( ( Type > D3DPT_TRIANGLESTRIP ) || !s_primTypes[Type].m_nType )
+			goto draw_failed;
+
+		const prim_t& p = s_primTypes[Type];
+
+		// opt-in index rework has to happen before FlushDrawStates, it may bind the index buffer
+		uint nIndexCount = p.m_nPrimAdd + primCount * p.m_nPrimMul;
+		bool bPrimitiveRestart = false;
+
+		CGLMStaticIndexData *pStaticIndexData = m_indices.m_idxBuffer->m_pStaticIndexData;
+		if ( pStaticIndexData )
+		{
+			if ( ( Type == D3DPT_TRIANGLELIST ) && ( m_nStaticIndexOptimizations & GLM_STATIC_INDEX_OPT_REORDER_TRILISTS ) )
+			{
+				nIndexCount = pStaticIndexData->OnDraw( kGLMIndexOpReorderTriList, startIndex, nIndexCount, &bPrimitiveRestart );
+			}
+			else if ( ( Type == D3DPT_TRIANGLESTRIP ) && ( m_nStaticIndexOptimizations & GLM_STATIC_INDEX_OPT_STRIP_RESTART ) )
+			{
+				nIndexCount = pStaticIndexData->OnDraw( kGLMIndexOpStripRestart, startIndex, nIndexCount, &bPrimitiveRestart );
+			}
+			else
+			{
+				// lines, or an op that's since been switched off - put back anything rewritten under this draw
+				pStaticIndexData->OnUnoptimizedDraw( startIndex, nIndexCount );
+			}
+		}
+
+		// lazily turned back off, 0xFFFF is an ordinary vertex index to D3D
+		m_ctx->SetPrimitiveRestart( bPrimitiveRestart );
 								
 		m_ctx->FlushDrawStates( MinVertexIndex, MinVertexIndex + NumVertices - 1, BaseVertexIndex );
 
@@ -5355,31 +5909,9 @@ HRESULT IDirect3DDevice9::DrawIndexedPrimitive( D3DPRIMITIVETYPE Type, INT BaseV
 #if !GL_TELEMETRY_ZONES && GL_BATCH_TELEMETRY_ZONES
 			tmZone( TELEMETRY_LEVEL2, TMZF_NONE, "glDrawRangeElements %u", primCount );
 #endif
-			Assert( ( D3DPT_LINELIST == 2 ) && ( D3DPT_TRIANGLELIST == 4 ) && ( D3DPT_TRIANGLESTRIP == 5 ) );
+			Assert( NumVertices >= 1 );
 
-			static const struct prim_t
-			{
-				GLenum m_nType;
-				uint m_nPrimMul;
-				uint m_nPrimAdd;
-			} s_primTypes[6] = 
-			{ 
-				{ 0, 0, 0 },				// 0
-				{ 0, 0, 0 },				// 1
-				{ GL_LINES, 2, 0 },			// 2 D3DPT_LINELIST
-				{ 0, 0, 0 },				// 3 
-				{ GL_TRIANGLES, 3, 0 },		// 4 D3DPT_TRIANGLELIST
-				{ GL_TRIANGLE_STRIP, 1, 2 }	// 5 D3DPT_TRIANGLESTRIP
-			};
-
-			if ( Type <= D3DPT_TRIANGLESTRIP )	
-			{
-				const prim_t& p = s_primTypes[Type];
-				Assert( p.m_nType );
-				Assert( NumVertices >= 1 );
-
-				m_ctx->DrawRangeElements( p.m_nType, (GLuint)MinVertexIndex, (GLuint)( MinVertexIndex + NumVertices - 1 ), (GLsizei)p.m_nPrimAdd + primCount * p.m_nPrimMul, (GLenum)GL_UNSIGNED_SHORT, (const GLvoid *)( startIndex * sizeof(short) ), BaseVertexIndex, m_indices.m_idxBuffer->m_idxBuffer );
-			}
+			m_ctx->DrawRangeElements( p.m_nType, (GLuint)MinVertexIndex, (GLuint)( MinVertexIndex + NumVertices - 1 ), (GLsizei)nIndexCount, (GLenum)GL_UNSIGNED_SHORT, (const GLvoid *)( startIndex * sizeof(short) ), BaseVertexIndex, m_indices.m_idxBuffer->m_idxBuffer );
 		}
 	}
 
@@ -5662,7 +6194,11 @@ HRESULT IDirect3DDevice9::EvictManagedResources()
 {
 	GL_BATCH_PERF_CALL_TIMER;
 	GL_PUBLIC_ENTRYPOINT_CHECKS( this );
-	GLMPRINTF(("-X- IDirect3DDevice9::EvictManagedResources --> IGNORED"));
+	GLMPRINTF(("-A- IDirect3DDevice9::EvictManagedResources"));
+
+	// with a gl_residency_budget_mb set, whatever isn't bound or locked right now drops its GL object and the next use
+	// re-sends it from system memory. otherwise a no-op, as it always was
+	m_ctx->EvictManagedTextures();
 	return S_OK;
 }
 
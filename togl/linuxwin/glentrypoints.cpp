@@ -454,10 +454,12 @@ COpenGLEntryPoints::COpenGLEntryPoints()
 	bool bGLCanDecodeS3TCTextures = m_bHave_GL_EXT_texture_compression_s3tc || ( m_bHave_GL_EXT_texture_compression_dxt1 && m_bHave_GL_ANGLE_texture_compression_dxt3 && m_bHave_GL_ANGLE_texture_compression_dxt5 );
 	if ( !bGLCanDecodeS3TCTextures )
 	{
-		Error( "This application requires either the GL_EXT_texture_compression_s3tc, or the GL_EXT_texture_compression_dxt1 + GL_ANGLE_texture_compression_dxt3 + GL_ANGLE_texture_compression_dxt5 OpenGL extensions. Please install S3TC texture support.\n" );
+		// not fatal any more, GLMContext decodes DXT textures on the CPU (slower loads, 4-8x the texture memory)
+		Plat_DebugString( "No S3TC texture support (GL_EXT_texture_compression_s3tc, or GL_EXT_texture_compression_dxt1 + GL_ANGLE_texture_compression_dxt3 + GL_ANGLE_texture_compression_dxt5), DXT textures will be decoded in software.\n" );
 	}
 
-	if ( !m_bHave_GL_EXT_texture_sRGB_decode )
+	// without decode control, sRGB and linear sampling of one texture goes through ARB_texture_view aliases instead
+	if ( !m_bHave_GL_EXT_texture_sRGB_decode && !( m_bHave_GL_ARB_texture_view && m_bHave_GL_ARB_texture_storage ) )
  	{
  		Error( "Required OpenGL extension \"GL_EXT_texture_sRGB_decode\" is not supported. Please update your OpenGL driver.\n" );
  	}
@@ -610,6 +610,7 @@ void GLMContext::ForceFlushStates()
 
 	for ( int i = 0; i < GLM_SAMPLER_COUNT; i++ )
 	{
+		m_samplers[i].m_pBoundAtlas = NULL;
 		SetSamplerTex( i, m_samplers[i].m_pBoundTex );
 		SetSamplerDirty( i );
 	}
@@ -732,6 +733,7 @@ void GLMContext::DumpCaps( void )
 	dumpfield( m_costlyGammaFlips );
 	dumpfield( m_badDriver1064NV );
 	dumpfield( m_badDriver108Intel );
+	dumpfield( m_nBufferSubDataChunkSize );
 
 	printf("\n--------------------------------");
 	
@@ -740,16 +742,90 @@ void GLMContext::DumpCaps( void )
 	#undef dumpfield_str
 }
 
+ConVar gl_texpool( "gl_texpool", "1" );
+ConVar gl_texpool_idle_frames( "gl_texpool_idle_frames", "300" );
+ConVar gl_texpool_budget_mb( "gl_texpool_budget_mb", "64" );
+
 CGLMTex	*GLMContext::NewTex( GLMTexLayoutKey *key, const char *debugLabel )
 {
 	// get a layout based on the key
 	GLMTexLayout *layout = m_texLayoutTable->NewLayoutRef( key );
+
+	// layouts are shared per key, so a pooled tex with the same layout is an exact match - newest first, it's likeliest to still be in VRAM
+	for ( int i = m_TexPool.Count() - 1; i >= 0; i-- )
+	{
+		CGLMTex *tex = m_TexPool[i];
+		if ( tex->m_layout != layout )
+			continue;
+
+		m_TexPool.Remove( i );
+		m_nTexPoolBytes -= tex->m_layout->m_storageTotalSize;
+
+		// the pooled tex already holds a ref on this layout
+		m_texLayoutTable->DelLayoutRef( layout );
+
+		if ( tex->m_debugLabel )
+		{
+			free( tex->m_debugLabel );
+		}
+		tex->m_debugLabel = debugLabel ? strdup( debugLabel ) : NULL;
+		tex->m_nResidencyPriority = 0;
+		tex->m_nLastUsedBatch = m_nBatchCounter;
+
+		GLMPRINTF(("-A- -**TEXREUSE '%-60s' name=%06d  label=%s ", layout->m_layoutSummary, tex->m_texName, tex->m_debugLabel ? tex->m_debugLabel : "-" ));
+
+		return tex;
+	}
 			
 	CGLMTex *tex = new CGLMTex( this, layout, debugLabel );
 	
 	return tex;
 }
 
+bool GLMContext::CanPoolTex( CGLMTex *tex )
+{
+	// only render targets - they get churned on view setup changes, and their contents are undefined on create anyway
+	if ( !gl_texpool.GetInt() || !m_pDevice )
+		return false;
+
+	return ( tex->m_layout->m_key.m_texFlags & kGLMTexRenderable ) && !tex->m_bEvicted && !tex->m_lockCount;
+}
+
+void GLMContext::ReleasePooledTex( int nPoolIndex )
+{
+	CGLMTex *tex = m_TexPool[nPoolIndex];
+	m_TexPool.Remove( nPoolIndex );
+	m_nTexPoolBytes -= tex->m_layout->m_storageTotalSize;
+
+	// IDirect3DDevice9::ReleasedCGLMTex left its FBOs in place for reuse, they go now
+	m_pDevice->ScrubFBOMap( tex );
+
+	if ( tex->m_rtAttachCount != 0 )
+	{
+		GLMDebugPrintf("GLMContext::ReleasePooledTex: Leaking tex %08x [ %s ] - still attached for drawing",tex, tex->m_layout->m_layoutSummary );
+	}
+	else
+	{
+		delete tex;
+	}
+}
+
+void GLMContext::UpdateTexPool( bool bPurgeAll )
+{
+	const uint nIdleFrames = MAX( gl_texpool_idle_frames.GetInt(), 0 );
+	const uint64 nBudget = (uint64)MAX( gl_texpool_budget_mb.GetInt(), 0 ) * 1024 * 1024;
+
+	// oldest first, so stop at the first one that is young enough and under budget
+	while ( m_TexPool.Count() )
+	{
+		CGLMTex *tex = m_TexPool[0];
+		if ( !bPurgeAll && ( m_nCurFrame - tex->m_nPooledFrame ) < nIdleFrames && m_nTexPoolBytes <= nBudget )
+			break;
+
+		ReleasePooledTex( 0 );
+	}
+}
+
 void GLMContext::DelTex( CGLMTex * tex )
 {
 	for( int i = 0; i < GLM_SAMPLER_COUNT; i++)
@@ -760,7 +836,22 @@ void GLMContext::DelTex( CGLMTex * tex )
 		}
 	}
 			
-	if ( tex->m_rtAttachCount != 0 )
+	if ( CanPoolTex( tex ) )
+	{
+		// keeps its GL object and its FBO entries, UpdateTexPool frees it if nobody asks for the layout again
+		if ( tex->m_bMipGenPending )
+		{
+			m_PendingMipGen.FindAndFastRemove( tex );
+			tex->m_bMipGenPending = false;
+		}
+		tex->ForceRBONonDirty();		// contents are dead, no point resolving them
+		tex->DiscardReadback();
+		tex->m_nPooledFrame = m_nCurFrame;
+
+		m_TexPool.AddToTail( tex );
+		m_nTexPoolBytes += tex->m_layout->m_storageTotalSize;
+	}
+	else if ( tex->m_rtAttachCount != 0 )
 	{
 		// RG - huh? wtf? TODO: fix this code which seems to be purposely leaking
 		// leak it and complain - we may have to implement a deferred-delete system for tex like these
@@ -783,6 +874,191 @@ void GLMContext::DelTex( CGLMTex * tex )
 	}
 }
 
+ConVar gl_texcompress_per_frame( "gl_texcompress_per_frame", "4" );	// finished compress jobs swapped in per Present, each one is a full re-upload
+
+bool GLMContext::SetTexCompression( uint nMinBytes )
+{
+	// the compressed textures would just get decoded again
+	if ( nMinBytes && m_bSoftwareDXTDecode )
+	{
+		nMinBytes = 0;
+	}
+
+	if ( nMinBytes && !m_pTexCompressor )
+	{
+		m_pTexCompressor = new CGLMTexCompressor;
+		if ( !m_pTexCompressor->Init() )
+		{
+			delete m_pTexCompressor;
+			m_pTexCompressor = NULL;
+		}
+	}
+
+	// textures already marked keep going, and the compressor lives until the context goes away
+	m_nTexCompressMinBytes = m_pTexCompressor ? nMinBytes : 0;
+
+	return m_nTexCompressMinBytes != 0;
+}
+
+void GLMContext::QueueTexCompress( CGLMTex *tex )
+{
+	Assert( tex->CanQueueCompression() );
+
+	GLMTexCompressJob_t *pJob = new GLMTexCompressJob_t;
+
+	GLMTexLayout *layout = tex->m_layout;
+	pJob->m_Src.SetCount( layout->m_storageTotalSize );
+	memcpy( pJob->m_Src.Base(), tex->m_backing, layout->m_storageTotalSize );
+	pJob->m_bSrcHasAlpha = ( layout->m_format->m_d3dFormat == D3DFMT_A8R8G8B8 );
+
+	pJob->m_Slices.SetCount( layout->m_sliceCount );
+	for( int i=0; i<layout->m_sliceCount; i++)
+	{
+		GLMTexCompressSlice_t &slice = pJob->m_Slices[i];
+		slice.m_nWidth = layout->m_slices[i].m_xSize;
+		slice.m_nHeight = layout->m_slices[i].m_ySize;
+		slice.m_nDepth = layout->m_slices[i].m_zSize;
+		slice.m_nSrcOffset = layout->m_slices[i].m_storageOffset;
+		slice.m_nDstOffset = 0;
+		slice.m_nDstSize = 0;
+	}
+
+	tex->m_pCompressJob = pJob;
+	m_CompressingTextures.AddToTail( tex );
+
+	m_pTexCompressor->QueueJob( pJob );
+}
+
+void GLMContext::CancelTexCompress( CGLMTex *tex )
+{
+	Assert( tex->m_pCompressJob );
+
+	m_CompressingTextures.FindAndRemove( tex );
+	m_pTexCompressor->ReleaseJob( tex->m_pCompressJob );
+	tex->m_pCompressJob = NULL;
+}
+
+void GLMContext::UpdateTexCompression( void )
+{
+	int nBudget = MAX( gl_texcompress_per_frame.GetInt(), 1 );
+
+	for( int i=0; i<m_CompressingTextures.Count() && nBudget; )
+	{
+		CGLMTex *tex = m_CompressingTextures[i];
+
+		// leave it be while something else has a hand on the texels
+		if ( !tex->m_pCompressJob->m_bDone || tex->m_lockCount || tex->m_bStreamPending || tex->HasDirtyRegions() )
+		{
+			i++;
+			continue;
+		}
+
+		m_CompressingTextures.Remove( i );
+		tex->ApplyCompression();
+		nBudget--;
+	}
+}
+
+ConVar gl_texatlas_layers( "gl_texatlas_layers", "64" );		// layers per atlas (capped by GL_MAX_ARRAY_TEXTURE_LAYERS)
+
+void GLMContext::AtlasTex( CGLMTex *tex )
+{
+	Assert( tex->CanAtlas() );
+
+	GLMTexLayout *layout = tex->m_layout;
+	if ( ( layout->m_key.m_texGLTarget != GL_TEXTURE_2D ) || layout->m_key.m_texSamples || ( layout->m_key.m_texFlags & kGLMTexRenderable ) )
+	{
+		tex->m_bAtlasCandidate = false;
+		return;
+	}
+
+	// any atlas of this layout with room (layouts are shared per key, so the pointer compare is a key compare)
+	GLMTexAtlas *atlas = NULL;
+	FOR_EACH_VEC( m_TexAtlases, i )
+	{
+		if ( ( m_TexAtlases[i]->m_layout == layout ) && ( m_TexAtlases[i]->m_nUsedLayers < m_TexAtlases[i]->m_Layers.Count() ) )
+		{
+			atlas = m_TexAtlases[i];
+			break;
+		}
+	}
+
+	if ( !atlas )
+	{
+		atlas = new GLMTexAtlas;
+		atlas->m_layout = m_texLayoutTable->NewLayoutRef( &layout->m_key );
+		Assert( atlas->m_layout == layout );
+		atlas->m_texName = 0;		// CGLMTex::CopyToAtlasLayer makes it
+		atlas->m_nUsedLayers = 0;
+		atlas->m_Layers.SetCount( clamp( gl_texatlas_layers.GetInt(), 1, MAX( m_nMaxTexAtlasLayers, 1 ) ) );
+		FOR_EACH_VEC( atlas->m_Layers, i )
+		{
+			atlas->m_Layers[i] = NULL;
+		}
+		m_TexAtlases.AddToTail( atlas );
+	}
+
+	int layer = atlas->m_Layers.Find( NULL );
+	Assert( layer >= 0 );
+
+	tex->CopyToAtlasLayer( atlas, layer );
+
+	atlas->m_Layers[layer] = tex;
+	atlas->m_nUsedLayers++;
+	tex->m_pAtlas = atlas;
+	tex->m_nAtlasLayer = layer;
+
+	GLMPRINTF(("-A- -**TEXATLAS '%-60s' name=%06d  atlas=%06d layer=%d  label=%s ", layout->m_layoutSummary, tex->m_texName, atlas->m_texName, layer, tex->m_debugLabel ? tex->m_debugLabel : "-" ));
+}
+
+void GLMContext::ReleaseAtlasLayer( CGLMTex *tex )
+{
+	GLMTexAtlas *atlas = tex->m_pAtlas;
+	Assert( atlas && ( atlas->m_Layers[ tex->m_nAtlasLayer ] == tex ) );
+
+	atlas->m_Layers[ tex->m_nAtlasLayer ] = NULL;
+	atlas->m_nUsedLayers--;
+	tex->m_pAtlas = NULL;
+	tex->m_nAtlasLayer = -1;
+
+	// samplers reading the layer go back to the tex's own GL object
+	for( int i=0; i<GLM_SAMPLER_COUNT; i++)
+	{
+		if ( ( m_nAtlasSamplerMask & ( 1 << i ) ) && ( m_samplers[i].m_pBoundTex == tex ) )
+		{
+			BindTexToTMU( tex, i );
+			SetSamplerDirty( i );
+		}
+	}
+
+	if ( !atlas->m_nUsedLayers )
+	{
+		FreeTexAtlas( atlas );
+	}
+}
+
+void GLMContext::FreeTexAtlas( GLMTexAtlas *atlas )
+{
+	for( int i=0; i<GLM_SAMPLER_COUNT; i++)
+	{
+		if ( m_samplers[i].m_pBoundAtlas == atlas )
+		{
+			SelectTMU( i );
+			gGL->glBindTexture( GL_TEXTURE_2D_ARRAY_EXT, 0 );
+			m_samplers[i].m_pBoundAtlas = NULL;
+		}
+	}
+
+	if ( atlas->m_texName )
+	{
+		gGL->glDeleteTextures( 1, &atlas->m_texName );
+	}
+
+	m_TexAtlases.FindAndFastRemove( atlas );
+	m_texLayoutTable->DelLayoutRef( atlas->m_layout );
+	delete atlas;
+}
+
 // push and pop attrib when blit has mixed srgb source and dest?		
 ConVar	gl_radar7954721_workaround_mixed ( "gl_radar7954721_workaround_mixed", "1" );
 
@@ -888,6 +1164,31 @@ void GLMContext::Blit2( CGLMTex *srcTex, GLMRect *srcRect, int srcFace, int srcM
 	
 	Assert( srcFace == 0 );
 	Assert( dstFace == 0 );
+
+	// FBO blits need the original color format back
+	srcTex->DropCompression();
+	dstTex->DropCompression();
+
+	// the blit lands in the dest's own GL object, its layer would go stale
+	if ( dstTex->m_pAtlas )
+	{
+		ReleaseAtlasLayer( dstTex );
+	}
+
+	// the source gets attached by name below (the dest goes through TexAttach)
+	srcTex->EnsureGLTexture();
+
+	// both have to be current in GL, or coalesced uploads land out of order
+	srcTex->FlushDirtyRegions();
+	dstTex->FlushDirtyRegions();
+
+	if ( ( dstMip == 0 ) && ( dstTex->m_layout->m_key.m_texFlags & kGLMTexMippedAuto ) )
+	{
+		QueueMipGen( dstTex );
+	}
+
+	// and whatever readback the dest had in flight is about to go stale
+	dstTex->DiscardReadback();
 	
 	//----------------------------------------------------------------- format assessment
 
@@ -1035,12 +1336,17 @@ void GLMContext::Blit2( CGLMTex *srcTex, GLMRect *srcRect, int srcFace, int srcM
 		
 		// blit#1 - to resolve to scratch
 		// implicitly means no scaling, thus will be done with NEAREST sampling
+		// only the damage needs it, the rest of the tex is already current (and none of it if nothing's been drawn since the last resolve)
 
 		GLenum resolveFilter = GL_NEAREST;
 		
-		gGL->glBlitFramebufferEXT(	0, 0,	srcTex->m_layout->m_key.m_xSize, srcTex->m_layout->m_key.m_ySize,
-								0, 0,	srcTex->m_layout->m_key.m_xSize, srcTex->m_layout->m_key.m_ySize,	// same source and dest rect, whole surface
-								blitMask, resolveFilter );
+		if ( srcTex->IsRBODirty() )
+		{
+			const GLMRect &damage = srcTex->m_resolveDamage;
+			gGL->glBlitFramebufferEXT(	damage.xmin, damage.ymin, damage.xmax, damage.ymax,
+									damage.xmin, damage.ymin, damage.xmax, damage.ymax,	// same source and dest rect
+									blitMask, resolveFilter );
+		}
 								
 		// FBO1 now holds the interesting content.
 		// scrub FBO0, bind FBO1 to READ, fall through to next stage of blit where 1 goes onto 0 (or BACK)
@@ -1162,6 +1468,11 @@ void GLMContext::Blit2( CGLMTex *srcTex, GLMRect *srcRect, int srcFace, int srcM
 		gGL->glBlitFramebufferEXT(	srcRect->xmin, srcRect->ymin, srcRect->xmax, srcRect->ymax,
 								dstRect->xmin, dstRect->ymin, dstRect->xmax, dstRect->ymax,
 								blitMask, filter );
+
+		if ( dstTex->m_rboName )
+		{
+			dstTex->AddResolveDamage( *dstRect );
+		}
 	}
 
 	//----------------------------------------------------------------- scrub READ and maybe DRAW FBO, and unbind
@@ -1493,179 +1804,543 @@ void GLMContext::BlitTex( CGLMTex *srcTex, GLMRect *srcRect, int srcFace, int sr
 		pushed--;
 	}
 
-	RestoreSavedColorMask();
+	RestoreSavedColorMask();
+}
+
+void GLMContext::ResolveTex( CGLMTex *tex, bool forceDirty )
+{
+	ResolveTexBatch( &tex, 1, forceDirty );
+}
+
+void GLMContext::ResolveTexBatch( CGLMTex **ppTex, int nCount, bool forceDirty )
+{
+	// only run resolves that are (a) possible and (b) dirty or force-dirtied
+	int nResolves = 0;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		if ( ( ppTex[i]->m_rboName ) && ( ppTex[i]->IsRBODirty() || forceDirty ) )
+		{
+			nResolves++;
+		}
+	}
+	if ( !nResolves )
+		return;
+
+#if GL_TELEMETRY_GPU_ZONES
+	CScopedGLMPIXEvent glmPIXEvent( "ResolveTex" );
+	g_TelemetryGPUStats.m_nTotalResolveTex += nResolves;
+#endif
+
+	// scissor off and the blit FBOs bound once for the whole batch
+	GLScissorEnable_t	oldsciss,newsciss;
+	m_ScissorEnable.Read( &oldsciss, 0 );
+	if ( oldsciss.enable )
+	{
+		newsciss.enable = false;
+		m_ScissorEnable.Write( &newsciss );
+	}
+
+	BindFBOToCtx( m_blitReadFBO, GL_READ_FRAMEBUFFER_EXT );
+	BindFBOToCtx( m_blitDrawFBO, GL_DRAW_FRAMEBUFFER_EXT );
+
+	// read/draw buffer state lives on the blit FBOs, only touch it when the class changes
+	GLenum nBlitBuffer = GL_INVALID_ENUM;
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		CGLMTex *tex = ppTex[i];
+		if ( !( ( tex->m_rboName ) && ( tex->IsRBODirty() || forceDirty ) ) )
+			continue;
+
+		// depth and depth/stencil resolve too, GL allows it as long as it's an unscaled NEAREST blit between matching formats (which we are)
+		eBlitFormatClass	formatClass = eColor;
+		GLuint				blitMask = 0;
+		switch( tex->m_layout->m_format->m_glDataFormat )
+		{
+			case GL_RED: case GL_BGRA:	case GL_RGB:	case GL_RGBA:	case GL_ALPHA:	case GL_LUMINANCE:	case GL_LUMINANCE_ALPHA:
+				formatClass = eColor;
+				blitMask = GL_COLOR_BUFFER_BIT;
+			break;
+
+			case GL_DEPTH_COMPONENT:
+				formatClass = eDepth;
+				blitMask = GL_DEPTH_BUFFER_BIT;
+			break;
+			
+			case GL_DEPTH_STENCIL_EXT:
+				formatClass = eDepthStencil;
+				blitMask = GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+			break;
+
+			default:
+				Assert(!"Unsupported format for MSAA resolve" );
+			break;
+		}
+
+		if ( !blitMask )
+		{
+			tex->ForceRBONonDirty();
+			continue;
+		}
+
+		GLMRect rect;
+		if ( forceDirty || !tex->IsRBODirty() )
+		{
+			rect.xmin = rect.ymin = 0;
+			rect.xmax = tex->m_layout->m_key.m_xSize;
+			rect.ymax = tex->m_layout->m_key.m_ySize;
+		}
+		else
+		{
+			rect = tex->m_resolveDamage;
+		}
+
+		// color goes through attachment 0. a depth only FBO has to say GL_NONE or EXT_fbo calls it incomplete
+		const GLenum nBuffer = ( formatClass == eColor ) ? GL_COLOR_ATTACHMENT0_EXT : GL_NONE;
+		if ( nBuffer != nBlitBuffer )
+		{
+			gGL->glReadBuffer( nBuffer );
+			gGL->glDrawBuffer( nBuffer );
+			nBlitBuffer = nBuffer;
+		}
+
+		// RBO on the read FB, tex on the draw FB
+		glAttachRBOtoFBO( GL_READ_FRAMEBUFFER_EXT, formatClass, tex->m_rboName );
+		glAttachTex2DtoFBO( GL_DRAW_FRAMEBUFFER_EXT, formatClass, tex->m_texName, 0 );
+
+		gGL->glBlitFramebufferEXT(	rect.xmin, rect.ymin, rect.xmax, rect.ymax,
+								rect.xmin, rect.ymin, rect.xmax, rect.ymax,
+								blitMask, GL_NEAREST );
+
+		glAttachRBOtoFBO( GL_READ_FRAMEBUFFER_EXT, formatClass, 0 );
+		glAttachTex2DtoFBO( GL_DRAW_FRAMEBUFFER_EXT, formatClass, 0, 0 );
+
+		// mark the RBO clean on the resolved tex
+		tex->ForceRBONonDirty();
+	}
+
+	//	put the original FB back in place (both read and draw)
+	BindFBOToCtx( m_drawingFBO, GL_FRAMEBUFFER_EXT );
+	
+	if ( oldsciss.enable )
+	{
+		m_ScissorEnable.Write( &oldsciss );
+	}
+}
+
+void GLMContext::DamageDrawingFBO( const GLScissorBox_t *pClearBox, bool bClear )
+{
+	// a draw lands inside the viewport, a clear anywhere. either one is held to the scissor (a clear box replaces it)
+	GLMRect rect = { 0, 0, INT_MAX, INT_MAX };
+	if ( !bClear )
+	{
+		const GLViewportBox_t &viewport = m_ViewportBox.GetData();
+		rect.xmin = viewport.x;
+		rect.ymin = viewport.y;
+		rect.xmax = viewport.x + viewport.width;
+		rect.ymax = viewport.y + viewport.height;
+	}
+
+	const GLScissorBox_t *pScissor = pClearBox;
+	if ( !pScissor && m_ScissorEnable.GetData().enable )
+	{
+		pScissor = &m_ScissorBox.GetData();
+	}
+	if ( pScissor )
+	{
+		rect.xmin = MAX( rect.xmin, pScissor->x );
+		rect.ymin = MAX( rect.ymin, pScissor->y );
+		rect.xmax = MIN( rect.xmax, pScissor->x + pScissor->width );
+		rect.ymax = MIN( rect.ymax, pScissor->y + pScissor->height );
+	}
+
+	uint nMask = m_drawingFBO->m_nRBOAttachMask;
+	for ( int i = 0; nMask; i++, nMask >>= 1 )
+	{
+		if ( nMask & 1 )
+		{
+			m_drawingFBO->m_attach[i].m_tex->AddResolveDamage( rect );
+		}
+	}
+}
+
+void GLMContext::FlushPendingResolves( void )
+{
+	// like FlushPendingMipGen - only what this draw samples, and not while it's still a target of the draw
+	CGLMTex *pResolves[ GLM_SAMPLER_COUNT ];
+	int nResolves = 0;
+
+	// vertex texture fetch counts too
+	const uint nSamplerMask = m_pBoundPair ? ( m_pBoundPair->m_fragmentProg->m_samplerMask | m_pBoundPair->m_vertexProg->m_samplerMask ) : 0;
+	for ( int i = 0; i < GLM_SAMPLER_COUNT; i++ )
+	{
+		CGLMTex *tex = m_samplers[i].m_pBoundTex;
+		if ( !( nSamplerMask & ( 1 << i ) ) || !tex || !tex->m_bResolvePending )
+			continue;
+
+		bool bAttached = false;
+		for ( int j = 0; m_drawingFBO && ( j < kAttCount ) && !bAttached; j++ )
+		{
+			bAttached = ( m_drawingFBO->m_attach[j].m_tex == tex );
+		}
+		if ( bAttached )
+			continue;
+
+		// same tex on two samplers
+		bool bDupe = false;
+		for ( int j = 0; ( j < nResolves ) && !bDupe; j++ )
+		{
+			bDupe = ( pResolves[j] == tex );
+		}
+		if ( !bDupe )
+		{
+			pResolves[ nResolves++ ] = tex;
+		}
+	}
+
+	if ( nResolves )
+	{
+		ResolveTexBatch( pResolves, nResolves );
+	}
+}
+
+// Once every slice of a texture has been uploaded, its system memory copy is only needed again for a lock
+// (or a readback), and CGLMTex::Lock copies the slice back out of GL for that unless the lock discards. So idle backings are kept in an LRU
+// and the oldest ones get freed past this budget. -1 keeps them all.
+ConVar gl_tex_backing_budget_mb( "gl_tex_backing_budget_mb", "128" );
+
+void GLMContext::EnforceTexBackingBudget( void )
+{
+	int nBudgetMB = gl_tex_backing_budget_mb.GetInt();
+	if ( nBudgetMB < 0 )
+		return;
+
+	const uint64 nBudget = (uint64)nBudgetMB * 1024 * 1024;
+	while ( ( m_nTexBackingLRUBytes > nBudget ) && m_pTexBackingLRUHead )
+	{
+		CGLMTex *pTex = m_pTexBackingLRUHead;
+		pTex->UnlinkBackingLRU();
+		pTex->ReleaseBacking();
+	}
+}
+
+// Estimated VRAM that the GL textures and buffers may use before cold managed textures start getting evicted, so the
+// driver doesn't have to page. 0 is no limit.
+ConVar gl_residency_budget_mb( "gl_residency_budget_mb", "0" );
+
+void GLMContext::AddResidentTex( CGLMTex *tex )
+{
+	Assert( tex->m_nResidentIndex < 0 );
+	tex->m_nResidentIndex = m_ResidentTextures.AddToTail( tex );
+	m_nResidentTexBytes += tex->m_layout->m_storageTotalSize;
+}
+
+void GLMContext::RemoveResidentTex( CGLMTex *tex )
+{
+	int i = tex->m_nResidentIndex;
+	if ( i < 0 )
+		return;
+
+	Assert( m_ResidentTextures[i] == tex );
+	m_ResidentTextures.FastRemove( i );
+	if ( i < m_ResidentTextures.Count() )
+	{
+		m_ResidentTextures[i]->m_nResidentIndex = i;
+	}
+	tex->m_nResidentIndex = -1;
+
+	Assert( m_nResidentTexBytes >= (uint64)tex->m_layout->m_storageTotalSize );
+	m_nResidentTexBytes -= tex->m_layout->m_storageTotalSize;
+}
+
+void GLMContext::EnforceResidencyBudget( void )
+{
+	int nBudgetMB = gl_residency_budget_mb.GetInt();
+	if ( nBudgetMB <= 0 )
+		return;
+
+	const uint64 nBudget = (uint64)nBudgetMB * 1024 * 1024;
+	if ( GetResidentBytes() > nBudget )
+	{
+		EvictTextures( nBudget, true );
+	}
+}
+
+void GLMContext::EvictManagedTextures( void )
+{
+	// every eviction reads the texture back and re-sends it on next use, so only when residency management is on
+	if ( gl_residency_budget_mb.GetInt() <= 0 )
+		return;
+
+	EvictTextures( 0, false );
+}
+
+int __cdecl GLMContext::EvictOrderFunc( CGLMTex * const *ppA, CGLMTex * const *ppB )
+{
+	// lowest priority first, then least recently used
+	const CGLMTex *pA = *ppA, *pB = *ppB;
+	if ( pA->m_nResidencyPriority != pB->m_nResidencyPriority )
+		return ( pA->m_nResidencyPriority < pB->m_nResidencyPriority ) ? -1 : 1;
+	if ( pA->m_nLastUsedBatch != pB->m_nLastUsedBatch )
+		return ( pA->m_nLastUsedBatch < pB->m_nLastUsedBatch ) ? -1 : 1;
+	return 0;
+}
+
+void GLMContext::EvictTextures( uint64 nTargetBytes, bool bColdOnly )
+{
+	CUtlVector< CGLMTex* > candidates;
+	for ( int i = 0; i < m_ResidentTextures.Count(); i++ )
+	{
+		CGLMTex *tex = m_ResidentTextures[i];
+		
+		// anything drawn with last frame or this one is likely to be wanted again right away
+		if ( bColdOnly && ( tex->m_nLastUsedBatch >= m_nPrevFrameFirstBatch ) )
+			continue;
+		
+		if ( tex->CanEvict() )
+		{
+			candidates.AddToTail( tex );
+		}
+	}
+
+	candidates.Sort( EvictOrderFunc );
+
+	for ( int i = 0; ( i < candidates.Count() ) && ( GetResidentBytes() > nTargetBytes ); i++ )
+	{
+		candidates[i]->Evict();
+	}
+
+	GLMPRINTF(( "-D- GLMContext::EvictTextures: %d candidates, %d MB resident", candidates.Count(), (int)( GetResidentBytes() >> 20 ) ));
+}
+
+ConVar gl_texstream_budget_kb( "gl_texstream_budget_kb", "4096" );
+
+void GLMContext::QueueTexStream( CGLMTex *tex )
+{
+	if ( !tex->m_bStreamPending )
+	{
+		tex->m_bStreamPending = true;
+		m_StreamingTextures.AddToTail( tex );
+	}
+}
+
+void GLMContext::UpdateTexStreaming( void )
+{
+	// a mip per texture per pass, oldest textures first, and always at least one so huge mips don't get stuck
+	const int nBudget = gl_texstream_budget_kb.GetInt() * 1024;
+	int nSent = 0;
+	bool bProgress = true;
+	while ( bProgress && m_StreamingTextures.Count() && ( !nSent || ( nSent < nBudget ) ) )
+	{
+		bProgress = false;
+		for ( int i = 0; ( i < m_StreamingTextures.Count() ) && ( !nSent || ( nSent < nBudget ) ); )
+		{
+			CGLMTex *tex = m_StreamingTextures[i];
+
+			int nBytes = tex->StreamNextMip();
+			nSent += nBytes;
+			bProgress |= ( nBytes != 0 );
+
+			bool bDone = true;
+			for ( int slice = 0; slice < tex->m_layout->m_sliceCount; slice++ )
+			{
+				if ( tex->m_sliceFlags[ slice ] & kSliceStreamPending )
+				{
+					bDone = false;
+					break;
+				}
+			}
+
+			if ( bDone )
+			{
+				tex->m_bStreamPending = false;
+				m_StreamingTextures.Remove( i );
+
+				// everything is in GL now
+				if ( tex->CanReleaseBacking() )
+				{
+					tex->LinkBackingLRU();
+				}
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	EnforceTexBackingBudget();
 }
 
-void GLMContext::ResolveTex( CGLMTex *tex, bool forceDirty )
+void GLMContext::FlushDirtyTextures( bool bSampledOnly )
 {
-#if GL_TELEMETRY_GPU_ZONES
-	CScopedGLMPIXEvent glmPIXEvent( "ResolveTex" );
-	g_TelemetryGPUStats.m_nTotalResolveTex++;
-#endif
-
-	// only run resolve if it's (a) possible and (b) dirty or force-dirtied
-	if ( ( tex->m_rboName ) && ( tex->IsRBODirty() || forceDirty ) )
+	for ( int i = m_DirtyTextures.Count() - 1; i >= 0; i-- )
 	{
-		// state we need to save
-		//	current setting of scissor
-		//	current setting of the drawing fbo (no explicit save, it's in the context)
-		GLScissorEnable_t	oldsciss,newsciss;
-		m_ScissorEnable.Read( &oldsciss, 0 );
-
-		// remember to restore m_drawingFBO at end of effort
-		
-		// setup
-		//	turn off scissor
-		newsciss.enable = false;
-		m_ScissorEnable.Write( &newsciss );
+		CGLMTex *tex = m_DirtyTextures[i];
 
-		// select which attachment enum we're going to use for the blit
-		// default to color0, unless it's a depth or stencil flava
-		
-		// for resolve, only handle a modest subset of the possible formats
-		EGLMFBOAttachment	attachIndex = (EGLMFBOAttachment)0;
-		GLenum				attachIndexGL = 0;
-		GLuint				blitMask = 0;
-		switch( tex->m_layout->m_format->m_glDataFormat )
+		if ( bSampledOnly )
 		{
-			case GL_BGRA:
-			case GL_RGB:
-			case GL_RGBA:
-	//		case GL_ALPHA:
-	//		case GL_LUMINANCE:
-	//		case GL_LUMINANCE_ALPHA:
-				attachIndex = kAttColor0;
-				attachIndexGL = GL_COLOR_ATTACHMENT0_EXT;
-				blitMask = GL_COLOR_BUFFER_BIT;
-			break;
+			bool bSampled = false;
+			for ( int j = 0; ( j < GLM_SAMPLER_COUNT ) && !bSampled; j++ )
+			{
+				bSampled = ( m_samplers[j].m_pBoundTex == tex );
+			}
+			if ( !bSampled )
+				continue;
+		}
 
-	//		case GL_DEPTH_COMPONENT:
-	//			attachIndex = kAttDepth;
-	//			attachIndexGL = GL_DEPTH_ATTACHMENT_EXT;
-	//			blitMask = GL_DEPTH_BUFFER_BIT;
-	//		break;
-			
-			case GL_DEPTH_STENCIL_EXT:
-				attachIndex = kAttDepthStencil;
-				attachIndexGL = GL_DEPTH_STENCIL_ATTACHMENT_EXT;
-				blitMask = GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
-			break;
+		// (this takes it off the list)
+		tex->FlushDirtyRegions();
+	}
+}
 
-			default:
-				Assert(!"Unsupported format for MSAA resolve" );
-			break;
-		}
+bool GLMContext::SelectSRGBView( int nSamplerIndex )
+{
+	GLMTexSampler &sampler = m_samplers[nSamplerIndex];
+	CGLMTex *pTex = sampler.m_pBoundTex;
 
-		
-		//	set the read fb, attach read RBO at appropriate attach point, set read buffer
-		BindFBOToCtx( m_blitReadFBO, GL_READ_FRAMEBUFFER_EXT );
+	bool bTexSRGB = ( pTex->m_layout->m_key.m_texFlags & kGLMTexSRGB ) != 0;
+	bool bMismatch = ( bTexSRGB != ( sampler.m_samp.m_packed.m_srgb != 0 ) );
+	bool bWantView = bMismatch && pTex->EnsureSRGBView();
 
-		// going to avoid the TexAttach / TexDetach calls due to potential confusion, implement it directly here
-		
-		//-----------------------------------------------------------------------------------
-		// put tex->m_rboName on the read FB's attachment
-		if (attachIndexGL==GL_DEPTH_STENCIL_ATTACHMENT_EXT)
+	if ( bMismatch && !bWantView && pTex->m_layout->m_format->m_glIntFormatSRGB )
+	{
+		// only L8/A8L8 get here, and CheckDeviceFormat never offers SRGBREAD on those - but don't get it wrong quietly
+		static bool s_bWarned = false;
+		if ( !s_bWarned )
 		{
-			// you have to attach it both places...
-			// http://www.opengl.org/wiki/GL_EXT_framebuffer_object
+			Warning( "GL: no sRGB texture view for %s, sampling it with the wrong sRGB decode\n", pTex->m_layout->m_format->m_formatSummary );
+			s_bWarned = true;
+		}
+	}
 
-			// bind the RBO to the GL_RENDERBUFFER_EXT target - is this extraneous ?
-			//glBindRenderbufferEXT( GL_RENDERBUFFER_EXT, tex->m_rboName );
-			
-			// attach the GL_RENDERBUFFER_EXT target to the depth and stencil attach points
-			gGL->glFramebufferRenderbufferEXT( GL_READ_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, tex->m_rboName);						
-				
-			gGL->glFramebufferRenderbufferEXT( GL_READ_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, tex->m_rboName);
+	if ( bWantView != sampler.m_bBoundSRGBView )
+	{
+		SelectTMU( nSamplerIndex );
+		gGL->glBindTexture( pTex->m_texGLTarget, bWantView ? pTex->m_texViewName : pTex->m_texName );
+		sampler.m_bBoundSRGBView = bWantView;
+	}
 
-			// no need to leave the RBO hanging on
-			//glBindRenderbufferEXT( GL_RENDERBUFFER_EXT, 0 );
-		}
-		else
-		{
-			//glBindRenderbufferEXT( GL_RENDERBUFFER_EXT, tex->m_rboName );
-			
-			gGL->glFramebufferRenderbufferEXT( GL_READ_FRAMEBUFFER_EXT, attachIndexGL, GL_RENDERBUFFER_EXT, tex->m_rboName);
+	if ( !bWantView )
+		return false;
 
-			//glBindRenderbufferEXT( GL_RENDERBUFFER_EXT, 0 );
-		}
+	SelectTMU( nSamplerIndex );
 
-		gGL->glReadBuffer( attachIndexGL );
+	// a fresh view has GL's default parameters
+	if ( pTex->m_nViewBaseLevel < 0 )
+	{
+		pTex->m_ViewSamplingParams.SetToDefaults();
+		pTex->m_ViewSamplingParams.SetToTarget( pTex->m_texGLTarget );
+	}
 
-		//-----------------------------------------------------------------------------------
-		// put tex->m_texName on the draw FBO attachment
+	// and its own level range, which has to follow the base texture's as mips stream in
+	int nBaseLevel = ( pTex->m_minActiveMip <= pTex->m_maxActiveMip ) ? pTex->m_minActiveMip : 0;
+	int nMaxLevel = ( pTex->m_minActiveMip <= pTex->m_maxActiveMip ) ? pTex->m_maxActiveMip : ( pTex->m_layout->m_mipCount - 1 );
+	if ( ( nBaseLevel != pTex->m_nViewBaseLevel ) || ( nMaxLevel != pTex->m_nViewMaxLevel ) )
+	{
+		gGL->glTexParameteri( pTex->m_texGLTarget, GL_TEXTURE_BASE_LEVEL, nBaseLevel );
+		gGL->glTexParameteri( pTex->m_texGLTarget, GL_TEXTURE_MAX_LEVEL, nMaxLevel );
+		pTex->m_nViewBaseLevel = nBaseLevel;
+		pTex->m_nViewMaxLevel = nMaxLevel;
+	}
 
-		//	set the write fb and buffer, and attach write tex
-		BindFBOToCtx( m_blitDrawFBO, GL_DRAW_FRAMEBUFFER_EXT );
+	if ( !m_bUseSamplerObjects && !( pTex->m_ViewSamplingParams == sampler.m_samp ) )
+	{
+		sampler.m_samp.DeltaSetToTarget( pTex->m_texGLTarget, pTex->m_ViewSamplingParams );
+		pTex->m_ViewSamplingParams = sampler.m_samp;
+	}
 
-		// regular path - attaching a texture2d
-		
-		if (attachIndexGL==GL_DEPTH_STENCIL_ATTACHMENT_EXT)
-		{
-			gGL->glFramebufferTexture2DEXT( GL_DRAW_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, tex->m_texName, 0 );
+	return true;
+}
+
+void GLMContext::QueueMipGen( CGLMTex *tex )
+{
+	Assert( tex->m_layout->m_key.m_texFlags & kGLMTexMippedAuto );
+	if ( !tex->m_bMipGenPending )
+	{
+		tex->m_bMipGenPending = true;
+		m_PendingMipGen.AddToTail( tex );
+	}
+}
+
+void GLMContext::FlushPendingMipGen( void )
+{
+	for ( int i = m_PendingMipGen.Count() - 1; i >= 0; i-- )
+	{
+		CGLMTex *tex = m_PendingMipGen[i];
 
-			gGL->glFramebufferTexture2DEXT( GL_DRAW_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT_EXT, GL_TEXTURE_2D, tex->m_texName, 0 );
+		// only rebuild what this draw can sample, anything else may still be getting written
+		bool bSampled = false;
+		for ( int j = 0; ( j < GLM_SAMPLER_COUNT ) && !bSampled; j++ )
+		{
+			bSampled = ( m_samplers[j].m_pBoundTex == tex );
 		}
-		else
+		if ( !bSampled )
+			continue;
+
+		// and if it's still a render target of this draw, level 0 isn't final yet
+		bool bAttached = false;
+		for ( int j = 0; m_drawingFBO && ( j < kAttCount ) && !bAttached; j++ )
 		{
-			gGL->glFramebufferTexture2DEXT( GL_DRAW_FRAMEBUFFER_EXT, attachIndexGL, GL_TEXTURE_2D, tex->m_texName, 0 );
+			bAttached = ( m_drawingFBO->m_attach[j].m_tex == tex );
 		}
+		if ( bAttached )
+			continue;
 
-		gGL->glDrawBuffer( attachIndexGL );
+		GenerateMipmaps( tex );
 
-		//-----------------------------------------------------------------------------------
+		tex->m_bMipGenPending = false;
+		m_PendingMipGen.FastRemove( i );
+	}
+}
 
-		// blit
-		gGL->glBlitFramebufferEXT(	0, 0,	tex->m_layout->m_key.m_xSize, tex->m_layout->m_key.m_ySize,
-								0, 0,	tex->m_layout->m_key.m_xSize, tex->m_layout->m_key.m_ySize,
-								blitMask, GL_NEAREST );
-			// or should it be GL_LINEAR?  does it matter ?
-			
-		//-----------------------------------------------------------------------------------
-		// cleanup
-		//-----------------------------------------------------------------------------------
+void GLMContext::GenerateMipmaps( CGLMTex *tex )
+{
+	GLMTexLayout *layout = tex->m_layout;
+	int topMip = layout->m_mipCount - 1;
+	if ( topMip <= 0 )
+		return;
 
+	tex->EnsureGLTexture();
 
-		//	unset the read fb and buffer, detach read RBO
-		//glBindRenderbufferEXT( GL_RENDERBUFFER_EXT, 0 );
+	// glGenerateMipmap only fills BASE_LEVEL+1 .. MAX_LEVEL, and immutable textures keep MAX_LEVEL at the highest mip written so far
+	bool bRaiseMaxLevel = tex->m_bImmutableStorage && ( tex->m_maxActiveMip < topMip );
+	if ( tex->m_maxActiveMip < topMip )
+	{
+		tex->m_maxActiveMip = topMip;
+	}
 
-		if (attachIndexGL==GL_DEPTH_STENCIL_ATTACHMENT_EXT)
+	if ( gGL->m_bHave_GL_EXT_direct_state_access )
+	{
+		if ( bRaiseMaxLevel )
 		{
-			// detach the GL_RENDERBUFFER_EXT target from the depth and stencil attach points
-			gGL->glFramebufferRenderbufferEXT( GL_READ_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, 0);						
-				
-			gGL->glFramebufferRenderbufferEXT( GL_READ_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, 0);
+			gGL->glTextureParameteriEXT( tex->m_texName, tex->m_texGLTarget, GL_TEXTURE_MAX_LEVEL, topMip );
 		}
-		else
+		gGL->glGenerateTextureMipmapEXT( tex->m_texName, tex->m_texGLTarget );
+	}
+	else
+	{
+		CGLMTex *pPrevTex = m_samplers[0].m_pBoundTex;
+		BindTexToTMU( tex, 0 );
+
+		if ( bRaiseMaxLevel )
 		{
-			gGL->glFramebufferRenderbufferEXT( GL_READ_FRAMEBUFFER_EXT, attachIndexGL, GL_RENDERBUFFER_EXT, 0);
+			gGL->glTexParameteri( tex->m_texGLTarget, GL_TEXTURE_MAX_LEVEL, topMip );
 		}
+		gGL->glGenerateMipmapEXT( tex->m_texGLTarget );
 
-		//-----------------------------------------------------------------------------------
-		//	unset the write fb and buffer, detach write tex
-		
-
-		if (attachIndexGL==GL_DEPTH_STENCIL_ATTACHMENT_EXT)
-		{
-			gGL->glFramebufferTexture2DEXT( GL_DRAW_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, 0, 0 );
+		BindTexToTMU( pPrevTex, 0 );
+	}
 
-			gGL->glFramebufferTexture2DEXT( GL_DRAW_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT_EXT, GL_TEXTURE_2D, 0, 0 );
-		}
-		else
+	// the lower levels are valid in GL now, but m_backing doesn't hold them any more
+	for ( int mip = 1; mip <= topMip; mip++ )
+	{
+		for ( int face = 0; face < layout->m_faceCount; face++ )
 		{
-			gGL->glFramebufferTexture2DEXT( GL_DRAW_FRAMEBUFFER_EXT, attachIndexGL, GL_TEXTURE_2D, 0, 0 );
+			unsigned char &sliceFlags = tex->m_sliceFlags[ tex->CalcSliceIndex( face, mip ) ];
+			sliceFlags |= kSliceValid;
+			sliceFlags &= ~kSliceStorageValid;
 		}
-
-		//	put the original FB back in place (both read and draw)
-		// this bind will hit both read and draw bindings
-		BindFBOToCtx( m_drawingFBO, GL_FRAMEBUFFER_EXT );
-		
-		//	set the read and write buffers back to... what ? does it matter for anything but copies ?  don't worry about it
-		
-		// restore the scissor state
-		m_ScissorEnable.Write( &oldsciss );
-		
-		// mark the RBO clean on the resolved tex
-		tex->ForceRBONonDirty();
 	}
 }
 
@@ -1932,11 +2607,54 @@ void GLMContext::DelBuffer( CGLMBuffer *buff )
 		}
 	}
 		
+	// the loader thread may still reference the GL name
+	if ( buff->m_nPendingUploadSerial )
+	{
+		FinishBufferUpload( buff );
+	}
+
 	BindGLBufferToCtx( buff->m_buffGLTarget, NULL, false );
 			
 	delete buff;
 }
 
+bool GLMContext::GetBufferFrameStats( uint nFramesAgo, GLMBufferFrameStats_t *pStats ) const
+{
+	if ( nFramesAgo >= m_nNumBufferFrameStats )
+		return false;
+
+	*pStats = m_BufferFrameStats[ ( m_nCurBufferFrameStats + GL_BUFFER_FRAME_STATS_HISTORY - 1 - nFramesAgo ) % GL_BUFFER_FRAME_STATS_HISTORY ];
+	return true;
+}
+
+void GLMContext::FinishBufferUpload( CGLMBuffer *pBuff )
+{
+	Assert( m_pBufferUploader && pBuff->m_nPendingUploadSerial );
+	Assert( m_nNumPendingBufferUploads > 0 );
+
+	double flStart = Plat_FloatTime();
+	m_pBufferUploader->WaitForUpload( pBuff->m_nPendingUploadSerial );
+	GetCurBufferFrameStats().m_flUploadStallTime += Plat_FloatTime() - flStart;
+
+	pBuff->m_nPendingUploadSerial = 0;
+	m_nNumPendingBufferUploads--;
+
+	// Changes made by another context are only guaranteed to be visible here after the buffer is re-bound,
+	// so invalidate the cached binding and bump the revision so any vertex attrib pointers get re-specified.
+	pBuff->m_nRevision++;
+
+	// converted vertex shadows were already refreshed from the staging data at Unlock time
+	for ( int i = 0; i < pBuff->m_VertexShadows.Count(); i++ )
+	{
+		if ( pBuff->m_VertexShadows[i].m_nRevision == pBuff->m_nRevision - 1 )
+			pBuff->m_VertexShadows[i].m_nRevision = pBuff->m_nRevision;
+	}
+	if ( m_nBoundGLBuffer[pBuff->m_type] == pBuff->m_nHandle )
+	{
+		m_nBoundGLBuffer[pBuff->m_type] = 0xFFFFFFFF;
+	}
+}
+
 GLMVertexSetup g_blank_setup;
 
 void GLMContext::Clear( bool color, unsigned long colorValue, bool depth, float depthValue, bool stencil, unsigned int stencilValue, GLScissorBox_t *box )
@@ -2045,6 +2763,11 @@ void GLMContext::Clear( bool color, unsigned long colorValue, bool depth, float
 
 		gGL->glClear( mask );
 
+		if ( m_drawingFBO && m_drawingFBO->m_nRBOAttachMask )
+		{
+			DamageDrawingFBO( box, true );
+		}
+
 		if (subrect)
 		{
 			// put old scissor box and enable back
@@ -2238,6 +2961,39 @@ void GLMContext::Present( CGLMTex *tex )
 			
 			gGL->glBindBufferARB( GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, m_PinnedMemoryBuffers[m_nCurPinnedMemoryBuffer].GetHandle() );
 		}
+
+		if ( m_bUsePixelUnpackBuffers )
+		{
+			m_PixelUnpackBuffers[m_nCurPixelUnpackBuffer].InsertFence();
+
+			m_nCurPixelUnpackBuffer = ( m_nCurPixelUnpackBuffer + 1 ) % cNumPixelUnpackBuffers;
+
+			m_PixelUnpackBuffers[m_nCurPixelUnpackBuffer].BlockUntilNotBusy();
+		}
+
+		if ( m_DirtyTextures.Count() )
+		{
+			FlushDirtyTextures( false );
+		}
+
+		m_nPrevFrameFirstBatch = m_nCurFrameFirstBatch;
+		m_nCurFrameFirstBatch = m_nBatchCounter;
+		EnforceResidencyBudget();
+
+		if ( m_StreamingTextures.Count() )
+		{
+			UpdateTexStreaming();
+		}
+
+		if ( m_TexPool.Count() )
+		{
+			UpdateTexPool( false );
+		}
+
+		if ( m_CompressingTextures.Count() )
+		{
+			UpdateTexCompression();
+		}
 					
 		bool newRefreshMode = false;
 		// two ways to go:
@@ -2319,7 +3075,7 @@ void GLMContext::Present( CGLMTex *tex )
 			}
 			else
 			{
-				ResolveTex( tex, true );	// dxabstract used to do this unconditionally.we still do if new refresh mode doesn't engage.
+				ResolveTex( tex );	// dxabstract used to do this unconditionally.we still do if new refresh mode doesn't engage (only the damage now).
 
 				BindFBOToCtx( NULL, GL_FRAMEBUFFER_EXT );
 
@@ -2339,8 +3095,21 @@ void GLMContext::Present( CGLMTex *tex )
 		m_ViewportBox.Flush();		
 	}
 
+	if ( m_pBufferUploader )
+	{
+		m_pBufferUploader->RetireCompletedUploads();
+	}
+
+	m_BufferSubDataTuner.Tick();
+
 	m_nCurFrame++;
 
+	// the new slot collects the frame that starts now
+	m_nCurBufferFrameStats = ( m_nCurBufferFrameStats + 1 ) % GL_BUFFER_FRAME_STATS_HISTORY;
+	m_nNumBufferFrameStats = MIN( m_nNumBufferFrameStats + 1, GL_BUFFER_FRAME_STATS_HISTORY - 1 );
+	m_BufferFrameStats[m_nCurBufferFrameStats].Clear();
+	m_BufferFrameStats[m_nCurBufferFrameStats].m_nFrame = m_nCurFrame;
+
 #if GL_BATCH_PERF_ANALYSIS
 	tmMessage( TELEMETRY_LEVEL2, TMMF_ICON_EXCLAMATION, "VS Uniform Calls: %u, VS Uniforms: %u|VS Uniform Bone Calls: %u, VS Bone Uniforms: %u|PS Uniform Calls: %u, PS Uniforms: %u", m_nTotalVSUniformCalls, m_nTotalVSUniformsSet, m_nTotalVSUniformBoneCalls, m_nTotalVSUniformsBoneSet, m_nTotalPSUniformCalls, m_nTotalPSUniformsSet );
 	m_nTotalVSUniformCalls = 0, m_nTotalVSUniformBoneCalls = 0, m_nTotalVSUniformsSet = 0, m_nTotalVSUniformsBoneSet = 0, m_nTotalPSUniformCalls = 0, m_nTotalPSUniformsSet = 0;
@@ -2403,6 +3172,34 @@ GLMContext::GLMContext( IDirect3DDevice9 *pDevice, GLMDisplayParams *params )
 	char buf[256];
 	V_snprintf( buf, sizeof( buf ), "GL sampler object usage: %s\n", m_bUseSamplerObjects ? "ENABLED" : "DISABLED" );
 	Plat_DebugString( buf );
+
+	// views only alias immutable storage
+	m_bUseSRGBTextureViews = !gGL->m_bHave_GL_EXT_texture_sRGB_decode && gGL->m_bHave_GL_ARB_texture_view && gGL->m_bHave_GL_ARB_texture_storage;
+
+	// without S3TC, DXT textures are decoded to RGBA8 on the CPU at upload time
+	bool bHaveS3TC = gGL->m_bHave_GL_EXT_texture_compression_s3tc || ( gGL->m_bHave_GL_EXT_texture_compression_dxt1 && gGL->m_bHave_GL_ANGLE_texture_compression_dxt3 && gGL->m_bHave_GL_ANGLE_texture_compression_dxt5 );
+	m_bSoftwareDXTDecode = !bHaveS3TC || CommandLine()->CheckParm( "-gl_force_dxt_decode" );
+	m_pDXTDecoder = NULL;
+	if ( m_bSoftwareDXTDecode )
+	{
+		m_pDXTDecoder = new CGLMDXTDecoder;
+		m_pDXTDecoder->Init();
+	}
+	m_pTexCompressor = NULL;
+	m_nTexCompressMinBytes = 0;
+
+	// atlased textures are sampled through the array flavor of the pixel shaders, which needs the sRGB state on the sampler
+	m_bUseTexAtlas = CommandLine()->CheckParm( "-gl_texatlas" ) && gGL->m_bHave_GL_EXT_texture_array && gGL->m_bHave_GL_EXT_texture_sRGB_decode && !m_bUseSRGBTextureViews;
+	m_nAtlasSamplerMask = 0;
+	m_nMaxTexAtlasLayers = 0;
+	if ( m_bUseTexAtlas )
+	{
+		gGL->glGetIntegerv( GL_MAX_ARRAY_TEXTURE_LAYERS_EXT, &m_nMaxTexAtlasLayers );
+	}
+	V_snprintf( buf, sizeof( buf ), "GL texture atlasing: %s\n", m_bUseTexAtlas ? "ENABLED" : "DISABLED" );
+	Plat_DebugString( buf );
+	V_snprintf( buf, sizeof( buf ), "GL software DXT decode: %s\n", m_bSoftwareDXTDecode ? "ENABLED" : "DISABLED" );
+	Plat_DebugString( buf );
 	
 	m_nCurOwnerThreadId = ThreadGetCurrentId();
 	m_nThreadOwnershipReleaseCounter = 0;
@@ -2424,6 +3221,33 @@ GLMContext::GLMContext( IDirect3DDevice9 *pDevice, GLMDisplayParams *params )
 		gGL->glBindBufferARB( GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, m_PinnedMemoryBuffers[m_nCurPinnedMemoryBuffer].GetHandle() );
 	}
 
+	// texture locks hand out memory in these instead of m_backing. Opt-in: the returned memory doesn't hold the current texels,
+	// so it's only safe if the app never reads through a non-readonly texture lock.
+	m_nCurPixelUnpackBuffer = 0;
+	m_bUsePixelUnpackBuffers = false;
+	if ( CommandLine()->CheckParm( "-gl_tex_pbo_uploads" ) && gGL->m_bHave_GL_ARB_buffer_storage && gGL->m_bHave_GL_ARB_sync )
+	{
+		m_bUsePixelUnpackBuffers = true;
+		for ( uint t = 0; t < cNumPixelUnpackBuffers; t++ )
+		{
+			if ( !m_PixelUnpackBuffers[t].Init( GLMGR_PIXEL_UNPACK_BUFFER_SIZE ) )
+			{
+				m_bUsePixelUnpackBuffers = false;
+				break;
+			}
+		}
+
+		if ( !m_bUsePixelUnpackBuffers )
+		{
+			for ( uint t = 0; t < cNumPixelUnpackBuffers; t++ )
+			{
+				m_PixelUnpackBuffers[t].Deinit();
+			}
+		}
+	}
+	V_snprintf( buf, sizeof( buf ), "GL texture PBO uploads: %s\n", m_bUsePixelUnpackBuffers ? "ENABLED" : "DISABLED" );
+	Plat_DebugString( buf );
+
 	m_bUseBoneUniformBuffers = true;
 	if (CommandLine()->CheckParm("-disableboneuniformbuffers"))
 	{
@@ -2515,6 +3339,17 @@ GLMContext::GLMContext( IDirect3DDevice9 *pDevice, GLMDisplayParams *params )
 	SetDisplayParams( params );
 
 	m_texLayoutTable = new CGLMTexLayoutTable;
+
+	m_pTexBackingLRUHead = NULL;
+	m_pTexBackingLRUTail = NULL;
+	m_nTexBackingLRUBytes = 0;
+
+	m_nResidentTexBytes = 0;
+	m_nResidentBufferBytes = 0;
+	m_nCurFrameFirstBatch = 0;
+	m_nPrevFrameFirstBatch = 0;
+
+	m_nTexPoolBytes = 0;
 	
 	memset( m_samplerObjectHash, 0, sizeof( m_samplerObjectHash ) );
 	m_nSamplerObjectHashNumEntries = 0;
@@ -2710,6 +3545,31 @@ GLMContext::GLMContext( IDirect3DDevice9 *pDevice, GLMDisplayParams *params )
 	}
 
 #endif
+
+	for ( uint i = 0; i < GL_BUFFER_FRAME_STATS_HISTORY; i++ )
+	{
+		m_BufferFrameStats[i].Clear();
+	}
+	m_nCurBufferFrameStats = 0;
+	m_nNumBufferFrameStats = 0;
+
+	m_BufferSubDataTuner.Init( this );
+
+	m_pBufferUploader = NULL;
+	m_nNumPendingBufferUploads = 0;
+	m_bPrimitiveRestartEnabled = false;
+	if ( CommandLine()->CheckParm( "-gl_async_buffer_uploads" ) )
+	{
+		m_pBufferUploader = new CGLMBufferUploader;
+		if ( !m_pBufferUploader->Init( this ) )
+		{
+			delete m_pBufferUploader;
+			m_pBufferUploader = NULL;
+		}
+	}
+	V_snprintf( buf, sizeof( buf ), "GL async static buffer uploads: %s\n", m_pBufferUploader ? "ENABLED" : "DISABLED" );
+	Plat_DebugString( buf );
+
 	// also, set the remote convar "gl_can_query_fast" to 1 if perf package present, else 0.
 	gl_can_query_fast.SetValue( m_caps.m_hasPerfPackage1?1:0 );
 
@@ -2729,13 +3589,64 @@ void GLMContext::Reset()
 
 GLMContext::~GLMContext	()
 {
+	if ( m_pBufferUploader )
+	{
+		m_pBufferUploader->Deinit();
+		delete m_pBufferUploader;
+		m_pBufferUploader = NULL;
+	}
+
+	if ( m_pDXTDecoder )
+	{
+		m_pDXTDecoder->Deinit();
+		delete m_pDXTDecoder;
+		m_pDXTDecoder = NULL;
+	}
+
+	if ( m_pTexCompressor )
+	{
+		// any textures still around just lose their jobs
+		FOR_EACH_VEC( m_CompressingTextures, i )
+		{
+			m_pTexCompressor->ReleaseJob( m_CompressingTextures[i]->m_pCompressJob );
+			m_CompressingTextures[i]->m_pCompressJob = NULL;
+		}
+		m_CompressingTextures.Purge();
+
+		m_pTexCompressor->Deinit();
+		delete m_pTexCompressor;
+		m_pTexCompressor = NULL;
+	}
+
+	// textures still around just lose their layers
+	while ( m_TexAtlases.Count() )
+	{
+		GLMTexAtlas *atlas = m_TexAtlases.Tail();
+		FOR_EACH_VEC( atlas->m_Layers, i )
+		{
+			if ( atlas->m_Layers[i] )
+			{
+				atlas->m_Layers[i]->m_pAtlas = NULL;
+				atlas->m_Layers[i]->m_nAtlasLayer = -1;
+			}
+		}
+		FreeTexAtlas( atlas );
+	}
+
 	GLMGPUTimestampManagerDeinit();
+
+	m_BufferSubDataTuner.Deinit();
 		
 	for ( uint t = 0; t < cNumPinnedMemoryBuffers; t++ )
 	{
 		m_PinnedMemoryBuffers[t].Deinit();
 	}
 
+	for ( uint t = 0; t < cNumPixelUnpackBuffers; t++ )
+	{
+		m_PixelUnpackBuffers[t].Deinit();
+	}
+
 	if ( m_bUseSamplerObjects )
 	{
 		for( int i=0; i< GLM_SAMPLER_COUNT; i++)
@@ -2770,6 +3681,14 @@ GLMContext::~GLMContext	()
 	}
 	m_fboTable.SetSize( 0 );
 
+	// the FBOs are gone, so the pooled tex can go straight away
+	FOR_EACH_VEC( m_TexPool, i )
+	{
+		delete m_TexPool[i];
+	}
+	m_TexPool.Purge();
+	m_nTexPoolBytes = 0;
+
 	if (m_pairCache)
 	{
 		delete m_pairCache;
@@ -2791,9 +3710,14 @@ void GLMContext::BindTexToTMU( CGLMTex *pTex, int tmu )
 	GLM_FUNC;
 #endif
 
-	GLMPRINTF(("--- GLMContext::BindTexToTMU tex %p GL name %d -> TMU %d ", pTex, pTex ? pTex->m_texName : -1, tmu ));
-
 	CheckCurrent();
+
+	if ( pTex )
+	{
+		pTex->EnsureGLTexture();
+	}
+
+	GLMPRINTF(("--- GLMContext::BindTexToTMU tex %p GL name %d -> TMU %d ", pTex, pTex ? pTex->m_texName : -1, tmu ));
 		
 	SelectTMU( tmu );
 		
@@ -2815,6 +3739,14 @@ void GLMContext::BindTexToTMU( CGLMTex *pTex, int tmu )
 	}
 
 	m_samplers[tmu].m_pBoundTex = pTex;
+	m_samplers[tmu].m_bBoundSRGBView = false;
+	m_nAtlasSamplerMask &= ~( 1 << tmu );		// the tex's own GL object is what's bound now
+
+	// the flush may need to put a view back on this TMU
+	if ( m_bUseSRGBTextureViews )
+	{
+		SetSamplerDirty( tmu );
+	}
 }
 
 void GLMContext::BindFBOToCtx( CGLMFBO *fbo, GLenum bindPoint )
@@ -2872,6 +3804,34 @@ void GLMContext::BindFBOToCtx( CGLMFBO *fbo, GLenum bindPoint )
 	}
 }
 
+CPixelUnpackBuffer *GLMContext::AllocPixelUnpackSpace( uint nSize, int *pOfs )
+{
+	if ( !m_bUsePixelUnpackBuffers )
+		return NULL;
+
+	CPixelUnpackBuffer *pBuf = &m_PixelUnpackBuffers[m_nCurPixelUnpackBuffer];
+	int nOfs = pBuf->Alloc( nSize );
+	if ( nOfs < 0 )
+	{
+		// move on early if the next one is already idle, never stall a lock on the GPU
+		uint nNext = ( m_nCurPixelUnpackBuffer + 1 ) % cNumPixelUnpackBuffers;
+		if ( ( nSize > m_PixelUnpackBuffers[nNext].GetSize() ) || m_PixelUnpackBuffers[nNext].IsBusy() )
+			return NULL;
+
+		pBuf->InsertFence();
+
+		m_nCurPixelUnpackBuffer = nNext;
+		pBuf = &m_PixelUnpackBuffers[m_nCurPixelUnpackBuffer];
+		pBuf->BlockUntilNotBusy();
+
+		nOfs = pBuf->Alloc( nSize );
+		Assert( nOfs >= 0 );
+	}
+
+	*pOfs = nOfs;
+	return pBuf;
+}
+
 void GLMContext::BindBufferToCtx( EGLMBufferType type, CGLMBuffer *pBuff, bool bForce )
 {
 #if GLMDEBUG
@@ -2881,6 +3841,11 @@ void GLMContext::BindBufferToCtx( EGLMBufferType type, CGLMBuffer *pBuff, bool b
 
 	CheckCurrent();
 
+	if ( pBuff && pBuff->m_nPendingUploadSerial )
+	{
+		FinishBufferUpload( pBuff );
+	}
+
 	GLuint nGLName = pBuff ? pBuff->m_nHandle : 0;
 	if ( !bForce ) 
 	{
@@ -4357,6 +5322,8 @@ void GLMContext::GenDebugFontTex( void )
 		lockreq.m_region.zmax = slice->m_zSize;
 
 		lockreq.m_readback = false;
+		lockreq.m_readonly = false;
+		lockreq.m_discard = false;
 		
 		char	*lockAddress;
 		int		yStride;
@@ -5316,6 +6283,10 @@ void GLMTester::Test0( void )
 										lockreq.m_region.xmax = slice->m_xSize;
 										lockreq.m_region.ymax = slice->m_ySize;
 										lockreq.m_region.zmax = slice->m_zSize;
+
+										lockreq.m_readback = false;
+										lockreq.m_readonly = false;
+										lockreq.m_discard = false;
 										
 										char	*lockAddress;
 										int		yStride;
@@ -172,11 +172,18 @@ FORCEINLINE void GLMContext::FlushDrawStates( uint nStartIndex, uint nEndIndex,
 	}
 #endif
 
-	if ( m_bDirtyPrograms )
+	// samplers reading atlas layers want the array flavor of the pixel shader, the mask is part of the pair key
+	uint nArraySamplerMask = 0;
+	if ( m_nAtlasSamplerMask && m_drawingProgram[ kGLMFragmentProgram ] )
+	{
+		nArraySamplerMask = m_nAtlasSamplerMask & m_drawingProgram[ kGLMFragmentProgram ]->m_nArraySamplerMask;
+	}
+
+	if ( m_bDirtyPrograms || ( nArraySamplerMask != m_pBoundPair->m_nArraySamplerMask ) )
 	{
 		m_bDirtyPrograms = false;
 
-		CGLMShaderPair *pNewPair = m_pairCache->SelectShaderPair( m_drawingProgram[ kGLMVertexProgram ], m_drawingProgram[ kGLMFragmentProgram ], 0 );
+		CGLMShaderPair *pNewPair = m_pairCache->SelectShaderPair( m_drawingProgram[ kGLMVertexProgram ], m_drawingProgram[ kGLMFragmentProgram ], nArraySamplerMask );
 
 		if ( pNewPair != m_pBoundPair )
 		{
@@ -242,7 +249,53 @@ FORCEINLINE void GLMContext::FlushDrawStates( uint nStartIndex, uint nEndIndex,
 	Assert( m_ViewportBox.GetData().height == (int)( m_ViewportBox.GetData().widthheight >> 16 ) );
 
 	m_pBoundPair->UpdateScreenUniform( m_ViewportBox.GetData().widthheight );
+
+	if ( m_nAtlasSamplerMask )
+	{
+		const uint nPairArrayMask = m_pBoundPair->m_nArraySamplerMask;
+		const uint nUsedMask = m_nAtlasSamplerMask & m_pBoundPair->m_fragmentProg->m_samplerMask;
+
+		for ( uint nSamplerIndex = 0; nSamplerIndex < GLM_SAMPLER_COUNT; nSamplerIndex++ )
+		{
+			const uint nBit = 1 << nSamplerIndex;
+			if ( !( nUsedMask & nBit ) )
+				continue;
+
+			if ( nPairArrayMask & nBit )
+			{
+				// switching textures within an atlas only costs this
+				m_pBoundPair->UpdateSamplerLayer( nSamplerIndex, m_samplers[nSamplerIndex].m_pBoundTex->m_nAtlasLayer );
+			}
+			else
+			{
+				// the shader can't read a layer here (explicit LOD, or the array flavor didn't compile), use the tex's own GL object
+				BindTexToTMU( m_samplers[nSamplerIndex].m_pBoundTex, nSamplerIndex );
+				SetSamplerDirty( nSamplerIndex );
+			}
+		}
+	}
 	
+	if ( m_DirtyTextures.Count() )
+	{
+		FlushDirtyTextures( true );
+	}
+
+	// MSAA textures this draw samples get their damage resolved first, mip gen may want level 0
+	if ( m_PendingResolves.Count() )
+	{
+		FlushPendingResolves();
+	}
+
+	if ( m_PendingMipGen.Count() )
+	{
+		FlushPendingMipGen();
+	}
+
+	if ( m_drawingFBO && m_drawingFBO->m_nRBOAttachMask )
+	{
+		DamageDrawingFBO( NULL, false );
+	}
+
 	GL_BATCH_PERF( m_FlushStats.m_nNumChangedSamplers += m_nNumDirtySamplers );
 
 	if ( m_bUseSamplerObjects)
@@ -258,6 +311,11 @@ FORCEINLINE void GLMContext::FlushDrawStates( uint nStartIndex, uint nEndIndex,
 
 			GL_BATCH_PERF( m_FlushStats.m_nNumSamplingParamsChanged++ );
 
+			if ( m_bUseSRGBTextureViews && m_samplers[nSamplerIndex].m_pBoundTex )
+			{
+				SelectSRGBView( nSamplerIndex );
+			}
+
 #if defined( OSX )
 			CGLMTex *pTex = m_samplers[nSamplerIndex].m_pBoundTex;
 
@@ -286,6 +344,25 @@ FORCEINLINE void GLMContext::FlushDrawStates( uint nStartIndex, uint nEndIndex,
 
 			CGLMTex *pTex = m_samplers[nSamplerIndex].m_pBoundTex;
 
+			// a bound sRGB view carries its own sampling params
+			if ( m_bUseSRGBTextureViews && pTex && SelectSRGBView( nSamplerIndex ) )
+				continue;
+
+			// and so does an atlas, every layer shares them
+			if ( m_nAtlasSamplerMask & ( 1 << nSamplerIndex ) )
+			{
+				GLMTexAtlas *pAtlas = pTex->m_pAtlas;
+				if ( !( pAtlas->m_SamplingParams == m_samplers[nSamplerIndex].m_samp ) )
+				{
+					SelectTMU( nSamplerIndex );
+
+					m_samplers[nSamplerIndex].m_samp.DeltaSetToTarget( GL_TEXTURE_2D_ARRAY_EXT, pAtlas->m_SamplingParams );
+
+					pAtlas->m_SamplingParams = m_samplers[nSamplerIndex].m_samp;
+				}
+				continue;
+			}
+
 			if ( ( pTex ) && ( !( pTex->m_SamplingParams == m_samplers[nSamplerIndex].m_samp ) ) )
 			{
 				SelectTMU( nSamplerIndex );
@@ -472,6 +549,18 @@ FORCEINLINE void GLMContext::FlushDrawStates( uint nStartIndex, uint nEndIndex,
 	Assert( ( m_pDevice->m_streams[2].m_vtxBuffer && ( m_pDevice->m_streams[2].m_vtxBuffer->m_vtxBuffer == m_pDevice->m_vtx_buffers[2] ) ) || ( ( !m_pDevice->m_streams[2].m_vtxBuffer ) && ( m_pDevice->m_vtx_buffers[2] == m_pDevice->m_pDummy_vtx_buffer ) ) );
 	Assert( ( m_pDevice->m_streams[3].m_vtxBuffer && ( m_pDevice->m_streams[3].m_vtxBuffer->m_vtxBuffer == m_pDevice->m_vtx_buffers[3] ) ) || ( ( !m_pDevice->m_streams[3].m_vtxBuffer ) && ( m_pDevice->m_vtx_buffers[3] == m_pDevice->m_pDummy_vtx_buffer ) ) );
 
+	if ( m_nNumPendingBufferUploads )
+	{
+		// a stream references a buffer the loader thread may still be uploading (this bumps its revision)
+		for ( uint i = 0; i < 4; i++ )
+		{
+			if ( m_pDevice->m_vtx_buffers[i]->m_nPendingUploadSerial )
+			{
+				FinishBufferUpload( m_pDevice->m_vtx_buffers[i] );
+			}
+		}
+	}
+
 	uint nCurTotalBufferRevision;
 	nCurTotalBufferRevision = m_pDevice->m_vtx_buffers[0]->m_nRevision + m_pDevice->m_vtx_buffers[1]->m_nRevision + m_pDevice->m_vtx_buffers[2]->m_nRevision + m_pDevice->m_vtx_buffers[3]->m_nRevision;
 
@@ -546,10 +635,25 @@ FORCEINLINE void GLMContext::FlushDrawStates( uint nStartIndex, uint nEndIndex,
 			Assert( nBufOffset >= 0 );
 			Assert( nBufOffset < (int)pBuf->m_nSize );
 
-			SetBufAndVertexAttribPointer( nIndex, pBuf->m_nHandle, 
-				pStream->m_stride, pDeclElem->m_gldecl.m_datatype, pDeclElem->m_gldecl.m_normalized, pDeclElem->m_gldecl.m_nCompCount, 
-				reinterpret_cast< const GLvoid * >( reinterpret_cast< int >( pBuf->m_pPseudoBuf ) + nBufOffset ), 
-				pBuf->m_nRevision );
+			if ( pDeclElem->m_nConversion )
+			{
+				// element type GL can't fetch - source it from the buffer's converted shadow (tightly packed, rebuilt once per buffer revision)
+				EGLMVertexConversion nConversion = (EGLMVertexConversion)pDeclElem->m_nConversion;
+				uint nShadowOffset;
+				GLuint nShadowHandle = pBuf->GetVertexShadow( nBufOffset, pStream->m_stride, nConversion, &nShadowOffset );
+
+				SetBufAndVertexAttribPointer( nIndex, nShadowHandle, 
+					pStream->m_stride ? CGLMBuffer::GetVertexConversionDstSize( nConversion ) : 0, pDeclElem->m_gldecl.m_datatype, pDeclElem->m_gldecl.m_normalized, pDeclElem->m_gldecl.m_nCompCount, 
+					reinterpret_cast< const GLvoid * >( nShadowOffset ), 
+					pBuf->m_nRevision );
+			}
+			else
+			{
+				SetBufAndVertexAttribPointer( nIndex, pBuf->m_nHandle, 
+					pStream->m_stride, pDeclElem->m_gldecl.m_datatype, pDeclElem->m_gldecl.m_normalized, pDeclElem->m_gldecl.m_nCompCount, 
+					reinterpret_cast< const GLvoid * >( reinterpret_cast< int >( pBuf->m_pPseudoBuf ) + nBufOffset ), 
+					pBuf->m_nRevision );
+			}
 
 			if ( !( m_lastKnownVertexAttribMask & nMask ) )
 			{